@@ -12,10 +12,11 @@ emcc \
   -s MODULARIZE=1 -s 'EXPORT_NAME="CREATE_SYRO_BINDINGS"' \
   -s ALLOW_MEMORY_GROWTH=1 \
   -s ALLOW_TABLE_GROWTH=1 \
+  -msimd128 \
   -O3 \
   ./syro/volcasample/syro/korg_syro_volcasample.c \
   ./syro/volcasample/syro/korg_syro_func.c \
-  ./syro/volcasample/syro/korg_syro_comp.c \
+  ./syro/syro-comp-cache.c \
   ./syro/syro-bindings.c \
   -o public/syro-bindings.js
 
@@ -23,9 +24,31 @@ emcc \
   -s WASM=1 \
   -s ALLOW_MEMORY_GROWTH=1 \
   -s BUILD_AS_WORKER=1 \
+  --pre-js ./syro/syro-worker-pre.js \
+  -msimd128 \
   -O3 \
   ./syro/volcasample/syro/korg_syro_volcasample.c \
   ./syro/volcasample/syro/korg_syro_func.c \
-  ./syro/volcasample/syro/korg_syro_comp.c \
+  ./syro/syro-comp-cache.c \
   ./syro/syro-worker.c \
   -o public/syro-worker.js
+
+# Only loaded when the page is cross-origin isolated (SharedArrayBuffer is
+# available). Same bindings as above, plus streams encoded on their own thread
+# straight into shared memory.
+emcc \
+  -s WASM=1 \
+  -pthread \
+  -s PTHREAD_POOL_SIZE=4 \
+  -s PTHREAD_POOL_SIZE_STRICT=0 \
+  -s EXPORTED_RUNTIME_METHODS='["cwrap", "addFunction", "removeFunction"]' \
+  -s MODULARIZE=1 -s 'EXPORT_NAME="CREATE_SYRO_BINDINGS_THREADED"' \
+  -s ALLOW_MEMORY_GROWTH=1 \
+  -s ALLOW_TABLE_GROWTH=1 \
+  -msimd128 \
+  -O3 \
+  ./syro/volcasample/syro/korg_syro_volcasample.c \
+  ./syro/volcasample/syro/korg_syro_func.c \
+  ./syro/syro-comp-cache.c \
+  ./syro/syro-bindings-threaded.c \
+  -o public/syro-bindings-threaded.js
@@ -0,0 +1,104 @@
+/*
+A worklet that plays a syrostream while it is still being encoded.
+
+The main thread posts 16-bit stereo-interleaved PCM chunks as they arrive from
+the syro worker:
+
+      streamNode.port.postMessage({ eventType: 'data', pcm }, [pcm.buffer]);
+
+and { eventType: 'end' } once the last chunk has been sent. Output starts once
+`leadFrames` frames are queued (or the stream has ended). Any gap would corrupt
+the transfer, so if the queue runs dry before the end we stop and report an
+'underrun' instead of playing silence.
+
+The worklet posts { eventType: 'progress', framesPlayed } periodically, which
+the main thread uses to decide when to pause or resume encoding, and
+{ eventType: 'ended', framesPlayed } once everything has been played.
+*/
+
+// about 0.1 seconds at 44.1kHz
+const PROGRESS_INTERVAL_FRAMES = 4096;
+
+class SyroStreamWorkletProcessor extends AudioWorkletProcessor {
+  /**
+   * @param {{ processorOptions: { leadFrames: number } }} options
+   */
+  constructor(options) {
+    super(options);
+    this._leadFrames = options.processorOptions.leadFrames;
+    /** @type {Int16Array[]} */
+    this._chunks = [];
+    // sample (not frame) offset into the first chunk
+    this._chunkOffset = 0;
+    this._framesQueued = 0;
+    this._framesPlayed = 0;
+    this._framesSinceProgress = 0;
+    this._started = false;
+    this._inputEnded = false;
+    this._stopped = false;
+    this.port.onmessage = (e) => {
+      if (e.data.eventType === 'data') {
+        /** @type {Int16Array} */
+        const pcm = e.data.pcm;
+        this._chunks.push(pcm);
+        this._framesQueued += pcm.length / 2;
+      }
+
+      if (e.data.eventType === 'end') {
+        this._inputEnded = true;
+      }
+
+      if (e.data.eventType === 'stop') {
+        this._stopped = true;
+      }
+    };
+  }
+
+  /**
+   * @param {Float32Array[][]} _inputs
+   * @param {Float32Array[][]} outputs
+   * @returns {boolean}
+   */
+  process(_inputs, [output]) {
+    if (this._stopped) {
+      return false;
+    }
+    if (!this._started) {
+      if (this._framesQueued < this._leadFrames && !this._inputEnded) {
+        return true;
+      }
+      this._started = true;
+    }
+    const left = output[0];
+    const right = output[1] || output[0];
+    for (let i = 0; i < left.length; i++) {
+      let chunk = this._chunks[0];
+      if (chunk && this._chunkOffset === chunk.length) {
+        this._chunks.shift();
+        this._chunkOffset = 0;
+        chunk = this._chunks[0];
+      }
+      if (!chunk) {
+        this.port.postMessage({
+          eventType: this._inputEnded ? 'ended' : 'underrun',
+          framesPlayed: this._framesPlayed,
+        });
+        return false;
+      }
+      left[i] = chunk[this._chunkOffset++] / 32768;
+      right[i] = chunk[this._chunkOffset++] / 32768;
+      this._framesPlayed++;
+    }
+    this._framesSinceProgress += left.length;
+    if (this._framesSinceProgress >= PROGRESS_INTERVAL_FRAMES) {
+      this._framesSinceProgress = 0;
+      this.port.postMessage({
+        eventType: 'progress',
+        framesPlayed: this._framesPlayed,
+      });
+    }
+    return true;
+  }
+}
+
+registerProcessor('syro-stream-worklet', SyroStreamWorkletProcessor);
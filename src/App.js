@@ -23,6 +23,7 @@ import {
 import { SampleCache } from './sampleCacheStore.js';
 import { getSamplePeaksForAudioBuffer } from './utils/waveform.js';
 import { getAudioBufferForAudioFileData } from './utils/audioData.js';
+import { getSyroBindings } from './utils/getSyroBindings.js';
 import { newSampleName } from './utils/words.js';
 import { onTabUpdateEvent, sendTabUpdateEvent } from './utils/tabSync.js';
 import { getPluginStatus, listPluginParams } from './pluginStore.js';
@@ -72,6 +73,11 @@ function App() {
       })
       .catch(console.error);
   }, []);
+  useEffect(() => {
+    // load the syro bindings (and their worker pool) now rather than on the
+    // first transfer
+    getSyroBindings().catch(console.error);
+  }, []);
   const restoredFocusedSampleId =
     typeof sessionStorage === 'undefined'
       ? null
@@ -14,7 +14,11 @@ import {
   ToggleButton,
 } from 'react-bootstrap';
 
-import { getSyroDeleteBuffer, useSyroTransfer } from './utils/syro.js';
+import {
+  getSyroDeleteBuffer,
+  precomputeSyroDeleteBuffers,
+  useSyroTransfer,
+} from './utils/syro.js';
 import { formatLongTime } from './utils/datetime.js';
 
 import classes from './VolcaEraseSlotsModals.module.scss';
@@ -42,6 +46,13 @@ const VolcaEraseSlotsModals = React.memo(
 
     const [showSample2SlotNumbers, setShowSample2SlotNumbers] = useState(false);
 
+    // get erase streams for every visible slot ready while a selection is made
+    useEffect(() => {
+      if (isInfoBeforeEraseModalOpen) {
+        precomputeSyroDeleteBuffers(showSample2SlotNumbers ? 200 : 100);
+      }
+    }, [isInfoBeforeEraseModalOpen, showSample2SlotNumbers]);
+
     useEffect(() => {
       if (!showSample2SlotNumbers) {
         setSelectedSlotNumbers((selectedSlotNumbers) => {
@@ -65,20 +76,42 @@ const VolcaEraseSlotsModals = React.memo(
       [selectedSlotNumbers]
     );
 
+    const [deleteBufferProgress, setDeleteBufferProgress] = useState(0);
+
     useEffect(() => {
       setSyroBufferAndDataStartPoints({
         syroBuffer: null,
         dataStartPoints: [],
       });
+      setDeleteBufferProgress(0);
       if (slotNumbers.length === 0) return;
       let cancelled = false;
-      getSyroDeleteBuffer(slotNumbers).then((result) => {
-        if (!cancelled) {
-          setSyroBufferAndDataStartPoints(result);
+      const { syroBufferPromise, cancelWork } = getSyroDeleteBuffer(
+        slotNumbers,
+        (progress) => {
+          if (!cancelled) {
+            setDeleteBufferProgress(progress);
+          }
         }
-      });
+      );
+      syroBufferPromise
+        .then((result) => {
+          if (!cancelled) {
+            setSyroBufferAndDataStartPoints(result);
+          }
+        })
+        .catch((err) => {
+          console.error(err);
+          if (!cancelled) {
+            setSyroBufferAndDataStartPoints({
+              syroBuffer: new Error(String(err)),
+              dataStartPoints: [],
+            });
+          }
+        });
       return () => {
         cancelled = true;
+        cancelWork();
       };
     }, [slotNumbers]);
 
@@ -177,7 +210,11 @@ const VolcaEraseSlotsModals = React.memo(
                 <i>
                   <small>
                     {selectedSlotNumbers.size
-                      ? 'Checking..'
+                      ? `Checking.. ${
+                          deleteBufferProgress
+                            ? `${(deleteBufferProgress * 100).toFixed(0)}%`
+                            : ''
+                        }`
                       : 'Make a selection.'}
                   </small>
                 </i>
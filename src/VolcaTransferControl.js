@@ -8,7 +8,12 @@ import React, {
 import { Button, Modal, ProgressBar } from 'react-bootstrap';
 import byteSize from 'byte-size';
 
-import { getSyroSampleBuffer, useSyroTransfer } from './utils/syro.js';
+import {
+  canStreamSyroSamples,
+  getSyroSampleBuffer,
+  getSyroTransferSeconds,
+  useSyroTransfer,
+} from './utils/syro.js';
 import { formatLongTime, formatShortTime } from './utils/datetime';
 import { SAMPLE_RATE } from './utils/constants.js';
 
@@ -17,6 +22,10 @@ import SlotNumberInput from './SlotNumberInput.js';
 import SampleSelectionTable from './SampleSelectionTable.js';
 import VolcaEraseSlotsModals from './VolcaEraseSlotsModals.js';
 
+// Past this much source audio we stream the transfer rather than encoding it
+// all before playback, which holds the whole syrostream in memory twice.
+const STREAM_TRANSFER_MIN_SOURCE_BYTES = 16 * 1024 * 1024;
+
 /**
  * @typedef {import('./store').SampleContainer} SampleContainer
  * @typedef {import('./sampleCacheStore.js').SampleCache} SampleCache
@@ -112,6 +121,21 @@ function VolcaTransferControl({
       dataStartPoints: /** @type {number[]} */ ([]),
     });
 
+  const targetWavDataSize = useMemo(() => {
+    let size = selectedSamples.size * 44;
+    for (const [id] of selectedSamples) {
+      const sampleCache = sampleCaches.get(id);
+      if (sampleCache) {
+        size += sampleCache.cachedInfo.duration * SAMPLE_RATE * 2; // 16-bit
+      }
+    }
+    return size;
+  }, [selectedSamples, sampleCaches]);
+
+  const streamTransfer =
+    canStreamSyroSamples() &&
+    targetWavDataSize > STREAM_TRANSFER_MIN_SOURCE_BYTES;
+
   const selectedSampleList = useMemo(
     () => [...selectedSamples.values()],
     [selectedSamples]
@@ -125,12 +149,14 @@ function VolcaTransferControl({
     transferInProgress,
     transferProgress,
     syroAudioBuffer,
+    transferDuration,
     startTransfer,
     stopTransfer,
   } = useSyroTransfer({
     syroBuffer,
     dataStartPoints,
     selectedItems: selectedSampleList,
+    stream: streamTransfer,
   });
 
   useLayoutEffect(() => {
@@ -139,17 +165,6 @@ function VolcaTransferControl({
     }
   }, [syroTransferState]);
 
-  const targetWavDataSize = useMemo(() => {
-    let size = selectedSamples.size * 44;
-    for (const [id] of selectedSamples) {
-      const sampleCache = sampleCaches.get(id);
-      if (sampleCache) {
-        size += sampleCache.cachedInfo.duration * SAMPLE_RATE * 2; // 16-bit
-      }
-    }
-    return size;
-  }, [selectedSamples, sampleCaches]);
-
   const canTransferSamples = Boolean(
     selectedSamples.size &&
       !duplicateSlots.length &&
@@ -157,7 +172,8 @@ function VolcaTransferControl({
       selectedSamples.size <= 110
   );
   useEffect(() => {
-    if (!canTransferSamples) return;
+    // streamed transfers are encoded during playback instead
+    if (!canTransferSamples || streamTransfer) return;
     let cancelled = false;
     setSyroProgress(0);
     setSyroBufferAndDataStartPoints({
@@ -180,18 +196,28 @@ function VolcaTransferControl({
         cancelWork();
         cancelled = true;
       };
-      syroBufferPromise.then(async ({ syroBuffer, dataStartPoints }) => {
-        if (cancelled) {
-          return;
-        }
-        stop = () => {
-          cancelled = true;
-        };
-        setSyroBufferAndDataStartPoints({
-          syroBuffer,
-          dataStartPoints,
+      syroBufferPromise
+        .then(async ({ syroBuffer, dataStartPoints }) => {
+          if (cancelled) {
+            return;
+          }
+          stop = () => {
+            cancelled = true;
+          };
+          setSyroBufferAndDataStartPoints({
+            syroBuffer,
+            dataStartPoints,
+          });
+        })
+        .catch((err) => {
+          console.error(err);
+          if (!cancelled) {
+            setSyroBufferAndDataStartPoints({
+              syroBuffer: new Error(String(err)),
+              dataStartPoints: [],
+            });
+          }
         });
-      });
     } catch (err) {
       console.error(err);
       setSyroBufferAndDataStartPoints({
@@ -200,7 +226,39 @@ function VolcaTransferControl({
       });
     }
     return () => stop();
-  }, [selectedSamples, canTransferSamples]);
+  }, [selectedSamples, canTransferSamples, streamTransfer]);
+
+  // known long before the syrostream is encoded (if it is at all)
+  const [estimatedTransferSeconds, setEstimatedTransferSeconds] = useState(
+    /** @type {number | null} */ (null)
+  );
+  useEffect(() => {
+    setEstimatedTransferSeconds(null);
+    if (!canTransferSamples) return;
+    /** @type {number[]} */
+    const postPluginFrameCounts = [];
+    for (const [id] of selectedSamples) {
+      const sampleCache = sampleCaches.get(id);
+      // we'll try again once every sample's info is in
+      if (!sampleCache) return;
+      postPluginFrameCounts.push(sampleCache.cachedInfo.postPluginFrameCount);
+    }
+    let cancelled = false;
+    getSyroTransferSeconds(
+      [...selectedSamples.values()],
+      postPluginFrameCounts,
+      () => cancelled
+    )
+      .then((seconds) => {
+        if (!cancelled) {
+          setEstimatedTransferSeconds(seconds);
+        }
+      })
+      .catch((err) => console.error(err));
+    return () => {
+      cancelled = true;
+    };
+  }, [selectedSamples, sampleCaches, canTransferSamples]);
 
   const transferInfo = (
     <>
@@ -214,10 +272,20 @@ function VolcaTransferControl({
       </div>
       <div>
         <strong>Time to transfer:</strong>{' '}
-        {syroAudioBuffer instanceof AudioBuffer ? (
+        {streamTransfer ? (
+          estimatedTransferSeconds !== null ? (
+            formatLongTime(estimatedTransferSeconds)
+          ) : (
+            <i>
+              <small>Calculated once transfer starts</small>
+            </i>
+          )
+        ) : syroAudioBuffer instanceof AudioBuffer ? (
           formatLongTime(syroAudioBuffer.duration)
         ) : syroAudioBuffer instanceof Error ? (
           'error'
+        ) : estimatedTransferSeconds !== null ? (
+          formatLongTime(estimatedTransferSeconds)
         ) : (
           <i>
             <small>
@@ -346,7 +414,8 @@ function VolcaTransferControl({
             type="button"
             variant="primary"
             disabled={
-              !(syroAudioBuffer instanceof AudioBuffer) || !canTransferSamples
+              !(streamTransfer || syroAudioBuffer instanceof AudioBuffer) ||
+              !canTransferSamples
             }
             onClick={() => {
               setPreTransferModalOpen(true);
@@ -400,7 +469,9 @@ function VolcaTransferControl({
           <Button
             type="button"
             variant="primary"
-            disabled={!(syroAudioBuffer instanceof AudioBuffer)}
+            disabled={
+              !(streamTransfer || syroAudioBuffer instanceof AudioBuffer)
+            }
             onClick={startTransfer}
           >
             Transfer now
@@ -437,10 +508,8 @@ function VolcaTransferControl({
             now={100 * transferProgress}
           />
           <div className={classes.progressAnnotation}>
-            {syroAudioBuffer instanceof AudioBuffer &&
-              formatLongTime(
-                syroAudioBuffer.duration * (1 - transferProgress)
-              )}{' '}
+            {transferDuration !== null &&
+              formatLongTime(transferDuration * (1 - transferProgress))}{' '}
             remaining
           </div>
           {selectedSamples.size > 1 && (
@@ -7,3 +7,10 @@ declare async function CREATE_SYRO_BINDINGS() {
   };
   return Module;
 };
+
+/**
+ * pthreads build, only present when the page is cross-origin isolated
+ */
+declare const CREATE_SYRO_BINDINGS_THREADED:
+  | typeof CREATE_SYRO_BINDINGS
+  | undefined;
@@ -26,6 +26,50 @@ const sampleCachedInfoStore = localforage.createInstance({
   driver: localforage.INDEXEDDB,
 });
 
+/**
+ * @typedef {{
+ *   cacheKey: string;
+ *   block: Uint8Array;
+ *   compSize: number;
+ *   checksum?: string; // of the block (see syro-comp-cache.h)
+ *   audioKey?: string; // what the audio was made from (see syro.js)
+ * }} CompressedBlockInfo
+ */
+
+// Compressed syro blocks from the last transfer of each sample. The cache key
+// is checked against the sample's audio before a block is reused, so a stale
+// block is simply ignored.
+const sampleCompressedBlockStore = localforage.createInstance({
+  name: 'sample_compressed_blocks',
+  driver: localforage.INDEXEDDB,
+});
+
+/**
+ * @param {string} sampleId
+ * @returns {Promise<CompressedBlockInfo | null>}
+ */
+export async function getCachedCompressedBlock(sampleId) {
+  try {
+    return await sampleCompressedBlockStore.getItem(sampleId);
+  } catch (err) {
+    console.error(err);
+    return null;
+  }
+}
+
+/**
+ * @param {string} sampleId
+ * @param {CompressedBlockInfo} compressedBlockInfo
+ */
+export async function cacheCompressedBlock(sampleId, compressedBlockInfo) {
+  try {
+    await sampleCompressedBlockStore.setItem(sampleId, compressedBlockInfo);
+  } catch (err) {
+    // a missing block only costs us a recompression next time
+    console.error(err);
+  }
+}
+
 export class SampleCache {
   /**
    * @param {{
@@ -152,6 +196,7 @@ export class SampleCache {
 
     async remove() {
       await sampleCachedInfoStore.removeItem(this.sampleContainer.id);
+      await sampleCompressedBlockStore.removeItem(this.sampleContainer.id);
     }
   };
 
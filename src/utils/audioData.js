@@ -8,13 +8,18 @@ import {
   useState,
 } from 'react';
 import getWavFileHeaders from 'wav-headers';
-import { resample } from 'wave-resampler';
 
 import { SampleContainer } from '../store.js';
-import { SAMPLE_RATE } from './constants.js';
+import { SAMPLE_RATE, SYRO_STREAM_SAMPLE_RATE } from './constants.js';
 import { userOS } from './os.js';
 import { PluginError, getPlugin } from './plugins.js';
-import { WAVEFORM_CACHED_WIDTH, getPeaksForSamples } from './waveform.js';
+import {
+  WAVEFORM_CACHED_WIDTH,
+  findPeaksInRange,
+  getPeaksFromIndex,
+  getWaveformPeakIndex,
+} from './waveform.js';
+import { getSyroBindings } from './getSyroBindings.js';
 
 /**
  * @param {Float32Array} array
@@ -83,42 +88,23 @@ export function findSamplePeak(samples) {
 }
 
 /**
- * Scales an array of samples according to a specified coefficient.
- * Note: mutates input array (no return value).
+ * The gain that normalizes the trimmed samples so the peak value is 1 or -1
+ * (1 for silence), found with the samples' peak index.
+ * @param {import('./waveform.js').WaveformPeakIndex} peakIndex
  * @param {Float32Array} samples array of floats
- * @param {number} coef float value to multiply against each sample
- */
-function scaleSamples(samples, coef) {
-  if (coef !== 1) {
-    for (let i = 0; i < samples.length; i++) {
-      samples[i] *= coef;
-    }
-  }
-}
-
-/**
- * Normalizes an array of samples so the peak value is 1 or -1.
- * Note: mutates input array (no return value).
- * @param {Float32Array} samples array of floats
- * @returns {number} peak
- */
-function normalizeSamples(samples) {
-  const peak = findSamplePeak(samples);
-  scaleSamples(samples, 1 / peak);
-  return peak;
-}
-
-/**
- * Reduces precision of samples by converting them to integers of a given bit
- * depth then back to floats. Note: mutates input array (no return value).
- * @param {Float32Array} samples array of floats between -1 and 1
- * @param {number} qualityBitDepth number from 8 to 16
+ * @param {[number, number]} trimFrames
+ * @returns {number}
  */
-function applyQualityBitDepthToSamples(samples, qualityBitDepth) {
-  const signedMax = 2 ** (qualityBitDepth - 1);
-  for (let i = 0; i < samples.length; i++) {
-    samples[i] = Math.round(samples[i] * signedMax) / signedMax;
-  }
+function getNormalizeGain(peakIndex, samples, trimFrames) {
+  const [trimStart, trimEnd] = trimFrames.map((t) => Math.max(t, 0));
+  const { max, min } = findPeaksInRange(
+    peakIndex,
+    samples,
+    trimStart,
+    samples.length - trimEnd
+  );
+  const peak = Math.max(max, -min);
+  return peak ? 1 / peak : 1;
 }
 
 /**
@@ -199,6 +185,22 @@ function getTargetAudioContext() {
     targetAudioContext || new AudioContext({ sampleRate: SAMPLE_RATE }));
 }
 
+/**
+ * @type {AudioContext | undefined}
+ */
+let syroStreamAudioContext;
+
+/**
+ * Streamed syrostreams are played at their own sample rate rather than being
+ * resampled to the target rate like decoded audio buffers are.
+ */
+export function getSyroStreamAudioContext() {
+  const AudioContext = getAudioContextConstructor();
+  return (syroStreamAudioContext =
+    syroStreamAudioContext ||
+    new AudioContext({ sampleRate: SYRO_STREAM_SAMPLE_RATE }));
+}
+
 /**
  * @param {Uint8Array} audioFileBuffer audio file to transform into audio buffer
  * @returns {Promise<AudioBuffer>}
@@ -327,6 +329,166 @@ export async function processPluginsForSample(sampleContainer) {
   return postPluginBuffer;
 }
 
+/**
+ * Applies the sample's metadata parameters to the plugin-processed audio.
+ * Returns mono float samples ready to be converted to 16 bits, along with
+ * waveform peaks for the trimmed (but not pitch adjusted) audio if asked for.
+ * Normalization and pitch adjustment aren't applied to the samples but
+ * returned as a gain and a rate to resample to, which the syro bindings apply
+ * in their own memory (see copyTargetSamplesToSyroMemory). The gain is applied
+ * after resampling rather than before, which can differ in the last bit.
+ * @param {import('../store').SampleContainer} sampleContainer
+ * @param {AudioBuffer} pluginProcessedAudioBuffer
+ * @param {boolean} [withWaveformPeaks]
+ * @returns {Promise<{
+ *   samples: Float32Array;
+ *   gain: number;
+ *   resampleRate: number | null;
+ *   waveformPeaks: import('./waveform.js').SamplePeaks | null;
+ * }>}
+ */
+async function getTargetSamplesForPluginProcessedSample(
+  sampleContainer,
+  pluginProcessedAudioBuffer,
+  withWaveformPeaks
+) {
+  const {
+    qualityBitDepth,
+    normalize,
+    trim: { frames: trimFrames },
+    pitchAdjustment,
+  } = sampleContainer.metadata;
+  if (
+    qualityBitDepth < 8 ||
+    qualityBitDepth > 16 ||
+    !Number.isInteger(qualityBitDepth)
+  ) {
+    throw new Error(
+      `Expected bit depth between 8 and 16. Received: ${qualityBitDepth}`
+    );
+  }
+
+  const channelData = pluginProcessedAudioBuffer.getChannelData(0);
+  const samples = getTrimmedView(channelData, trimFrames);
+  // built once per plugin-processed buffer, which stays the same while only
+  // the trim or other metadata changes
+  const peakIndex = await getWaveformPeakIndex(channelData);
+  const gain =
+    normalize === 'all'
+      ? getNormalizeGain(peakIndex, channelData, [0, 0])
+      : normalize === 'selection'
+      ? getNormalizeGain(peakIndex, channelData, trimFrames)
+      : 1;
+
+  let waveformPeaks = null;
+  if (withWaveformPeaks) {
+    waveformPeaks = getPeaksFromIndex(
+      peakIndex,
+      channelData,
+      trimFrames,
+      WAVEFORM_CACHED_WIDTH
+    );
+    // the same as the peaks of the scaled samples, since scaling (and
+    // rounding to float) keeps them in order
+    for (const peaks of [waveformPeaks.positive, waveformPeaks.negative]) {
+      for (let i = 0; i < peaks.length; i++) {
+        peaks[i] *= gain;
+      }
+    }
+  }
+
+  const resampleRate = getResampleRateForPitch(pitchAdjustment);
+
+  return { samples, gain, resampleRate, waveformPeaks };
+}
+
+/**
+ * The rate to resample a sample's audio to for its pitch adjustment, or null
+ * if it isn't resampled
+ * @param {number} pitchAdjustment
+ */
+function getResampleRateForPitch(pitchAdjustment) {
+  // for now we don't support pitch adjustments out of these bounds
+  const hasValidPitchAdjustment =
+    !isNaN(pitchAdjustment) &&
+    pitchAdjustment !== 1 &&
+    pitchAdjustment >= 0.5 &&
+    pitchAdjustment <= 2;
+  return hasValidPitchAdjustment
+    ? Math.round(SAMPLE_RATE / pitchAdjustment)
+    : null;
+}
+
+/**
+ * Copies target samples into the syro bindings' memory, resampling them there
+ * for the pitch adjustment if they need it. Returns the allocation, to be
+ * handed on to the bindings (which take ownership) or freed with
+ * freeSampleData.
+ * @param {import('./getSyroBindings.js').SyroBindings} syroBindings
+ * @param {{ samples: Float32Array; resampleRate: number | null }} targetSamples
+ * @returns {{ sampleDataPointer: number; numOfFrames: number }}
+ */
+export function copyTargetSamplesToSyroMemory(
+  {
+    allocateSampleData,
+    getResampledPcmFrameCount,
+    resampleFloatPcm,
+    heap8Buffer,
+  },
+  { samples, resampleRate }
+) {
+  const sampleDataPointer = allocateSampleData(samples.length, 4);
+  new Float32Array(heap8Buffer(), sampleDataPointer, samples.length).set(
+    samples
+  );
+  if (resampleRate === null) {
+    return { sampleDataPointer, numOfFrames: samples.length };
+  }
+  const resampledPointer = resampleFloatPcm(
+    sampleDataPointer,
+    samples.length,
+    SAMPLE_RATE,
+    resampleRate
+  );
+  if (!resampledPointer) {
+    throw new Error('Not enough memory to resample sample');
+  }
+  return {
+    sampleDataPointer: resampledPointer,
+    numOfFrames: getResampledPcmFrameCount(
+      samples.length,
+      SAMPLE_RATE,
+      resampleRate
+    ),
+  };
+}
+
+/**
+ * The number of frames copyTargetSamplesToSyroMemory ends up with for a
+ * sample, worked out from its metadata and the length of its plugin-processed
+ * audio, without the audio itself
+ * @param {import('./getSyroBindings.js').SyroBindings} syroBindings
+ * @param {import('../store').SampleContainer} sampleContainer
+ * @param {number} postPluginFrameCount
+ */
+export function getTargetFrameCount(
+  { getResampledPcmFrameCount },
+  sampleContainer,
+  postPluginFrameCount
+) {
+  const { trim, pitchAdjustment } = sampleContainer.metadata;
+  const [trimStart, trimEnd] = trim.frames.map((t) => Math.max(t, 0));
+  // (see getTrimmedView)
+  const numOfFrames =
+    trimStart + trimEnd >= postPluginFrameCount
+      ? 1
+      : postPluginFrameCount - trimStart - trimEnd;
+  const resampleRate = getResampleRateForPitch(pitchAdjustment);
+  return resampleRate === null
+    ? numOfFrames
+    : getResampledPcmFrameCount(numOfFrames, SAMPLE_RATE, resampleRate);
+}
+
 /**
  * @type {WeakMap<
  *   import('../store').SampleContainer,
@@ -357,64 +519,20 @@ export async function getTargetWavForPluginProcessedSample(
     if (promise) return promise;
   }
   const promise = (async () => {
-    const {
-      qualityBitDepth,
-      normalize,
-      trim: { frames: trimFrames },
-      pitchAdjustment,
-    } = sampleContainer.metadata;
-    if (
-      qualityBitDepth < 8 ||
-      qualityBitDepth > 16 ||
-      !Number.isInteger(qualityBitDepth)
-    ) {
-      throw new Error(
-        `Expected bit depth between 8 and 16. Received: ${qualityBitDepth}`
-      );
-    }
-
-    const samplesPreNormalize =
-      normalize === 'all'
-        ? pluginProcessedAudioBuffer.getChannelData(0)
-        : getTrimmedView(
-            pluginProcessedAudioBuffer.getChannelData(0),
-            trimFrames
-          );
-    if (normalize === 'all') {
-      normalizeSamples(samplesPreNormalize);
-    }
-    const samples =
-      normalize === 'all'
-        ? getTrimmedView(samplesPreNormalize, trimFrames)
-        : samplesPreNormalize;
-    if (normalize === 'selection') {
-      normalizeSamples(samples);
-    }
-
-    const waveformPeaks = getPeaksForSamples(samples, WAVEFORM_CACHED_WIDTH);
-
-    // for now we don't support pitch adjustments out of these bounds
-    const hasValidPitchAdjustment =
-      !isNaN(pitchAdjustment) &&
-      pitchAdjustment !== 1 &&
-      pitchAdjustment >= 0.5 &&
-      pitchAdjustment <= 2;
-    const pitchAdjustedSamples = hasValidPitchAdjustment
-      ? new Float32Array(
-          resample(
-            samples,
-            SAMPLE_RATE,
-            Math.round(SAMPLE_RATE / pitchAdjustment)
-          )
-        )
-      : samples;
-
-    if (forPreview && qualityBitDepth < 16) {
-      applyQualityBitDepthToSamples(pitchAdjustedSamples, qualityBitDepth);
-    }
-
-    const samples16 = convertSamplesTo16Bit(pitchAdjustedSamples);
-    const samplesByteLength = samples16.length * 2;
+    const targetSamples = await getTargetSamplesForPluginProcessedSample(
+      sampleContainer,
+      pluginProcessedAudioBuffer,
+      true
+    );
+    // resampling, normalizing, the quality preview and conversion to 16 bits
+    // all happen in wasm memory, from where the result goes straight into the
+    // wav
+    const syroBindings = await getSyroBindings();
+    const { sampleDataPointer, numOfFrames } = copyTargetSamplesToSyroMemory(
+      syroBindings,
+      targetSamples
+    );
+    const samplesByteLength = numOfFrames * 2;
     /**
      * @type {Uint8Array}
      */
@@ -426,14 +544,29 @@ export async function getTargetWavForPluginProcessedSample(
     });
     const wavBuffer = new Uint8Array(wavHeader.length + samplesByteLength);
     wavBuffer.set(wavHeader);
-    wavBuffer.set(new Uint8Array(samples16.buffer), wavHeader.length);
+    const { convertFloatPcmTo16Bit, freeSampleData, heap8Buffer } =
+      syroBindings;
+    const { qualityBitDepth } = sampleContainer.metadata;
+    const pcm16Pointer = convertFloatPcmTo16Bit(
+      sampleDataPointer,
+      numOfFrames,
+      targetSamples.gain,
+      forPreview ? qualityBitDepth : 16
+    );
+    wavBuffer.set(
+      new Uint8Array(heap8Buffer(), pcm16Pointer, samplesByteLength),
+      wavHeader.length
+    );
+    freeSampleData(pcm16Pointer);
     return {
       data: wavBuffer,
       sampleRate: 16,
       cachedInfo: {
-        waveformPeaks,
+        waveformPeaks: /** @type {import('./waveform.js').SamplePeaks} */ (
+          targetSamples.waveformPeaks
+        ),
         postPluginFrameCount: pluginProcessedAudioBuffer.length,
-        duration: samples16.length / pluginProcessedAudioBuffer.sampleRate,
+        duration: numOfFrames / pluginProcessedAudioBuffer.sampleRate,
         failedPluginIndex: -1,
       },
     };
@@ -480,6 +613,36 @@ export async function getTargetWavForSample(sampleContainer, forPreview) {
   );
 }
 
+/**
+ * Like getTargetWavForSample, but returns the float samples themselves, to be
+ * written straight into the syro bindings' memory without a wav file in
+ * between (see copyTargetSamplesToSyroMemory), along with the gain to
+ * normalize them by
+ * @param {import('../store').SampleContainer} sampleContainer
+ * @returns {Promise<{
+ *   samples: Float32Array;
+ *   sampleRate: number;
+ *   gain: number;
+ *   resampleRate: number | null;
+ * }>}
+ */
+export async function getTargetSamplesForSample(sampleContainer) {
+  const pluginProcessedAudioBuffer = await processPluginsForSample(
+    sampleContainer
+  );
+  const { samples, gain, resampleRate } =
+    await getTargetSamplesForPluginProcessedSample(
+      sampleContainer,
+      pluginProcessedAudioBuffer
+    );
+  return {
+    samples,
+    sampleRate: pluginProcessedAudioBuffer.sampleRate,
+    gain,
+    resampleRate,
+  };
+}
+
 /**
  * Silent audio to play during Web Audio playback to make iOS force Web Audio to
  * even if the mute (do not disturb) setting is on.
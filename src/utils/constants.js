@@ -1 +1,4 @@
 export const SAMPLE_RATE = 31250;
+
+// syrostreams are always 44.1kHz 16-bit stereo
+export const SYRO_STREAM_SAMPLE_RATE = 44100;
@@ -15,35 +15,231 @@
  *     quality: number,
  *     useCompression: 0 | 1
  *   ): void;
- *   getDeleteBufferFromSyroData(
+ *   createSyroDataFromWavDataWithCompressedBlock(
  *     syroDataHandle: number,
- *     numOfData: number
+ *     syroDataIndex: number,
+ *     wavData: Uint8Array,
+ *     bytes: number,
+ *     slotNumber: number,
+ *     quality: number,
+ *     useCompression: 0 | 1,
+ *     cacheKey: string,
+ *     block: Uint8Array,
+ *     blockSize: number,
+ *     compSize: number,
+ *     checksum: string
+ *   ): 0 | 1;
+ *   createWavStreamParser(): number;
+ *   feedWavStreamParser(
+ *     wavStreamParser: number,
+ *     bytesPointer: number,
+ *     size: number
+ *   ): 0 | 1;
+ *   createSyroDataFromWavStreamParser(
+ *     syroDataHandle: number,
+ *     syroDataIndex: number,
+ *     wavStreamParser: number,
+ *     slotNumber: number,
+ *     quality: number,
+ *     useCompression: 0 | 1
+ *   ): 0 | 1;
+ *   freeWavStreamParser(wavStreamParser: number): void;
+ *   allocateSampleData(numOfFrames: number, bytesPerSample: 1 | 2 | 4): number;
+ *   freeSampleData(sampleDataPointer: number): void;
+ *   createSyroDataFromPcm(
+ *     syroDataHandle: number,
+ *     syroDataIndex: number,
+ *     sampleDataPointer: number,
+ *     numOfFrames: number,
+ *     sampleRate: number,
+ *     slotNumber: number,
+ *     quality: number,
+ *     useCompression: 0 | 1
+ *   ): void;
+ *   convertFloatPcmTo16Bit(
+ *     sampleDataPointer: number,
+ *     numOfFrames: number,
+ *     gain: number,
+ *     qualityBitDepth: number
+ *   ): number;
+ *   getResampledPcmFrameCount(
+ *     numOfFrames: number,
+ *     sourceRate: number,
+ *     targetRate: number
+ *   ): number;
+ *   resampleFloatPcm(
+ *     sampleDataPointer: number,
+ *     numOfFrames: number,
+ *     sourceRate: number,
+ *     targetRate: number
  *   ): number;
+ *   buildWaveformPeakIndex(
+ *     sampleDataPointer: number,
+ *     numOfFrames: number
+ *   ): number;
+ *   getSyroPackEntryCount(packPointer: number, size: number): number;
+ *   createSyroDataFromSyroPack(
+ *     syroDataHandle: number,
+ *     packPointer: number,
+ *     size: number
+ *   ): 0 | 1;
+ *   getSyroPackFrameCount(
+ *     packPointer: number,
+ *     size: number,
+ *     index: number
+ *   ): number;
+ *   getSyroPackPeaksPointer(
+ *     packPointer: number,
+ *     size: number,
+ *     index: number
+ *   ): number;
+ *   createSyroDataFromFloatPcm(
+ *     syroDataHandle: number,
+ *     syroDataIndex: number,
+ *     sampleDataPointer: number,
+ *     numOfFrames: number,
+ *     sampleRate: number,
+ *     slotNumber: number,
+ *     quality: number,
+ *     useCompression: 0 | 1,
+ *     gain: number
+ *   ): void;
+ *   useCompressedBlockForSyroData(
+ *     syroDataHandle: number,
+ *     syroDataIndex: number,
+ *     cacheKey: string,
+ *     block: Uint8Array,
+ *     blockSize: number,
+ *     compSize: number,
+ *     checksum: string
+ *   ): 0 | 1;
+ *   getSyroDataCacheKey(syroDataHandle: number, syroDataIndex: number): string;
+ *   exportCompressedBlock(cacheKey: string): number;
+ *   getCompressedBlockPointer(compressedBlock: number): number;
+ *   getCompressedBlockSize(compressedBlock: number): number;
+ *   getCompressedBlockCompSize(compressedBlock: number): number;
+ *   getCompressedBlockChecksum(compressedBlock: number): string;
+ *   freeCompressedBlock(compressedBlock: number): void;
+ *   initSyroWorkerPool(numOfWorkers: number): void;
+ *   precomputeEraseStreams(
+ *     numOfSlots: number,
+ *     priority: number,
+ *     onDone: number
+ *   ): void;
  *   prepareSampleBufferFromSyroData(
  *     syroDataHandle: number,
  *     numOfData: number,
- *     onUpdate: number
+ *     onUpdate: number,
+ *     chunkBudgetMs: number,
+ *     priority: number
  *   ): number;
+ *   getSyroStreamFrameCount(
+ *     sizes: Uint8Array, // bytes of a Uint32Array
+ *     slotNumbers: Uint8Array, // bytes of a Uint32Array
+ *     numOfData: number
+ *   ): number;
+ *   measureSyroCompSize(
+ *     syroDataHandle: number,
+ *     onMeasured: number,
+ *     priority: number
+ *   ): void;
  *   getSampleBufferChunkPointer(sampleBufferUpdate: number): number;
  *   getSampleBufferChunkSize(sampleBufferUpdate: number): number;
  *   getSampleBufferProgress(sampleBufferUpdate: number): number;
  *   getSampleBufferTotalSize(sampleBufferUpdate: number): number;
+ *   getSampleBufferFailed(sampleBufferUpdate: number): number;
  *   getSampleBufferDataStartPointsPointer(sampleBufferUpdate: number): number;
- *   freeDeleteBuffer(deleteBufferUpdate: number): void;
+ *   getSampleBufferStatsPointer(sampleBufferUpdate: number): number;
+ *   getSampleBufferTraceJson(sampleBufferUpdate: number): string;
+ *   setSyroTraceEnabled(enabled: 0 | 1): void;
  *   cancelSampleBufferWork(workHandle: number): void;
+ *   pauseSampleBufferWork(workHandle: number): void;
+ *   resumeSampleBufferWork(workHandle: number): void;
  *   registerUpdateCallback(
  *     cb: (sampleBufferContainer: number) => void
  *   ): number;
  *   unregisterUpdateCallback(pointer: number): void;
  *   heap8Buffer(): ArrayBuffer;
+ *   sharedStream: SharedStreamBindings | null;
  * }} SyroBindings
  */
 
+/**
+ * Only available in the pthreads build (see syro-shared-stream.c).
+ * @typedef {{
+ *   startSharedSampleStream(
+ *     syroDataHandle: number,
+ *     numOfData: number,
+ *     bufferSize: number,
+ *     maxCompressionThreads: number
+ *   ): number;
+ *   getSharedStreamState(sharedStream: number): number;
+ *   getSharedStreamProgress(sharedStream: number): number;
+ *   getSharedStreamTotalSize(sharedStream: number): number;
+ *   getSharedStreamBufferPointer(sharedStream: number): number;
+ *   getSharedStreamBufferSize(sharedStream: number): number;
+ *   getSharedStreamDataStartPointsPointer(sharedStream: number): number;
+ *   setSharedStreamConsumed(sharedStream: number, consumed: number): void;
+ *   freeSharedSampleStream(sharedStream: number): void;
+ * }} SharedStreamBindings
+ */
+
 /**
  * @type {Promise<SyroBindings> | undefined}
  */
 let syroBindingsPromise;
 
+/**
+ * The pthreads build needs SharedArrayBuffer, which browsers only provide on
+ * cross-origin isolated pages (GitHub Pages can't send the headers for that,
+ * for instance).
+ */
+function canUseSharedMemory() {
+  return (
+    typeof SharedArrayBuffer === 'function' &&
+    window.crossOriginIsolated === true
+  );
+}
+
+/**
+ * @returns {Promise<typeof window.CREATE_SYRO_BINDINGS | null>}
+ */
+function loadThreadedBindingsScript() {
+  return new Promise((resolve) => {
+    const script = document.createElement('script');
+    script.src = './syro-bindings-threaded.js';
+    script.onload = () =>
+      resolve(
+        typeof window.CREATE_SYRO_BINDINGS_THREADED === 'function'
+          ? window.CREATE_SYRO_BINDINGS_THREADED
+          : null
+      );
+    script.onerror = () => resolve(null);
+    document.body.appendChild(script);
+  });
+}
+
+/**
+ * Prefers the pthreads build when the page allows it.
+ * @returns {Promise<{
+ *   Module: Awaited<ReturnType<typeof window.CREATE_SYRO_BINDINGS>>;
+ *   threaded: boolean;
+ * }>}
+ */
+async function createSyroModule() {
+  const createThreadedModule = canUseSharedMemory()
+    ? await loadThreadedBindingsScript()
+    : null;
+  if (createThreadedModule) {
+    try {
+      return { Module: await createThreadedModule(), threaded: true };
+    } catch (err) {
+      console.error(err);
+    }
+  }
+  return { Module: await window.CREATE_SYRO_BINDINGS(), threaded: false };
+}
+
 export async function getSyroBindings() {
   if (typeof window.CREATE_SYRO_BINDINGS !== 'function') {
     return Promise.reject(
@@ -52,7 +248,7 @@ export async function getSyroBindings() {
   }
   return (syroBindingsPromise =
     syroBindingsPromise ||
-    window.CREATE_SYRO_BINDINGS().then(async (Module) => {
+    createSyroModule().then(async ({ Module, threaded }) => {
       /**
        * @type {SyroBindings}
        */
@@ -70,16 +266,172 @@ export async function getSyroBindings() {
           null,
           ['number', 'number', 'array', 'number', 'number', 'number']
         ),
-        getDeleteBufferFromSyroData: Module.cwrap(
-          'getDeleteBufferFromSyroData',
+        createSyroDataFromWavDataWithCompressedBlock: Module.cwrap(
+          'createSyroDataFromWavDataWithCompressedBlock',
+          'number',
+          [
+            'number',
+            'number',
+            'array',
+            'number',
+            'number',
+            'number',
+            'number',
+            'string',
+            'array',
+            'number',
+            'number',
+            'string',
+          ]
+        ),
+        createWavStreamParser: Module.cwrap(
+          'createWavStreamParser',
+          'number',
+          []
+        ),
+        feedWavStreamParser: Module.cwrap('feedWavStreamParser', 'number', [
+          'number',
+          'number',
+          'number',
+        ]),
+        createSyroDataFromWavStreamParser: Module.cwrap(
+          'createSyroDataFromWavStreamParser',
+          'number',
+          ['number', 'number', 'number', 'number', 'number', 'number']
+        ),
+        freeWavStreamParser: Module.cwrap('freeWavStreamParser', null, [
+          'number',
+        ]),
+        allocateSampleData: Module.cwrap('allocateSampleData', 'number', [
+          'number',
+          'number',
+        ]),
+        freeSampleData: Module.cwrap('freeSampleData', null, ['number']),
+        createSyroDataFromPcm: Module.cwrap('createSyroDataFromPcm', null, [
+          'number',
+          'number',
+          'number',
+          'number',
+          'number',
+          'number',
+          'number',
+          'number',
+        ]),
+        convertFloatPcmTo16Bit: Module.cwrap(
+          'convertFloatPcmTo16Bit',
+          'number',
+          ['number', 'number', 'number', 'number']
+        ),
+        getResampledPcmFrameCount: Module.cwrap(
+          'getResampledPcmFrameCount',
+          'number',
+          ['number', 'number', 'number']
+        ),
+        resampleFloatPcm: Module.cwrap('resampleFloatPcm', 'number', [
+          'number',
+          'number',
+          'number',
+          'number',
+        ]),
+        buildWaveformPeakIndex: Module.cwrap(
+          'buildWaveformPeakIndex',
           'number',
           ['number', 'number']
         ),
+        getSyroPackEntryCount: Module.cwrap('getSyroPackEntryCount', 'number', [
+          'number',
+          'number',
+        ]),
+        createSyroDataFromSyroPack: Module.cwrap(
+          'createSyroDataFromSyroPack',
+          'number',
+          ['number', 'number', 'number']
+        ),
+        getSyroPackFrameCount: Module.cwrap('getSyroPackFrameCount', 'number', [
+          'number',
+          'number',
+          'number',
+        ]),
+        getSyroPackPeaksPointer: Module.cwrap(
+          'getSyroPackPeaksPointer',
+          'number',
+          ['number', 'number', 'number']
+        ),
+        createSyroDataFromFloatPcm: Module.cwrap(
+          'createSyroDataFromFloatPcm',
+          null,
+          [
+            'number',
+            'number',
+            'number',
+            'number',
+            'number',
+            'number',
+            'number',
+            'number',
+            'number',
+          ]
+        ),
+        useCompressedBlockForSyroData: Module.cwrap(
+          'useCompressedBlockForSyroData',
+          'number',
+          ['number', 'number', 'string', 'array', 'number', 'number', 'string']
+        ),
+        getSyroDataCacheKey: Module.cwrap('getSyroDataCacheKey', 'string', [
+          'number',
+          'number',
+        ]),
+        exportCompressedBlock: Module.cwrap(
+          'exportCompressedBlock',
+          'number',
+          ['string']
+        ),
+        getCompressedBlockPointer: Module.cwrap(
+          'getCompressedBlockPointer',
+          'number',
+          ['number']
+        ),
+        getCompressedBlockSize: Module.cwrap(
+          'getCompressedBlockSize',
+          'number',
+          ['number']
+        ),
+        getCompressedBlockCompSize: Module.cwrap(
+          'getCompressedBlockCompSize',
+          'number',
+          ['number']
+        ),
+        getCompressedBlockChecksum: Module.cwrap(
+          'getCompressedBlockChecksum',
+          'string',
+          ['number']
+        ),
+        freeCompressedBlock: Module.cwrap('freeCompressedBlock', null, [
+          'number',
+        ]),
+        initSyroWorkerPool: Module.cwrap('initSyroWorkerPool', null, [
+          'number',
+        ]),
+        precomputeEraseStreams: Module.cwrap('precomputeEraseStreams', null, [
+          'number',
+          'number',
+          'number',
+        ]),
         prepareSampleBufferFromSyroData: Module.cwrap(
           'prepareSampleBufferFromSyroData',
           'number',
-          ['number', 'number', 'number']
+          ['number', 'number', 'number', 'number', 'number']
         ),
+        getSyroStreamFrameCount: Module.cwrap(
+          'getSyroStreamFrameCount',
+          'number',
+          ['array', 'array', 'number']
+        ),
+        measureSyroCompSize: Module.cwrap('measureSyroCompSize', null, [
+          'number',
+          'number',
+          'number',
+        ]),
         getSampleBufferChunkPointer: Module.cwrap(
           'getSampleBufferChunkPointer',
           'number',
@@ -100,15 +452,36 @@ export async function getSyroBindings() {
           'number',
           ['number']
         ),
+        getSampleBufferFailed: Module.cwrap('getSampleBufferFailed', 'number', [
+          'number',
+        ]),
         getSampleBufferDataStartPointsPointer: Module.cwrap(
           'getSampleBufferDataStartPointsPointer',
           'number',
           ['number']
         ),
-        freeDeleteBuffer: Module.cwrap('freeDeleteBuffer', null, ['number']),
+        getSampleBufferStatsPointer: Module.cwrap(
+          'getSampleBufferStatsPointer',
+          'number',
+          ['number']
+        ),
+        getSampleBufferTraceJson: Module.cwrap(
+          'getSampleBufferTraceJson',
+          'string',
+          ['number']
+        ),
+        setSyroTraceEnabled: Module.cwrap('setSyroTraceEnabled', null, [
+          'number',
+        ]),
         cancelSampleBufferWork: Module.cwrap('cancelSampleBufferWork', null, [
           'number',
         ]),
+        pauseSampleBufferWork: Module.cwrap('pauseSampleBufferWork', null, [
+          'number',
+        ]),
+        resumeSampleBufferWork: Module.cwrap('resumeSampleBufferWork', null, [
+          'number',
+        ]),
         registerUpdateCallback(cb) {
           return Module.addFunction(cb, 'vi');
         },
@@ -118,7 +491,59 @@ export async function getSyroBindings() {
         heap8Buffer() {
           return Module.HEAP8.buffer;
         },
+        sharedStream: threaded
+          ? {
+              startSharedSampleStream: Module.cwrap(
+                'startSharedSampleStream',
+                'number',
+                ['number', 'number', 'number', 'number']
+              ),
+              getSharedStreamState: Module.cwrap(
+                'getSharedStreamState',
+                'number',
+                ['number']
+              ),
+              getSharedStreamProgress: Module.cwrap(
+                'getSharedStreamProgress',
+                'number',
+                ['number']
+              ),
+              getSharedStreamTotalSize: Module.cwrap(
+                'getSharedStreamTotalSize',
+                'number',
+                ['number']
+              ),
+              getSharedStreamBufferPointer: Module.cwrap(
+                'getSharedStreamBufferPointer',
+                'number',
+                ['number']
+              ),
+              getSharedStreamBufferSize: Module.cwrap(
+                'getSharedStreamBufferSize',
+                'number',
+                ['number']
+              ),
+              getSharedStreamDataStartPointsPointer: Module.cwrap(
+                'getSharedStreamDataStartPointsPointer',
+                'number',
+                ['number']
+              ),
+              setSharedStreamConsumed: Module.cwrap(
+                'setSharedStreamConsumed',
+                null,
+                ['number', 'number']
+              ),
+              freeSharedSampleStream: Module.cwrap(
+                'freeSharedSampleStream',
+                null,
+                ['number']
+              ),
+            }
+          : null,
       };
+      // the syro workers load in the background from here on, so they're
+      // ready by the time they're needed
+      bindings.initSyroWorkerPool(navigator.hardwareConcurrency || 1);
       return bindings;
     }));
 }
@@ -8,23 +8,510 @@ import {
 } from 'react';
 import { getSyroBindings } from './getSyroBindings.js';
 import {
-  getTargetWavForSample,
+  getTargetSamplesForSample,
+  getTargetFrameCount,
+  copyTargetSamplesToSyroMemory,
   getAudioBufferForAudioFileData,
+  getSyroStreamAudioContext,
   useAudioPlaybackContext,
 } from './audioData.js';
+import { SYRO_STREAM_SAMPLE_RATE } from './constants.js';
+import {
+  cacheCompressedBlock,
+  getCachedCompressedBlock,
+} from '../sampleCacheStore.js';
+
+/**
+ * @typedef {import('./getSyroBindings.js').SyroBindings} SyroBindings
+ * @typedef {import('../sampleCacheStore.js').CompressedBlockInfo} CompressedBlockInfo
+ */
+
+// the fields of SyroTransferStats in syro-bindings.c, in order
+const SYRO_TRANSFER_STATS_FIELDS = /** @type {const} */ ([
+  'elapsedMs',
+  'queueWaitMs',
+  'compressMs',
+  'startMs',
+  'encodeMs',
+  'copyMs',
+  'callbackMs',
+  'frames',
+  'bytes',
+  'framesPerSecond',
+  'workerMemoryBytes',
+  'peakWorkerMemoryBytes',
+]);
+
+/**
+ * Where a transfer's time went so far, in milliseconds (see
+ * SyroTransferStats in syro-bindings.c), along with the worker's memory use in
+ * bytes. prepareMs is the time spent getting the audio ready on the main
+ * thread, before any of the rest. Only elapsedMs and bytes are measured for
+ * shared memory streams.
+ * @typedef {Record<
+ *   'prepareMs' | (typeof SYRO_TRANSFER_STATS_FIELDS)[number],
+ *   number
+ * >} SyroTransferStats
+ */
+
+/**
+ * @returns {SyroTransferStats}
+ */
+function createSyroTransferStats() {
+  const stats = /** @type {SyroTransferStats} */ ({ prepareMs: 0 });
+  for (const field of SYRO_TRANSFER_STATS_FIELDS) {
+    stats[field] = 0;
+  }
+  return stats;
+}
+
+/**
+ * @param {ArrayBuffer} heapBuffer
+ * @param {number} statsPointer
+ * @returns {SyroTransferStats}
+ */
+function readSyroTransferStats(heapBuffer, statsPointer) {
+  const values = new Float64Array(
+    heapBuffer,
+    statsPointer,
+    SYRO_TRANSFER_STATS_FIELDS.length
+  );
+  const stats = createSyroTransferStats();
+  SYRO_TRANSFER_STATS_FIELDS.forEach((field, i) => {
+    stats[field] = values[i];
+  });
+  return stats;
+}
+
+/**
+ * Fills in syro data for each sample container, using compressed blocks saved
+ * from an earlier transfer where we have them. Returns null if cancelled along
+ * the way.
+ * @param {SyroBindings} bindings
+ * @param {(import('../store').SampleContainer)[]} sampleContainers
+ * @param {() => boolean} isCancelled
+ * @returns {Promise<{
+ *   syroDataHandle: number;
+ *   cacheKeys: (string | null)[];
+ *   cachedBlocks: (CompressedBlockInfo | null)[];
+ * } | null>}
+ */
+async function createSyroDataForSamples(
+  bindings,
+  sampleContainers,
+  isCancelled
+) {
+  const {
+    allocateSyroData,
+    createSyroDataFromFloatPcm,
+    useCompressedBlockForSyroData,
+    getSyroDataCacheKey,
+  } = bindings;
+  /** @type {Awaited<ReturnType<typeof getTargetSamplesForSample>>[]} */
+  const targetSamples = [];
+  for (const sampleContainer of sampleContainers) {
+    targetSamples.push(await getTargetSamplesForSample(sampleContainer));
+    if (isCancelled()) {
+      return null;
+    }
+  }
+  // blocks compressed during an earlier transfer of the same audio
+  const cachedBlocks = await Promise.all(
+    sampleContainers.map((sampleContainer) =>
+      sampleContainer.metadata.useCompression
+        ? getCachedCompressedBlock(sampleContainer.id)
+        : null
+    )
+  );
+  if (isCancelled()) {
+    return null;
+  }
+  const syroDataHandle = allocateSyroData(sampleContainers.length);
+  /** @type {(string | null)[]} */
+  const cacheKeys = sampleContainers.map((sampleContainer, i) => {
+    const { sampleRate, gain } = targetSamples[i];
+    // the samples are written straight into wasm memory, where the syro data
+    // takes them over (normalized and converted to 16 bits in place)
+    const { sampleDataPointer, numOfFrames } = copyTargetSamplesToSyroMemory(
+      bindings,
+      targetSamples[i]
+    );
+    createSyroDataFromFloatPcm(
+      syroDataHandle,
+      i,
+      sampleDataPointer,
+      numOfFrames,
+      sampleRate,
+      sampleContainer.metadata.slotNumber,
+      sampleContainer.metadata.qualityBitDepth,
+      sampleContainer.metadata.useCompression ? 1 : 0,
+      gain
+    );
+    const cachedBlock = cachedBlocks[i];
+    if (
+      cachedBlock &&
+      !useCompressedBlockForSyroData(
+        syroDataHandle,
+        i,
+        cachedBlock.cacheKey,
+        cachedBlock.block,
+        cachedBlock.block.length,
+        cachedBlock.compSize,
+        cachedBlock.checksum || ''
+      )
+    ) {
+      // stale or damaged, so it's saved again once compressed
+      cachedBlocks[i] = null;
+    }
+    // read keys now since the syro data is freed once work starts
+    return sampleContainer.metadata.useCompression
+      ? getSyroDataCacheKey(syroDataHandle, i)
+      : null;
+  });
+  return { syroDataHandle, cacheKeys, cachedBlocks };
+}
+
+/**
+ * Persists compressed blocks that weren't already saved, so the next transfer
+ * of the same audio can skip compression.
+ * @param {SyroBindings} bindings
+ * @param {(import('../store').SampleContainer)[]} sampleContainers
+ * @param {(string | null)[]} cacheKeys
+ * @param {(CompressedBlockInfo | null)[]} cachedBlocks
+ */
+function saveCompressedBlocks(
+  {
+    exportCompressedBlock,
+    getCompressedBlockPointer,
+    getCompressedBlockSize,
+    getCompressedBlockCompSize,
+    getCompressedBlockChecksum,
+    freeCompressedBlock,
+    heap8Buffer,
+  },
+  sampleContainers,
+  cacheKeys,
+  cachedBlocks
+) {
+  sampleContainers.forEach((sampleContainer, i) => {
+    const cacheKey = cacheKeys[i];
+    const cachedBlock = cachedBlocks[i];
+    if (!cacheKey || (cachedBlock && cachedBlock.cacheKey === cacheKey)) {
+      return;
+    }
+    const compressedBlockPointer = exportCompressedBlock(cacheKey);
+    if (!compressedBlockPointer) {
+      return;
+    }
+    // save a new copy of the data so it doesn't disappear
+    const block = new Uint8Array(
+      new Uint8Array(
+        heap8Buffer(),
+        getCompressedBlockPointer(compressedBlockPointer),
+        getCompressedBlockSize(compressedBlockPointer)
+      )
+    );
+    const compSize = getCompressedBlockCompSize(compressedBlockPointer);
+    const checksum = getCompressedBlockChecksum(compressedBlockPointer);
+    freeCompressedBlock(compressedBlockPointer);
+    const audioKey = getSampleAudioKey(sampleContainer);
+    syroCompSizes.set(sampleContainer.id, {
+      audioKey,
+      compSize: Promise.resolve(compSize),
+    });
+    cacheCompressedBlock(sampleContainer.id, {
+      cacheKey,
+      block,
+      compSize,
+      checksum,
+      audioKey,
+    });
+  });
+}
+
+/**
+ * Encodes the whole syrostream on a shared memory stream (pthreads build).
+ * The encoder thread writes straight into the output, so the only copy is the
+ * final one out of the wasm heap. Resolves with null if cancelled.
+ * @param {SyroBindings} bindings
+ * @param {import('./getSyroBindings.js').SharedStreamBindings} sharedStream
+ * @param {number} syroDataHandle
+ * @param {number} numOfData
+ * @param {(progress: number, stats: SyroTransferStats) => void} onProgress
+ * @param {(onCancel: () => void) => void} setOnCancel
+ * @returns {Promise<{
+ *   syroBuffer: Uint8Array;
+ *   dataStartPoints: number[];
+ * } | null>}
+ */
+async function getSyroBufferFromSharedStream(
+  { heap8Buffer },
+  {
+    startSharedSampleStream,
+    getSharedStreamState,
+    getSharedStreamProgress,
+    getSharedStreamTotalSize,
+    getSharedStreamBufferPointer,
+    getSharedStreamDataStartPointsPointer,
+    freeSharedSampleStream,
+  },
+  syroDataHandle,
+  numOfData,
+  onProgress,
+  setOnCancel
+) {
+  const startedAt = performance.now();
+  const stats = createSyroTransferStats();
+  const streamHandle = startSharedSampleStream(
+    syroDataHandle,
+    numOfData,
+    0,
+    navigator.hardwareConcurrency || 1
+  );
+  if (!streamHandle) {
+    throw new Error('Failed to start syrostream encoding');
+  }
+  try {
+    onProgress(0, stats);
+    const finished = await /** @type {Promise<boolean>} */ (
+      new Promise((resolve, reject) => {
+        /**
+         * @type {number}
+         */
+        let frame;
+        setOnCancel(() => {
+          cancelAnimationFrame(frame);
+          resolve(false);
+        });
+        checkProgress();
+        function checkProgress() {
+          const state = getSharedStreamState(streamHandle);
+          if (state === SHARED_STREAM_FAILED) {
+            reject(new Error('Failed to start syrostream encoding'));
+            return;
+          }
+          if (state === SHARED_STREAM_RUNNING) {
+            const bytesProgress = getSharedStreamProgress(streamHandle);
+            const progress =
+              bytesProgress / getSharedStreamTotalSize(streamHandle);
+            stats.elapsedMs = performance.now() - startedAt;
+            stats.bytes = bytesProgress;
+            if (progress) {
+              onProgress(progress, stats);
+            }
+            if (progress >= 1) {
+              resolve(true);
+              return;
+            }
+          }
+          frame = requestAnimationFrame(checkProgress);
+        }
+      })
+    );
+    if (!finished) {
+      return null;
+    }
+    // save a new copy of the data so it doesn't disappear (this also gets
+    // it out of shared memory, which decodeAudioData won't accept)
+    const syroBuffer = new Uint8Array(
+      new Uint8Array(
+        heap8Buffer(),
+        getSharedStreamBufferPointer(streamHandle),
+        getSharedStreamTotalSize(streamHandle)
+      )
+    );
+    const dataStartPoints = [
+      ...new Uint32Array(
+        heap8Buffer(),
+        getSharedStreamDataStartPointsPointer(streamHandle),
+        numOfData
+      ),
+    ];
+    return { syroBuffer, dataStartPoints };
+  } finally {
+    freeSharedSampleStream(streamHandle);
+  }
+}
+
+// roughly how long the syro worker spends encoding between updates, however
+// fast the machine is. short enough for smooth progress, long enough that
+// message overhead stays small.
+const SYRO_WORKER_CHUNK_BUDGET_MS = 50;
+// work for higher priority jobs goes to the syro worker pool first
+const SYRO_WORK_PRIORITY_BACKGROUND = -1;
+const SYRO_WORK_PRIORITY_DEFAULT = 0;
+const SYRO_WORK_PRIORITY_STREAM = 1;
+
+/**
+ * Encodes the whole syrostream on the syro worker pool, which sends it back
+ * in chunks. Resolves with null if cancelled. With trace set, the result
+ * includes a Chrome trace of the transfer (see getSampleBufferTraceJson in
+ * syro-bindings.c).
+ * @param {SyroBindings} bindings
+ * @param {number} syroDataHandle
+ * @param {number} numOfData
+ * @param {number} priority
+ * @param {boolean} trace
+ * @param {(progress: number, stats: SyroTransferStats) => void} onProgress
+ * @param {(onCancel: () => void) => void} setOnCancel
+ * @returns {Promise<{
+ *   syroBuffer: Uint8Array;
+ *   dataStartPoints: number[];
+ *   trace?: string;
+ * } | null>}
+ */
+async function getSyroBufferFromWorker(
+  {
+    prepareSampleBufferFromSyroData,
+    getSampleBufferChunkPointer,
+    getSampleBufferChunkSize,
+    getSampleBufferProgress,
+    getSampleBufferTotalSize,
+    getSampleBufferFailed,
+    getSampleBufferDataStartPointsPointer,
+    getSampleBufferStatsPointer,
+    getSampleBufferTraceJson,
+    setSyroTraceEnabled,
+    cancelSampleBufferWork,
+    registerUpdateCallback,
+    unregisterUpdateCallback,
+    heap8Buffer,
+  },
+  syroDataHandle,
+  numOfData,
+  priority,
+  trace,
+  onProgress,
+  setOnCancel
+) {
+  /** @type {Uint8Array | undefined} */
+  let syroBuffer;
+  let progress = 0;
+  let stats = createSyroTransferStats();
+  /** @type {string | undefined} */
+  let traceJson;
+  let cancelled = false;
+  let failed = false;
+  const dataStartPoints = new Uint32Array(numOfData);
+  const onUpdate = registerUpdateCallback((sampleBufferUpdatePointer) => {
+    if (cancelled) {
+      return;
+    }
+    if (getSampleBufferFailed(sampleBufferUpdatePointer)) {
+      // (the job is gone after this update)
+      failed = true;
+      return;
+    }
+    const totalSize = getSampleBufferTotalSize(sampleBufferUpdatePointer);
+    if (!syroBuffer) {
+      syroBuffer = new Uint8Array(totalSize);
+    }
+    const chunkPointer = getSampleBufferChunkPointer(sampleBufferUpdatePointer);
+    const chunkSize = getSampleBufferChunkSize(sampleBufferUpdatePointer);
+    const bytesProgress = getSampleBufferProgress(sampleBufferUpdatePointer);
+    // save a new copy of the data so it doesn't disappear
+    syroBuffer.set(
+      new Uint8Array(heap8Buffer(), chunkPointer, chunkSize),
+      bytesProgress - chunkSize
+    );
+    progress = bytesProgress / totalSize;
+    const dataStartPointsPointer = getSampleBufferDataStartPointsPointer(
+      sampleBufferUpdatePointer
+    );
+    dataStartPoints.set(
+      new Uint32Array(heap8Buffer(), dataStartPointsPointer, numOfData),
+      0
+    );
+    stats = readSyroTransferStats(
+      heap8Buffer(),
+      getSampleBufferStatsPointer(sampleBufferUpdatePointer)
+    );
+    // (the job is gone after its last update, and the trace with it)
+    if (trace && bytesProgress >= totalSize) {
+      traceJson = getSampleBufferTraceJson(sampleBufferUpdatePointer);
+    }
+  });
+  // only the job started here is traced
+  setSyroTraceEnabled(trace ? 1 : 0);
+  const workHandle = prepareSampleBufferFromSyroData(
+    syroDataHandle,
+    numOfData,
+    onUpdate,
+    SYRO_WORKER_CHUNK_BUDGET_MS,
+    priority
+  );
+  setSyroTraceEnabled(0);
+  onProgress(progress, stats);
+  try {
+    await /** @type {Promise<void>} */ (
+      new Promise((resolve, reject) => {
+        /**
+         * @type {number}
+         */
+        let frame;
+        setOnCancel(() => {
+          cancelled = true;
+          cancelAnimationFrame(frame);
+          cancelSampleBufferWork(workHandle);
+          resolve();
+        });
+        checkProgress();
+        function checkProgress() {
+          if (failed) {
+            reject(new Error('Syrostream encoding failed on the worker'));
+            return;
+          }
+          if (progress) {
+            onProgress(progress, stats);
+            if (progress >= 1) {
+              resolve();
+              return;
+            }
+          }
+          frame = requestAnimationFrame(checkProgress);
+        }
+      })
+    );
+  } finally {
+    unregisterUpdateCallback(onUpdate);
+    // (the job is freed once it has finished or failed)
+    setOnCancel(() => {});
+  }
+  if (cancelled) {
+    return null;
+  }
+  if (!syroBuffer) {
+    throw new Error('Unexpected condition: syroBuffer should be defined');
+  }
+  return {
+    syroBuffer,
+    dataStartPoints: [...dataStartPoints],
+    trace: traceJson,
+  };
+}
 
 /**
+ * onProgress also gets the transfer's stats so far, to see where the time is
+ * going. Set trace to get a Chrome trace of the whole transfer with the
+ * result (for chrome://tracing or Perfetto), except for shared memory streams
+ * which aren't traced.
  * @param {(import('../store').SampleContainer)[]} sampleContainers
- * @param {(progress: number) => void} onProgress
+ * @param {(progress: number, stats: SyroTransferStats) => void} onProgress
+ * @param {{ trace?: boolean }} [options]
  * @returns {{
  *   syroBufferPromise: Promise<{
  *     syroBuffer: Uint8Array;
  *     dataStartPoints: number[];
+ *     trace?: string;
  *   }>;
  *   cancelWork: () => void;
  * }}
  */
-export function getSyroSampleBuffer(sampleContainers, onProgress) {
+export function getSyroSampleBuffer(
+  sampleContainers,
+  onProgress,
+  { trace = false } = {}
+) {
   let cancelled = false;
   let onCancel = () => {};
   return {
@@ -33,178 +520,636 @@ export function getSyroSampleBuffer(sampleContainers, onProgress) {
       onCancel();
     },
     syroBufferPromise: (async () => {
+      const bindings = await getSyroBindings();
+      const emptyResponse = {
+        syroBuffer: new Uint8Array(),
+        dataStartPoints: [],
+      };
+      if (cancelled) {
+        return emptyResponse;
+      }
+      const prepareStartedAt = performance.now();
+      const syroData = await createSyroDataForSamples(
+        bindings,
+        sampleContainers,
+        () => cancelled
+      );
+      if (!syroData) {
+        return emptyResponse;
+      }
+      const prepareMs = performance.now() - prepareStartedAt;
+      /**
+       * @param {number} progress
+       * @param {SyroTransferStats} stats
+       */
+      const onTransferProgress = (progress, stats) =>
+        onProgress(progress, { ...stats, prepareMs });
+      const { syroDataHandle, cacheKeys, cachedBlocks } = syroData;
+      if (bindings.sharedStream) {
+        const result = await getSyroBufferFromSharedStream(
+          bindings,
+          bindings.sharedStream,
+          syroDataHandle,
+          sampleContainers.length,
+          onTransferProgress,
+          (fn) => {
+            onCancel = fn;
+          }
+        );
+        onCancel = () => {};
+        if (!result || cancelled) {
+          return emptyResponse;
+        }
+        saveCompressedBlocks(
+          bindings,
+          sampleContainers,
+          cacheKeys,
+          cachedBlocks
+        );
+        return result;
+      }
+      const result = await getSyroBufferFromWorker(
+        bindings,
+        syroDataHandle,
+        sampleContainers.length,
+        SYRO_WORK_PRIORITY_DEFAULT,
+        trace,
+        onTransferProgress,
+        (fn) => {
+          onCancel = fn;
+        }
+      );
+      onCancel = () => {};
+      if (!result || cancelled) {
+        return emptyResponse;
+      }
+      saveCompressedBlocks(bindings, sampleContainers, cacheKeys, cachedBlocks);
+      return result;
+    })(),
+  };
+}
+
+/**
+ * Identifies what a sample's audio is made from, so a compressed size measured
+ * for it can be reused until any of that changes
+ * @param {import('../store').SampleContainer} sampleContainer
+ */
+function getSampleAudioKey({ metadata }) {
+  return JSON.stringify([
+    metadata.sourceFileId,
+    metadata.trim.frames,
+    metadata.normalize,
+    metadata.pitchAdjustment,
+    metadata.plugins,
+    metadata.qualityBitDepth,
+  ]);
+}
+
+/**
+ * The compSize of each compressed sample's block, by sample id, along with the
+ * audio key it was measured for. Resolves with null if it couldn't be measured.
+ * @type {Map<string, { audioKey: string; compSize: Promise<number | null> }>}
+ */
+const syroCompSizes = new Map();
+
+/**
+ * Renders a compressed sample's audio and measures its compSize with the
+ * compressor's size pass, on the worker pool (or from the block cache)
+ * @param {SyroBindings} bindings
+ * @param {import('../store').SampleContainer} sampleContainer
+ * @returns {Promise<number | null>}
+ */
+async function measureSyroCompSizeForSample(bindings, sampleContainer) {
+  const {
+    allocateSyroData,
+    createSyroDataFromFloatPcm,
+    measureSyroCompSize,
+    registerUpdateCallback,
+    unregisterUpdateCallback,
+  } = bindings;
+  const targetSamples = await getTargetSamplesForSample(sampleContainer);
+  const { sampleDataPointer, numOfFrames } = copyTargetSamplesToSyroMemory(
+    bindings,
+    targetSamples
+  );
+  const syroDataHandle = allocateSyroData(1);
+  createSyroDataFromFloatPcm(
+    syroDataHandle,
+    0,
+    sampleDataPointer,
+    numOfFrames,
+    targetSamples.sampleRate,
+    sampleContainer.metadata.slotNumber,
+    sampleContainer.metadata.qualityBitDepth,
+    1,
+    targetSamples.gain
+  );
+  return new Promise((resolve) => {
+    const onMeasured = registerUpdateCallback((compSize) => {
+      unregisterUpdateCallback(onMeasured);
+      resolve(compSize || null);
+    });
+    // (this frees the syro data)
+    measureSyroCompSize(
+      syroDataHandle,
+      onMeasured,
+      SYRO_WORK_PRIORITY_BACKGROUND
+    );
+  });
+}
+
+/**
+ * The compSize of a compressed sample's block, remembered from the last
+ * measurement or transfer of the same audio where possible
+ * @param {SyroBindings} bindings
+ * @param {import('../store').SampleContainer} sampleContainer
+ * @returns {Promise<number | null>}
+ */
+function getSyroCompSizeForSample(bindings, sampleContainer) {
+  const audioKey = getSampleAudioKey(sampleContainer);
+  const known = syroCompSizes.get(sampleContainer.id);
+  if (known && known.audioKey === audioKey) {
+    return known.compSize;
+  }
+  const compSize = getCachedCompressedBlock(sampleContainer.id).then(
+    (cachedBlock) =>
+      cachedBlock && cachedBlock.audioKey === audioKey
+        ? cachedBlock.compSize
+        : measureSyroCompSizeForSample(bindings, sampleContainer)
+  );
+  syroCompSizes.set(sampleContainer.id, { audioKey, compSize });
+  // don't hold on to a failed measurement
+  compSize.then(
+    (size) => {
+      if (size === null) {
+        syroCompSizes.delete(sampleContainer.id);
+      }
+    },
+    () => syroCompSizes.delete(sampleContainer.id)
+  );
+  return compSize;
+}
+
+/**
+ * How long the transfer of the given samples will take, worked out without
+ * encoding the syrostream, so it's quick enough to call whenever the
+ * selection changes. Linear samples' sizes follow from their metadata and
+ * postPluginFrameCounts (from each sample's cached info), while compressed
+ * samples' sizes are remembered once measured (on the worker pool). Resolves
+ * with null if cancelled or if the length can't be worked out.
+ * @param {(import('../store').SampleContainer)[]} sampleContainers
+ * @param {number[]} postPluginFrameCounts
+ * @param {() => boolean} [isCancelled]
+ * @returns {Promise<number | null>}
+ */
+export async function getSyroTransferSeconds(
+  sampleContainers,
+  postPluginFrameCounts,
+  isCancelled = () => false
+) {
+  const bindings = await getSyroBindings();
+  if (isCancelled()) {
+    return null;
+  }
+  const sizes = await Promise.all(
+    sampleContainers.map((sampleContainer, i) =>
+      sampleContainer.metadata.useCompression
+        ? getSyroCompSizeForSample(bindings, sampleContainer)
+        : getTargetFrameCount(
+            bindings,
+            sampleContainer,
+            postPluginFrameCounts[i]
+          ) * 2
+    )
+  );
+  if (isCancelled() || sizes.includes(null)) {
+    return null;
+  }
+  const slotNumbers = new Uint32Array(
+    sampleContainers.map(({ metadata }) => metadata.slotNumber)
+  );
+  // (passed as bytes, which is how the bindings take arrays)
+  const frames = bindings.getSyroStreamFrameCount(
+    new Uint8Array(new Uint32Array(/** @type {number[]} */ (sizes)).buffer),
+    new Uint8Array(slotNumbers.buffer),
+    sampleContainers.length
+  );
+  return frames ? frames / SYRO_STREAM_SAMPLE_RATE : null;
+}
+
+// wav header at the start of the syrostream, which the stream player skips
+const WAV_HEADER_SIZE = 44;
+// playback starts once this much audio is encoded
+const STREAM_LEAD_SECONDS = 1;
+// encoding pauses once this much audio is waiting to be played and resumes
+// when it drops below the low mark. the gap leaves room for the chunks that
+// are already queued on the worker when we pause.
+const STREAM_HIGH_WATER_SECONDS = 12;
+const STREAM_LOW_WATER_SECONDS = 6;
+// ring size for shared memory streams (pthreads build)
+const STREAM_SHARED_BUFFER_SECONDS = 4;
+// milliseconds between checks on the encoder while streaming
+const STREAM_POLL_INTERVAL = 50;
+// see SharedStreamState in syro-shared-stream.c
+const SHARED_STREAM_RUNNING = 1;
+const SHARED_STREAM_FAILED = 2;
+
+/**
+ * @type {Promise<void> | undefined}
+ */
+let syroStreamWorkletProcessorPromise;
+
+/**
+ * Whether this browser can play a syrostream while it is being encoded (see
+ * playSyroSampleStream).
+ */
+export function canStreamSyroSamples() {
+  return typeof AudioWorkletNode === 'function';
+}
+
+/**
+ * Plays the syrostream for the given samples while it is still being encoded,
+ * instead of encoding it all up front like getSyroSampleBuffer. Playback
+ * starts once a short lead is encoded, and encoding is held back whenever it
+ * gets far enough ahead of playback, so memory use doesn't depend on the
+ * length of the stream. Must be called from a user gesture handler so
+ * playback is allowed to start.
+ * @param {(import('../store').SampleContainer)[]} sampleContainers
+ * @param {{
+ *   onStreamInfo?: (info: { duration: number; dataStartPoints: number[] }) => void;
+ *   onTimeUpdate?: (currentTime: number) => void;
+ *   onEnded?: () => void;
+ *   onError?: (err: Error) => void;
+ * }} [callbacks]
+ * @returns {() => void} stop
+ */
+export function playSyroSampleStream(
+  sampleContainers,
+  {
+    onStreamInfo = () => null,
+    onTimeUpdate = () => null,
+    onEnded = () => null,
+    onError = () => null,
+  } = {}
+) {
+  let stopped = false;
+  let cleanup = () => {};
+  const audioContext = getSyroStreamAudioContext();
+  // resume right away while we still have the user gesture
+  audioContext.resume();
+  (async () => {
+    const bindings = await getSyroBindings();
+    const { heap8Buffer } = bindings;
+    syroStreamWorkletProcessorPromise =
+      syroStreamWorkletProcessorPromise ||
+      audioContext.audioWorklet.addModule('syroStreamWorkletProcessor.js');
+    await syroStreamWorkletProcessorPromise;
+    if (stopped) {
+      return;
+    }
+    const syroData = await createSyroDataForSamples(
+      bindings,
+      sampleContainers,
+      () => stopped
+    );
+    if (!syroData) {
+      return;
+    }
+    const { syroDataHandle, cacheKeys, cachedBlocks } = syroData;
+    const streamNode = new AudioWorkletNode(
+      audioContext,
+      'syro-stream-worklet',
+      {
+        numberOfInputs: 0,
+        outputChannelCount: [2],
+        processorOptions: {
+          leadFrames: STREAM_LEAD_SECONDS * SYRO_STREAM_SAMPLE_RATE,
+        },
+      }
+    );
+    streamNode.connect(audioContext.destination);
+    let stopSource = () => {};
+    cleanup = () => {
+      streamNode.port.postMessage({ eventType: 'stop' });
+      streamNode.disconnect();
+      stopSource();
+      cleanup = () => {};
+    };
+    let framesQueued = 0;
+    let framesPlayed = 0;
+    let inputEnded = false;
+    const dataStartPoints = new Uint32Array(sampleContainers.length);
+    function getSecondsQueued() {
+      return (framesQueued - framesPlayed) / SYRO_STREAM_SAMPLE_RATE;
+    }
+    /**
+     * @param {number} pointer heap address of stream bytes
+     * @param {number} size
+     * @param {number} streamOffset where the bytes start in the stream
+     */
+    function queueStreamBytes(pointer, size, streamOffset) {
+      // the wav header is only needed for decoding, so skip it
+      const skipBytes = Math.max(0, WAV_HEADER_SIZE - streamOffset);
+      if (size <= skipBytes) {
+        return;
+      }
+      // copy into a fresh buffer we can hand over to the worklet
+      const pcm = new Int16Array(
+        new Uint8Array(heap8Buffer(), pointer + skipBytes, size - skipBytes)
+          .slice().buffer
+      );
+      framesQueued += pcm.length / 2;
+      streamNode.port.postMessage({ eventType: 'data', pcm }, [pcm.buffer]);
+    }
+    /**
+     * @param {number} totalSize
+     * @param {number} dataStartPointsPointer
+     */
+    function updateStreamInfo(totalSize, dataStartPointsPointer) {
+      dataStartPoints.set(
+        new Uint32Array(
+          heap8Buffer(),
+          dataStartPointsPointer,
+          sampleContainers.length
+        ),
+        0
+      );
+      onStreamInfo({
+        duration: (totalSize - WAV_HEADER_SIZE) / 4 / SYRO_STREAM_SAMPLE_RATE,
+        dataStartPoints: [...dataStartPoints].map((p) => p / totalSize),
+      });
+    }
+    function endInput() {
+      inputEnded = true;
+      streamNode.port.postMessage({ eventType: 'end' });
+      saveCompressedBlocks(bindings, sampleContainers, cacheKeys, cachedBlocks);
+    }
+    stopSource = bindings.sharedStream
+      ? streamFromSharedMemory(bindings.sharedStream)
+      : streamFromWorker();
+    streamNode.port.onmessage = (e) => {
+      if (stopped) {
+        return;
+      }
+      framesPlayed = e.data.framesPlayed;
+      onTimeUpdate(framesPlayed / SYRO_STREAM_SAMPLE_RATE);
+      if (e.data.eventType === 'ended') {
+        stopped = true;
+        cleanup();
+        onEnded();
+      }
+      if (e.data.eventType === 'underrun') {
+        stopped = true;
+        cleanup();
+        onError(new Error('Syrostream playback got ahead of encoding'));
+      }
+    };
+
+    /**
+     * Chunks arrive from the syro worker as they are encoded, and we pause the
+     * worker when playback falls too far behind.
+     * @returns {() => void} stop
+     */
+    function streamFromWorker() {
       const {
-        allocateSyroData,
-        createSyroDataFromWavData,
         prepareSampleBufferFromSyroData,
         getSampleBufferChunkPointer,
         getSampleBufferChunkSize,
         getSampleBufferProgress,
         getSampleBufferTotalSize,
+        getSampleBufferFailed,
         getSampleBufferDataStartPointsPointer,
         cancelSampleBufferWork,
+        pauseSampleBufferWork,
+        resumeSampleBufferWork,
         registerUpdateCallback,
         unregisterUpdateCallback,
-        heap8Buffer,
-      } = await getSyroBindings();
-      const emptyResponse = {
-        syroBuffer: new Uint8Array(),
-        dataStartPoints: [],
-      };
-      if (cancelled) {
-        return emptyResponse;
-      }
-      /** @type {Uint8Array[]} */
-      const targetWavs = [];
-      for (const sampleContainer of sampleContainers) {
-        const { data } = await getTargetWavForSample(sampleContainer);
-        if (cancelled) {
-          return emptyResponse;
+      } = bindings;
+      let paused = false;
+      function updateBackpressure() {
+        if (inputEnded) {
+          return;
+        }
+        const secondsQueued = getSecondsQueued();
+        if (!paused && secondsQueued > STREAM_HIGH_WATER_SECONDS) {
+          pauseSampleBufferWork(workHandle);
+          paused = true;
+        } else if (paused && secondsQueued < STREAM_LOW_WATER_SECONDS) {
+          resumeSampleBufferWork(workHandle);
+          paused = false;
         }
-        targetWavs.push(data);
       }
-      /** @type {Uint8Array | undefined} */
-      let syroBuffer;
-      let progress = 0;
-      const dataStartPoints = new Uint32Array(sampleContainers.length);
       const onUpdate = registerUpdateCallback((sampleBufferUpdatePointer) => {
-        if (cancelled) {
+        if (stopped) {
           return;
         }
-        const totalSize = getSampleBufferTotalSize(sampleBufferUpdatePointer);
-        if (!syroBuffer) {
-          syroBuffer = new Uint8Array(totalSize);
+        if (getSampleBufferFailed(sampleBufferUpdatePointer)) {
+          // the work handle is freed after this update too
+          inputEnded = true;
+          stopped = true;
+          cleanup();
+          onError(new Error('Syrostream encoding failed on the worker'));
+          return;
         }
-        const chunkPointer = getSampleBufferChunkPointer(
-          sampleBufferUpdatePointer
-        );
+        const totalSize = getSampleBufferTotalSize(sampleBufferUpdatePointer);
         const chunkSize = getSampleBufferChunkSize(sampleBufferUpdatePointer);
         const bytesProgress = getSampleBufferProgress(
           sampleBufferUpdatePointer
         );
-        // save a new copy of the data so it doesn't disappear
-        syroBuffer.set(
-          new Uint8Array(heap8Buffer(), chunkPointer, chunkSize),
+        queueStreamBytes(
+          getSampleBufferChunkPointer(sampleBufferUpdatePointer),
+          chunkSize,
           bytesProgress - chunkSize
         );
-        progress = bytesProgress / totalSize;
-        const dataStartPointsPointer = getSampleBufferDataStartPointsPointer(
-          sampleBufferUpdatePointer
-        );
-        dataStartPoints.set(
-          new Uint32Array(
-            heap8Buffer(),
-            dataStartPointsPointer,
-            sampleContainers.length
-          ),
-          0
-        );
-      });
-      const syroDataHandle = allocateSyroData(sampleContainers.length);
-      sampleContainers.forEach((sampleContainer, i) => {
-        const data = targetWavs[i];
-        createSyroDataFromWavData(
-          syroDataHandle,
-          i,
-          data,
-          data.length,
-          sampleContainer.metadata.slotNumber,
-          sampleContainer.metadata.qualityBitDepth,
-          sampleContainer.metadata.useCompression ? 1 : 0
+        updateStreamInfo(
+          totalSize,
+          getSampleBufferDataStartPointsPointer(sampleBufferUpdatePointer)
         );
+        if (bytesProgress >= totalSize) {
+          // the work handle is freed after this update
+          endInput();
+        } else {
+          updateBackpressure();
+        }
       });
       const workHandle = prepareSampleBufferFromSyroData(
         syroDataHandle,
         sampleContainers.length,
-        onUpdate
+        onUpdate,
+        SYRO_WORKER_CHUNK_BUDGET_MS,
+        // playback can't wait on anything else the workers are doing
+        SYRO_WORK_PRIORITY_STREAM
       );
-      onProgress(progress);
-      try {
-        await /** @type {Promise<void>} */ (
-          new Promise((resolve) => {
-            /**
-             * @type {number}
-             */
-            let frame;
-            onCancel = () => {
-              cancelAnimationFrame(frame);
-              cancelSampleBufferWork(workHandle);
-              resolve();
-            };
-            checkProgress();
-            function checkProgress() {
-              // TODO: find a way to detect if the web worker failed to load, in
-              // which case we should reject the promise
-              if (progress) {
-                onProgress(progress);
-                if (progress >= 1) {
-                  resolve();
-                  return;
-                }
-              }
-              frame = requestAnimationFrame(checkProgress);
-            }
-          })
-        );
-      } finally {
-        onCancel = () => {};
+      const interval = setInterval(updateBackpressure, STREAM_POLL_INTERVAL);
+      return () => {
+        clearInterval(interval);
+        if (!inputEnded) {
+          cancelSampleBufferWork(workHandle);
+        }
         unregisterUpdateCallback(onUpdate);
+      };
+    }
+
+    /**
+     * The encoder thread writes into a ring in shared memory, and we copy out
+     * whatever it has written whenever playback needs more. Leaving data in
+     * the ring is all it takes to hold the encoder back.
+     * @param {import('./getSyroBindings.js').SharedStreamBindings} sharedStream
+     * @returns {() => void} stop
+     */
+    function streamFromSharedMemory({
+      startSharedSampleStream,
+      getSharedStreamState,
+      getSharedStreamProgress,
+      getSharedStreamTotalSize,
+      getSharedStreamBufferPointer,
+      getSharedStreamBufferSize,
+      getSharedStreamDataStartPointsPointer,
+      setSharedStreamConsumed,
+      freeSharedSampleStream,
+    }) {
+      const streamHandle = startSharedSampleStream(
+        syroDataHandle,
+        sampleContainers.length,
+        STREAM_SHARED_BUFFER_SECONDS * SYRO_STREAM_SAMPLE_RATE * 4,
+        navigator.hardwareConcurrency || 1
+      );
+      if (!streamHandle) {
+        throw new Error('Failed to start syrostream encoding');
       }
+      let consumed = 0;
+      function pump() {
+        if (stopped || inputEnded) {
+          return;
+        }
+        const state = getSharedStreamState(streamHandle);
+        if (state === SHARED_STREAM_FAILED) {
+          stopped = true;
+          cleanup();
+          onError(new Error('Failed to start syrostream encoding'));
+          return;
+        }
+        if (
+          state !== SHARED_STREAM_RUNNING ||
+          getSecondsQueued() > STREAM_HIGH_WATER_SECONDS
+        ) {
+          return;
+        }
+        // read progress before anything it covers
+        const progress = getSharedStreamProgress(streamHandle);
+        const totalSize = getSharedStreamTotalSize(streamHandle);
+        const bufferPointer = getSharedStreamBufferPointer(streamHandle);
+        const bufferSize = getSharedStreamBufferSize(streamHandle);
+        while (consumed < progress) {
+          const readIndex = consumed % bufferSize;
+          const size = Math.min(progress - consumed, bufferSize - readIndex);
+          queueStreamBytes(bufferPointer + readIndex, size, consumed);
+          consumed += size;
+        }
+        setSharedStreamConsumed(streamHandle, consumed);
+        updateStreamInfo(
+          totalSize,
+          getSharedStreamDataStartPointsPointer(streamHandle)
+        );
+        if (consumed >= totalSize) {
+          endInput();
+        }
+      }
+      const interval = setInterval(pump, STREAM_POLL_INTERVAL);
+      return () => {
+        clearInterval(interval);
+        freeSharedSampleStream(streamHandle);
+      };
+    }
+  })().catch((err) => {
+    if (!stopped) {
+      stopped = true;
+      cleanup();
+      onError(err instanceof Error ? err : new Error(String(err)));
+    }
+  });
+  return function stop() {
+    if (!stopped) {
+      stopped = true;
+      cleanup();
+    }
+  };
+}
+
+/**
+ * Encodes the syrostream that erases the given slots, like getSyroSampleBuffer
+ * does for samples. Slots that have been erased before (or precomputed with
+ * precomputeSyroDeleteBuffers) don't need encoding again.
+ * @param {number[]} slotNumbers
+ * @param {(progress: number, stats: SyroTransferStats) => void} onProgress
+ * @returns {{
+ *   syroBufferPromise: Promise<{
+ *     syroBuffer: Uint8Array;
+ *     dataStartPoints: number[];
+ *   }>;
+ *   cancelWork: () => void;
+ * }}
+ */
+export function getSyroDeleteBuffer(slotNumbers, onProgress) {
+  let cancelled = false;
+  let onCancel = () => {};
+  return {
+    cancelWork() {
+      cancelled = true;
+      onCancel();
+    },
+    syroBufferPromise: (async () => {
+      const bindings = await getSyroBindings();
+      const { allocateSyroData, createEmptySyroData } = bindings;
+      const emptyResponse = {
+        syroBuffer: new Uint8Array(),
+        dataStartPoints: [],
+      };
       if (cancelled) {
         return emptyResponse;
       }
-      if (!syroBuffer) {
-        throw new Error('Unexpected condition: syroBuffer should be defined');
-      }
-      return {
-        syroBuffer,
-        dataStartPoints: [...dataStartPoints],
-      };
+      const syroDataHandle = allocateSyroData(slotNumbers.length);
+      slotNumbers.forEach((slotNumber, i) => {
+        createEmptySyroData(syroDataHandle, i, slotNumber);
+      });
+      const result = await getSyroBufferFromWorker(
+        bindings,
+        syroDataHandle,
+        slotNumbers.length,
+        SYRO_WORK_PRIORITY_DEFAULT,
+        false,
+        onProgress,
+        (fn) => {
+          onCancel = fn;
+        }
+      );
+      onCancel = () => {};
+      return result && !cancelled ? result : emptyResponse;
     })(),
   };
 }
 
 /**
- * @param {number[]} slotNumbers
- * @returns {Promise<{ syroBuffer: Uint8Array; dataStartPoints: number[] }>}
+ * Encodes erase streams for slots 0 to numOfSlots - 1 in the background
+ * (after any other work on the syro workers), so getSyroDeleteBuffer can put
+ * together any selection of them without encoding.
+ * @param {number} numOfSlots
+ * @returns {Promise<boolean>} resolves once they're done, to whether erase
+ * streams can now be put together that way
  */
-export async function getSyroDeleteBuffer(slotNumbers) {
+export async function precomputeSyroDeleteBuffers(numOfSlots) {
   const {
-    allocateSyroData,
-    createEmptySyroData,
-    getDeleteBufferFromSyroData,
-    getSampleBufferChunkPointer,
-    getSampleBufferChunkSize,
-    getSampleBufferDataStartPointsPointer,
-    freeDeleteBuffer,
-    heap8Buffer,
+    precomputeEraseStreams,
+    registerUpdateCallback,
+    unregisterUpdateCallback,
   } = await getSyroBindings();
-  const syroDataHandle = allocateSyroData(slotNumbers.length);
-  slotNumbers.forEach((slotNumber, i) => {
-    createEmptySyroData(syroDataHandle, i, slotNumber);
+  return new Promise((resolve) => {
+    const onDone = registerUpdateCallback((composable) => {
+      unregisterUpdateCallback(onDone);
+      resolve(Boolean(composable));
+    });
+    precomputeEraseStreams(numOfSlots, SYRO_WORK_PRIORITY_BACKGROUND, onDone);
   });
-  const deleteBufferUpdatePointer = getDeleteBufferFromSyroData(
-    syroDataHandle,
-    slotNumbers.length
-  );
-  const chunkPointer = getSampleBufferChunkPointer(deleteBufferUpdatePointer);
-  const chunkSize = getSampleBufferChunkSize(deleteBufferUpdatePointer);
-  // save a new copy of the data so it doesn't disappear
-  const syroBuffer = new Uint8Array(
-    new Uint8Array(heap8Buffer(), chunkPointer, chunkSize)
-  );
-  const dataStartPointsPointer = getSampleBufferDataStartPointsPointer(
-    deleteBufferUpdatePointer
-  );
-  const dataStartPoints = [
-    ...new Uint32Array(
-      heap8Buffer(),
-      dataStartPointsPointer,
-      slotNumbers.length
-    ),
-  ];
-  freeDeleteBuffer(deleteBufferUpdatePointer);
-  return { syroBuffer, dataStartPoints };
 }
 
 /**
@@ -216,11 +1161,14 @@ export async function getSyroDeleteBuffer(slotNumbers) {
  * @param {Uint8Array | Error | null} params.syroBuffer
  * @param {number[]} params.dataStartPoints
  * @param {T[]} params.selectedItems
+ * @param {boolean} [params.stream] play the selected samples with
+ * playSyroSampleStream as they are encoded, instead of playing syroBuffer
  */
 export function useSyroTransfer({
   syroBuffer,
   dataStartPoints: _dataStartPoints,
   selectedItems,
+  stream = false,
 }) {
   const [dataStartPoints, setDataStartPoints] = useState(
     /** @type {number[]} */ ([])
@@ -228,6 +1176,10 @@ export function useSyroTransfer({
   const [syroAudioBuffer, setSyroAudioBuffer] = useState(
     /** @type {AudioBuffer | Error | null} */ (null)
   );
+  // only known once a streamed transfer has started
+  const [streamDuration, setStreamDuration] = useState(
+    /** @type {number | null} */ (null)
+  );
   useEffect(() => {
     setSyroAudioBuffer(null);
     setDataStartPoints(
@@ -289,10 +1241,39 @@ export function useSyroTransfer({
   const stop = useRef(() => {
     setSyroTransferState('idle');
   });
-  const { playAudioBuffer } = useAudioPlaybackContext();
+  const { playAudioBuffer, iOSPrepareForAudio } = useAudioPlaybackContext();
   /** @type {React.MouseEventHandler} */
   const handleTransfer = useCallback(
     (e) => {
+      if (stream) {
+        iOSPrepareForAudio();
+        setSyroTransferState('transferring');
+        setStreamDuration(null);
+        setDataStartPoints([]);
+        let duration = 0;
+        const stopStream = playSyroSampleStream(
+          /** @type {SampleContainer[]} */ (selectedItems),
+          {
+            onStreamInfo(info) {
+              duration = info.duration;
+              setStreamDuration(info.duration);
+              setDataStartPoints(info.dataStartPoints);
+            },
+            onTimeUpdate: (currentTime) =>
+              duration && setTransferProgress(currentTime / duration),
+            onEnded: () => setTransferProgress(1),
+            onError(err) {
+              console.error(err);
+              setSyroTransferState('error');
+            },
+          }
+        );
+        stop.current = () => {
+          stopStream();
+          setSyroTransferState('idle');
+        };
+        return;
+      }
       if (!(syroAudioBuffer instanceof AudioBuffer)) {
         if (!syroAudioBuffer) {
           const { target, nativeEvent } = e;
@@ -320,11 +1301,22 @@ export function useSyroTransfer({
         setSyroTransferState('error');
       }
     },
-    [playAudioBuffer, syroAudioBuffer]
+    [
+      playAudioBuffer,
+      iOSPrepareForAudio,
+      syroAudioBuffer,
+      stream,
+      selectedItems,
+    ]
   );
   const handleCancel = useCallback(() => stop.current(), []);
   const transferInProgress =
     syroTransferState === 'transferring' && transferProgress < 1;
+  const transferDuration = stream
+    ? streamDuration
+    : syroAudioBuffer instanceof AudioBuffer
+    ? syroAudioBuffer.duration
+    : null;
 
   const {
     currentlyTransferringItem,
@@ -339,18 +1331,18 @@ export function useSyroTransfer({
      * }}
      */
     () => {
-      if (
-        syroTransferState !== 'transferring' ||
-        !(syroAudioBuffer instanceof AudioBuffer)
-      ) {
+      if (syroTransferState !== 'transferring' || !transferDuration) {
         return {
           currentlyTransferringItem: selectedItems[0],
           currentItemProgress: 0,
           timeLeftUntilNextItem: 0,
         };
       }
+      // start points after the first are 0 until a stream has reached them
       const foundIndex =
-        dataStartPoints.findIndex((p) => p > transferProgress) - 1;
+        dataStartPoints.findIndex(
+          (p, i) => i > 0 && (!p || p > transferProgress)
+        ) - 1;
       const currentTransferIndex =
         foundIndex >= 0 ? foundIndex : selectedItems.length - 1;
       const currentlyTransferringItem = selectedItems[currentTransferIndex];
@@ -360,7 +1352,7 @@ export function useSyroTransfer({
         (transferProgress - currentStartPoint) /
         (nextStartPoint - currentStartPoint);
       const timeLeftUntilNextSample =
-        (nextStartPoint - transferProgress) * syroAudioBuffer.duration;
+        (nextStartPoint - transferProgress) * transferDuration;
       return {
         currentlyTransferringItem,
         currentItemProgress,
@@ -372,7 +1364,7 @@ export function useSyroTransfer({
       dataStartPoints,
       syroTransferState,
       transferProgress,
-      syroAudioBuffer,
+      transferDuration,
     ]
   );
 
@@ -386,5 +1378,6 @@ export function useSyroTransfer({
     currentItemProgress,
     timeLeftUntilNextItem,
     syroAudioBuffer,
+    transferDuration,
   };
 }
@@ -7,6 +7,7 @@ import {
   useAudioPlaybackContext,
 } from './audioData.js';
 import { formatShortTime } from './datetime.js';
+import { getSyroBindings } from './getSyroBindings.js';
 import { userOS } from './os.js';
 
 export const GROUP_PIXEL_WIDTH = 6;
@@ -40,14 +41,10 @@ export function getPeaksForSamples(samples, containerPixelWidth) {
   const positive = new Float32Array(Math.floor(samples.length / groupSize));
   const negative = new Float32Array(Math.floor(samples.length / groupSize));
   for (let i = 0; i < positive.length; i++) {
-    const group = new Float32Array(
-      samples.buffer,
-      samples.byteOffset + i * groupSize * 4,
-      groupSize
-    );
     let max = 0;
     let min = 0;
-    for (const sample of group) {
+    for (let j = i * groupSize; j < (i + 1) * groupSize; j++) {
+      const sample = samples[j];
       if (sample > max) {
         max = sample;
       }
@@ -64,14 +61,205 @@ export function getPeaksForSamples(samples, containerPixelWidth) {
   };
 }
 
+// WAVEFORM_PEAK_BLOCK in waveform-peaks.c
+const WAVEFORM_PEAK_BLOCK_SIZE = 16;
+
+/**
+ * A min/max pyramid over an array of samples, from buildWaveformPeakIndex in
+ * the syro bindings. Level 0 has the peaks of every WAVEFORM_PEAK_BLOCK_SIZE
+ * frames, and each level after it the peaks of every 2 entries of the one
+ * before.
+ * @typedef {{ max: Float32Array; min: Float32Array }[]} WaveformPeakIndex
+ */
+
+/**
+ * @type {WeakMap<Float32Array, Promise<WaveformPeakIndex>>}
+ */
+const waveformPeakIndexes = new WeakMap();
+
+/**
+ * Builds the peak index for samples, or returns the one already built for
+ * the same array (which mustn't be changed afterwards).
+ * @param {Float32Array} samples
+ * @returns {Promise<WaveformPeakIndex>}
+ */
+export function getWaveformPeakIndex(samples) {
+  const cached = waveformPeakIndexes.get(samples);
+  if (cached) return cached;
+  const promise = (async () => {
+    const {
+      allocateSampleData,
+      buildWaveformPeakIndex,
+      freeSampleData,
+      heap8Buffer,
+    } = await getSyroBindings();
+    const sampleDataPointer = allocateSampleData(samples.length, 4);
+    new Float32Array(heap8Buffer(), sampleDataPointer, samples.length).set(
+      samples
+    );
+    const indexPointer = buildWaveformPeakIndex(
+      sampleDataPointer,
+      samples.length
+    );
+    freeSampleData(sampleDataPointer);
+    if (!indexPointer) {
+      throw new Error('Not enough memory for waveform peak index');
+    }
+    /** @type {number[]} */
+    const levelLengths = [];
+    let count = Math.ceil(samples.length / WAVEFORM_PEAK_BLOCK_SIZE);
+    while (count) {
+      levelLengths.push(count);
+      count = count > 1 ? Math.ceil(count / 2) : 0;
+    }
+    const length = levelLengths.reduce((sum, count) => sum + count * 2, 0);
+    const data = new Float32Array(heap8Buffer(), indexPointer, length).slice();
+    freeSampleData(indexPointer);
+    /** @type {WaveformPeakIndex} */
+    const index = [];
+    let offset = 0;
+    for (const count of levelLengths) {
+      index.push({
+        max: data.subarray(offset, offset + count),
+        min: data.subarray(offset + count, offset + count * 2),
+      });
+      offset += count * 2;
+    }
+    return index;
+  })();
+  // (a failed build can be retried)
+  promise.catch(() => waveformPeakIndexes.delete(samples));
+  waveformPeakIndexes.set(samples, promise);
+  return promise;
+}
+
+/**
+ * The peaks of samples from start up to end, counting 0 as the lowest peak and
+ * the highest dip like getPeaksForSamples does. Whole blocks are read from the
+ * index (at most 2 entries per level) and only the frames either side of them
+ * from the samples.
+ * @param {WaveformPeakIndex} index
+ * @param {Float32Array} samples the samples the index was built from
+ * @param {number} start
+ * @param {number} end
+ */
+export function findPeaksInRange(index, samples, start, end) {
+  let max = 0;
+  let min = 0;
+  /** @param {number} sample */
+  const add = (sample) => {
+    if (sample > max) {
+      max = sample;
+    }
+    if (sample < min) {
+      min = sample;
+    }
+  };
+  let firstBlock = Math.ceil(start / WAVEFORM_PEAK_BLOCK_SIZE);
+  let endBlock = Math.floor(end / WAVEFORM_PEAK_BLOCK_SIZE);
+  if (firstBlock >= endBlock) {
+    for (let i = start; i < end; i++) {
+      add(samples[i]);
+    }
+    return { max, min };
+  }
+  for (let i = start; i < firstBlock * WAVEFORM_PEAK_BLOCK_SIZE; i++) {
+    add(samples[i]);
+  }
+  for (let i = endBlock * WAVEFORM_PEAK_BLOCK_SIZE; i < end; i++) {
+    add(samples[i]);
+  }
+  for (let level = 0; firstBlock < endBlock; level++) {
+    const entries = index[level];
+    if (firstBlock % 2) {
+      add(entries.max[firstBlock]);
+      add(entries.min[firstBlock]);
+      firstBlock++;
+    }
+    if (endBlock % 2) {
+      endBlock--;
+      add(entries.max[endBlock]);
+      add(entries.min[endBlock]);
+    }
+    firstBlock /= 2;
+    endBlock /= 2;
+  }
+  return { max, min };
+}
+
+/**
+ * Gives the same peaks as getPeaksForSamples(getTrimmedView(samples,
+ * trimFrames), containerPixelWidth), read off the samples' peak index, so it
+ * takes time in proportion to the width rather than the number of samples.
+ * @param {WaveformPeakIndex} index
+ * @param {Float32Array} samples the samples the index was built from
+ * @param {[number, number]} trimFrames
+ * @param {number} containerPixelWidth
+ * @returns {SamplePeaks}
+ */
+export function getPeaksFromIndex(
+  index,
+  samples,
+  trimFrames,
+  containerPixelWidth
+) {
+  const [trimStart, trimEnd] = trimFrames.map((t) => Math.max(t, 0));
+  if (trimStart + trimEnd >= samples.length) {
+    // (which getTrimmedView turns into a single silent frame)
+    return getPeaksForSamples(new Float32Array(1), containerPixelWidth);
+  }
+  const length = samples.length - trimStart - trimEnd;
+  const groupSize = Math.floor(
+    (GROUP_PIXEL_WIDTH * length) / containerPixelWidth
+  );
+  if (groupSize === 0) {
+    return {
+      positive: new Float32Array(),
+      negative: new Float32Array(),
+    };
+  }
+  const positive = new Float32Array(Math.floor(length / groupSize));
+  const negative = new Float32Array(Math.floor(length / groupSize));
+  for (let i = 0; i < positive.length; i++) {
+    const start = trimStart + i * groupSize;
+    const { max, min } = findPeaksInRange(
+      index,
+      samples,
+      start,
+      start + groupSize
+    );
+    positive[i] = max;
+    negative[i] = min;
+  }
+  return {
+    positive,
+    negative,
+  };
+}
+
+/**
+ * @type {WeakMap<AudioBuffer, Float32Array>}
+ */
+const monoSamplesByAudioBuffer = new WeakMap();
+
 /**
  * @param {AudioBuffer} audioBuffer
  * @param {[number, number]} trimFrames
  */
 export async function getSamplePeaksForAudioBuffer(audioBuffer, trimFrames) {
-  const monoSamples = getMonoSamplesFromAudioBuffer(audioBuffer, trimFrames);
-  const waveformPeaks = getPeaksForSamples(monoSamples, WAVEFORM_CACHED_WIDTH);
-  return waveformPeaks;
+  // mixed down untrimmed, so every trim of the same audio shares one index
+  let monoSamples = monoSamplesByAudioBuffer.get(audioBuffer);
+  if (!monoSamples) {
+    monoSamples = getMonoSamplesFromAudioBuffer(audioBuffer, [0, 0]);
+    monoSamplesByAudioBuffer.set(audioBuffer, monoSamples);
+  }
+  const index = await getWaveformPeakIndex(monoSamples);
+  return getPeaksFromIndex(
+    index,
+    monoSamples,
+    trimFrames,
+    WAVEFORM_CACHED_WIDTH
+  );
 }
 
 /**
@@ -153,6 +341,24 @@ export function useWaveformInfo(sourceAudioBuffer) {
     () => waveformElement && (size.width || waveformElement.offsetWidth),
     [waveformElement, size]
   );
+  // read off an index once it's built, so resizing doesn't mean going through
+  // every sample again
+  const [peakIndex, setPeakIndex] = useState(
+    /** @type {[Float32Array, WaveformPeakIndex] | null} */ (null)
+  );
+  useEffect(() => {
+    if (!monoSamples.length) return;
+    let cancelled = false;
+    getWaveformPeakIndex(monoSamples).then(
+      (index) => {
+        if (!cancelled) setPeakIndex([monoSamples, index]);
+      },
+      (err) => console.error(err)
+    );
+    return () => {
+      cancelled = true;
+    };
+  }, [monoSamples]);
   const peaks = useMemo(() => {
     if (!pixelWidth || !monoSamples.length) {
       return {
@@ -160,8 +366,11 @@ export function useWaveformInfo(sourceAudioBuffer) {
         negative: new Float32Array(),
       };
     }
+    if (peakIndex && peakIndex[0] === monoSamples) {
+      return getPeaksFromIndex(peakIndex[1], monoSamples, [0, 0], pixelWidth);
+    }
     return getPeaksForSamples(monoSamples, pixelWidth);
-  }, [pixelWidth, monoSamples]);
+  }, [pixelWidth, monoSamples, peakIndex]);
   return {
     monoSamples,
     waveformRef,
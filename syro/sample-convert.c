@@ -0,0 +1,93 @@
+// Conversion from 16Bit wav data to the 1ch, 16Bit samples the syro encoder
+// takes, for wav-stream-parser.c (and Korg's setup_file_sample, which
+// test/benchmark.c keeps for comparison). There's one loop per channel count,
+// using SIMD where the build has it (WASM SIMD128, SSE2 or NEON), and both
+// produce exactly what Korg's original loop did. Wider samples are scaled down
+// by the parser itself.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline int16_t readWavSample16(const uint8_t *src) {
+  return (int16_t)(uint16_t)(src[0] | (src[1] << 8));
+}
+
+static void convertMono16(const uint8_t *src, int16_t *dest,
+                          uint32_t num_of_frame) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(dest, src, num_of_frame * 2);
+#else
+  for (uint32_t i = 0; i < num_of_frame; i++) {
+    dest[i] = readWavSample16(src + i * 2);
+  }
+#endif
+}
+
+static void convertStereo16(const uint8_t *src, int16_t *dest,
+                            uint32_t num_of_frame) {
+  uint32_t i = 0;
+  // Each vector holds 4 frames. Left and right are summed pairwise into 32Bit
+  // lanes, then halved rounding towards zero like the integer division in the
+  // scalar loop. The average always fits in 16 bits so narrowing is exact.
+#if defined(__wasm_simd128__)
+  for (; i + 8 <= num_of_frame; i += 8) {
+    v128_t a = wasm_i32x4_extadd_pairwise_i16x8(wasm_v128_load(src + i * 4));
+    v128_t b =
+        wasm_i32x4_extadd_pairwise_i16x8(wasm_v128_load(src + i * 4 + 16));
+    a = wasm_i32x4_shr(wasm_i32x4_add(a, wasm_u32x4_shr(a, 31)), 1);
+    b = wasm_i32x4_shr(wasm_i32x4_add(b, wasm_u32x4_shr(b, 31)), 1);
+    wasm_v128_store(dest + i, wasm_i16x8_narrow_i32x4(a, b));
+  }
+#elif defined(__SSE2__)
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 8 <= num_of_frame; i += 8) {
+    __m128i a =
+        _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(src + i * 4)), ones);
+    __m128i b = _mm_madd_epi16(
+        _mm_loadu_si128((const __m128i *)(src + i * 4 + 16)), ones);
+    a = _mm_srai_epi32(_mm_add_epi32(a, _mm_srli_epi32(a, 31)), 1);
+    b = _mm_srai_epi32(_mm_add_epi32(b, _mm_srli_epi32(b, 31)), 1);
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_packs_epi32(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 8 <= num_of_frame; i += 8) {
+    int32x4_t a = vpaddlq_s16(vld1q_s16((const int16_t *)(src + i * 4)));
+    int32x4_t b = vpaddlq_s16(vld1q_s16((const int16_t *)(src + i * 4 + 16)));
+    a = vshrq_n_s32(
+        vaddq_s32(a, vreinterpretq_s32_u32(
+                         vshrq_n_u32(vreinterpretq_u32_s32(a), 31))),
+        1);
+    b = vshrq_n_s32(
+        vaddq_s32(b, vreinterpretq_s32_u32(
+                         vshrq_n_u32(vreinterpretq_u32_s32(b), 31))),
+        1);
+    vst1q_s16(dest + i, vcombine_s16(vmovn_s32(a), vmovn_s32(b)));
+  }
+#endif
+  for (; i < num_of_frame; i++) {
+    const uint8_t *frame = src + i * 4;
+    int32_t sum = readWavSample16(frame) + readWavSample16(frame + 2);
+    dest[i] = (int16_t)(sum / 2);
+  }
+}
+
+/**
+ * Converts num_of_frame frames of little endian 16Bit PCM (num_of_ch must be
+ * 1 or 2) to 1ch, 16Bit.
+ */
+static void convertWavDataToMono16(const uint8_t *src, int16_t *dest,
+                                   uint32_t num_of_frame, uint16_t num_of_ch) {
+  if (num_of_ch == 1) {
+    convertMono16(src, dest, num_of_frame);
+  } else {
+    convertStereo16(src, dest, num_of_frame);
+  }
+}
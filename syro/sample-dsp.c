@@ -0,0 +1,115 @@
+// Float sample kernels for the bindings, run in place on samples JS has
+// written into wasm memory (see allocateSampleData). They replace the loops
+// audioData.js used to run one after another, each allocating its own output,
+// with a single pass, and give the same result sample for sample. They use
+// WASM SIMD128 where the build has it (the native build only needs them to
+// compile, so it gets the scalar loop).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+// Math.round, which rounds halves up (towards positive infinity)
+static inline float roundHalfUp(float value) {
+  float rounded = floorf(value);
+  return value - rounded >= 0.5f ? rounded + 1 : rounded;
+}
+
+static inline int16_t convertFloatSampleTo16Bit(float sample) {
+  sample *= 32768;
+  if (sample != sample) {
+    // NaN, which ends up as 0 in an Int16Array
+    return 0;
+  }
+  if (sample > 32767) {
+    return 32767;
+  }
+  if (sample < -32768) {
+    return -32768;
+  }
+  return (int16_t)sample;
+}
+
+#if defined(__wasm_simd128__)
+// Multiplies in double precision and rounds back to float, like scaling a
+// Float32Array in JS does.
+static inline v128_t scaleFloatSamples4(v128_t samples, v128_t gain) {
+  v128_t low = wasm_f64x2_mul(wasm_f64x2_promote_low_f32x4(samples), gain);
+  v128_t high = wasm_f64x2_mul(
+      wasm_f64x2_promote_low_f32x4(wasm_i32x4_shuffle(samples, samples, 2, 3,
+                                                      0, 1)),
+      gain);
+  return wasm_i32x4_shuffle(wasm_f32x4_demote_f64x2_zero(low),
+                            wasm_f32x4_demote_f64x2_zero(high), 0, 1, 4, 5);
+}
+
+static inline v128_t quantizeFloatSamples4(v128_t samples, v128_t signedMax,
+                                           v128_t inverseSignedMax) {
+  v128_t scaled = wasm_f32x4_mul(samples, signedMax);
+  v128_t rounded = wasm_f32x4_floor(scaled);
+  v128_t roundUp = wasm_f32x4_ge(wasm_f32x4_sub(scaled, rounded),
+                                 wasm_f32x4_splat(0.5f));
+  rounded = wasm_f32x4_add(
+      rounded, wasm_v128_and(roundUp, wasm_f32x4_splat(1.0f)));
+  // (exact, since signedMax is a power of 2)
+  return wasm_f32x4_mul(rounded, inverseSignedMax);
+}
+#endif
+
+/**
+ * Converts float samples (-1 to 1) to 16 bits, into dest, which may be the
+ * samples themselves: each int16 is written at or before the float it came
+ * from, so going forwards never overwrites a float we still need.
+ *
+ * Each sample is first multiplied by gain (for normalizing), then, if
+ * qualityBitDepth is below 16, rounded to that many bits to preview the
+ * sample's quality setting. Out of range samples are clamped and NaN becomes
+ * 0.
+ */
+static void convertFloatSamplesTo16Bit(const float *samples, int16_t *dest,
+                                       uint32_t numOfSamples, double gain,
+                                       uint32_t qualityBitDepth) {
+  bool quantize = qualityBitDepth < 16;
+  float signedMax = (float)(1 << ((quantize ? qualityBitDepth : 16) - 1));
+  uint32_t i = 0;
+#if defined(__wasm_simd128__)
+  v128_t gainVector = wasm_f64x2_splat(gain);
+  v128_t signedMaxVector = wasm_f32x4_splat(signedMax);
+  v128_t inverseSignedMaxVector = wasm_f32x4_splat(1 / signedMax);
+  v128_t scale16 = wasm_f32x4_splat(32768);
+  for (; i + 8 <= numOfSamples; i += 8) {
+    v128_t a = wasm_v128_load(samples + i);
+    v128_t b = wasm_v128_load(samples + i + 4);
+    if (gain != 1) {
+      a = scaleFloatSamples4(a, gainVector);
+      b = scaleFloatSamples4(b, gainVector);
+    }
+    if (quantize) {
+      a = quantizeFloatSamples4(a, signedMaxVector, inverseSignedMaxVector);
+      b = quantizeFloatSamples4(b, signedMaxVector, inverseSignedMaxVector);
+    }
+    // truncating saturates and turns NaN into 0, and narrowing saturates
+    // again, which together are the same as clamping first
+    a = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(a, scale16));
+    b = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(b, scale16));
+    wasm_v128_store(dest + i, wasm_i16x8_narrow_i32x4(a, b));
+  }
+#endif
+  for (; i < numOfSamples; i++) {
+    // (read through memcpy, since dest may alias the samples)
+    float sample;
+    memcpy(&sample, samples + i, sizeof(float));
+    if (gain != 1) {
+      sample = (float)(sample * gain);
+    }
+    if (quantize) {
+      sample = roundHalfUp(sample * signedMax) / signedMax;
+    }
+    dest[i] = convertFloatSampleTo16Bit(sample);
+  }
+}
@@ -0,0 +1,217 @@
+// Band-limited resampling between arbitrary rates, for pitch adjustment in the
+// bindings and for converting wav files at other rates to the rate the volca
+// plays at in the native tools. It's a polyphase windowed sinc filter: a table
+// of RESAMPLE_PHASES filters, one per fractional source position, with each
+// output frame blending the two filters either side of its position. The dot
+// products use SIMD where the build has it (WASM SIMD128, SSE2 or NEON).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// taps per filter (a multiple of 4 for the SIMD loop)
+#define RESAMPLE_TAPS 32
+#define RESAMPLE_PHASES 256
+#define RESAMPLE_KAISER_BETA 8.0
+// the cutoff as a fraction of the lower of the two Nyquist frequencies,
+// leaving room for the transition band
+#define RESAMPLE_ROLLOFF 0.94
+
+/**
+ * The number of frames numOfFrames at sourceRate turn into at targetRate,
+ * rounded to the nearest frame.
+ */
+static uint32_t getResampledFrameCount(uint32_t numOfFrames,
+                                       uint32_t sourceRate,
+                                       uint32_t targetRate) {
+  if (!sourceRate || !targetRate) {
+    return 0;
+  }
+  return (uint32_t)(((uint64_t)numOfFrames * targetRate + sourceRate / 2) /
+                    sourceRate);
+}
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser
+// window
+static double besselI0(double x) {
+  double sum = 1;
+  double term = 1;
+  for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+    double half = x / (2 * k);
+    term *= half * half;
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * Builds the filter table for resampling from sourceRate to targetRate:
+ * RESAMPLE_PHASES + 1 filters of RESAMPLE_TAPS taps, where filter k is for an
+ * output frame k / RESAMPLE_PHASES of the way from one source frame to the
+ * next (so the last one is the first shifted by a frame, for blending). Each
+ * filter sums to 1. Returns NULL if out of memory.
+ */
+static float *createResampleFilters(uint32_t sourceRate, uint32_t targetRate) {
+  float *filters =
+      malloc(sizeof(float) * (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS);
+  if (!filters) {
+    return NULL;
+  }
+  double cutoff = RESAMPLE_ROLLOFF;
+  if (targetRate < sourceRate) {
+    cutoff *= (double)targetRate / sourceRate;
+  }
+  double halfLength = RESAMPLE_TAPS / 2;
+  double windowScale = 1 / besselI0(RESAMPLE_KAISER_BETA);
+  for (uint32_t k = 0; k <= RESAMPLE_PHASES; k++) {
+    float *filter = filters + k * RESAMPLE_TAPS;
+    double frac = (double)k / RESAMPLE_PHASES;
+    double sum = 0;
+    double taps[RESAMPLE_TAPS];
+    for (uint32_t n = 0; n < RESAMPLE_TAPS; n++) {
+      // distance from the output frame to this tap's source frame
+      double x = (double)n - (halfLength - 1) - frac;
+      double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+      double r = x / halfLength;
+      double window =
+          r * r < 1
+              ? besselI0(RESAMPLE_KAISER_BETA * sqrt(1 - r * r)) * windowScale
+              : 0;
+      taps[n] = sinc * window;
+      sum += taps[n];
+    }
+    for (uint32_t n = 0; n < RESAMPLE_TAPS; n++) {
+      filter[n] = (float)(taps[n] / sum);
+    }
+  }
+  return filters;
+}
+
+/**
+ * Applies the blend of two filters mix of the way from a to b to
+ * RESAMPLE_TAPS source frames.
+ */
+static inline float applyResampleFilters(const float *samples, const float *a,
+                                         const float *b, float mix) {
+  uint32_t n = 0;
+  float sum = 0;
+#if defined(__wasm_simd128__)
+  v128_t mixVector = wasm_f32x4_splat(mix);
+  v128_t acc = wasm_f32x4_splat(0);
+  for (; n < RESAMPLE_TAPS; n += 4) {
+    v128_t filterA = wasm_v128_load(a + n);
+    v128_t filter = wasm_f32x4_add(
+        filterA,
+        wasm_f32x4_mul(mixVector,
+                       wasm_f32x4_sub(wasm_v128_load(b + n), filterA)));
+    acc = wasm_f32x4_add(acc,
+                         wasm_f32x4_mul(wasm_v128_load(samples + n), filter));
+  }
+  sum = wasm_f32x4_extract_lane(acc, 0) + wasm_f32x4_extract_lane(acc, 1) +
+        wasm_f32x4_extract_lane(acc, 2) + wasm_f32x4_extract_lane(acc, 3);
+#elif defined(__SSE2__)
+  __m128 mixVector = _mm_set1_ps(mix);
+  __m128 acc = _mm_setzero_ps();
+  for (; n < RESAMPLE_TAPS; n += 4) {
+    __m128 filterA = _mm_loadu_ps(a + n);
+    __m128 filter = _mm_add_ps(
+        filterA,
+        _mm_mul_ps(mixVector, _mm_sub_ps(_mm_loadu_ps(b + n), filterA)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(samples + n), filter));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0);
+  for (; n < RESAMPLE_TAPS; n += 4) {
+    float32x4_t filterA = vld1q_f32(a + n);
+    float32x4_t filter =
+        vmlaq_n_f32(filterA, vsubq_f32(vld1q_f32(b + n), filterA), mix);
+    acc = vmlaq_f32(acc, vld1q_f32(samples + n), filter);
+  }
+  float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  sum = vget_lane_f32(pair, 0) + vget_lane_f32(pair, 1);
+#endif
+  for (; n < RESAMPLE_TAPS; n++) {
+    sum += samples[n] * (a[n] + mix * (b[n] - a[n]));
+  }
+  return sum;
+}
+
+static inline int16_t roundResampledSampleTo16Bit(float sample) {
+  float value = sample * 32768 + (sample < 0 ? -0.5f : 0.5f);
+  if (value != value) {
+    return 0;
+  }
+  if (value >= 32767) {
+    return 32767;
+  }
+  if (value <= -32768) {
+    return -32768;
+  }
+  return (int16_t)value;
+}
+
+/**
+ * Resamples numOfFrames float samples at sourceRate into destFrames frames at
+ * targetRate (see getResampledFrameCount), using filters from
+ * createResampleFilters for the same rates. Frames before the start and after
+ * the end count as silence. The output goes to floatDest, or, if that's NULL,
+ * is rounded to 16 bits into dest16.
+ */
+static void resampleFloatSamples(const float *samples, uint32_t numOfFrames,
+                                 uint32_t sourceRate, uint32_t targetRate,
+                                 const float *filters, float *floatDest,
+                                 int16_t *dest16, uint32_t destFrames) {
+  if (!destFrames) {
+    return;
+  }
+  const int64_t firstTapOffset = RESAMPLE_TAPS / 2 - 1;
+  const uint32_t wholeStep = sourceRate / targetRate;
+  const uint32_t remainderStep = sourceRate % targetRate;
+  // the source position of each output frame, as index + remainder /
+  // targetRate, stepped exactly so long samples don't drift
+  int64_t index = 0;
+  uint64_t remainder = 0;
+  float edge[RESAMPLE_TAPS];
+  for (uint32_t i = 0; i < destFrames; i++) {
+    double phase = (double)remainder * RESAMPLE_PHASES / targetRate;
+    uint32_t k = (uint32_t)phase;
+    float mix = (float)(phase - k);
+    int64_t start = index - firstTapOffset;
+    const float *window;
+    if (start >= 0 && start + RESAMPLE_TAPS <= numOfFrames) {
+      window = samples + start;
+    } else {
+      for (int64_t n = 0; n < RESAMPLE_TAPS; n++) {
+        int64_t source = start + n;
+        edge[n] = source >= 0 && source < numOfFrames ? samples[source] : 0;
+      }
+      window = edge;
+    }
+    float sample =
+        applyResampleFilters(window, filters + k * RESAMPLE_TAPS,
+                             filters + (k + 1) * RESAMPLE_TAPS, mix);
+    if (floatDest) {
+      floatDest[i] = sample;
+    } else {
+      dest16[i] = roundResampledSampleTo16Bit(sample);
+    }
+    index += wholeStep;
+    remainder += remainderStep;
+    if (remainder >= targetRate) {
+      remainder -= targetRate;
+      index++;
+    }
+  }
+}
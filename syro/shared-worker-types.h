@@ -1,12 +1,55 @@
 #include <stdint.h>
 
 #define ITERATION_INTERVAL 100000
+// The syro worker sizes each chunk to take about chunkBudgetMs to encode,
+// based on the speed it has observed so far, within these bounds (in frames).
+// The first chunk is kept small so there's a measurement early on.
+#define MIN_ITERATION_INTERVAL 4096
+#define MAX_ITERATION_INTERVAL 1048576
+#define INITIAL_ITERATION_INTERVAL 16384
+#define DEFAULT_CHUNK_BUDGET_MS 50
+// ring size for streamed output: the largest iteration plus the wav header,
+// so a single iteration always fits once the previous chunk has been read
+#define SAMPLE_BUFFER_STREAM_SIZE (MAX_ITERATION_INTERVAL * 4 + 44)
+
+// Time a worker spent on the work behind one response, for the main thread's
+// transfer stats (in milliseconds).
+typedef struct SyroWorkerTimings {
+  // SyroVolcaSample_Start, which compresses any samples it has no block for
+  double startMs;
+  // generating frames
+  double encodeMs;
+  // copying output into the response
+  double copyMs;
+  uint32_t frames;
+} SyroWorkerTimings;
 
 typedef struct SampleBufferUpdate {
   void *sampleBufferPointer;
+  // the main thread's job for this stream (to be defined in main thread)
+  void *transfer;
   uint8_t *chunk;
   uint32_t chunkSize;
   uint32_t progress;
   uint32_t totalSize;
   uint32_t dataStartPoints[110];
+  SyroWorkerTimings timings;
+  // what the worker holds for the stream (see SyroArena), and the most it has
+  // held at once
+  uint32_t memoryBytes;
+  uint32_t peakMemoryBytes;
 } SampleBufferUpdate;
+
+// response to encodeSyroStreamWork, followed by the whole stream (including
+// the wav header)
+typedef struct SyroStreamUpdate {
+  // getSyroSegmentKey for the first entry (for a single entry's stream, the
+  // segment cache key)
+  uint64_t segmentKey;
+  // bytes of sample data the first entry carries in the stream: its 16Bit
+  // samples if linear, its compSize if compressed, or 0 if it has none
+  uint32_t dataSize;
+  uint32_t totalSize;
+  uint32_t dataStartPoints[110];
+  SyroWorkerTimings timings;
+} SyroStreamUpdate;
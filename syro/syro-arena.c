@@ -0,0 +1,107 @@
+// Job-scoped allocations. Everything a job allocates from its arena is
+// released in one call when the job ends, so nothing can be left behind, and
+// the arena keeps count of what it holds for the job's stats. Small
+// allocations are carved out of shared blocks; large ones (sample data, the
+// output ring) get blocks of their own, so the heap gets back exactly what it
+// gave.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SYRO_ARENA_BLOCK_SIZE (64 * 1024)
+#define SYRO_ARENA_ALIGNMENT 16
+
+typedef struct SyroArenaBlock {
+  struct SyroArenaBlock *next;
+  size_t size;
+  size_t used;
+} SyroArenaBlock;
+
+// (rounded up so every allocation stays aligned)
+#define SYRO_ARENA_HEADER_SIZE                                                 \
+  ((sizeof(SyroArenaBlock) + SYRO_ARENA_ALIGNMENT - 1) &                       \
+   ~(size_t)(SYRO_ARENA_ALIGNMENT - 1))
+
+typedef struct SyroArena {
+  // the first block is the one small allocations come from
+  SyroArenaBlock *blocks;
+  // taken from the heap right now, including block headers
+  size_t bytes;
+  // the most bytes ever held at once
+  size_t peakBytes;
+} SyroArena;
+
+void initSyroArena(SyroArena *arena) {
+  arena->blocks = NULL;
+  arena->bytes = 0;
+  arena->peakBytes = 0;
+}
+
+static SyroArenaBlock *addSyroArenaBlock(SyroArena *arena, size_t size) {
+  SyroArenaBlock *block = malloc(SYRO_ARENA_HEADER_SIZE + size);
+  if (!block) {
+    return NULL;
+  }
+  block->size = size;
+  block->used = 0;
+  arena->bytes += SYRO_ARENA_HEADER_SIZE + size;
+  if (arena->bytes > arena->peakBytes) {
+    arena->peakBytes = arena->bytes;
+  }
+  return block;
+}
+
+/**
+ * Returns size bytes that last until releaseSyroArena, or NULL if out of
+ * memory. (Never free them on their own.)
+ */
+void *allocateInSyroArena(SyroArena *arena, size_t size) {
+  // (never 0 bytes, like the rest of the sample data)
+  size_t alignment = SYRO_ARENA_ALIGNMENT;
+  size = size ? (size + alignment - 1) & ~(alignment - 1) : alignment;
+  SyroArenaBlock *current = arena->blocks;
+  if (size > SYRO_ARENA_BLOCK_SIZE / 4) {
+    SyroArenaBlock *block = addSyroArenaBlock(arena, size);
+    if (!block) {
+      return NULL;
+    }
+    block->used = size;
+    // behind the current block, which still has room for small ones
+    if (current) {
+      block->next = current->next;
+      current->next = block;
+    } else {
+      block->next = NULL;
+      arena->blocks = block;
+    }
+    return (uint8_t *)block + SYRO_ARENA_HEADER_SIZE;
+  }
+  if (!current || current->size - current->used < size) {
+    current = addSyroArenaBlock(arena, SYRO_ARENA_BLOCK_SIZE);
+    if (!current) {
+      return NULL;
+    }
+    current->next = arena->blocks;
+    arena->blocks = current;
+  }
+  void *allocation =
+      (uint8_t *)current + SYRO_ARENA_HEADER_SIZE + current->used;
+  current->used += size;
+  return allocation;
+}
+
+/**
+ * Frees everything allocated from the arena. It can be used again afterwards
+ * (peakBytes carries on from before).
+ */
+void releaseSyroArena(SyroArena *arena) {
+  SyroArenaBlock *block = arena->blocks;
+  while (block) {
+    SyroArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = NULL;
+  arena->bytes = 0;
+}
@@ -0,0 +1,5 @@
+// Entry point for the pthreads build of the bindings (syro-bindings-threaded.js),
+// which is only loaded when the page is cross-origin isolated. It exposes
+// everything the regular build does, plus shared memory streams.
+#include "./syro-bindings.c"
+#include "./syro-shared-stream.c"
@@ -1,14 +1,186 @@
 #include "./shared-worker-types.h"
 #include "./syro-utils.c"
+#include "./syro-worker-pool.c"
+#include "./syro-stream-length.c"
+#include "./syro-segment-cache.c"
+#include "./sample-dsp.c"
 #include <emscripten.h>
 
+/**
+ * Where a job's time went so far, as returned by getSampleBufferStatsPointer.
+ * Times are in milliseconds, summed over every call. Everything is a double so
+ * JS can read it as a Float64Array (in this order).
+ */
+typedef struct SyroTransferStats {
+  // since prepareSampleBufferFromSyroData
+  double elapsedMs;
+  // calls waiting in the worker pool queue, and on their worker
+  double queueWaitMs;
+  // compression jobs on the pool, from their worker starting on them until
+  // the block came back
+  double compressMs;
+  // starting streams on workers (see SyroWorkerTimings)
+  double startMs;
+  // generating frames on workers
+  double encodeMs;
+  // copying output into messages on workers, and composing cached segments
+  double copyMs;
+  // in onUpdate, before the current call
+  double callbackMs;
+  double frames;
+  // output passed to onUpdate
+  double bytes;
+  // frames generated per second of encodeMs
+  double framesPerSecond;
+  // bytes the worker holds for the stream as of the last update, and the most
+  // it has held at once (0 for streams put together from cached segments)
+  double workerMemoryBytes;
+  double peakWorkerMemoryBytes;
+} SyroTransferStats;
+
+// One slice of a job's trace, on the main thread (track -1) or a pool worker.
+typedef struct SyroTraceEvent {
+  const char *name;
+  int32_t track;
+  double startedAt;
+  double durationMs;
+} SyroTraceEvent;
+
 typedef struct WorkerUpdateArg {
-  worker_handle worker;
   void (*onUpdate)(SampleBufferUpdate *);
-  bool secondJobStarted;
+  // passed on to the syro worker, which sizes its chunks to match
+  uint32_t chunkBudgetMs;
+  // for the worker pool queue
+  int32_t priority;
+  // pool worker holding the sample buffer, once the encoding stage starts
+  int32_t workerIndex;
+  // (see isSyroWorkerCurrent)
+  uint32_t workerGeneration;
+  // every call queued or in flight on the worker pool for this job. the job
+  // is freed once it's cancelled or finished and this gets back to 0.
+  uint32_t callsInFlight;
+  // start and iterate calls for the encoding stage
+  uint32_t jobsInFlight;
+  // set from the first update, for queueing more jobs (opaque, it's the
+  // worker's stream state)
+  void *sampleBufferPointer;
+  bool paused;
   bool cancelled;
+  bool finished;
+  // the worker couldn't start the stream or was retired (see
+  // failSampleBufferWork)
+  bool failed;
+  // jobs put together from cached segments, on the main thread
+  bool composingStream;
+  uint32_t composedProgress;
+  SyroSegment **segments;
+  // encodes of segments the cache is missing, before composing
+  uint32_t pendingSegmentJobs;
+  // set if this job's stream is being used to check the segment cache
+  SyroSegmentCheck *segmentCheck;
+  // compression stage, before the syro worker is started
+  SyroData *syro_data;
+  uint32_t NumOfData;
+  uint32_t pendingCompressionJobs;
+  double startedAt;
+  SyroTransferStats stats;
+  // only recorded for jobs started while tracing is on
+  SyroTraceEvent *traceEvents;
+  uint32_t numOfTraceEvents;
+  uint32_t traceEventsCapacity;
+  // built by getSampleBufferTraceJson
+  char *traceJson;
 } WorkerUpdateArg;
 
+static bool syroTraceEnabled = false;
+
+/**
+ * Turns on tracing for jobs started after this, so getSampleBufferTraceJson
+ * has something to export. Off by default, since every call adds events.
+ */
+EMSCRIPTEN_KEEPALIVE
+void setSyroTraceEnabled(uint32_t enabled) { syroTraceEnabled = enabled != 0; }
+
+static void addSyroTraceEvent(WorkerUpdateArg *updateArg, const char *name,
+                              int32_t track, double startedAt,
+                              double durationMs) {
+  if (!updateArg->traceEvents) {
+    return;
+  }
+  if (updateArg->numOfTraceEvents == updateArg->traceEventsCapacity) {
+    SyroTraceEvent *traceEvents =
+        realloc(updateArg->traceEvents,
+                sizeof(SyroTraceEvent) * updateArg->traceEventsCapacity * 2);
+    if (!traceEvents) {
+      // (the trace is only missing this event)
+      return;
+    }
+    updateArg->traceEvents = traceEvents;
+    updateArg->traceEventsCapacity *= 2;
+  }
+  SyroTraceEvent *event =
+      updateArg->traceEvents + updateArg->numOfTraceEvents++;
+  event->name = name;
+  event->track = track;
+  event->startedAt = startedAt;
+  event->durationMs = durationMs;
+}
+
+/**
+ * Adds the pool call whose response is being handled (see
+ * currentSyroCallTiming) to the job's stats and trace, along with the
+ * worker's own timings if it sent any. The worker doesn't say when each of
+ * its phases began, so in the trace they're laid end to end, finishing as the
+ * response arrived.
+ */
+static void addSyroCallStats(WorkerUpdateArg *updateArg,
+                             const SyroWorkerTimings *timings) {
+  SyroCallTiming *timing = &currentSyroCallTiming;
+  SyroTransferStats *stats = &updateArg->stats;
+  stats->queueWaitMs += timing->startedAt - timing->queuedAt;
+  addSyroTraceEvent(updateArg, timing->funcName, timing->workerIndex,
+                    timing->startedAt, timing->respondedAt - timing->startedAt);
+  if (!timings) {
+    return;
+  }
+  stats->startMs += timings->startMs;
+  stats->encodeMs += timings->encodeMs;
+  stats->copyMs += timings->copyMs;
+  stats->frames += timings->frames;
+  if (stats->encodeMs) {
+    stats->framesPerSecond = stats->frames / (stats->encodeMs / 1000);
+  }
+  double phaseStartedAt = timing->respondedAt - timings->copyMs -
+                          timings->encodeMs - timings->startMs;
+  // (kept inside the call, in case the clocks disagree)
+  if (phaseStartedAt < timing->startedAt) {
+    phaseStartedAt = timing->startedAt;
+  }
+  if (timings->startMs) {
+    addSyroTraceEvent(updateArg, "start", timing->workerIndex, phaseStartedAt,
+                      timings->startMs);
+  }
+  phaseStartedAt += timings->startMs;
+  addSyroTraceEvent(updateArg, "encode", timing->workerIndex, phaseStartedAt,
+                    timings->encodeMs);
+  phaseStartedAt += timings->encodeMs;
+  addSyroTraceEvent(updateArg, "copy", timing->workerIndex, phaseStartedAt,
+                    timings->copyMs);
+}
+
+// Calls onUpdate, timing it (and keeping the stats current for it to read).
+static void sendSampleBufferUpdate(WorkerUpdateArg *updateArg,
+                                   SampleBufferUpdate *sampleBufferUpdate) {
+  double startedAt = emscripten_get_now();
+  sampleBufferUpdate->transfer = (void *)updateArg;
+  updateArg->stats.elapsedMs = startedAt - updateArg->startedAt;
+  updateArg->stats.bytes += sampleBufferUpdate->chunkSize;
+  updateArg->onUpdate(sampleBufferUpdate);
+  double durationMs = emscripten_get_now() - startedAt;
+  updateArg->stats.callbackMs += durationMs;
+  addSyroTraceEvent(updateArg, "onUpdate", -1, startedAt, durationMs);
+}
+
 EMSCRIPTEN_KEEPALIVE
 uint8_t *getSampleBufferChunkPointer(SampleBufferUpdate *sampleBufferUpdate) {
   return sampleBufferUpdate->chunk;
@@ -29,126 +201,557 @@ uint32_t getSampleBufferTotalSize(SampleBufferUpdate *sampleBufferUpdate) {
   return sampleBufferUpdate->totalSize;
 }
 
+/**
+ * 1 if the job failed (its worker couldn't start the stream, or died along
+ * with it). That update is the job's last, and has nothing else to read but
+ * the stats.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSampleBufferFailed(SampleBufferUpdate *sampleBufferUpdate) {
+  return ((WorkerUpdateArg *)sampleBufferUpdate->transfer)->failed ? 1 : 0;
+}
+
 EMSCRIPTEN_KEEPALIVE
 uint32_t *
 getSampleBufferDataStartPointsPointer(SampleBufferUpdate *sampleBufferUpdate) {
   return sampleBufferUpdate->dataStartPoints;
 }
 
-// only used for the delete buffer which makes a specific allocation for the
-// sample buffer update.
+/**
+ * The job's SyroTransferStats so far, valid for as long as the update is.
+ */
 EMSCRIPTEN_KEEPALIVE
-void freeDeleteBuffer(SampleBufferUpdate *deleteBufferUpdate) {
-  free(deleteBufferUpdate->chunk);
-  free((SampleBufferContainer *)deleteBufferUpdate->sampleBufferPointer);
-  free(deleteBufferUpdate);
+SyroTransferStats *
+getSampleBufferStatsPointer(SampleBufferUpdate *sampleBufferUpdate) {
+  return &((WorkerUpdateArg *)sampleBufferUpdate->transfer)->stats;
+}
+
+/**
+ * Exports the job's trace so far in Chrome's trace event format (for
+ * chrome://tracing or Perfetto), or an empty string if the job wasn't traced
+ * (see setSyroTraceEnabled). Valid for as long as the update is, so read it
+ * from the last update to get the whole transfer.
+ */
+EMSCRIPTEN_KEEPALIVE
+const char *getSampleBufferTraceJson(SampleBufferUpdate *sampleBufferUpdate) {
+  WorkerUpdateArg *updateArg = (WorkerUpdateArg *)sampleBufferUpdate->transfer;
+  if (!updateArg->traceEvents) {
+    return "";
+  }
+  // more than enough for one event, or the thread names
+  size_t maxEventSize = 160;
+  size_t capacity =
+      (updateArg->numOfTraceEvents + MAX_SYRO_WORKERS + 2) * maxEventSize;
+  char *json = realloc(updateArg->traceJson, capacity);
+  if (!json) {
+    return "";
+  }
+  updateArg->traceJson = json;
+  size_t length = 0;
+  length += snprintf(json + length, capacity - length,
+                     "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                     "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                     "\"tid\":0,\"args\":{\"name\":\"main thread\"}}");
+  for (uint32_t i = 0; i < numOfSyroWorkers; i++) {
+    length += snprintf(json + length, capacity - length,
+                       ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":%u,\"args\":{\"name\":\"syro worker %u\"}}",
+                       i + 1, i);
+  }
+  for (uint32_t i = 0; i < updateArg->numOfTraceEvents; i++) {
+    SyroTraceEvent *event = updateArg->traceEvents + i;
+    // (timestamps are in microseconds, from the start of the job)
+    length += snprintf(
+        json + length, capacity - length,
+        ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+        "\"ts\":%.3f,\"dur\":%.3f}",
+        event->name, event->track + 1,
+        (event->startedAt - updateArg->startedAt) * 1000,
+        event->durationMs * 1000);
+  }
+  snprintf(json + length, capacity - length, "]}");
+  return json;
+}
+
+// Frees the job once nothing more can come back for it, and lets the worker
+// free its side.
+static void finishSampleBufferWork(WorkerUpdateArg *updateArg) {
+  if (updateArg->callsInFlight) {
+    return;
+  }
+  // (a retired worker took the sample buffer with it)
+  if (updateArg->sampleBufferPointer &&
+      isSyroWorkerCurrent(updateArg->workerIndex,
+                          updateArg->workerGeneration)) {
+    callSyroWorker(updateArg->workerIndex, updateArg->priority,
+                   "endSyroBufferWork",
+                   (char *)&updateArg->sampleBufferPointer, sizeof(void *),
+                   NULL, 0, false, NULL, NULL);
+  }
+  if (updateArg->workerIndex != ANY_SYRO_WORKER) {
+    releaseSyroWorker(updateArg->workerIndex);
+  }
+  if (updateArg->segments) {
+    releaseSyroSegments(updateArg->segments, updateArg->NumOfData);
+  }
+  if (updateArg->segmentCheck) {
+    submitSyroSegmentCheck(updateArg->segmentCheck, false);
+  }
+  if (updateArg->syro_data) {
+    free_syrodata(updateArg->syro_data, updateArg->NumOfData);
+    free(updateArg->syro_data);
+  }
+  free(updateArg->traceEvents);
+  free(updateArg->traceJson);
+  free(updateArg);
 }
 
 EMSCRIPTEN_KEEPALIVE
 void cancelSampleBufferWork(WorkerUpdateArg *updateArg) {
   updateArg->cancelled = true;
+  // calls that haven't gone out yet never will. for the rest we wait, since
+  // their responses still reference the job.
+  updateArg->callsInFlight -= cancelSyroWorkerCalls(updateArg);
+  finishSampleBufferWork(updateArg);
+}
+
+static void queueIterateJobs(WorkerUpdateArg *updateArg);
+static void queueComposedChunk(WorkerUpdateArg *updateArg);
+
+// Sends onUpdate an empty update for which getSampleBufferFailed is 1, unless
+// the job was cancelled. Nothing is sent after it, and the job is freed once
+// its calls are all back, like a finished one.
+static void failSampleBufferWork(WorkerUpdateArg *updateArg) {
+  if (updateArg->failed || updateArg->cancelled) {
+    return;
+  }
+  updateArg->failed = true;
+  SampleBufferUpdate sampleBufferUpdate;
+  memset(&sampleBufferUpdate, 0, sizeof(SampleBufferUpdate));
+  // (held up during the callback so a cancel from inside it leaves the
+  // cleanup to the caller)
+  updateArg->callsInFlight++;
+  sendSampleBufferUpdate(updateArg, &sampleBufferUpdate);
+  updateArg->callsInFlight--;
 }
 
 void onWorkerMessage(char *data, int size, void *updateArgPointer) {
+  WorkerUpdateArg *updateArg = (WorkerUpdateArg *)updateArgPointer;
+  SampleBufferUpdate *sampleBufferUpdate = (SampleBufferUpdate *)(data);
+  updateArg->jobsInFlight--;
+  if (size < (int)sizeof(SampleBufferUpdate)) {
+    // the worker couldn't start the stream (e.g. out of memory), or it was
+    // retired and the stream went with it
+    addSyroCallStats(updateArg, NULL);
+    failSampleBufferWork(updateArg);
+  } else if (updateArg->cancelled || updateArg->finished ||
+             updateArg->failed) {
+    // (still need to know where the worker keeps the sample buffer so it can
+    // be freed, if this was the first response)
+    updateArg->sampleBufferPointer = sampleBufferUpdate->sampleBufferPointer;
+  } else {
+    addSyroCallStats(updateArg, &sampleBufferUpdate->timings);
+    updateArg->stats.workerMemoryBytes = sampleBufferUpdate->memoryBytes;
+    updateArg->stats.peakWorkerMemoryBytes =
+        sampleBufferUpdate->peakMemoryBytes;
+    // We pass the actual chunk as part of the input buffer so we can replace
+    // the chunk pointer with one that references memory in the main thread.
+    sampleBufferUpdate->chunk = (uint8_t *)(data) + sizeof(SampleBufferUpdate);
+    updateArg->sampleBufferPointer = sampleBufferUpdate->sampleBufferPointer;
+    if (sampleBufferUpdate->progress >= sampleBufferUpdate->totalSize) {
+      updateArg->finished = true;
+    }
+    SyroSegmentCheck *check = updateArg->segmentCheck;
+    if (check) {
+      check->hash = hashSyroStream(check->hash, sampleBufferUpdate->chunk,
+                                   sampleBufferUpdate->chunkSize);
+      if (updateArg->finished) {
+        check->size = sampleBufferUpdate->totalSize;
+        memcpy(check->dataStartPoints, sampleBufferUpdate->dataStartPoints,
+               sizeof(check->dataStartPoints));
+        updateArg->segmentCheck = NULL;
+        submitSyroSegmentCheck(check, true);
+      }
+    }
+    sendSampleBufferUpdate(updateArg, sampleBufferUpdate);
+  }
+  // (counted down after the callback so a cancel from inside it leaves the
+  // cleanup to us)
+  updateArg->callsInFlight--;
+  if (updateArg->cancelled || updateArg->finished || updateArg->failed) {
+    finishSampleBufferWork(updateArg);
+  } else {
+    queueIterateJobs(updateArg);
+  }
+}
+
+static void queueIterateJobs(WorkerUpdateArg *updateArg) {
+  // Queue two jobs at a time to reduce idle time on the worker thread
+  // (only one job will run at a time but this means the worker thread should
+  // normally have something to do next while we're processing the update
+  // in the main thread). While paused, jobs already in flight still finish.
+  while (!updateArg->paused && updateArg->jobsInFlight < 2) {
+    callSyroWorker(updateArg->workerIndex, updateArg->priority,
+                   "iterateSyroBufferWork",
+                   (char *)&updateArg->sampleBufferPointer, sizeof(void *),
+                   NULL, 0, false, onWorkerMessage, (void *)updateArg);
+    updateArg->jobsInFlight++;
+    updateArg->callsInFlight++;
+  }
+}
+
+static void sendComposedChunk(void *updateArgPointer) {
   WorkerUpdateArg *updateArg = (WorkerUpdateArg *)updateArgPointer;
   if (updateArg->cancelled) {
-    emscripten_destroy_worker(updateArg->worker);
-    free(updateArg);
+    updateArg->callsInFlight--;
+    finishSampleBufferWork(updateArg);
     return;
   }
-  SampleBufferUpdate *sampleBufferUpdate = (SampleBufferUpdate *)(data);
-  if (size - sizeof(SampleBufferUpdate) != sampleBufferUpdate->chunkSize) {
-    // TODO: error case... maybe handle it?
+  double startedAt = emscripten_get_now();
+  uint32_t totalSize =
+      getComposedSyroStreamSize(updateArg->segments, updateArg->NumOfData);
+  uint32_t maxChunkSize = MAX_ITERATION_INTERVAL * 4;
+  uint8_t *messageBuffer = malloc(sizeof(SampleBufferUpdate) + maxChunkSize);
+  SampleBufferUpdate *sampleBufferUpdate = (SampleBufferUpdate *)messageBuffer;
+  sampleBufferUpdate->sampleBufferPointer = NULL;
+  sampleBufferUpdate->chunk = messageBuffer + sizeof(SampleBufferUpdate);
+  memset(&sampleBufferUpdate->timings, 0, sizeof(SyroWorkerTimings));
+  sampleBufferUpdate->chunkSize = readComposedSyroStream(
+      updateArg->segments, updateArg->NumOfData, updateArg->composedProgress,
+      sampleBufferUpdate->chunk, maxChunkSize,
+      sampleBufferUpdate->dataStartPoints);
+  updateArg->composedProgress += sampleBufferUpdate->chunkSize;
+  sampleBufferUpdate->progress = updateArg->composedProgress;
+  sampleBufferUpdate->totalSize = totalSize;
+  if (updateArg->composedProgress >= totalSize) {
+    updateArg->finished = true;
   }
-  // We pass the actual chunk as part of the input buffer so we can replace the
-  // chunk pointer with one that references memory in the main thread.
-  sampleBufferUpdate->chunk = (uint8_t *)(data) + sizeof(SampleBufferUpdate);
-  updateArg->onUpdate(sampleBufferUpdate);
-  if (sampleBufferUpdate->progress < sampleBufferUpdate->totalSize) {
-    // Queue two jobs at a time to reduce idle time on the worker thread
-    // (only one job will run at a time but this means the worker thread should
-    // normally have something to do next while we're processing the update
-    // in the main thread)
-    int numberOfJobs = updateArg->secondJobStarted ? 1 : 2;
-    for (int i = 0; i < numberOfJobs; i++) {
-      emscripten_call_worker(updateArg->worker, "iterateSyroBufferWork",
-                             (char *)&sampleBufferUpdate->sampleBufferPointer,
-                             sizeof(SampleBufferContainer *), onWorkerMessage,
-                             updateArgPointer);
-    }
-    updateArg->secondJobStarted = true;
-  } else {
-    emscripten_destroy_worker(updateArg->worker);
-    free(updateArg);
+  double durationMs = emscripten_get_now() - startedAt;
+  updateArg->stats.copyMs += durationMs;
+  addSyroTraceEvent(updateArg, "composeChunk", -1, startedAt, durationMs);
+  sendSampleBufferUpdate(updateArg, sampleBufferUpdate);
+  free(messageBuffer);
+  // (counted down after the callback, as in onWorkerMessage)
+  updateArg->callsInFlight--;
+  if (updateArg->cancelled || updateArg->finished) {
+    finishSampleBufferWork(updateArg);
+  } else if (!updateArg->paused) {
+    queueComposedChunk(updateArg);
   }
 }
 
+// Chunks are still sent one at a time from the event loop, so a big composed
+// stream reports progress and can be cancelled like an encoded one.
+static void queueComposedChunk(WorkerUpdateArg *updateArg) {
+  updateArg->callsInFlight++;
+  emscripten_async_call(sendComposedChunk, (void *)updateArg, 0);
+}
+
+/**
+ * Stops queueing work on the syro worker, for a consumer that can't keep up
+ * (e.g. audio playback of a stream). Updates for jobs already queued will
+ * still arrive.
+ */
 EMSCRIPTEN_KEEPALIVE
-WorkerUpdateArg *
-prepareSampleBufferFromSyroData(SyroData *syro_data, uint32_t NumOfData,
-                                void (*onUpdate)(SampleBufferUpdate *)) {
-  // count buffer size
-  // buffer contains: NumOfData:SyroDataList:WavDataList
-  int startMessageBufferSize = 0;
-  startMessageBufferSize += sizeof(uint32_t);
-  for (uint32_t i = 0; i < NumOfData; i++) {
-    SyroData *current_syro_data = syro_data + i;
-    startMessageBufferSize += sizeof(SyroData) + current_syro_data->Size;
+void pauseSampleBufferWork(WorkerUpdateArg *updateArg) {
+  updateArg->paused = true;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void resumeSampleBufferWork(WorkerUpdateArg *updateArg) {
+  if (!updateArg->paused) {
+    return;
+  }
+  updateArg->paused = false;
+  // nothing can be queued until the first update tells us where the sample
+  // buffer lives. (the handle is freed after the last update, so callers must
+  // not resume once they've seen the full stream.)
+  if (updateArg->cancelled || updateArg->finished || updateArg->failed) {
+    return;
   }
+  if (updateArg->composingStream) {
+    if (!updateArg->callsInFlight) {
+      queueComposedChunk(updateArg);
+    }
+  } else if (updateArg->sampleBufferPointer) {
+    // (its worker may have been retired while nothing was out on it)
+    if (!isSyroWorkerCurrent(updateArg->workerIndex,
+                             updateArg->workerGeneration)) {
+      failSampleBufferWork(updateArg);
+      finishSampleBufferWork(updateArg);
+      return;
+    }
+    queueIterateJobs(updateArg);
+  }
+}
 
-  uint8_t *startMessageBuffer = malloc(startMessageBufferSize);
+static void startSampleBufferWorker(WorkerUpdateArg *updateArg) {
+  SyroData *syro_data = updateArg->syro_data;
+  uint32_t NumOfData = updateArg->NumOfData;
+
+  int startMessageBufferSize;
+  uint8_t *startMessageBuffer = createSyroStartMessage(
+      syro_data, NumOfData, updateArg->chunkBudgetMs, &startMessageBufferSize);
+
+  // the sample buffer lives on one worker, so every call from now on goes there
+  updateArg->workerIndex = acquireSyroWorker(&updateArg->workerGeneration);
+  // (the start call takes over the syro data and sends it along)
+  updateArg->syro_data = NULL;
+  callSyroWorker(updateArg->workerIndex, updateArg->priority,
+                 "startSyroBufferWork", (char *)startMessageBuffer,
+                 startMessageBufferSize, syro_data, NumOfData, true,
+                 onWorkerMessage, (void *)updateArg);
+  updateArg->jobsInFlight = 1;
+  updateArg->callsInFlight++;
+  free(startMessageBuffer);
+}
 
-  // write NumOfData to buffer
-  uint32_t *numOfDataBuffer = (uint32_t *)startMessageBuffer;
-  *numOfDataBuffer = NumOfData;
+// Puts the stream together from the segment cache, if every entry is there.
+static bool startComposedStream(WorkerUpdateArg *updateArg) {
+  updateArg->segments =
+      acquireSyroSegments(updateArg->syro_data, updateArg->NumOfData);
+  if (!updateArg->segments) {
+    return false;
+  }
+  updateArg->composingStream = true;
+  queueComposedChunk(updateArg);
+  return true;
+}
 
-  // copy syro data list into buffer
-  SyroData *syroDataCopy = (SyroData *)(startMessageBuffer + sizeof(uint32_t));
-  memcpy(syroDataCopy, syro_data, sizeof(SyroData) * NumOfData);
+void onSegmentWorkerMessage(char *data, int size, void *updateArgPointer) {
+  WorkerUpdateArg *updateArg = (WorkerUpdateArg *)updateArgPointer;
+  updateArg->callsInFlight--;
+  addSyroCallStats(updateArg, size >= (int)sizeof(SyroStreamUpdate)
+                                  ? &((SyroStreamUpdate *)data)->timings
+                                  : NULL);
+  // (worth keeping even if the job was cancelled)
+  addSyroSegment(data, size);
+  if (updateArg->cancelled) {
+    finishSampleBufferWork(updateArg);
+    return;
+  }
+  // if a segment failed (or was evicted already), encode the stream in full
+  if (--updateArg->pendingSegmentJobs == 0 && !startComposedStream(updateArg)) {
+    startSampleBufferWorker(updateArg);
+  }
+}
 
-  // iterate through list of syro data and copy wav data one at a time
-  // into the buffer
-  uint8_t *pDataBuffer =
-      startMessageBuffer + sizeof(uint32_t) + sizeof(SyroData) * NumOfData;
-  uint32_t pDataOffset = 0;
+/**
+ * Starts the encoding stage, once compressed blocks are ready. Streams that
+ * can be put together from cached segments only have the missing segments
+ * encoded, spread across the pool.
+ */
+static void startSampleBufferEncoding(WorkerUpdateArg *updateArg) {
+  SyroData *syro_data = updateArg->syro_data;
+  uint32_t NumOfData = updateArg->NumOfData;
+  if (!canUseSyroSegments(syro_data, NumOfData)) {
+    // (its segments are encoded after this job's own work)
+    updateArg->segmentCheck =
+        startSyroSegmentCheck(syro_data, NumOfData, updateArg->priority - 1);
+    startSampleBufferWorker(updateArg);
+    return;
+  }
+  // count every job before sending any, since responses decrement the count
   for (uint32_t i = 0; i < NumOfData; i++) {
-    SyroData *current_syro_data = syro_data + i;
-    uint8_t *pData = pDataBuffer + pDataOffset;
-    memcpy(pData, current_syro_data->pData, current_syro_data->Size);
-    pDataOffset += current_syro_data->Size;
+    SyroSegment *segment = findSyroSegment(getSyroSegmentKey(syro_data + i));
+    if (!segment || !segment->stream) {
+      updateArg->pendingSegmentJobs++;
+    }
   }
+  if (!updateArg->pendingSegmentJobs) {
+    if (!startComposedStream(updateArg)) {
+      startSampleBufferWorker(updateArg);
+    }
+    return;
+  }
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroSegment *segment = findSyroSegment(getSyroSegmentKey(syro_data + i));
+    if (segment && segment->stream) {
+      continue;
+    }
+    int messageSize;
+    uint8_t *message =
+        createSyroStartMessage(syro_data + i, 1, 0, &messageSize);
+    callSyroWorker(ANY_SYRO_WORKER, updateArg->priority, "encodeSyroStreamWork",
+                   (char *)message, messageSize, syro_data + i, 1, false,
+                   onSegmentWorkerMessage, (void *)updateArg);
+    updateArg->callsInFlight++;
+    free(message);
+  }
+}
 
-  free_syrodata(syro_data, NumOfData);
-  free(syro_data);
+void onCompressionWorkerMessage(char *data, int size, void *updateArgPointer) {
+  WorkerUpdateArg *updateArg = (WorkerUpdateArg *)updateArgPointer;
+  updateArg->callsInFlight--;
+  addSyroCallStats(updateArg, NULL);
+  updateArg->stats.compressMs +=
+      currentSyroCallTiming.respondedAt - currentSyroCallTiming.startedAt;
+  if (updateArg->cancelled) {
+    finishSampleBufferWork(updateArg);
+    return;
+  }
+  if (size >= (int)sizeof(SyroCompBlock)) {
+    SyroCompBlock *compBlock = (SyroCompBlock *)data;
+    // We pass the block as part of the response buffer, right after the
+    // struct, so the block pointer needs to reference main thread memory.
+    compBlock->block = (uint8_t *)(data) + sizeof(SyroCompBlock);
+    addSyroCompBlock(compBlock->key, compBlock->compSize, compBlock->block,
+                     compBlock->blockSize, compBlock->checksum);
+  }
+  // if a worker failed to compress, the syro worker will just compress that
+  // sample itself
+  if (--updateArg->pendingCompressionJobs == 0) {
+    startSampleBufferEncoding(updateArg);
+  }
+}
 
-  worker_handle worker = emscripten_create_worker("syro-worker.js");
+/**
+ * Compressing samples is what keeps the syro worker from sending its first
+ * chunk, so any samples that need compressing are spread across the worker
+ * pool first. The syro worker then receives the finished blocks along with
+ * the wav data.
+ *
+ * chunkBudgetMs is roughly how long the syro worker should spend encoding
+ * each chunk (so how often onUpdate is called), whatever the speed of the
+ * machine. 0 uses DEFAULT_CHUNK_BUDGET_MS.
+ *
+ * Work for jobs with a higher priority goes to the pool first, e.g. for a
+ * stream that is playing while the next one is prepared.
+ *
+ * Where it's safe to, the stream is put together from each entry's cached
+ * segment (see syro-segment-cache.c), so only entries that changed since an
+ * earlier job are encoded.
+ */
+EMSCRIPTEN_KEEPALIVE
+WorkerUpdateArg *
+prepareSampleBufferFromSyroData(SyroData *syro_data, uint32_t NumOfData,
+                                void (*onUpdate)(SampleBufferUpdate *),
+                                uint32_t chunkBudgetMs, int32_t priority) {
   WorkerUpdateArg *updateArg = malloc(sizeof(WorkerUpdateArg));
-  updateArg->worker = worker;
   updateArg->onUpdate = onUpdate;
-  updateArg->secondJobStarted = false;
+  updateArg->chunkBudgetMs = chunkBudgetMs;
+  updateArg->priority = priority;
+  updateArg->workerIndex = ANY_SYRO_WORKER;
+  updateArg->callsInFlight = 0;
+  updateArg->jobsInFlight = 0;
+  updateArg->sampleBufferPointer = NULL;
+  updateArg->paused = false;
   updateArg->cancelled = false;
-  emscripten_call_worker(worker, "startSyroBufferWork",
-                         (char *)startMessageBuffer, startMessageBufferSize,
-                         onWorkerMessage, (void *)updateArg);
-  free(startMessageBuffer);
+  updateArg->finished = false;
+  updateArg->failed = false;
+  updateArg->composingStream = false;
+  updateArg->composedProgress = 0;
+  updateArg->segments = NULL;
+  updateArg->pendingSegmentJobs = 0;
+  updateArg->segmentCheck = NULL;
+  updateArg->syro_data = syro_data;
+  updateArg->NumOfData = NumOfData;
+  updateArg->pendingCompressionJobs = 0;
+  updateArg->startedAt = emscripten_get_now();
+  memset(&updateArg->stats, 0, sizeof(SyroTransferStats));
+  updateArg->traceEvents = NULL;
+  updateArg->numOfTraceEvents = 0;
+  updateArg->traceEventsCapacity = 0;
+  updateArg->traceJson = NULL;
+  if (syroTraceEnabled) {
+    updateArg->traceEventsCapacity = 64;
+    updateArg->traceEvents =
+        malloc(sizeof(SyroTraceEvent) * updateArg->traceEventsCapacity);
+  }
+
+  // count every job before sending any, since responses decrement the count
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    if (current_syro_data->DataType == DataType_Sample_Compress &&
+        current_syro_data->Size &&
+        !hasSyroCompBlock(getSyroCompKeyForSyroData(current_syro_data))) {
+      updateArg->pendingCompressionJobs++;
+    }
+  }
+  // even a single sample goes through a compression job, so its block comes
+  // back to the main thread where it can be exported and reused
+  if (!updateArg->pendingCompressionJobs) {
+    startSampleBufferEncoding(updateArg);
+    return updateArg;
+  }
+
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    if (current_syro_data->DataType != DataType_Sample_Compress ||
+        !current_syro_data->Size ||
+        hasSyroCompBlock(getSyroCompKeyForSyroData(current_syro_data))) {
+      continue;
+    }
+    callSyroWorker(ANY_SYRO_WORKER, priority, "compressSyroDataWork",
+                   (char *)current_syro_data, sizeof(SyroData),
+                   current_syro_data, 1, false, onCompressionWorkerMessage,
+                   (void *)updateArg);
+    updateArg->callsInFlight++;
+  }
   return updateArg;
 }
 
+/**
+ * The number of frames in the syrostream for a sample in each slot in
+ * slotNumbers with sizes[i] bytes of sample data (see syro-stream-length.c),
+ * for showing how long a transfer will take (at 44100 frames a second) as
+ * soon as samples are picked. Linear samples' sizes follow from their frame
+ * counts, and compressed ones' from measureSyroCompSize. Returns 0 if the
+ * frames can't be counted that way.
+ */
 EMSCRIPTEN_KEEPALIVE
-SampleBufferUpdate *getDeleteBufferFromSyroData(SyroData *syro_data,
-                                                uint32_t NumOfData) {
-  SampleBufferContainer *sampleBuffer = startSampleBuffer(syro_data, NumOfData);
-  iterateSampleBuffer(sampleBuffer, INT32_MAX);
-  SampleBufferUpdate *sampleBufferUpdate = malloc(sizeof(SampleBufferUpdate));
-  sampleBufferUpdate->sampleBufferPointer = (void *)sampleBuffer;
-  sampleBufferUpdate->chunk = sampleBuffer->buffer;
-  sampleBufferUpdate->chunkSize = sampleBuffer->size;
-  sampleBufferUpdate->progress = sampleBuffer->progress;
-  sampleBufferUpdate->totalSize = sampleBuffer->size;
-  memcpy(sampleBufferUpdate->dataStartPoints, sampleBuffer->dataStartPoints,
-         sizeof(sampleBuffer->dataStartPoints));
-  free(syro_data);
-  return sampleBufferUpdate;
+uint32_t getSyroStreamFrameCount(const uint32_t *sizes,
+                                 const uint32_t *slotNumbers,
+                                 uint32_t NumOfData) {
+  uint32_t frame;
+  if (!countSyroStreamFrames(sizes, slotNumbers, NumOfData, &frame)) {
+    return 0;
+  }
+  return frame;
+}
+
+typedef struct SyroCompSizeMeasure {
+  void (*onMeasured)(uint32_t);
+} SyroCompSizeMeasure;
+
+void onCompSizeWorkerMessage(char *data, int size, void *measurePointer) {
+  SyroCompSizeMeasure *measure = (SyroCompSizeMeasure *)measurePointer;
+  uint32_t compSize = 0;
+  if (size >= (int)sizeof(uint32_t)) {
+    memcpy(&compSize, data, sizeof(uint32_t));
+  }
+  measure->onMeasured(compSize);
+  free(measure);
+}
+
+/**
+ * Works out the compSize of a compressed syro data entry (a list of one, from
+ * allocateSyroData) for getSyroStreamFrameCount, and calls onMeasured with it
+ * (or with 0 if it couldn't). That's only the compressor's size pass, on the
+ * worker pool, or nothing at all if the block is cached, in which case
+ * onMeasured is called right away. Takes over the syro data.
+ */
+EMSCRIPTEN_KEEPALIVE
+void measureSyroCompSize(SyroData *syro_data, void (*onMeasured)(uint32_t),
+                         int32_t priority) {
+  SyroCompBlock *compBlock =
+      syro_data->DataType == DataType_Sample_Compress && syro_data->Size
+          ? getSyroCompBlock(getSyroCompKeyForSyroData(syro_data))
+          : NULL;
+  SyroCompSizeMeasure *measure =
+      compBlock ? NULL : malloc(sizeof(SyroCompSizeMeasure));
+  if (!measure) {
+    uint32_t compSize = compBlock ? compBlock->compSize : 0;
+    free(compBlock);
+    free_syrodata(syro_data, 1);
+    free(syro_data);
+    onMeasured(compSize);
+    return;
+  }
+  measure->onMeasured = onMeasured;
+  callSyroWorker(ANY_SYRO_WORKER, priority, "measureSyroCompSizeWork",
+                 (char *)syro_data, sizeof(SyroData), syro_data, 1, true,
+                 onCompSizeWorkerMessage, (void *)measure);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -161,26 +764,358 @@ void createSyroDataFromWavData(SyroData *syro_data, uint32_t syro_data_index,
       useCompression == 0 ? DataType_Sample_Liner : DataType_Sample_Compress;
   current_syro_data->Number = slotNumber;
   current_syro_data->Quality = quality;
-  bool ok = setup_file_sample(wavData, bytes, current_syro_data);
+  WavStreamParser parser;
+  initWavStreamParser(&parser);
+  pushWavStreamBytes(&parser, wavData, bytes);
+  bool ok = setupSyroDataFromWavStream(&parser, current_syro_data);
   if (!ok) {
     printf("Oops!\n");
     exit(1);
   }
 }
 
+/**
+ * Starts parsing a wav or aiff file that JS will pass in a piece at a time
+ * with feedWavStreamParser (see wav-stream-parser.c), so it's converted as it
+ * is read rather than all at once. Returns 0 if out of memory.
+ */
 EMSCRIPTEN_KEEPALIVE
-void createEmptySyroData(SyroData *syro_data, uint32_t syro_data_index,
-                         uint32_t slotNumber) {
+WavStreamParser *createWavStreamParser(void) {
+  WavStreamParser *parser = malloc(sizeof(WavStreamParser));
+  if (parser) {
+    initWavStreamParser(parser);
+  }
+  return parser;
+}
+
+/**
+ * Parses the next bytes of the file, which JS writes into memory from
+ * allocateSampleData(size, 1) (the same memory can be reused for every
+ * piece). Returns
+ * 0 if the file can't be read, in which case the parser only needs freeing.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t feedWavStreamParser(WavStreamParser *parser, uint8_t *bytes,
+                             uint32_t size) {
+  return pushWavStreamBytes(parser, bytes, size) ? 1 : 0;
+}
+
+/**
+ * Like createSyroDataFromWavData, once the whole file has been fed to the
+ * parser. Its samples become the entry's sample data and the parser is freed
+ * either way. Returns 0 if the file couldn't be read.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t createSyroDataFromWavStreamParser(SyroData *syro_data,
+                                           uint32_t syro_data_index,
+                                           WavStreamParser *parser,
+                                           uint32_t slotNumber,
+                                           uint32_t quality,
+                                           uint32_t useCompression) {
+  SyroData *current_syro_data = syro_data + syro_data_index;
+  current_syro_data->DataType =
+      useCompression == 0 ? DataType_Sample_Liner : DataType_Sample_Compress;
+  current_syro_data->Number = slotNumber;
+  current_syro_data->Quality = quality;
+  bool ok = setupSyroDataFromWavStream(parser, current_syro_data);
+  clearWavStreamParser(parser);
+  free(parser);
+  return ok ? 1 : 0;
+}
+
+/**
+ * Frees a parser that isn't going to be handed to
+ * createSyroDataFromWavStreamParser.
+ */
+EMSCRIPTEN_KEEPALIVE
+void freeWavStreamParser(WavStreamParser *parser) {
+  clearWavStreamParser(parser);
+  free(parser);
+}
+
+/**
+ * Returns the compressed block cache key for a syro data entry as a hex
+ * string (valid until the next call).
+ */
+EMSCRIPTEN_KEEPALIVE
+const char *getSyroDataCacheKey(SyroData *syro_data, uint32_t syro_data_index) {
+  static char cacheKey[17];
+  SyroData *current_syro_data = syro_data + syro_data_index;
+  snprintf(cacheKey, sizeof(cacheKey), "%016llx",
+           (unsigned long long)getSyroCompKeyForSyroData(current_syro_data));
+  return cacheKey;
+}
+
+/**
+ * Returns a copy of the compressed block for a cache key (to be freed with
+ * freeCompressedBlock) or 0 if no sample with that key has been compressed in
+ * this session. Keys should be read with getSyroDataCacheKey before the syro
+ * data is handed to prepareSampleBufferFromSyroData, which frees it.
+ */
+EMSCRIPTEN_KEEPALIVE
+SyroCompBlock *exportCompressedBlock(const char *cacheKey) {
+  return getSyroCompBlock(strtoull(cacheKey, NULL, 16));
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint8_t *getCompressedBlockPointer(SyroCompBlock *compBlock) {
+  return compBlock->block;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t getCompressedBlockSize(SyroCompBlock *compBlock) {
+  return compBlock->blockSize;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t getCompressedBlockCompSize(SyroCompBlock *compBlock) {
+  return compBlock->compSize;
+}
+
+/**
+ * The block's checksum as a hex string (valid until the next call), to be
+ * saved along with it and handed back to useCompressedBlockForSyroData.
+ */
+EMSCRIPTEN_KEEPALIVE
+const char *getCompressedBlockChecksum(SyroCompBlock *compBlock) {
+  static char checksum[17];
+  snprintf(checksum, sizeof(checksum), "%016llx",
+           (unsigned long long)compBlock->checksum);
+  return checksum;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void freeCompressedBlock(SyroCompBlock *compBlock) { free(compBlock); }
+
+/**
+ * Takes a block previously returned by exportCompressedBlock, along with its
+ * cache key and checksum, for a syro data entry that is already set up. If
+ * the key still matches the sample's audio and parameters, and the block its
+ * checksum, the block is used and the sample won't be compressed again.
+ * Returns 1 if the block was used and 0 otherwise.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t useCompressedBlockForSyroData(SyroData *syro_data,
+                                       uint32_t syro_data_index,
+                                       const char *cacheKey, uint8_t *block,
+                                       uint32_t blockSize, uint32_t compSize,
+                                       const char *checksum) {
   SyroData *current_syro_data = syro_data + syro_data_index;
-  current_syro_data->DataType = DataType_Sample_Compress;
+  if (current_syro_data->DataType != DataType_Sample_Compress) {
+    return 0;
+  }
+  uint64_t key = getSyroCompKeyForSyroData(current_syro_data);
+  if (strtoull(cacheKey, NULL, 16) != key) {
+    return 0;
+  }
+  return addSyroCompBlock(key, compSize, block, blockSize,
+                          strtoull(checksum, NULL, 16))
+             ? 1
+             : 0;
+}
+
+/**
+ * createSyroDataFromWavData followed by useCompressedBlockForSyroData.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t createSyroDataFromWavDataWithCompressedBlock(
+    SyroData *syro_data, uint32_t syro_data_index, uint8_t *wavData,
+    uint32_t bytes, uint32_t slotNumber, uint32_t quality,
+    uint32_t useCompression, const char *cacheKey, uint8_t *block,
+    uint32_t blockSize, uint32_t compSize, const char *checksum) {
+  createSyroDataFromWavData(syro_data, syro_data_index, wavData, bytes,
+                            slotNumber, quality, useCompression);
+  return useCompressedBlockForSyroData(syro_data, syro_data_index, cacheKey,
+                                       block, blockSize, compSize, checksum);
+}
+
+/**
+ * Allocates room for numOfFrames mono samples of bytesPerSample bytes each (2
+ * for int16, 4 for float32) which JS can write into directly, then hand to
+ * createSyroDataFromPcm or createSyroDataFromFloatPcm. Those take ownership;
+ * anything not handed over must be freed with freeSampleData.
+ */
+EMSCRIPTEN_KEEPALIVE
+void *allocateSampleData(uint32_t numOfFrames, uint32_t bytesPerSample) {
+  // (never 0 bytes, so a valid allocation is never mistaken for a failed one)
+  return malloc(numOfFrames ? numOfFrames * bytesPerSample : 1);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void freeSampleData(void *sampleData) { free(sampleData); }
+
+/**
+ * Like createSyroDataFromWavData, but takes 16-bit mono samples from
+ * allocateSampleData and uses them as the sample data as-is, without parsing
+ * or copying.
+ */
+EMSCRIPTEN_KEEPALIVE
+void createSyroDataFromPcm(SyroData *syro_data, uint32_t syro_data_index,
+                           int16_t *pcm, uint32_t numOfFrames,
+                           uint32_t sampleRate, uint32_t slotNumber,
+                           uint32_t quality, uint32_t useCompression) {
+  SyroData *current_syro_data = syro_data + syro_data_index;
+  current_syro_data->DataType =
+      useCompression == 0 ? DataType_Sample_Liner : DataType_Sample_Compress;
   current_syro_data->Number = slotNumber;
-  current_syro_data->Quality = 8;
-  current_syro_data->pData = NULL;
-  current_syro_data->Size = 0;
-  current_syro_data->Fs = 31250;
+  current_syro_data->Quality = quality;
+  current_syro_data->pData = (uint8_t *)pcm;
+  current_syro_data->Size = numOfFrames * 2;
+  current_syro_data->Fs = sampleRate;
   current_syro_data->SampleEndian = LittleEndian;
 }
 
+/**
+ * Converts float samples from allocateSampleData (-1 to 1) to 16 bits in
+ * place, multiplying them by gain and rounding them to qualityBitDepth bits on
+ * the way (see convertFloatSamplesTo16Bit in sample-dsp.c). Returns the same
+ * pointer, now to int16 samples, to be freed with freeSampleData.
+ */
+EMSCRIPTEN_KEEPALIVE
+int16_t *convertFloatPcmTo16Bit(float *pcm, uint32_t numOfFrames, double gain,
+                                uint32_t qualityBitDepth) {
+  int16_t *pcm16 = (int16_t *)pcm;
+  convertFloatSamplesTo16Bit(pcm, pcm16, numOfFrames, gain, qualityBitDepth);
+  return pcm16;
+}
+
+/**
+ * The number of frames resampleFloatPcm turns numOfFrames into.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t getResampledPcmFrameCount(uint32_t numOfFrames, uint32_t sourceRate,
+                                   uint32_t targetRate) {
+  return getResampledFrameCount(numOfFrames, sourceRate, targetRate);
+}
+
+/**
+ * Resamples float samples from allocateSampleData from sourceRate to
+ * targetRate (see sample-resample.c), into a new allocation of
+ * getResampledPcmFrameCount frames that can be handed on the same way. pcm is
+ * freed either way. Returns 0 if out of memory.
+ */
+EMSCRIPTEN_KEEPALIVE
+float *resampleFloatPcm(float *pcm, uint32_t numOfFrames, uint32_t sourceRate,
+                        uint32_t targetRate) {
+  uint32_t destFrames =
+      getResampledFrameCount(numOfFrames, sourceRate, targetRate);
+  float *filters = createResampleFilters(sourceRate, targetRate);
+  float *dest = allocateSampleData(destFrames, sizeof(float));
+  if (filters && dest) {
+    resampleFloatSamples(pcm, numOfFrames, sourceRate, targetRate, filters,
+                         dest, NULL, destFrames);
+  } else {
+    free(dest);
+    dest = NULL;
+  }
+  free(filters);
+  free(pcm);
+  return dest;
+}
+
+/**
+ * Builds a waveform peak index (see waveform-peaks.c) for float samples from
+ * allocateSampleData, which are left as they are. Returns a new allocation of
+ * getWaveformPeakIndexLength(numOfFrames) floats, to be freed with
+ * freeSampleData, or 0 if out of memory.
+ */
+EMSCRIPTEN_KEEPALIVE
+float *buildWaveformPeakIndex(const float *samples, uint32_t numOfFrames) {
+  uint32_t length = getWaveformPeakIndexLength(numOfFrames);
+  float *index = allocateSampleData(length, sizeof(float));
+  if (index) {
+    buildWaveformPeaks(samples, numOfFrames, index);
+  }
+  return index;
+}
+
+/**
+ * The number of entries in a pack (see syro-pack.c) JS has written into
+ * memory from allocateSampleData(size, 1), for allocateSyroData. Returns 0 if
+ * it isn't a pack we can read.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSyroPackEntryCount(const uint8_t *packData, uint32_t size) {
+  SyroPack pack;
+  return openSyroPack(packData, size, &pack) ? pack.header->numOfEntries : 0;
+}
+
+/**
+ * Sets up a syro data entry for each entry in a pack, in order, ready to be
+ * streamed with nothing left to prepare or compress. The pack can be freed
+ * afterwards. Returns 0 if out of memory or the pack is damaged, in which
+ * case the entries set up so far are freed.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t createSyroDataFromSyroPack(SyroData *syro_data,
+                                    const uint8_t *packData, uint32_t size) {
+  SyroPack pack;
+  if (!openSyroPack(packData, size, &pack)) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < pack.header->numOfEntries; i++) {
+    if (!setupSyroDataFromSyroPack(&pack, i, syro_data + i)) {
+      free_syrodata(syro_data, i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * The number of frames in a pack entry, and a pointer to its waveform peak
+ * index inside the pack (getWaveformPeakIndexLength(numOfFrames) floats, laid
+ * out as from buildWaveformPeakIndex), for viewing it in place.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSyroPackFrameCount(const uint8_t *packData, uint32_t size,
+                               uint32_t index) {
+  SyroPack pack;
+  if (!openSyroPack(packData, size, &pack) ||
+      index >= pack.header->numOfEntries) {
+    return 0;
+  }
+  return pack.entries[index].numOfFrames;
+}
+
+EMSCRIPTEN_KEEPALIVE
+const float *getSyroPackPeaksPointer(const uint8_t *packData, uint32_t size,
+                                     uint32_t index) {
+  SyroPack pack;
+  if (!openSyroPack(packData, size, &pack) ||
+      index >= pack.header->numOfEntries) {
+    return 0;
+  }
+  return getSyroPackPeaks(&pack, index);
+}
+
+/**
+ * Like createSyroDataFromPcm, but for float samples (-1 to 1), which are
+ * multiplied by gain (e.g. to normalize them) and converted to 16 bits in
+ * place, in one pass.
+ */
+EMSCRIPTEN_KEEPALIVE
+void createSyroDataFromFloatPcm(SyroData *syro_data, uint32_t syro_data_index,
+                                float *pcm, uint32_t numOfFrames,
+                                uint32_t sampleRate, uint32_t slotNumber,
+                                uint32_t quality, uint32_t useCompression,
+                                double gain) {
+  int16_t *pcm16 = convertFloatPcmTo16Bit(pcm, numOfFrames, gain, 16);
+  // give back the half we don't need
+  int16_t *shrunk = realloc(pcm16, numOfFrames ? numOfFrames * 2 : 1);
+  if (shrunk) {
+    pcm16 = shrunk;
+  }
+  createSyroDataFromPcm(syro_data, syro_data_index, pcm16, numOfFrames,
+                        sampleRate, slotNumber, quality, useCompression);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void createEmptySyroData(SyroData *syro_data, uint32_t syro_data_index,
+                         uint32_t slotNumber) {
+  setupEraseSyroData(syro_data + syro_data_index, slotNumber);
+}
+
 EMSCRIPTEN_KEEPALIVE
 SyroData *allocateSyroData(uint32_t NumOfData) {
   SyroData *syro_data = malloc(sizeof(SyroData) * NumOfData);
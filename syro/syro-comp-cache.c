@@ -0,0 +1,243 @@
+// Replaces korg_syro_comp.c in the build. The Korg compressor is included
+// under different names and the public SyroComp_* entry points (which
+// SyroVolcaSample_Start calls) look for an already compressed block before
+// falling back to it. That lets compression happen ahead of time, in parallel
+// or in another worker, without changing the stream Start produces.
+
+#define SyroComp_GetCompSize SyroComp_GetCompSize_Korg
+#define SyroComp_Comp SyroComp_Comp_Korg
+#include "./volcasample/syro/korg_syro_comp.c"
+#undef SyroComp_GetCompSize
+#undef SyroComp_Comp
+
+#include "./syro-comp-cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compressed blocks are much smaller than the source audio, but we still put a
+// cap on what a long session can accumulate. Oldest blocks are evicted first.
+#define SYRO_COMP_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+uint32_t SyroComp_GetCompSize(const uint8_t *psrc, int num_of_sample,
+                              int quality, Endian sample_endian);
+uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample,
+                       int quality, Endian sample_endian);
+
+static pthread_mutex_t syroCompCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static SyroCompBlock *syroCompCache = NULL;
+static uint32_t syroCompCacheLength = 0;
+static uint32_t syroCompCacheCapacity = 0;
+static uint32_t syroCompCacheBytes = 0;
+
+#define SYRO_COMP_HASH_PRIME 0x100000001b3ULL
+#define SYRO_COMP_HASH_BASIS 0xcbf29ce484222325ULL
+
+// FNV-style mixing over 64-bit words, which is plenty fast next to the
+// compressor itself
+static uint64_t mixSyroCompHash(uint64_t hash, const uint8_t *bytes,
+                                size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * SYRO_COMP_HASH_PRIME;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * SYRO_COMP_HASH_PRIME;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint64_t getSyroCompKey(const uint8_t *psrc, int num_of_sample, int quality,
+                        Endian sample_endian) {
+  uint64_t hash = SYRO_COMP_HASH_BASIS;
+  hash = (hash ^ (uint32_t)num_of_sample) * SYRO_COMP_HASH_PRIME;
+  hash = (hash ^ (uint32_t)quality) * SYRO_COMP_HASH_PRIME;
+  hash = (hash ^ (uint32_t)sample_endian) * SYRO_COMP_HASH_PRIME;
+  return mixSyroCompHash(hash, psrc, (size_t)num_of_sample * 2);
+}
+
+uint64_t getSyroCompBlockChecksum(uint32_t compSize, const uint8_t *block,
+                                  uint32_t blockSize) {
+  uint64_t hash = SYRO_COMP_HASH_BASIS;
+  hash = (hash ^ compSize) * SYRO_COMP_HASH_PRIME;
+  hash = (hash ^ blockSize) * SYRO_COMP_HASH_PRIME;
+  return mixSyroCompHash(hash, block, blockSize);
+}
+
+uint64_t getSyroCompKeyForSyroData(SyroData *syro_data) {
+  return getSyroCompKey(syro_data->pData, syro_data->Size / 2,
+                        syro_data->Quality, syro_data->SampleEndian);
+}
+
+// call with the mutex held
+static SyroCompBlock *findSyroCompBlock(uint64_t key) {
+  for (uint32_t i = 0; i < syroCompCacheLength; i++) {
+    if (syroCompCache[i].key == key) {
+      return syroCompCache + i;
+    }
+  }
+  return NULL;
+}
+
+bool hasSyroCompBlock(uint64_t key) {
+  pthread_mutex_lock(&syroCompCacheMutex);
+  bool cached = findSyroCompBlock(key) != NULL;
+  pthread_mutex_unlock(&syroCompCacheMutex);
+  return cached;
+}
+
+SyroCompBlock *getSyroCompBlock(uint64_t key) {
+  SyroCompBlock *copy = NULL;
+  pthread_mutex_lock(&syroCompCacheMutex);
+  SyroCompBlock *cached = findSyroCompBlock(key);
+  if (cached) {
+    copy = malloc(sizeof(SyroCompBlock) + cached->blockSize);
+    if (copy) {
+      *copy = *cached;
+      copy->block = (uint8_t *)(copy + 1);
+      memcpy(copy->block, cached->block, cached->blockSize);
+    }
+  }
+  pthread_mutex_unlock(&syroCompCacheMutex);
+  return copy;
+}
+
+bool addSyroCompBlock(uint64_t key, uint32_t compSize, const uint8_t *block,
+                      uint32_t blockSize, uint64_t checksum) {
+  if (blockSize > compSize ||
+      getSyroCompBlockChecksum(compSize, block, blockSize) != checksum) {
+    return false;
+  }
+  uint8_t *blockCopy = malloc(blockSize ? blockSize : 1);
+  if (!blockCopy) {
+    return false;
+  }
+  memcpy(blockCopy, block, blockSize);
+  pthread_mutex_lock(&syroCompCacheMutex);
+  if (findSyroCompBlock(key)) {
+    pthread_mutex_unlock(&syroCompCacheMutex);
+    free(blockCopy);
+    return true;
+  }
+  // evict oldest blocks first
+  uint32_t evicted = 0;
+  while (evicted < syroCompCacheLength &&
+         syroCompCacheBytes + blockSize > SYRO_COMP_CACHE_MAX_BYTES) {
+    syroCompCacheBytes -= syroCompCache[evicted].blockSize;
+    free(syroCompCache[evicted].block);
+    evicted++;
+  }
+  if (evicted) {
+    memmove(syroCompCache, syroCompCache + evicted,
+            sizeof(SyroCompBlock) * (syroCompCacheLength - evicted));
+    syroCompCacheLength -= evicted;
+  }
+  if (syroCompCacheLength == syroCompCacheCapacity) {
+    uint32_t capacity = syroCompCacheCapacity ? syroCompCacheCapacity * 2 : 16;
+    SyroCompBlock *cache =
+        realloc(syroCompCache, sizeof(SyroCompBlock) * capacity);
+    if (!cache) {
+      pthread_mutex_unlock(&syroCompCacheMutex);
+      free(blockCopy);
+      return false;
+    }
+    syroCompCache = cache;
+    syroCompCacheCapacity = capacity;
+  }
+  SyroCompBlock *entry = syroCompCache + syroCompCacheLength++;
+  entry->key = key;
+  entry->compSize = compSize;
+  entry->blockSize = blockSize;
+  entry->checksum = checksum;
+  entry->block = blockCopy;
+  syroCompCacheBytes += blockSize;
+  pthread_mutex_unlock(&syroCompCacheMutex);
+  return true;
+}
+
+void clearSyroCompCache(void) {
+  pthread_mutex_lock(&syroCompCacheMutex);
+  for (uint32_t i = 0; i < syroCompCacheLength; i++) {
+    free(syroCompCache[i].block);
+  }
+  free(syroCompCache);
+  syroCompCache = NULL;
+  syroCompCacheLength = 0;
+  syroCompCacheCapacity = 0;
+  syroCompCacheBytes = 0;
+  pthread_mutex_unlock(&syroCompCacheMutex);
+}
+
+bool precompressSyroData(SyroData *syro_data) {
+  if (syro_data->DataType != DataType_Sample_Compress || !syro_data->Size) {
+    return true;
+  }
+  int num_of_sample = syro_data->Size / 2;
+  uint64_t key = getSyroCompKeyForSyroData(syro_data);
+  if (hasSyroCompBlock(key)) {
+    return true;
+  }
+  uint32_t compSize = SyroComp_GetCompSize_Korg(
+      syro_data->pData, num_of_sample, syro_data->Quality,
+      syro_data->SampleEndian);
+  uint8_t *block = malloc(compSize);
+  if (!block) {
+    return false;
+  }
+  uint32_t blockSize =
+      SyroComp_Comp_Korg(syro_data->pData, block, num_of_sample,
+                         syro_data->Quality, syro_data->SampleEndian);
+  bool ok = addSyroCompBlock(
+      key, compSize, block, blockSize,
+      getSyroCompBlockChecksum(compSize, block, blockSize));
+  free(block);
+  return ok;
+}
+
+uint32_t SyroComp_GetCompSize(const uint8_t *psrc, int num_of_sample,
+                              int quality, Endian sample_endian) {
+  if (num_of_sample > 0) {
+    uint64_t key = getSyroCompKey(psrc, num_of_sample, quality, sample_endian);
+    pthread_mutex_lock(&syroCompCacheMutex);
+    SyroCompBlock *cached = findSyroCompBlock(key);
+    uint32_t compSize = cached ? cached->compSize : 0;
+    pthread_mutex_unlock(&syroCompCacheMutex);
+    if (cached) {
+      return compSize;
+    }
+  }
+  return SyroComp_GetCompSize_Korg(psrc, num_of_sample, quality,
+                                   sample_endian);
+}
+
+uint32_t SyroComp_Comp(const uint8_t *psrc, uint8_t *pdest, int num_of_sample,
+                       int quality, Endian sample_endian) {
+  if (num_of_sample > 0) {
+    uint64_t key = getSyroCompKey(psrc, num_of_sample, quality, sample_endian);
+    pthread_mutex_lock(&syroCompCacheMutex);
+    SyroCompBlock *cached = findSyroCompBlock(key);
+    // pdest only has room for the compSize SyroComp_GetCompSize gave, so the
+    // block is checked again rather than trusted
+    bool usable = cached &&
+                  getSyroCompBlockChecksum(cached->compSize, cached->block,
+                                           cached->blockSize) ==
+                      cached->checksum;
+    uint32_t blockSize = 0;
+    if (usable) {
+      blockSize = cached->blockSize;
+      memcpy(pdest, cached->block, blockSize);
+    }
+    pthread_mutex_unlock(&syroCompCacheMutex);
+    if (usable) {
+      return blockSize;
+    }
+  }
+  return SyroComp_Comp_Korg(psrc, pdest, num_of_sample, quality,
+                            sample_endian);
+}
@@ -0,0 +1,60 @@
+#ifndef SYRO_COMP_CACHE_H
+#define SYRO_COMP_CACHE_H
+
+#include "./volcasample/syro/korg_syro_volcasample.h"
+#include <stdint.h>
+
+/**
+ * A compressed sample block as produced by the Korg compressor for one
+ * SyroData entry. The key is a 64-bit hash of the 16-bit PCM plus the
+ * parameters that affect compression (sample count, quality and endianness).
+ */
+typedef struct SyroCompBlock {
+  uint64_t key;
+  // value reported by SyroComp_GetCompSize
+  uint32_t compSize;
+  // bytes written by SyroComp_Comp, never more than compSize
+  uint32_t blockSize;
+  // of compSize and the block bytes (see getSyroCompBlockChecksum)
+  uint64_t checksum;
+  uint8_t *block;
+} SyroCompBlock;
+
+uint64_t getSyroCompKey(const uint8_t *psrc, int num_of_sample, int quality,
+                        Endian sample_endian);
+
+uint64_t getSyroCompKeyForSyroData(SyroData *syro_data);
+
+/**
+ * A hash of the block itself, so blocks kept outside of the cache (in
+ * IndexedDB, packs or worker messages) can be checked before they're trusted.
+ */
+uint64_t getSyroCompBlockChecksum(uint32_t compSize, const uint8_t *block,
+                                  uint32_t blockSize);
+
+bool hasSyroCompBlock(uint64_t key);
+
+/**
+ * Returns a copy of the cached block or 0. The copy is a single allocation
+ * (block bytes follow the struct) which the caller must free.
+ */
+SyroCompBlock *getSyroCompBlock(uint64_t key);
+
+/**
+ * Copies the block into the cache. Returns false if out of memory, or if the
+ * block is bigger than compSize (SyroVolcaSample_Start only makes room for
+ * compSize bytes) or doesn't match its checksum.
+ */
+bool addSyroCompBlock(uint64_t key, uint32_t compSize, const uint8_t *block,
+                      uint32_t blockSize, uint64_t checksum);
+
+/**
+ * Compresses a DataType_Sample_Compress entry into the cache (if it isn't
+ * there already) so a later SyroVolcaSample_Start can skip compression.
+ * Safe to call concurrently for different entries.
+ */
+bool precompressSyroData(SyroData *syro_data);
+
+void clearSyroCompCache(void);
+
+#endif
@@ -0,0 +1,329 @@
+// A sample pack: a kit's samples as they are once prepared for the volca, so
+// loading it is a matter of pointing at them rather than decoding and
+// processing every source file again. For each entry there's the mono 16Bit
+// sample data, its compressed block (for DataType_Sample_Compress entries, so
+// nothing needs compressing either), its waveform peak index (see
+// waveform-peaks.c) and where its data starts in the stream the whole pack
+// makes. The format is laid out to be read in place from an mmapped file or a
+// view of wasm memory:
+//
+//   SyroPackHeader
+//   SyroPackEntry * numOfEntries
+//   each entry's sample data, compressed block and peak index, every one
+//   starting at a multiple of SYRO_PACK_ALIGNMENT
+//
+// Offsets are from the start of the pack, and everything is little endian
+// (what every host we build for is), so the structs are read as they are.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYRO_PACK_MAGIC "SYROPACK"
+#define SYRO_PACK_VERSION 2
+#define SYRO_PACK_ALIGNMENT 16
+
+typedef struct SyroPackHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numOfEntries;
+  // total size of the pack, and of the stream its entries make in order
+  // (including the wav header), or 0 if that wasn't known when it was written
+  uint32_t packSize;
+  uint32_t streamSize;
+  uint32_t reserved[2];
+} SyroPackHeader;
+
+typedef struct SyroPackEntry {
+  // getSyroCompKeyForSyroData, for the compressed block
+  uint64_t compKey;
+  uint32_t dataType;
+  uint32_t slotNumber;
+  uint32_t quality;
+  uint32_t sampleRate;
+  uint32_t numOfFrames;
+  uint32_t sampleDataOffset;
+  // the compressed block (blockSize 0 if there isn't one) and the compSize
+  // that goes with it, as in SyroCompBlock
+  uint32_t blockOffset;
+  uint32_t blockSize;
+  uint32_t compSize;
+  // getWaveformPeakIndexLength(numOfFrames) floats
+  uint32_t peaksOffset;
+  // where the entry's data starts in the pack's stream, as in
+  // SampleBufferContainer's dataStartPoints (so 0 for the first entry)
+  uint32_t dataStartPoint;
+  uint32_t reserved;
+  // getSyroCompBlockChecksum, for the compressed block
+  uint64_t blockChecksum;
+} SyroPackEntry;
+
+_Static_assert(sizeof(SyroPackHeader) % SYRO_PACK_ALIGNMENT == 0,
+               "entries must stay aligned");
+_Static_assert(sizeof(SyroPackEntry) % SYRO_PACK_ALIGNMENT == 0,
+               "entries must stay aligned");
+
+static inline uint32_t alignSyroPackOffset(uint32_t offset) {
+  return (offset + SYRO_PACK_ALIGNMENT - 1) & ~(SYRO_PACK_ALIGNMENT - 1);
+}
+
+/**
+ * Fills in where each entry's data starts in the stream the pack's entries
+ * make, and that stream's size (dataStartPoints may be NULL if only the size
+ * is known).
+ */
+void setSyroPackStreamLayout(uint8_t *pack, const uint32_t *dataStartPoints,
+                             uint32_t streamSize) {
+  SyroPackHeader *header = (SyroPackHeader *)pack;
+  SyroPackEntry *entries = (SyroPackEntry *)(header + 1);
+  header->streamSize = streamSize;
+  for (uint32_t i = 0; i < header->numOfEntries; i++) {
+    entries[i].dataStartPoint =
+        dataStartPoints && i < 110 ? dataStartPoints[i] : 0;
+  }
+}
+
+static void freeSyroPackBlocks(SyroCompBlock **blocks, uint32_t NumOfData) {
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    free(blocks[i]);
+  }
+  free(blocks);
+}
+
+/**
+ * Gets copies of the entries' compressed blocks (NULL for
+ * DataType_Sample_Liner ones) and works out the pack's size and the longest
+ * entry. Returns NULL if an entry isn't a sample or isn't compressed yet.
+ */
+static SyroCompBlock **getSyroPackBlocks(SyroData *syro_data,
+                                         uint32_t NumOfData, uint64_t *size,
+                                         uint32_t *maxNumOfFrames) {
+  SyroCompBlock **blocks =
+      calloc(NumOfData ? NumOfData : 1, sizeof(SyroCompBlock *));
+  if (!blocks) {
+    printf("not enough memory for pack. \n");
+    return NULL;
+  }
+  *size = sizeof(SyroPackHeader) + sizeof(SyroPackEntry) * NumOfData;
+  *maxNumOfFrames = 0;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    if (current_syro_data->DataType != DataType_Sample_Liner &&
+        current_syro_data->DataType != DataType_Sample_Compress) {
+      printf("pack error, entry %u is not a sample.\n", i);
+      freeSyroPackBlocks(blocks, NumOfData);
+      return NULL;
+    }
+    uint32_t numOfFrames = current_syro_data->Size / 2;
+    if (numOfFrames > *maxNumOfFrames) {
+      *maxNumOfFrames = numOfFrames;
+    }
+    *size = alignSyroPackOffset(*size) + numOfFrames * 2;
+    if (current_syro_data->DataType == DataType_Sample_Compress) {
+      blocks[i] =
+          getSyroCompBlock(getSyroCompKeyForSyroData(current_syro_data));
+      if (!blocks[i]) {
+        printf("pack error, entry %u is not compressed.\n", i);
+        freeSyroPackBlocks(blocks, NumOfData);
+        return NULL;
+      }
+      *size = alignSyroPackOffset(*size) + blocks[i]->blockSize;
+    }
+    *size = alignSyroPackOffset(*size) +
+            sizeof(float) * getWaveformPeakIndexLength(numOfFrames);
+  }
+  return blocks;
+}
+
+/**
+ * Builds a pack from prepared syro data entries (DataType_Sample_Compress ones
+ * already compressed with precompressSyroData). dataStartPoints (110 entries,
+ * may be NULL) and streamSize describe the stream the entries make, and can
+ * be filled in later with setSyroPackStreamLayout.
+ *
+ * Returns the pack (to be freed) and its size in packSize, or NULL if an
+ * entry isn't a sample, its compressed block isn't cached or we're out of
+ * memory.
+ */
+uint8_t *createSyroPack(SyroData *syro_data, uint32_t NumOfData,
+                        const uint32_t *dataStartPoints, uint32_t streamSize,
+                        uint32_t *packSize) {
+  uint64_t size;
+  uint32_t maxNumOfFrames;
+  SyroCompBlock **blocks =
+      getSyroPackBlocks(syro_data, NumOfData, &size, &maxNumOfFrames);
+  if (!blocks) {
+    return NULL;
+  }
+  if (size > UINT32_MAX) {
+    printf("pack error, too big.\n");
+    freeSyroPackBlocks(blocks, NumOfData);
+    return NULL;
+  }
+  uint8_t *pack = calloc(1, size);
+  // the peaks are built over the samples as floats, as the app has them
+  float *samples =
+      malloc(sizeof(float) * (maxNumOfFrames ? maxNumOfFrames : 1));
+  if (!pack || !samples) {
+    printf("not enough memory for pack. \n");
+    free(pack);
+    free(samples);
+    freeSyroPackBlocks(blocks, NumOfData);
+    return NULL;
+  }
+  SyroPackHeader *header = (SyroPackHeader *)pack;
+  memcpy(header->magic, SYRO_PACK_MAGIC, sizeof(header->magic));
+  header->version = SYRO_PACK_VERSION;
+  header->numOfEntries = NumOfData;
+  header->packSize = (uint32_t)size;
+  SyroPackEntry *entries = (SyroPackEntry *)(header + 1);
+  uint32_t offset = sizeof(SyroPackHeader) + sizeof(SyroPackEntry) * NumOfData;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    SyroPackEntry *entry = entries + i;
+    uint32_t numOfFrames = current_syro_data->Size / 2;
+    entry->compKey = getSyroCompKeyForSyroData(current_syro_data);
+    entry->dataType = current_syro_data->DataType;
+    entry->slotNumber = current_syro_data->Number;
+    entry->quality = current_syro_data->Quality;
+    entry->sampleRate = current_syro_data->Fs;
+    entry->numOfFrames = numOfFrames;
+    entry->sampleDataOffset = offset = alignSyroPackOffset(offset);
+    memcpy(pack + offset, current_syro_data->pData, numOfFrames * 2);
+    offset += numOfFrames * 2;
+    if (blocks[i]) {
+      entry->blockOffset = offset = alignSyroPackOffset(offset);
+      entry->blockSize = blocks[i]->blockSize;
+      entry->compSize = blocks[i]->compSize;
+      entry->blockChecksum = blocks[i]->checksum;
+      memcpy(pack + offset, blocks[i]->block, blocks[i]->blockSize);
+      offset += blocks[i]->blockSize;
+    }
+    entry->peaksOffset = offset = alignSyroPackOffset(offset);
+    const int16_t *pcm = (const int16_t *)current_syro_data->pData;
+    for (uint32_t j = 0; j < numOfFrames; j++) {
+      samples[j] = pcm[j] / 32768.0f;
+    }
+    buildWaveformPeaks(samples, numOfFrames, (float *)(pack + offset));
+    offset += sizeof(float) * getWaveformPeakIndexLength(numOfFrames);
+  }
+  free(samples);
+  freeSyroPackBlocks(blocks, NumOfData);
+  setSyroPackStreamLayout(pack, dataStartPoints, streamSize);
+  *packSize = (uint32_t)size;
+  return pack;
+}
+
+typedef struct SyroPack {
+  const uint8_t *data;
+  const SyroPackHeader *header;
+  const SyroPackEntry *entries;
+} SyroPack;
+
+static bool isInSyroPack(uint32_t size, uint32_t offset, uint64_t bytes) {
+  return offset % SYRO_PACK_ALIGNMENT == 0 && offset + bytes <= size;
+}
+
+/**
+ * Checks the size bytes at data are a pack we can read, and points pack at
+ * its parts. Nothing is copied, so data has to outlive pack. Returns false
+ * (having printed why) if it isn't a pack or is cut short.
+ */
+bool openSyroPack(const uint8_t *data, uint32_t size, SyroPack *pack) {
+  const SyroPackHeader *header = (const SyroPackHeader *)data;
+  if ((uintptr_t)data % sizeof(uint64_t)) {
+    printf("pack error, not aligned.\n");
+    return false;
+  }
+  if (size < sizeof(SyroPackHeader) ||
+      memcmp(header->magic, SYRO_PACK_MAGIC, sizeof(header->magic))) {
+    printf("pack error, 'SYROPACK' is not found.\n");
+    return false;
+  }
+  if (header->version != SYRO_PACK_VERSION) {
+    printf("pack error, version %u is not supported.\n", header->version);
+    return false;
+  }
+  if (header->packSize > size ||
+      header->numOfEntries > (size - sizeof(SyroPackHeader)) /
+                                 sizeof(SyroPackEntry)) {
+    printf("pack error, too small.\n");
+    return false;
+  }
+  const SyroPackEntry *entries = (const SyroPackEntry *)(header + 1);
+  for (uint32_t i = 0; i < header->numOfEntries; i++) {
+    const SyroPackEntry *entry = entries + i;
+    if ((entry->dataType != DataType_Sample_Liner &&
+         entry->dataType != DataType_Sample_Compress) ||
+        entry->slotNumber > 99 || entry->quality < 8 || entry->quality > 16 ||
+        !isInSyroPack(size, entry->sampleDataOffset,
+                      (uint64_t)entry->numOfFrames * 2) ||
+        !isInSyroPack(size, entry->peaksOffset,
+                      sizeof(float) * (uint64_t)getWaveformPeakIndexLength(
+                                          entry->numOfFrames)) ||
+        (entry->dataType == DataType_Sample_Compress &&
+         (!entry->blockSize || entry->blockSize > entry->compSize ||
+          !isInSyroPack(size, entry->blockOffset, entry->blockSize)))) {
+      printf("pack error, entry %u is broken.\n", i);
+      return false;
+    }
+  }
+  pack->data = data;
+  pack->header = header;
+  pack->entries = entries;
+  return true;
+}
+
+/**
+ * The entry's waveform peak index (see buildWaveformPeaks), in place.
+ */
+const float *getSyroPackPeaks(const SyroPack *pack, uint32_t index) {
+  return (const float *)(pack->data + pack->entries[index].peaksOffset);
+}
+
+/**
+ * Sets up a syro data entry from a pack entry: a copy of its sample data
+ * (owned by the entry as usual), with its compressed block put in the cache
+ * so it never has to be compressed. Returns false if out of memory, or if the
+ * block doesn't belong to the sample data or is damaged.
+ */
+bool setupSyroDataFromSyroPack(const SyroPack *pack, uint32_t index,
+                               SyroData *syro_data) {
+  const SyroPackEntry *entry = pack->entries + index;
+  uint32_t size = entry->numOfFrames * 2;
+  syro_data->pData = malloc(size ? size : 1);
+  if (!syro_data->pData) {
+    printf("not enough memory to setup file. \n");
+    return false;
+  }
+  memcpy(syro_data->pData, pack->data + entry->sampleDataOffset, size);
+  syro_data->DataType = entry->dataType;
+  syro_data->Number = entry->slotNumber;
+  syro_data->Quality = entry->quality;
+  syro_data->Size = size;
+  syro_data->Fs = entry->sampleRate;
+  syro_data->SampleEndian = LittleEndian;
+  if (entry->dataType != DataType_Sample_Compress) {
+    return true;
+  }
+  // (hashing is cheap next to compressing. The samples' hash makes sure the
+  // block is for them, and the block's own checksum that it isn't damaged,
+  // which addSyroCompBlock checks)
+  uint64_t key = getSyroCompKeyForSyroData(syro_data);
+  if (key != entry->compKey) {
+    printf("pack error, entry %u doesn't match its compressed block.\n",
+           index);
+  } else if (hasSyroCompBlock(key) ||
+             addSyroCompBlock(key, entry->compSize,
+                              pack->data + entry->blockOffset,
+                              entry->blockSize, entry->blockChecksum)) {
+    return true;
+  } else {
+    printf("pack error, entry %u's compressed block is damaged.\n", index);
+  }
+  free(syro_data->pData);
+  syro_data->pData = NULL;
+  return false;
+}
@@ -0,0 +1,364 @@
+// Encodes the segments of a stream (one per syro data entry) on several
+// threads at once, each written straight to its place in the output. This
+// relies on each segment being what the entry would make in a stream of its
+// own, minus the footer, which is checked once per process by encoding a
+// small stream both ways (see isParallelSyroEncodingExact). If that doesn't
+// hold, startParallelSyroStream always returns 0 and callers encode the
+// stream in order as before.
+
+#include "./thread-pool.c"
+#include <stdatomic.h>
+
+#define PARALLEL_STREAM_ITERATION_FRAMES 8192
+#define PARALLEL_PROBE_FRAMES 700
+
+// Output goes either straight into a buffer holding the whole stream, or to a
+// sink that may be called from several threads at once (with distinct
+// ranges). Returns false to stop the encode.
+typedef bool (*SyroStreamSink)(uint32_t offset, const uint8_t *bytes,
+                               uint32_t size, void *arg);
+
+typedef struct ParallelSyroStream {
+  SyroData *syro_data;
+  uint32_t NumOfData;
+  // each entry's stream on its own (opened by startParallelSyroStream)
+  SyroHandle *handles;
+  // bytes of the output each segment covers, and where it starts. the last
+  // segment includes the footer.
+  uint32_t *segmentSizes;
+  uint32_t *offsets;
+  // total size of the stream, including the wav header
+  uint32_t size;
+  // where (in the entry's own stream) each entry's data ends and the next
+  // one's would start, or 0 if not seen
+  uint32_t *nextStartPoints;
+  // set by runParallelSyroStream
+  uint8_t *buffer;
+  SyroStreamSink sink;
+  void *sinkArg;
+  uint32_t *dataStartPoints;
+  _Atomic uint32_t *progress;
+  _Atomic uint32_t *cancelled;
+  _Atomic uint32_t failed;
+  // bytes written so far per segment, for publishing progress
+  _Atomic uint32_t *written;
+  pthread_mutex_t progressMutex;
+  uint32_t headSegment;
+} ParallelSyroStream;
+
+static bool parallelSyroEncodingExact = false;
+static pthread_once_t parallelSyroProbeOnce = PTHREAD_ONCE_INIT;
+
+static void startParallelSegmentTask(uint32_t index, void *streamPointer) {
+  ParallelSyroStream *stream = (ParallelSyroStream *)streamPointer;
+  uint32_t frame;
+  if (SyroVolcaSample_Start(stream->handles + index, stream->syro_data + index,
+                            1, 0, &frame) != Status_Success) {
+    stream->handles[index] = NULL;
+    atomic_store(&stream->failed, 1);
+    return;
+  }
+  stream->segmentSizes[index] = frame * 4;
+}
+
+/**
+ * Frees a stream from startParallelSyroStream (the syro data is the caller's).
+ */
+void freeParallelSyroStream(ParallelSyroStream *stream) {
+  for (uint32_t i = 0; i < stream->NumOfData; i++) {
+    if (stream->handles[i]) {
+      SyroVolcaSample_End(stream->handles[i]);
+    }
+  }
+  pthread_mutex_destroy(&stream->progressMutex);
+  free(stream->handles);
+  free(stream->segmentSizes);
+  free(stream->offsets);
+  free(stream->nextStartPoints);
+  free(stream->written);
+  free(stream);
+}
+
+/**
+ * Lays out a stream for runParallelSyroStream: opens each entry's own stream
+ * (across the pool, since this compresses any samples that aren't cached)
+ * and works out where each segment goes. Returns 0 if the stream has to be
+ * encoded in order instead.
+ */
+static ParallelSyroStream *startParallelSyroStreamUnchecked(
+    ThreadPool *pool, SyroData *syro_data, uint32_t NumOfData) {
+  if (NumOfData < 2) {
+    return 0;
+  }
+  ParallelSyroStream *stream = calloc(1, sizeof(ParallelSyroStream));
+  stream->syro_data = syro_data;
+  stream->NumOfData = NumOfData;
+  stream->handles = calloc(NumOfData, sizeof(SyroHandle));
+  stream->segmentSizes = calloc(NumOfData, sizeof(uint32_t));
+  stream->offsets = calloc(NumOfData, sizeof(uint32_t));
+  stream->nextStartPoints = calloc(NumOfData, sizeof(uint32_t));
+  stream->written = calloc(NumOfData, sizeof(_Atomic uint32_t));
+  pthread_mutex_init(&stream->progressMutex, NULL);
+  if (pool) {
+    threadPoolRun(pool, NumOfData, startParallelSegmentTask, stream);
+  } else {
+    for (uint32_t i = 0; i < NumOfData; i++) {
+      startParallelSegmentTask(i, stream);
+    }
+  }
+  // the footer's size is whatever the entries' own streams have on top of
+  // the whole one. (any compressing happened just now, so this is quick.)
+  uint32_t frame;
+  SyroHandle handle;
+  if (atomic_load(&stream->failed) ||
+      SyroVolcaSample_Start(&handle, syro_data, NumOfData, 0, &frame) !=
+          Status_Success) {
+    freeParallelSyroStream(stream);
+    return 0;
+  }
+  SyroVolcaSample_End(handle);
+  uint64_t segmentsSize = 0;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    segmentsSize += stream->segmentSizes[i];
+  }
+  uint64_t wholeSize = (uint64_t)frame * 4;
+  uint64_t extraFooters = NumOfData - 1;
+  if (segmentsSize <= wholeSize ||
+      (segmentsSize - wholeSize) % (extraFooters * 4)) {
+    freeParallelSyroStream(stream);
+    return 0;
+  }
+  uint32_t footerSize = (uint32_t)((segmentsSize - wholeSize) / extraFooters);
+  uint32_t offset = sizeof(wav_header);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (stream->segmentSizes[i] < footerSize) {
+      freeParallelSyroStream(stream);
+      return 0;
+    }
+    if (i + 1 < NumOfData) {
+      stream->segmentSizes[i] -= footerSize;
+    }
+    stream->offsets[i] = offset;
+    offset += stream->segmentSizes[i];
+  }
+  stream->size = offset;
+  return stream;
+}
+
+static bool writeParallelSyroStream(ParallelSyroStream *stream,
+                                    uint32_t offset, const uint8_t *bytes,
+                                    uint32_t size) {
+  if (stream->buffer) {
+    if (bytes != stream->buffer + offset) {
+      memcpy(stream->buffer + offset, bytes, size);
+    }
+    return true;
+  }
+  return stream->sink(offset, bytes, size, stream->sinkArg);
+}
+
+// Progress is how far the stream is written without gaps.
+static void publishParallelSyroProgress(ParallelSyroStream *stream) {
+  if (!stream->progress) {
+    return;
+  }
+  pthread_mutex_lock(&stream->progressMutex);
+  while (stream->headSegment < stream->NumOfData &&
+         atomic_load(stream->written + stream->headSegment) ==
+             stream->segmentSizes[stream->headSegment]) {
+    stream->headSegment++;
+  }
+  uint32_t progress =
+      stream->headSegment < stream->NumOfData
+          ? stream->offsets[stream->headSegment] +
+                atomic_load(stream->written + stream->headSegment)
+          : stream->size;
+  if (progress > atomic_load(stream->progress)) {
+    atomic_store(stream->progress, progress);
+  }
+  pthread_mutex_unlock(&stream->progressMutex);
+}
+
+static void encodeParallelSegmentTask(uint32_t index, void *streamPointer) {
+  ParallelSyroStream *stream = (ParallelSyroStream *)streamPointer;
+  SyroHandle handle = stream->handles[index];
+  uint32_t segmentSize = stream->segmentSizes[index];
+  uint32_t offset = stream->offsets[index];
+  uint8_t *chunk =
+      stream->buffer ? NULL : malloc(PARALLEL_STREAM_ITERATION_FRAMES * 4);
+  uint32_t CurData = SyroVolcaSample_GetCurData(handle);
+  SyroDataStart starts[8];
+  uint32_t done = 0;
+  while (done < segmentSize && !atomic_load(&stream->failed) &&
+         !(stream->cancelled && atomic_load(stream->cancelled))) {
+    uint32_t frames = (segmentSize - done) / 4;
+    if (frames > PARALLEL_STREAM_ITERATION_FRAMES) {
+      frames = PARALLEL_STREAM_ITERATION_FRAMES;
+    }
+    uint8_t *dest = chunk ? chunk : stream->buffer + offset + done;
+    uint32_t numOfStarts;
+    frames = getSyroFrames(handle, (int16_t *)dest, frames, &CurData, starts,
+                           sizeof(starts) / sizeof(SyroDataStart),
+                           &numOfStarts);
+    for (uint32_t i = 0; i < numOfStarts; i++) {
+      if (starts[i].dataIndex == 1) {
+        stream->nextStartPoints[index] = done + starts[i].frame * 4;
+      }
+    }
+    if (!writeParallelSyroStream(stream, offset + done, dest, frames * 4)) {
+      atomic_store(&stream->failed, 1);
+      break;
+    }
+    done += frames * 4;
+    atomic_store(stream->written + index, done);
+    publishParallelSyroProgress(stream);
+  }
+  if (done == segmentSize && !CurData && index + 1 < stream->NumOfData) {
+    // the next entry may start on the first frame of this one's footer,
+    // which we don't write
+    int16_t frame[2];
+    SyroVolcaSample_GetSample(handle, frame, frame + 1);
+    if (SyroVolcaSample_GetCurData(handle)) {
+      stream->nextStartPoints[index] = segmentSize;
+    }
+  }
+  free(chunk);
+}
+
+/**
+ * Encodes a stream from startParallelSyroStream across the pool. Output goes
+ * straight into buffer (stream->size bytes) if given, or else to sink.
+ * dataStartPoints (110 entries, may be NULL) gets each entry's start point
+ * before progress passes it. progress (may be NULL) is updated with how much
+ * of the stream is written without gaps, and cancelled (may be NULL) stops
+ * the encode once set. Returns false if it was stopped or the sink failed.
+ */
+bool runParallelSyroStream(ThreadPool *pool, ParallelSyroStream *stream,
+                           uint8_t *buffer, SyroStreamSink sink, void *sinkArg,
+                           uint32_t *dataStartPoints,
+                           _Atomic uint32_t *progress,
+                           _Atomic uint32_t *cancelled) {
+  stream->buffer = buffer;
+  stream->sink = sink;
+  stream->sinkArg = sinkArg;
+  stream->dataStartPoints = dataStartPoints;
+  stream->progress = progress;
+  stream->cancelled = cancelled;
+  uint8_t header[sizeof(wav_header)];
+  writeSyroWavHeader(header, (stream->size - sizeof(wav_header)) / 4);
+  if (!writeParallelSyroStream(stream, 0, header, sizeof(header))) {
+    return false;
+  }
+  if (progress) {
+    atomic_store(progress, sizeof(header));
+  }
+  if (pool) {
+    threadPoolRun(pool, stream->NumOfData, encodeParallelSegmentTask, stream);
+  } else {
+    for (uint32_t i = 0; i < stream->NumOfData; i++) {
+      encodeParallelSegmentTask(i, stream);
+    }
+  }
+  if (atomic_load(&stream->failed) ||
+      (cancelled && atomic_load(cancelled))) {
+    return false;
+  }
+  if (dataStartPoints) {
+    // as in iterateSampleBuffer, the first entry's start point is never set
+    for (uint32_t i = 0; i < stream->NumOfData && i + 1 < 110; i++) {
+      if (stream->nextStartPoints[i]) {
+        dataStartPoints[i + 1] =
+            stream->offsets[i] + stream->nextStartPoints[i];
+      }
+    }
+  }
+  publishParallelSyroProgress(stream);
+  return true;
+}
+
+// Encodes a small stream with a sample of each kind and an erase entry both
+// ways, and compares them.
+static void probeParallelSyroEncoding(void) {
+  const uint32_t NumOfData = 3;
+  SyroData syro_data[3];
+  uint32_t seed = 12345;
+  for (uint32_t i = 0; i < 2; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    current_syro_data->DataType =
+        i ? DataType_Sample_Compress : DataType_Sample_Liner;
+    current_syro_data->Number = i;
+    current_syro_data->Quality = i ? 12 : 16;
+    current_syro_data->Fs = 31250;
+    current_syro_data->SampleEndian = LittleEndian;
+    current_syro_data->Size = (PARALLEL_PROBE_FRAMES + i * 300) * 2;
+    current_syro_data->pData = malloc(current_syro_data->Size);
+    for (uint32_t j = 0; j < current_syro_data->Size; j++) {
+      seed = seed * 1103515245 + 12345;
+      current_syro_data->pData[j] = (uint8_t)(seed >> 16);
+    }
+  }
+  setupEraseSyroData(syro_data + 2, 2);
+
+  SyroData *sequential_syro_data = malloc(sizeof(SyroData) * NumOfData);
+  memcpy(sequential_syro_data, syro_data, sizeof(SyroData) * NumOfData);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (syro_data[i].Size) {
+      sequential_syro_data[i].pData = malloc(syro_data[i].Size);
+      memcpy(sequential_syro_data[i].pData, syro_data[i].pData,
+             syro_data[i].Size);
+    }
+  }
+  SampleBufferContainer *sampleBuffer =
+      startSampleBuffer(sequential_syro_data, NumOfData);
+  ParallelSyroStream *stream =
+      startParallelSyroStreamUnchecked(NULL, syro_data, NumOfData);
+  if (sampleBuffer && stream && stream->size == sampleBuffer->size) {
+    uint32_t dataStartPoints[110] = {0};
+    uint8_t *buffer = malloc(stream->size);
+    iterateSampleBuffer(sampleBuffer, INT32_MAX);
+    parallelSyroEncodingExact =
+        runParallelSyroStream(NULL, stream, buffer, NULL, NULL,
+                              dataStartPoints, NULL, NULL) &&
+        !memcmp(buffer, sampleBuffer->buffer, stream->size) &&
+        !memcmp(dataStartPoints, sampleBuffer->dataStartPoints,
+                sizeof(dataStartPoints));
+    free(buffer);
+  }
+  if (stream) {
+    freeParallelSyroStream(stream);
+  }
+  if (sampleBuffer) {
+    if (sampleBuffer->progress < sampleBuffer->size) {
+      SyroVolcaSample_End(sampleBuffer->syro_handle);
+    }
+    free_syrodata(sequential_syro_data, NumOfData);
+    freeSampleBuffer(sampleBuffer);
+  } else {
+    free_syrodata(sequential_syro_data, NumOfData);
+    free(sequential_syro_data);
+  }
+  free_syrodata(syro_data, NumOfData);
+  if (!parallelSyroEncodingExact) {
+    printf("Stream segments don't match an encode in order, so streams will "
+           "be encoded in order.\n");
+  }
+}
+
+bool isParallelSyroEncodingExact(void) {
+  pthread_once(&parallelSyroProbeOnce, probeParallelSyroEncoding);
+  return parallelSyroEncodingExact;
+}
+
+/**
+ * Returns a stream to pass to runParallelSyroStream (free it with
+ * freeParallelSyroStream), or 0 if the stream has to be encoded in order.
+ * The syro data must stay alive until then. The pool may be NULL.
+ */
+ParallelSyroStream *startParallelSyroStream(ThreadPool *pool,
+                                            SyroData *syro_data,
+                                            uint32_t NumOfData) {
+  if (!isParallelSyroEncodingExact()) {
+    return 0;
+  }
+  return startParallelSyroStreamUnchecked(pool, syro_data, NumOfData);
+}
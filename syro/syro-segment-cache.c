@@ -0,0 +1,689 @@
+// A syrostream is a wav header, then a segment for each syro data entry, then
+// a footer. If a segment depends only on its own entry (its sample data, slot
+// and parameters), a stream can be put together from segments encoded before.
+// Changing one sample in a big kit then only means encoding that sample
+// again, and erasing any set of slots means no encoding at all. This keeps the
+// stream each entry makes on its own (its segment plus a footer, since the
+// last entry's footer ends the stream), keyed by the entry, and puts streams
+// together from those.
+//
+// Whether segments really are independent is up to the encoder, so this is
+// checked before we rely on it. A stream encoded the normal way is compared,
+// by hash, with the same stream put together from its entries. If they differ,
+// streams are always encoded in full. Erase segments and segments with sample
+// data are each checked on their own, and only a kind whose own check passed
+// is put together: one kind passing says nothing about the other. Every
+// stream put together is also checked against the frame count
+// SyroVolcaSample_Start gives for its entries (see syro-stream-length.c),
+// since one check can't cover every mix of slots and sizes. A stream with a
+// single entry is exactly that entry's cached stream, so it can always come
+// from the cache.
+
+#include <emscripten.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cached streams are about 8 times the size of their sample data, so this
+// only keeps a few recent kits' worth. Least recently used ones are evicted
+// past it, to keep the main thread's memory bounded like the workers'.
+#define SYRO_SEGMENT_CACHE_MAX_BYTES (48 * 1024 * 1024)
+// sample2 slots go up to 199
+#define MAX_ERASE_SEGMENT_SLOTS 200
+// the slots in the erase stream used to check erase segments
+#define ERASE_CHECK_SLOT_A 0
+#define ERASE_CHECK_SLOT_B 1
+
+typedef struct SyroSegment {
+  uint64_t key;
+  // queued for encoding in the background, no stream yet
+  bool pending;
+  // the entry's whole stream on its own, without the wav header
+  uint8_t *stream;
+  uint32_t size;
+  // where that stream reports the footer starting (its dataStartPoints[1]),
+  // also without the wav header
+  uint32_t footerStartPoint;
+  // bytes of sample data the entry carries (see SyroStreamUpdate)
+  uint32_t dataSize;
+  // jobs reading the stream, which can't be evicted until they're done
+  uint32_t users;
+  uint32_t lastUsed;
+} SyroSegment;
+
+typedef enum {
+  SyroSegments_Erase = 0,
+  SyroSegments_Sample,
+  NUM_OF_SEGMENT_KINDS,
+} SyroSegmentKind;
+
+typedef enum {
+  SegmentCheck_Unchecked = 0,
+  SegmentCheck_Checking,
+  SegmentCheck_Usable,
+  SegmentCheck_Unusable,
+} SegmentCheckState;
+
+// a stream encoded the normal way, waiting for its entries' segments so it
+// can be compared with the stream they make
+typedef struct SyroSegmentCheck {
+  SyroSegmentKind kind;
+  uint32_t NumOfData;
+  uint64_t *keys;
+  uint32_t size;
+  uint64_t hash;
+  uint32_t dataStartPoints[110];
+} SyroSegmentCheck;
+
+// a precomputeEraseStreams call waiting for its segments
+typedef struct EraseStreamsWatch {
+  uint32_t NumOfSlots;
+  void (*onDone)(uint32_t);
+  struct EraseStreamsWatch *next;
+} EraseStreamsWatch;
+
+static SyroSegment **syroSegments = NULL;
+static uint32_t numOfSyroSegments = 0;
+static uint32_t syroSegmentsCapacity = 0;
+static uint32_t syroSegmentsBytes = 0;
+static uint32_t syroSegmentsClock = 0;
+static SegmentCheckState segmentCheckStates[NUM_OF_SEGMENT_KINDS];
+static SyroSegmentCheck *segmentChecks[NUM_OF_SEGMENT_KINDS];
+// size of the footer each kind's streams end with, known once its check has
+// passed
+static uint32_t syroFooterSizes[NUM_OF_SEGMENT_KINDS];
+static EraseStreamsWatch *eraseStreamsWatches = NULL;
+
+static SyroSegmentKind getSyroSegmentKind(SyroData *syro_data,
+                                          uint32_t NumOfData) {
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (syro_data[i].Size) {
+      return SyroSegments_Sample;
+    }
+  }
+  return SyroSegments_Erase;
+}
+
+static uint32_t getSyroFooterSize(SyroSegment **segments, uint32_t NumOfData) {
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (segments[i]->dataSize) {
+      return syroFooterSizes[SyroSegments_Sample];
+    }
+  }
+  return syroFooterSizes[SyroSegments_Erase];
+}
+
+/**
+ * Starts (or continues) a hash of stream bytes. Streams are only ever split
+ * on frame boundaries, so the hash comes out the same however the stream is
+ * chunked.
+ */
+static uint64_t hashSyroStream(uint64_t hash, const uint8_t *bytes,
+                               uint32_t size) {
+  const uint64_t prime = 0x100000001b3ULL;
+  uint32_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    uint32_t word;
+    memcpy(&word, bytes + i, 4);
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  return hash;
+}
+
+#define SYRO_STREAM_HASH_START 0xcbf29ce484222325ULL
+
+static SyroSegment *findSyroSegment(uint64_t key) {
+  for (uint32_t i = 0; i < numOfSyroSegments; i++) {
+    if (syroSegments[i]->key == key) {
+      return syroSegments[i];
+    }
+  }
+  return NULL;
+}
+
+static void removeSyroSegment(uint32_t index) {
+  SyroSegment *segment = syroSegments[index];
+  syroSegmentsBytes -= segment->size;
+  free(segment->stream);
+  free(segment);
+  syroSegments[index] = syroSegments[--numOfSyroSegments];
+}
+
+// evicts unused segments, least recently used first, until bytes more fit
+static void makeRoomForSyroSegment(uint32_t bytes) {
+  while (syroSegmentsBytes + bytes > SYRO_SEGMENT_CACHE_MAX_BYTES) {
+    int32_t oldest = -1;
+    for (uint32_t i = 0; i < numOfSyroSegments; i++) {
+      SyroSegment *segment = syroSegments[i];
+      if (segment->stream && !segment->users &&
+          (oldest == -1 ||
+           segment->lastUsed < syroSegments[oldest]->lastUsed)) {
+        oldest = (int32_t)i;
+      }
+    }
+    if (oldest == -1) {
+      return;
+    }
+    removeSyroSegment(oldest);
+  }
+}
+
+// finds or adds the cache entry for key (with no stream yet if it's new)
+static SyroSegment *getOrAddSyroSegment(uint64_t key) {
+  SyroSegment *segment = findSyroSegment(key);
+  if (segment) {
+    return segment;
+  }
+  if (numOfSyroSegments == syroSegmentsCapacity) {
+    uint32_t capacity = syroSegmentsCapacity ? syroSegmentsCapacity * 2 : 64;
+    SyroSegment **grown =
+        realloc(syroSegments, sizeof(SyroSegment *) * capacity);
+    if (!grown) {
+      return NULL;
+    }
+    syroSegments = grown;
+    syroSegmentsCapacity = capacity;
+  }
+  segment = calloc(1, sizeof(SyroSegment));
+  if (!segment) {
+    return NULL;
+  }
+  segment->key = key;
+  syroSegments[numOfSyroSegments++] = segment;
+  return segment;
+}
+
+static void checkSyroSegments(void);
+static void notifyEraseStreamsWatches(void);
+
+/**
+ * Saves a single entry's stream from an encodeSyroStreamWork response.
+ */
+static void addSyroSegment(char *data, int size) {
+  SyroStreamUpdate *streamUpdate = (SyroStreamUpdate *)data;
+  if (size < (int)sizeof(SyroStreamUpdate) ||
+      streamUpdate->totalSize <= sizeof(wav_header)) {
+    return;
+  }
+  SyroSegment *segment = getOrAddSyroSegment(streamUpdate->segmentKey);
+  if (!segment || segment->stream) {
+    // (or someone else encoded it first)
+    return;
+  }
+  uint32_t streamSize = streamUpdate->totalSize - sizeof(wav_header);
+  makeRoomForSyroSegment(streamSize);
+  // the response buffer is reused, so keep a copy
+  segment->stream = malloc(streamSize);
+  if (!segment->stream) {
+    return;
+  }
+  memcpy(segment->stream,
+         (uint8_t *)data + sizeof(SyroStreamUpdate) + sizeof(wav_header),
+         streamSize);
+  segment->size = streamSize;
+  segment->footerStartPoint =
+      streamUpdate->dataStartPoints[1] - sizeof(wav_header);
+  segment->dataSize = streamUpdate->dataSize;
+  segment->pending = false;
+  segment->lastUsed = ++syroSegmentsClock;
+  syroSegmentsBytes += streamSize;
+  checkSyroSegments();
+}
+
+static void onSyroSegmentResponse(char *data, int size, void *keyPointer) {
+  uint64_t key = *(uint64_t *)keyPointer;
+  free(keyPointer);
+  addSyroSegment(data, size);
+  // drop the placeholder if encoding failed, so it can be tried again
+  for (uint32_t i = 0; i < numOfSyroSegments; i++) {
+    SyroSegment *segment = syroSegments[i];
+    if (segment->key == key && !segment->stream) {
+      removeSyroSegment(i);
+      checkSyroSegments();
+      break;
+    }
+  }
+}
+
+/**
+ * Queues a single entry's stream for encoding in the background, unless it's
+ * cached or queued already. The entry is copied.
+ */
+static void cacheSyroSegment(SyroData *syro_data, int32_t priority) {
+  SyroSegment *segment = getOrAddSyroSegment(getSyroSegmentKey(syro_data));
+  if (!segment || segment->stream || segment->pending) {
+    return;
+  }
+  SyroData *copy = malloc(sizeof(SyroData));
+  uint64_t *key = malloc(sizeof(uint64_t));
+  if (!copy || !key) {
+    free(copy);
+    free(key);
+    return;
+  }
+  *copy = *syro_data;
+  if (syro_data->Size) {
+    copy->pData = malloc(syro_data->Size);
+    if (!copy->pData) {
+      free(copy);
+      free(key);
+      return;
+    }
+    memcpy(copy->pData, syro_data->pData, syro_data->Size);
+  }
+  segment->pending = true;
+  *key = segment->key;
+  int messageSize;
+  uint8_t *message = createSyroStartMessage(copy, 1, 0, &messageSize);
+  callSyroWorker(ANY_SYRO_WORKER, priority, "encodeSyroStreamWork",
+                 (char *)message, messageSize, copy, 1, true,
+                 onSyroSegmentResponse, key);
+  free(message);
+}
+
+/**
+ * Whether a stream for these entries can be put together from the cache
+ * (once the cache has them), rather than encoded the normal way.
+ */
+static bool canUseSyroSegments(SyroData *syro_data, uint32_t NumOfData) {
+  if (NumOfData == 1) {
+    return true;
+  }
+  return segmentCheckStates[getSyroSegmentKind(syro_data, NumOfData)] ==
+         SegmentCheck_Usable;
+}
+
+static uint32_t getComposedSyroStreamSize(SyroSegment **segments,
+                                          uint32_t NumOfData);
+
+// whether the stream these segments make is as long as a stream encoded the
+// normal way for the same entries would be
+static bool isComposedSyroStreamLengthRight(SyroData *syro_data,
+                                            SyroSegment **segments,
+                                            uint32_t NumOfData) {
+  if (NumOfData == 1) {
+    return true;
+  }
+  uint32_t *sizes = malloc(sizeof(uint32_t) * NumOfData * 2);
+  if (!sizes) {
+    return false;
+  }
+  uint32_t *slotNumbers = sizes + NumOfData;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    sizes[i] = segments[i]->dataSize;
+    slotNumbers[i] = syro_data[i].Number;
+  }
+  uint32_t frame;
+  bool right = countSyroStreamFrames(sizes, slotNumbers, NumOfData, &frame) &&
+               sizeof(wav_header) + (uint64_t)frame * 4 ==
+                   getComposedSyroStreamSize(segments, NumOfData);
+  free(sizes);
+  return right;
+}
+
+/**
+ * Takes hold of the cached segments for each entry, so they can't be evicted
+ * while a stream is put together from them. Returns NULL if any of them
+ * aren't cached, or if the stream they make isn't the length it should be.
+ * Let go with releaseSyroSegments.
+ */
+static SyroSegment **acquireSyroSegments(SyroData *syro_data,
+                                         uint32_t NumOfData) {
+  SyroSegment **segments = malloc(sizeof(SyroSegment *) * NumOfData);
+  if (!segments) {
+    return NULL;
+  }
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    segments[i] = findSyroSegment(getSyroSegmentKey(syro_data + i));
+    if (!segments[i] || !segments[i]->stream) {
+      free(segments);
+      return NULL;
+    }
+  }
+  if (!isComposedSyroStreamLengthRight(syro_data, segments, NumOfData)) {
+    printf("A stream put together from cached segments isn't the length it "
+           "should be, so it will be encoded in full.\n");
+    free(segments);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    segments[i]->users++;
+    segments[i]->lastUsed = ++syroSegmentsClock;
+  }
+  return segments;
+}
+
+static void releaseSyroSegments(SyroSegment **segments, uint32_t NumOfData) {
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    segments[i]->users--;
+  }
+  free(segments);
+}
+
+static uint32_t getSyroSegmentSize(SyroSegment *segment, uint32_t NumOfData,
+                                   uint32_t footerSize) {
+  // a single entry's stream is used as is, footer and all
+  return NumOfData == 1 ? segment->size : segment->size - footerSize;
+}
+
+/**
+ * Total size of the composed stream, including the wav header.
+ */
+static uint32_t getComposedSyroStreamSize(SyroSegment **segments,
+                                          uint32_t NumOfData) {
+  uint32_t footerSize = getSyroFooterSize(segments, NumOfData);
+  uint32_t size = sizeof(wav_header) + (NumOfData == 1 ? 0 : footerSize);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    size += getSyroSegmentSize(segments[i], NumOfData, footerSize);
+  }
+  return size;
+}
+
+// copies the part of [pieceStart, pieceStart + pieceSize) that falls within
+// [offset, end) of the stream
+static void copyStreamPiece(const uint8_t *piece, uint32_t pieceStart,
+                            uint32_t pieceSize, uint32_t offset, uint32_t end,
+                            uint8_t *dest) {
+  uint32_t pieceEnd = pieceStart + pieceSize;
+  if (pieceEnd <= offset || pieceStart >= end) {
+    return;
+  }
+  uint32_t from = offset > pieceStart ? offset - pieceStart : 0;
+  uint32_t to = (end < pieceEnd ? end : pieceEnd) - pieceStart;
+  memcpy(dest + pieceStart + from - offset, piece + from, to - from);
+}
+
+/**
+ * Copies up to maxBytes of the composed stream, starting at offset, into
+ * dest. dataStartPoints (110 entries, as in SampleBufferContainer) gets the
+ * start points the stream has reached by then, with the rest left at 0 like
+ * iterateSampleBuffer does. Returns the number of bytes copied.
+ */
+static uint32_t readComposedSyroStream(SyroSegment **segments,
+                                       uint32_t NumOfData, uint32_t offset,
+                                       uint8_t *dest, uint32_t maxBytes,
+                                       uint32_t *dataStartPoints) {
+  uint32_t totalSize = getComposedSyroStreamSize(segments, NumOfData);
+  uint32_t footerSize = getSyroFooterSize(segments, NumOfData);
+  uint32_t end = offset + maxBytes < totalSize ? offset + maxBytes : totalSize;
+  memset(dataStartPoints, 0, sizeof(uint32_t) * 110);
+
+  uint8_t header[sizeof(wav_header)];
+  writeSyroWavHeader(header, (totalSize - sizeof(wav_header)) / 4);
+  copyStreamPiece(header, 0, sizeof(header), offset, end, dest);
+  uint32_t pieceStart = sizeof(header);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    uint32_t segmentSize =
+        getSyroSegmentSize(segments[i], NumOfData, footerSize);
+    copyStreamPiece(segments[i]->stream, pieceStart, segmentSize, offset, end,
+                    dest);
+    // the next entry's start point sits where the footer's did in the
+    // entry's own stream. (the first entry's start point is never set.)
+    uint32_t nextStartPoint = pieceStart + segments[i]->footerStartPoint;
+    if (i + 1 < 110 && nextStartPoint < end) {
+      dataStartPoints[i + 1] = nextStartPoint;
+    }
+    pieceStart += segmentSize;
+  }
+  if (NumOfData > 1) {
+    // and the footer comes from the last entry's stream
+    SyroSegment *last = segments[NumOfData - 1];
+    copyStreamPiece(last->stream + last->size - footerSize, pieceStart,
+                    footerSize, offset, end, dest);
+  }
+  return end > offset ? end - offset : 0;
+}
+
+/**
+ * Starts a check of the segments in these entries' stream, if that kind of
+ * segment hasn't been checked yet (and it can tell us anything). The stream
+ * itself is encoded by the caller, which hashes it into the check as it goes
+ * and hands it back with submitSyroSegmentCheck. Meanwhile each entry's own
+ * stream is encoded in the background. Returns NULL if there's nothing to
+ * check.
+ */
+static SyroSegmentCheck *startSyroSegmentCheck(SyroData *syro_data,
+                                               uint32_t NumOfData,
+                                               int32_t priority) {
+  SyroSegmentKind kind = getSyroSegmentKind(syro_data, NumOfData);
+  if (NumOfData < 2 || segmentCheckStates[kind] != SegmentCheck_Unchecked) {
+    return NULL;
+  }
+  SyroSegmentCheck *check = calloc(1, sizeof(SyroSegmentCheck));
+  if (!check) {
+    return NULL;
+  }
+  check->keys = malloc(sizeof(uint64_t) * NumOfData);
+  if (!check->keys) {
+    free(check);
+    return NULL;
+  }
+  check->kind = kind;
+  check->NumOfData = NumOfData;
+  check->hash = SYRO_STREAM_HASH_START;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    check->keys[i] = getSyroSegmentKey(syro_data + i);
+    cacheSyroSegment(syro_data + i, priority);
+  }
+  segmentCheckStates[kind] = SegmentCheck_Checking;
+  return check;
+}
+
+static void freeSyroSegmentCheck(SyroSegmentCheck *check) {
+  free(check->keys);
+  free(check);
+}
+
+/**
+ * Takes back a check from startSyroSegmentCheck once its stream is done
+ * (complete is false if it was cancelled, so the check is dropped).
+ */
+static void submitSyroSegmentCheck(SyroSegmentCheck *check, bool complete) {
+  if (!complete) {
+    segmentCheckStates[check->kind] = SegmentCheck_Unchecked;
+    freeSyroSegmentCheck(check);
+    notifyEraseStreamsWatches();
+    return;
+  }
+  segmentChecks[check->kind] = check;
+  checkSyroSegments();
+}
+
+static bool runSyroSegmentCheck(SyroSegmentCheck *check,
+                                SyroSegment **segments) {
+  uint32_t segmentsSize = 0;
+  for (uint32_t i = 0; i < check->NumOfData; i++) {
+    segmentsSize += segments[i]->size;
+  }
+  // every entry's own stream has a footer, the checked stream only has one
+  uint32_t checkedBodySize = check->size - sizeof(wav_header);
+  uint32_t extraFooters = check->NumOfData - 1;
+  if (segmentsSize <= checkedBodySize ||
+      (segmentsSize - checkedBodySize) % extraFooters) {
+    return false;
+  }
+  uint32_t footerSize = (segmentsSize - checkedBodySize) / extraFooters;
+  for (uint32_t i = 0; i < check->NumOfData; i++) {
+    if (footerSize > segments[i]->size) {
+      return false;
+    }
+  }
+  syroFooterSizes[check->kind] = footerSize;
+  bool matches = getComposedSyroStreamSize(segments, check->NumOfData) ==
+                 check->size;
+  // hash the composed stream a chunk at a time, as it would be sent
+  const uint32_t chunkSize = 1024 * 1024;
+  uint8_t *chunk = malloc(chunkSize);
+  uint32_t dataStartPoints[110];
+  uint64_t hash = SYRO_STREAM_HASH_START;
+  matches = matches && chunk;
+  for (uint32_t offset = 0; matches && offset < check->size;) {
+    uint32_t bytes = readComposedSyroStream(segments, check->NumOfData, offset,
+                                            chunk, chunkSize, dataStartPoints);
+    hash = hashSyroStream(hash, chunk, bytes);
+    offset += bytes;
+  }
+  free(chunk);
+  matches = matches && hash == check->hash &&
+            !memcmp(dataStartPoints, check->dataStartPoints,
+                    sizeof(uint32_t) * (check->NumOfData < 110
+                                            ? check->NumOfData + 1
+                                            : 110));
+  if (!matches) {
+    syroFooterSizes[check->kind] = 0;
+  }
+  return matches;
+}
+
+// Runs any check whose segments have all arrived.
+static void checkSyroSegments(void) {
+  for (uint32_t kind = 0; kind < NUM_OF_SEGMENT_KINDS; kind++) {
+    SyroSegmentCheck *check = segmentChecks[kind];
+    if (!check) {
+      continue;
+    }
+    SyroSegment **segments = malloc(sizeof(SyroSegment *) * check->NumOfData);
+    if (!segments) {
+      // (tried again when the next segment arrives)
+      continue;
+    }
+    bool ready = true;
+    bool failed = false;
+    for (uint32_t i = 0; i < check->NumOfData; i++) {
+      segments[i] = findSyroSegment(check->keys[i]);
+      if (!segments[i] || !segments[i]->stream) {
+        ready = false;
+        // (not on its way either, e.g. if it failed or was evicted)
+        failed = failed || !segments[i] || !segments[i]->pending;
+      }
+    }
+    if (ready) {
+      bool usable = runSyroSegmentCheck(check, segments);
+      if (!usable) {
+        printf("Stream segments don't match a full encode, so streams will "
+               "be encoded in full.\n");
+      }
+      segmentCheckStates[kind] =
+          usable ? SegmentCheck_Usable : SegmentCheck_Unusable;
+    } else if (failed) {
+      // try again with a later stream
+      segmentCheckStates[kind] = SegmentCheck_Unchecked;
+    }
+    free(segments);
+    if (ready || failed) {
+      segmentChecks[kind] = NULL;
+      freeSyroSegmentCheck(check);
+    }
+  }
+  notifyEraseStreamsWatches();
+}
+
+// Whether erase segments for slots 0 to NumOfSlots - 1 are all done with
+// (cached, or failed), and so is the erase check.
+static bool areEraseStreamsSettled(uint32_t NumOfSlots) {
+  if (segmentCheckStates[SyroSegments_Erase] == SegmentCheck_Checking) {
+    return false;
+  }
+  for (uint32_t i = 0; i < NumOfSlots; i++) {
+    SyroData syro_data;
+    setupEraseSyroData(&syro_data, i);
+    SyroSegment *segment = findSyroSegment(getSyroSegmentKey(&syro_data));
+    if (segment && segment->pending) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Calls back any precomputeEraseStreams calls whose segments are settled.
+static void notifyEraseStreamsWatches(void) {
+  EraseStreamsWatch **link = &eraseStreamsWatches;
+  while (*link) {
+    EraseStreamsWatch *watch = *link;
+    if (!areEraseStreamsSettled(watch->NumOfSlots)) {
+      link = &watch->next;
+      continue;
+    }
+    *link = watch->next;
+    void (*onDone)(uint32_t) = watch->onDone;
+    free(watch);
+    onDone(segmentCheckStates[SyroSegments_Erase] == SegmentCheck_Usable);
+    // (the callback may have changed the list)
+    link = &eraseStreamsWatches;
+  }
+}
+
+static void onEraseCheckStreamResponse(char *data, int size,
+                                       void *checkPointer) {
+  SyroSegmentCheck *check = (SyroSegmentCheck *)checkPointer;
+  SyroStreamUpdate *streamUpdate = (SyroStreamUpdate *)data;
+  if (size < (int)sizeof(SyroStreamUpdate)) {
+    submitSyroSegmentCheck(check, false);
+    return;
+  }
+  check->size = streamUpdate->totalSize;
+  check->hash = hashSyroStream(check->hash,
+                               (uint8_t *)data + sizeof(SyroStreamUpdate),
+                               streamUpdate->totalSize);
+  memcpy(check->dataStartPoints, streamUpdate->dataStartPoints,
+         sizeof(check->dataStartPoints));
+  submitSyroSegmentCheck(check, true);
+}
+
+/**
+ * Fills the segment cache with erase segments for slots 0 to NumOfSlots - 1
+ * in the background, so erase jobs for those slots don't need any encoding
+ * (the first time, along with a stream to check them against). Work for jobs
+ * with a higher priority goes first. onDone (if any) is called once they're
+ * all cached or have failed, with 1 if erase streams can now be put together
+ * from the cache, or 0 if they'll still be encoded.
+ */
+EMSCRIPTEN_KEEPALIVE
+void precomputeEraseStreams(uint32_t NumOfSlots, int32_t priority,
+                            void (*onDone)(uint32_t)) {
+  if (segmentCheckStates[SyroSegments_Erase] == SegmentCheck_Unusable) {
+    if (onDone) {
+      onDone(0);
+    }
+    return;
+  }
+  if (NumOfSlots > MAX_ERASE_SEGMENT_SLOTS) {
+    NumOfSlots = MAX_ERASE_SEGMENT_SLOTS;
+  }
+  SyroData checkData[2];
+  setupEraseSyroData(checkData, ERASE_CHECK_SLOT_A);
+  setupEraseSyroData(checkData + 1, ERASE_CHECK_SLOT_B);
+  SyroSegmentCheck *check = startSyroSegmentCheck(checkData, 2, priority);
+  if (check) {
+    int messageSize;
+    uint8_t *message = createSyroStartMessage(checkData, 2, 0, &messageSize);
+    callSyroWorker(ANY_SYRO_WORKER, priority, "encodeSyroStreamWork",
+                   (char *)message, messageSize, NULL, 0, false,
+                   onEraseCheckStreamResponse, (void *)check);
+    free(message);
+  }
+  for (uint32_t i = 0; i < NumOfSlots; i++) {
+    SyroData syro_data;
+    setupEraseSyroData(&syro_data, i);
+    cacheSyroSegment(&syro_data, priority);
+  }
+  if (!onDone) {
+    return;
+  }
+  EraseStreamsWatch *watch = malloc(sizeof(EraseStreamsWatch));
+  if (!watch) {
+    onDone(0);
+    return;
+  }
+  watch->NumOfSlots = NumOfSlots;
+  watch->onDone = onDone;
+  watch->next = eraseStreamsWatches;
+  eraseStreamsWatches = watch;
+  // (they might all be cached already)
+  notifyEraseStreamsWatches();
+}
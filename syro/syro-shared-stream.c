@@ -0,0 +1,248 @@
+// Only part of the pthreads build (see syro-bindings-threaded.c). Instead of
+// sending chunks back and forth with a worker, the encoder runs on its own
+// thread and writes straight into a sample buffer in shared memory. The main
+// thread follows along with a progress cursor the encoder publishes after each
+// iteration, and (when the buffer is a ring) hands space back by publishing
+// how much it has consumed. There is exactly one producer and one consumer, so
+// the two cursors are all the synchronization needed.
+
+#include "./syro-parallel-stream.c"
+#include <emscripten/threading.h>
+#include <stdatomic.h>
+
+// Publishing progress is just an atomic store, so the encoder can publish
+// much more often than the worker path sends chunks.
+#define SHARED_STREAM_ITERATION_FRAMES 8192
+// the encoder re-checks for cancellation this often while the ring is full
+#define SHARED_STREAM_WAIT_MS 50
+
+typedef enum {
+  SharedStream_Starting = 0,
+  SharedStream_Running,
+  SharedStream_Failed,
+} SharedStreamState;
+
+typedef struct SharedSampleStream {
+  // written by the encoder thread
+  _Atomic uint32_t state;
+  _Atomic uint32_t progress;
+  // written by the consumer
+  _Atomic uint32_t consumed;
+  _Atomic uint32_t cancelled;
+  // the encoder and the consumer each hold a reference. whoever lets go last
+  // frees everything.
+  _Atomic uint32_t refCount;
+  // fixed once state is SharedStream_Running
+  SampleBufferContainer *sampleBuffer;
+  // input, owned by the stream
+  SyroData *syro_data;
+  uint32_t NumOfData;
+  uint32_t bufferSize;
+  uint32_t maxCompressionThreads;
+} SharedSampleStream;
+
+static void releaseSharedSampleStream(SharedSampleStream *stream) {
+  if (atomic_fetch_sub(&stream->refCount, 1) != 1) {
+    return;
+  }
+  if (stream->sampleBuffer) {
+    freeSampleBuffer(stream->sampleBuffer);
+  }
+  free_syrodata(stream->syro_data, stream->NumOfData);
+  free(stream->syro_data);
+  free(stream);
+}
+
+static void precompressSharedStreamTask(uint32_t index, void *streamPointer) {
+  SharedSampleStream *stream = (SharedSampleStream *)streamPointer;
+  precompressSyroData(stream->syro_data + index);
+}
+
+// Encodes the whole stream with its segments spread across the pool (see
+// syro-parallel-stream.c). Returns false, having done nothing, if the stream
+// has to be encoded in order.
+static bool encodeSharedStreamInParallel(SharedSampleStream *stream,
+                                         ThreadPool *pool) {
+  ParallelSyroStream *parallelStream =
+      startParallelSyroStream(pool, stream->syro_data, stream->NumOfData);
+  if (!parallelStream) {
+    return false;
+  }
+  SampleBufferContainer *sampleBuffer =
+      calloc(1, sizeof(SampleBufferContainer));
+  sampleBuffer->size = parallelStream->size;
+  sampleBuffer->bufferSize = parallelStream->size;
+  sampleBuffer->buffer = malloc(sampleBuffer->size);
+  if (!sampleBuffer->buffer) {
+    free(sampleBuffer);
+    freeParallelSyroStream(parallelStream);
+    return false;
+  }
+  stream->sampleBuffer = sampleBuffer;
+  atomic_store(&stream->state, SharedStream_Running);
+  // segments are written as they're encoded, and progress only counts the
+  // part of the stream without gaps
+  runParallelSyroStream(pool, parallelStream, sampleBuffer->buffer, NULL,
+                        NULL, sampleBuffer->dataStartPoints, &stream->progress,
+                        &stream->cancelled);
+  freeParallelSyroStream(parallelStream);
+  return true;
+}
+
+static void *sharedStreamEncoder(void *streamPointer) {
+  SharedSampleStream *stream = (SharedSampleStream *)streamPointer;
+
+  // compress across threads first, so Start only has to look blocks up
+  if (stream->maxCompressionThreads > 1) {
+    ThreadPool *pool = createThreadPool(stream->maxCompressionThreads);
+    if (pool) {
+      threadPoolRun(pool, stream->NumOfData, precompressSharedStreamTask,
+                    stream);
+      // a stream held whole in memory can have its segments encoded in
+      // parallel too (a ring has to be filled in order)
+      bool encoded = !stream->bufferSize &&
+                     encodeSharedStreamInParallel(stream, pool);
+      freeThreadPool(pool);
+      if (encoded) {
+        releaseSharedSampleStream(stream);
+        return NULL;
+      }
+    }
+  }
+
+  // the sample buffer gets its own copy of the syro data list, which takes
+  // over the sample data from ours
+  SyroData *syro_data_list = malloc(sizeof(SyroData) * stream->NumOfData);
+  memcpy(syro_data_list, stream->syro_data,
+         sizeof(SyroData) * stream->NumOfData);
+  for (uint32_t i = 0; i < stream->NumOfData; i++) {
+    stream->syro_data[i].pData = NULL;
+  }
+  SampleBufferContainer *sampleBuffer = startSampleBufferStream(
+      syro_data_list, stream->NumOfData, stream->bufferSize);
+  if (!sampleBuffer) {
+    free_syrodata(syro_data_list, stream->NumOfData);
+    free(syro_data_list);
+    atomic_store(&stream->state, SharedStream_Failed);
+    releaseSharedSampleStream(stream);
+    return NULL;
+  }
+  stream->sampleBuffer = sampleBuffer;
+  atomic_store(&stream->progress, sampleBuffer->progress);
+  atomic_store(&stream->state, SharedStream_Running);
+
+  while (sampleBuffer->progress < sampleBuffer->size &&
+         !atomic_load(&stream->cancelled)) {
+    uint32_t consumed = atomic_load(&stream->consumed);
+    sampleBuffer->consumed = consumed;
+    if (sampleBuffer->progress - consumed >= sampleBuffer->bufferSize) {
+      // ring is full. sleep until the consumer moves its cursor.
+      emscripten_futex_wait((void *)&stream->consumed, consumed,
+                            SHARED_STREAM_WAIT_MS);
+      continue;
+    }
+    iterateSampleBuffer(sampleBuffer, SHARED_STREAM_ITERATION_FRAMES);
+    atomic_store(&stream->progress, sampleBuffer->progress);
+  }
+  if (sampleBuffer->progress < sampleBuffer->size) {
+    // cancelled (iterateSampleBuffer ends the handle when it finishes)
+    SyroVolcaSample_End(sampleBuffer->syro_handle);
+  }
+  free_syrodata(syro_data_list, stream->NumOfData);
+  releaseSharedSampleStream(stream);
+  return NULL;
+}
+
+/**
+ * Starts encoding the syro data on a new thread. bufferSize is as for
+ * startSampleBufferStream (0 for the whole stream). Up to
+ * maxCompressionThreads threads compress samples and, for a whole stream,
+ * encode its segments. Takes ownership of the syro data. Returns a non-zero
+ * pointer if successful or 0 if not.
+ */
+EMSCRIPTEN_KEEPALIVE
+SharedSampleStream *startSharedSampleStream(SyroData *syro_data,
+                                            uint32_t NumOfData,
+                                            uint32_t bufferSize,
+                                            uint32_t maxCompressionThreads) {
+  SharedSampleStream *stream = calloc(1, sizeof(SharedSampleStream));
+  if (!stream) {
+    free_syrodata(syro_data, NumOfData);
+    free(syro_data);
+    return 0;
+  }
+  stream->syro_data = syro_data;
+  stream->NumOfData = NumOfData;
+  stream->bufferSize = bufferSize;
+  stream->maxCompressionThreads = maxCompressionThreads;
+  atomic_store(&stream->refCount, 2);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, sharedStreamEncoder, stream)) {
+    free_syrodata(syro_data, NumOfData);
+    free(syro_data);
+    free(stream);
+    return 0;
+  }
+  pthread_detach(thread);
+  return stream;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSharedStreamState(SharedSampleStream *stream) {
+  return atomic_load(&stream->state);
+}
+
+/**
+ * Bytes of the stream (including the wav header) the encoder has written.
+ * Everything below this is safe to read.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSharedStreamProgress(SharedSampleStream *stream) {
+  return atomic_load(&stream->progress);
+}
+
+// the getters below are only valid once the stream is running
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSharedStreamTotalSize(SharedSampleStream *stream) {
+  return stream->sampleBuffer->size;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint8_t *getSharedStreamBufferPointer(SharedSampleStream *stream) {
+  return stream->sampleBuffer->buffer;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t getSharedStreamBufferSize(SharedSampleStream *stream) {
+  return stream->sampleBuffer->bufferSize;
+}
+
+/**
+ * Entries are final once progress has passed them (read progress first).
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t *getSharedStreamDataStartPointsPointer(SharedSampleStream *stream) {
+  return stream->sampleBuffer->dataStartPoints;
+}
+
+/**
+ * Hands ring space back to the encoder. consumed is the stream offset up to
+ * which the consumer has copied data out, and must never go backwards.
+ */
+EMSCRIPTEN_KEEPALIVE
+void setSharedStreamConsumed(SharedSampleStream *stream, uint32_t consumed) {
+  atomic_store(&stream->consumed, consumed);
+  emscripten_futex_wake((void *)&stream->consumed, 1);
+}
+
+/**
+ * Stops the encoder if it is still running and lets go of the stream. The
+ * buffer must not be read after this.
+ */
+EMSCRIPTEN_KEEPALIVE
+void freeSharedSampleStream(SharedSampleStream *stream) {
+  atomic_store(&stream->cancelled, 1);
+  emscripten_futex_wake((void *)&stream->consumed, 1);
+  releaseSharedSampleStream(stream);
+}
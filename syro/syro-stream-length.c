@@ -0,0 +1,144 @@
+// Works out how many frames a syrostream will have without encoding it, or
+// even having its samples, so the time a transfer takes can be shown while
+// samples are still being picked. All an entry's frames depend on is its slot
+// and how many bytes of sample data it carries: its 16Bit samples if linear,
+// or its compressed block. So each entry is stood in for by zeroed linear
+// data of that size (or an erase entry if it has none), and a stream of those
+// is opened for its frame count.
+// Whether the encoder frames compressed blocks like linear data of the same
+// size is checked once per process, by counting a small stream both ways (see
+// isSyroStreamLengthExact). If it doesn't, nothing is counted.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_LENGTH_PROBE_FRAMES 700
+
+static bool syroStreamLengthExact = false;
+static pthread_once_t syroStreamLengthProbeOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Opens (and closes) a stream for the syro data, for its frame count.
+ */
+static bool countOpenedSyroStreamFrames(SyroData *syro_data,
+                                        uint32_t NumOfData, uint32_t *frame) {
+  SyroHandle handle;
+  if (SyroVolcaSample_Start(&handle, syro_data, NumOfData, 0, frame) !=
+      Status_Success) {
+    return false;
+  }
+  SyroVolcaSample_End(handle);
+  return true;
+}
+
+/**
+ * Counts the frames of a stream with an entry of sizes[i] bytes of sample
+ * data (16Bit samples, or a compressed block's compSize) for each slot in
+ * slotNumbers. A size of 0 is an entry with no sample data, as
+ * setupEraseSyroData makes.
+ */
+static bool countStandInSyroStreamFrames(const uint32_t *sizes,
+                                         const uint32_t *slotNumbers,
+                                         uint32_t NumOfData, uint32_t *frame) {
+  SyroData *syro_data = malloc(sizeof(SyroData) * (NumOfData ? NumOfData : 1));
+  uint32_t maxSize = 0;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (sizes[i] > maxSize) {
+      maxSize = sizes[i];
+    }
+  }
+  // every stand-in reads the same zeros
+  uint8_t *zeros = calloc(maxSize ? maxSize : 1, 1);
+  if (!syro_data || !zeros) {
+    free(syro_data);
+    free(zeros);
+    return false;
+  }
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    if (!sizes[i]) {
+      setupEraseSyroData(current_syro_data, slotNumbers[i]);
+      continue;
+    }
+    current_syro_data->DataType = DataType_Sample_Liner;
+    current_syro_data->Number = slotNumbers[i];
+    current_syro_data->Quality = 16;
+    current_syro_data->pData = zeros;
+    current_syro_data->Size = sizes[i];
+    current_syro_data->Fs = 31250;
+    current_syro_data->SampleEndian = LittleEndian;
+  }
+  bool ok = countOpenedSyroStreamFrames(syro_data, NumOfData, frame);
+  free(zeros);
+  free(syro_data);
+  return ok;
+}
+
+// Counts a small stream (a linear sample and compressed samples at two
+// qualities) both ways, and compares them.
+static void probeSyroStreamLength(void) {
+  const uint32_t NumOfData = 3;
+  SyroData syro_data[3];
+  uint32_t sizes[3];
+  uint32_t slotNumbers[3];
+  uint32_t seed = 54321;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    current_syro_data->DataType =
+        i ? DataType_Sample_Compress : DataType_Sample_Liner;
+    current_syro_data->Number = i;
+    current_syro_data->Quality = i == 2 ? 8 : 12;
+    current_syro_data->Fs = 31250;
+    current_syro_data->SampleEndian = LittleEndian;
+    current_syro_data->Size = (STREAM_LENGTH_PROBE_FRAMES + i * 300) * 2;
+    current_syro_data->pData = malloc(current_syro_data->Size);
+    if (!current_syro_data->pData) {
+      free_syrodata(syro_data, i);
+      return;
+    }
+    for (uint32_t j = 0; j < current_syro_data->Size; j++) {
+      seed = seed * 1103515245 + 12345;
+      current_syro_data->pData[j] = (uint8_t)(seed >> 16);
+    }
+    sizes[i] = i ? SyroComp_GetCompSize(current_syro_data->pData,
+                                        current_syro_data->Size / 2,
+                                        current_syro_data->Quality,
+                                        current_syro_data->SampleEndian)
+                 : current_syro_data->Size;
+    slotNumbers[i] = i;
+  }
+
+  uint32_t standInFrame;
+  uint32_t openedFrame;
+  syroStreamLengthExact =
+      countStandInSyroStreamFrames(sizes, slotNumbers, NumOfData,
+                                   &standInFrame) &&
+      countOpenedSyroStreamFrames(syro_data, NumOfData, &openedFrame) &&
+      standInFrame == openedFrame;
+  free_syrodata(syro_data, NumOfData);
+  if (!syroStreamLengthExact) {
+    printf("Stream lengths can't be counted from sample sizes, so they "
+           "won't be known until streams are encoded.\n");
+  }
+}
+
+bool isSyroStreamLengthExact(void) {
+  pthread_once(&syroStreamLengthProbeOnce, probeSyroStreamLength);
+  return syroStreamLengthExact;
+}
+
+/**
+ * Sets frame to the number of frames (after the wav header) in the
+ * syrostream for a sample in each slot in slotNumbers, with sizes[i] bytes of
+ * sample data: Size for linear samples, or the compSize from
+ * SyroComp_GetCompSize for compressed ones. Returns false if that can't be
+ * counted exactly, the stream can't be opened or out of memory.
+ */
+bool countSyroStreamFrames(const uint32_t *sizes, const uint32_t *slotNumbers,
+                           uint32_t NumOfData, uint32_t *frame) {
+  return isSyroStreamLengthExact() &&
+         countStandInSyroStreamFrames(sizes, slotNumbers, NumOfData, frame);
+}
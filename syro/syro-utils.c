@@ -1,29 +1,144 @@
+#include "./syro-comp-cache.h"
+#include "./syro-arena.c"
 #include "./syro-example-helpers.c"
+#include "./sample-resample.c"
+#include "./wav-stream-parser.c"
+#include "./waveform-peaks.c"
+#include "./syro-pack.c"
 
 typedef struct SampleBufferContainer {
   uint8_t *buffer;
+  // total size of the stream, including the wav header
   uint32_t size;
   uint32_t progress;
   uint32_t dataStartPoints[110];
+  // allocated size of buffer. when smaller than size, buffer is a ring and
+  // byte n of the stream lives at buffer[n % bufferSize]
+  uint32_t bufferSize;
+  // bytes already drained with readSampleBuffer
+  uint32_t consumed;
   // internal
   SyroData *syro_data;
   SyroHandle syro_handle;
+  // where the container and its buffer came from, or NULL for the heap
+  SyroArena *arena;
 } SampleBufferContainer;
 
+/**
+ * Frees the sample buffer along with its syro data list, but not the sample
+ * data, which is still the caller's to free. Those in an arena go with it
+ * instead.
+ */
 void freeSampleBuffer(SampleBufferContainer *sampleBuffer) {
+  if (sampleBuffer->arena) {
+    return;
+  }
   free(sampleBuffer->buffer);
   free(sampleBuffer->syro_data);
+  free(sampleBuffer);
+}
+
+/**
+ * Writes the wav header for a syrostream of `frame` frames (sizeof(wav_header)
+ * bytes) to dest.
+ */
+void writeSyroWavHeader(uint8_t *dest, uint32_t frame) {
+  memcpy(dest, wav_header, sizeof(wav_header));
+  set_32Bit_value((dest + WAV_POS_RIFF_SIZE), ((frame * 4) + 0x24));
+  set_32Bit_value((dest + WAV_POS_DATA_SIZE), (frame * 4));
 }
 
 /**
+ * Key for everything an entry's segment of a syrostream depends on: the
+ * sample data and the parameters that end up in the stream.
+ */
+uint64_t getSyroSegmentKey(SyroData *syro_data) {
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = getSyroCompKeyForSyroData(syro_data);
+  hash = (hash ^ (uint32_t)syro_data->DataType) * prime;
+  hash = (hash ^ syro_data->Number) * prime;
+  hash = (hash ^ syro_data->Fs) * prime;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * Sets up a syro data entry that erases slotNumber (no sample data).
+ */
+void setupEraseSyroData(SyroData *syro_data, uint32_t slotNumber) {
+  syro_data->DataType = DataType_Sample_Compress;
+  syro_data->Number = slotNumber;
+  syro_data->Quality = 8;
+  syro_data->pData = NULL;
+  syro_data->Size = 0;
+  syro_data->Fs = 31250;
+  syro_data->SampleEndian = LittleEndian;
+}
+
+/**
+ * Resamples an entry's 16Bit samples (as set up by setup_file_sample) from its
+ * Fs to targetFs, replacing pData. The volca plays every sample at 31250Hz
+ * whatever Fs says, so this keeps wav files at other rates at their pitch.
+ *
+ * Returns false if out of memory, in which case the entry is left as it was.
+ */
+bool resampleSyroData(SyroData *syro_data, uint32_t targetFs) {
+  uint32_t sourceFs = syro_data->Fs;
+  if (!sourceFs || sourceFs == targetFs || !syro_data->pData) {
+    syro_data->Fs = targetFs;
+    return true;
+  }
+  uint32_t numOfFrames = syro_data->Size / 2;
+  uint32_t destFrames =
+      getResampledFrameCount(numOfFrames, sourceFs, targetFs);
+  float *samples = malloc(sizeof(float) * (numOfFrames ? numOfFrames : 1));
+  float *filters = createResampleFilters(sourceFs, targetFs);
+  int16_t *dest = malloc(destFrames ? destFrames * 2 : 1);
+  if (!samples || !filters || !dest) {
+    printf("not enough memory to resample. \n");
+    free(samples);
+    free(filters);
+    free(dest);
+    return false;
+  }
+  const int16_t *pcm = (const int16_t *)syro_data->pData;
+  for (uint32_t i = 0; i < numOfFrames; i++) {
+    samples[i] = pcm[i] / 32768.0f;
+  }
+  resampleFloatSamples(samples, numOfFrames, sourceFs, targetFs, filters, NULL,
+                       dest, destFrames);
+  free(samples);
+  free(filters);
+  free(syro_data->pData);
+  syro_data->pData = (uint8_t *)dest;
+  syro_data->Size = destFrames * 2;
+  syro_data->Fs = targetFs;
+  return true;
+}
+
+/**
+ * Like startSampleBufferStream, but takes the container and the output
+ * buffer from arena (when it isn't NULL), so they go when it's released.
+ *
  * Returns a non-zero pointer if successful or 0 if not
  */
-SampleBufferContainer *startSampleBuffer(SyroData *syro_data,
-                                         uint32_t NumOfData) {
+SampleBufferContainer *startSampleBufferStreamInArena(SyroArena *arena,
+                                                      SyroData *syro_data,
+                                                      uint32_t NumOfData,
+                                                      uint32_t bufferSize) {
   uint32_t frame;
-  SampleBufferContainer *sampleBuffer = malloc(sizeof(SampleBufferContainer));
+  SampleBufferContainer *sampleBuffer =
+      arena ? allocateInSyroArena(arena, sizeof(SampleBufferContainer))
+            : malloc(sizeof(SampleBufferContainer));
+  if (!sampleBuffer) {
+    printf(" Not enough memory for write file.\n");
+    return 0;
+  }
   sampleBuffer->syro_data = syro_data;
-  sampleBuffer->dataStartPoints[0] = 0;
+  sampleBuffer->arena = arena;
+  // later entries stay 0 until the stream reaches them
+  memset(sampleBuffer->dataStartPoints, 0,
+         sizeof(sampleBuffer->dataStartPoints));
 
   //----- Start ------
   SyroStatus status =
@@ -31,68 +146,265 @@ SampleBufferContainer *startSampleBuffer(SyroData *syro_data,
                             sampleBuffer->syro_data, NumOfData, 0, &frame);
   if (status != Status_Success) {
     printf(" Start error, %d \n", status);
-    free_syrodata(sampleBuffer->syro_data, NumOfData);
+    if (!arena) {
+      free(sampleBuffer);
+    }
     return 0;
   }
 
   sampleBuffer->size = (frame * 4) + sizeof(wav_header);
   sampleBuffer->progress = 0;
+  sampleBuffer->consumed = 0;
+
+  bufferSize -= bufferSize % 4;
+  if (!bufferSize || bufferSize > sampleBuffer->size) {
+    bufferSize = sampleBuffer->size;
+  } else if (bufferSize < sizeof(wav_header) + 4) {
+    bufferSize = sizeof(wav_header) + 4;
+  }
+  sampleBuffer->bufferSize = bufferSize;
 
-  sampleBuffer->buffer = malloc(sampleBuffer->size);
+  sampleBuffer->buffer = arena ? allocateInSyroArena(arena, bufferSize)
+                               : malloc(bufferSize);
   if (!sampleBuffer->buffer) {
     printf(" Not enough memory for write file.\n");
     SyroVolcaSample_End(sampleBuffer->syro_handle);
-    free_syrodata(sampleBuffer->syro_data, NumOfData);
+    if (!arena) {
+      free(sampleBuffer);
+    }
     return 0;
   }
 
-  memcpy(sampleBuffer->buffer, wav_header, sizeof(wav_header));
-  set_32Bit_value((sampleBuffer->buffer + WAV_POS_RIFF_SIZE),
-                  ((frame * 4) + 0x24));
-  set_32Bit_value((sampleBuffer->buffer + WAV_POS_DATA_SIZE), (frame * 4));
+  writeSyroWavHeader(sampleBuffer->buffer, frame);
 
   sampleBuffer->progress += sizeof(wav_header);
 
   return sampleBuffer;
 }
 
+/**
+ * Like startSampleBuffer, but only allocates bufferSize bytes for the output
+ * (0 means the whole stream). Iterating stops whenever the ring is full, so
+ * the caller has to drain it with readSampleBuffer as it goes. bufferSize is
+ * rounded down to whole frames and must fit the wav header plus one frame.
+ *
+ * Returns a non-zero pointer if successful or 0 if not
+ */
+SampleBufferContainer *startSampleBufferStream(SyroData *syro_data,
+                                               uint32_t NumOfData,
+                                               uint32_t bufferSize) {
+  return startSampleBufferStreamInArena(NULL, syro_data, NumOfData,
+                                        bufferSize);
+}
+
+/**
+ * Starts encoding the syro data into a buffer that holds the whole stream.
+ * The sample buffer takes over the syro data list (freeSampleBuffer frees it),
+ * but the sample data stays the caller's, to free once the stream is done
+ * with it (or straight away if this fails).
+ *
+ * Returns a non-zero pointer if successful or 0 if not
+ */
+SampleBufferContainer *startSampleBuffer(SyroData *syro_data,
+                                         uint32_t NumOfData) {
+  return startSampleBufferStream(syro_data, NumOfData, 0);
+}
+
+typedef struct SyroDataStart {
+  uint32_t dataIndex;
+  // offset into the batch
+  uint32_t frame;
+} SyroDataStart;
+
+/**
+ * Generates up to `frames` frames into dest as interleaved 16-bit stereo in
+ * the stream's byte order (little endian). Each time the current data index
+ * changes, the new index and the frame it starts on are appended to starts,
+ * and the batch ends early if starts fills up (maxStarts). curData is the
+ * index before the batch and is updated to the index after it.
+ *
+ * Returns the number of frames generated.
+ */
+uint32_t getSyroFrames(SyroHandle syro_handle, int16_t *dest, uint32_t frames,
+                       uint32_t *curData, SyroDataStart *starts,
+                       uint32_t maxStarts, uint32_t *numOfStarts) {
+  uint32_t CurData = *curData;
+  uint32_t startCount = 0;
+  uint32_t frame = 0;
+  while (frame < frames) {
+    SyroVolcaSample_GetSample(syro_handle, dest, dest + 1);
+    uint32_t NewCurData = SyroVolcaSample_GetCurData(syro_handle);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    dest[0] = (int16_t)__builtin_bswap16((uint16_t)dest[0]);
+    dest[1] = (int16_t)__builtin_bswap16((uint16_t)dest[1]);
+#endif
+    dest += 2;
+    frame++;
+    if (NewCurData != CurData) {
+      starts[startCount].dataIndex = NewCurData;
+      starts[startCount].frame = frame - 1;
+      startCount++;
+      CurData = NewCurData;
+      if (startCount == maxStarts) {
+        break;
+      }
+    }
+  }
+  *curData = CurData;
+  *numOfStarts = startCount;
+  return frame;
+}
+
 void iterateSampleBuffer(SampleBufferContainer *sampleBuffer,
                          int32_t iterations) {
-  const int num_of_data = 1;
-  int16_t left, right;
-  int32_t frame = iterations;
+  uint32_t framesLeft = iterations;
+  if (sampleBuffer->progress >= sampleBuffer->size) {
+    // already finished (and ended)
+    return;
+  }
   uint32_t CurData = SyroVolcaSample_GetCurData(sampleBuffer->syro_handle);
-  while (sampleBuffer->progress < sampleBuffer->size && frame) {
-    SyroVolcaSample_GetSample(sampleBuffer->syro_handle, &left, &right);
-    uint32_t NewCurData = SyroVolcaSample_GetCurData(sampleBuffer->syro_handle);
-    if (NewCurData != CurData) {
-      sampleBuffer->dataStartPoints[NewCurData] = sampleBuffer->progress;
-      CurData = NewCurData;
+  SyroDataStart starts[8];
+  while (framesLeft) {
+    // each batch is contiguous in the buffer, so it stops at the end of the
+    // stream, the end of the ring and wherever unread data begins. frames
+    // never straddle the end of the ring since the header and the ring size
+    // are both multiples of 4.
+    uint32_t writeIndex = sampleBuffer->progress % sampleBuffer->bufferSize;
+    uint32_t bytes = sampleBuffer->size - sampleBuffer->progress;
+    uint32_t space = sampleBuffer->bufferSize -
+                     (sampleBuffer->progress - sampleBuffer->consumed);
+    if (bytes > space) {
+      bytes = space;
+    }
+    if (bytes > sampleBuffer->bufferSize - writeIndex) {
+      bytes = sampleBuffer->bufferSize - writeIndex;
+    }
+    uint32_t frames = bytes / 4;
+    if (frames > framesLeft) {
+      frames = framesLeft;
+    }
+    if (!frames) {
+      break;
+    }
+    uint32_t numOfStarts;
+    frames = getSyroFrames(
+        sampleBuffer->syro_handle,
+        (int16_t *)(sampleBuffer->buffer + writeIndex), frames, &CurData,
+        starts, sizeof(starts) / sizeof(SyroDataStart), &numOfStarts);
+    for (uint32_t i = 0; i < numOfStarts; i++) {
+      // (only the first 110 entries' start points are kept)
+      if (starts[i].dataIndex < sizeof(sampleBuffer->dataStartPoints) /
+                                    sizeof(sampleBuffer->dataStartPoints[0])) {
+        sampleBuffer->dataStartPoints[starts[i].dataIndex] =
+            sampleBuffer->progress + starts[i].frame * 4;
+      }
     }
-    sampleBuffer->buffer[sampleBuffer->progress++] = (uint8_t)left;
-    sampleBuffer->buffer[sampleBuffer->progress++] = (uint8_t)(left >> 8);
-    sampleBuffer->buffer[sampleBuffer->progress++] = (uint8_t)right;
-    sampleBuffer->buffer[sampleBuffer->progress++] = (uint8_t)(right >> 8);
-    frame--;
+    sampleBuffer->progress += frames * 4;
+    framesLeft -= frames;
   }
   if (sampleBuffer->progress == sampleBuffer->size) {
     SyroVolcaSample_End(sampleBuffer->syro_handle);
-    free_syrodata(sampleBuffer->syro_data, num_of_data);
   }
 }
 
-SyroData *getSyroDataForWavData(uint8_t *wavData, uint32_t bytes,
-                                uint32_t slotNumber, uint32_t quality,
-                                uint32_t useCompression) {
+/**
+ * Copies up to maxBytes of stream data that hasn't been read yet into dest
+ * and frees that space in the ring. Returns the number of bytes copied.
+ */
+uint32_t readSampleBuffer(SampleBufferContainer *sampleBuffer, uint8_t *dest,
+                          uint32_t maxBytes) {
+  uint32_t bytes = sampleBuffer->progress - sampleBuffer->consumed;
+  if (bytes > maxBytes) {
+    bytes = maxBytes;
+  }
+  uint32_t readIndex = sampleBuffer->consumed % sampleBuffer->bufferSize;
+  uint32_t firstPart = sampleBuffer->bufferSize - readIndex;
+  if (firstPart > bytes) {
+    firstPart = bytes;
+  }
+  memcpy(dest, sampleBuffer->buffer + readIndex, firstPart);
+  memcpy(dest + firstPart, sampleBuffer->buffer, bytes - firstPart);
+  sampleBuffer->consumed += bytes;
+  return bytes;
+}
+
+/**
+ * Points parts at the bytes generated but not yet drained, without copying
+ * them: two parts, since the ring may wrap (the second is often empty).
+ * Returns the total. Mark what was used as drained with skipSampleBuffer.
+ */
+uint32_t peekSampleBuffer(SampleBufferContainer *sampleBuffer, uint8_t **parts,
+                          uint32_t *partSizes) {
+  uint32_t bytes = sampleBuffer->progress - sampleBuffer->consumed;
+  uint32_t readIndex = sampleBuffer->consumed % sampleBuffer->bufferSize;
+  uint32_t firstPart = sampleBuffer->bufferSize - readIndex;
+  if (firstPart > bytes) {
+    firstPart = bytes;
+  }
+  parts[0] = sampleBuffer->buffer + readIndex;
+  partSizes[0] = firstPart;
+  parts[1] = sampleBuffer->buffer;
+  partSizes[1] = bytes - firstPart;
+  return bytes;
+}
+
+void skipSampleBuffer(SampleBufferContainer *sampleBuffer, uint32_t bytes) {
+  sampleBuffer->consumed += bytes;
+}
+
+/**
+ * Like setup_file_sample, but takes the samples a WavStreamParser has been fed
+ * (the whole file), handing its output over as the sample data.
+ */
+bool setupSyroDataFromWavStream(WavStreamParser *parser, SyroData *syro_data) {
+  if (!finishWavStream(parser)) {
+    return false;
+  }
+  uint32_t numOfFrames = parser->numOfFrames;
+  // (never 0 bytes, like the rest of the sample data)
+  int16_t *frames =
+      realloc(parser->frames, numOfFrames ? numOfFrames * 2 : 1);
+  if (!frames) {
+    printf("not enough memory to setup file. \n");
+    return false;
+  }
+  syro_data->pData = (uint8_t *)frames;
+  syro_data->Size = numOfFrames * 2;
+  syro_data->Fs = parser->sampleRate;
+  syro_data->SampleEndian = LittleEndian;
+  parser->frames = NULL;
+  clearWavStreamParser(parser);
+  return true;
+}
+
+/**
+ * Sets up a new syro data entry from a WavStreamParser that has been fed a
+ * whole file. The parser's output is handed over either way.
+ *
+ * Returns a non-zero pointer if successful or 0 if not
+ */
+SyroData *getSyroDataForWavStream(WavStreamParser *parser, uint32_t slotNumber,
+                                  uint32_t quality, uint32_t useCompression) {
   SyroData *syro_data = malloc(sizeof(SyroData));
+  if (!syro_data || !setupSyroDataFromWavStream(parser, syro_data)) {
+    printf("Oops!\n");
+    free(syro_data);
+    clearWavStreamParser(parser);
+    return 0;
+  }
   syro_data->DataType =
       useCompression == 0 ? DataType_Sample_Liner : DataType_Sample_Compress;
   syro_data->Number = slotNumber;
   syro_data->Quality = quality;
-  bool ok = setup_file_sample(wavData, bytes, syro_data);
-  if (!ok) {
-    printf("Oops!\n");
-    return 0;
-  }
   return syro_data;
 }
+
+SyroData *getSyroDataForWavData(uint8_t *wavData, uint32_t bytes,
+                                uint32_t slotNumber, uint32_t quality,
+                                uint32_t useCompression) {
+  WavStreamParser parser;
+  initWavStreamParser(&parser);
+  pushWavStreamBytes(&parser, wavData, bytes);
+  return getSyroDataForWavStream(&parser, slotNumber, quality,
+                                 useCompression);
+}
@@ -0,0 +1,551 @@
+// A pool of syro workers that lives as long as the page, so transfers don't
+// pay for fetching and compiling syro-worker.js every time. Calls are queued
+// here on the main thread and handed out in priority order (first come first
+// served within a priority), with at most MAX_CALLS_PER_SYRO_WORKER in flight
+// per worker so each worker normally has its next call waiting while we
+// handle a response. A call can be pinned to one worker, for work that
+// depends on state kept there (like a sample buffer being encoded).
+//
+// Since workers are kept for the whole page, one that dies (e.g. on a trap)
+// or stops responding would otherwise take every call pinned to it down with
+// it. Such a worker is retired instead: replaced by a fresh one, with the
+// calls it had and those pinned to it failed (their callbacks get no data).
+// How long a worker may take depends on how much sample data its call
+// carries, since a single call can compress or encode a whole sample.
+
+#include <emscripten.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SYRO_WORKERS 16
+// used if the pool is needed before initSyroWorkerPool was called
+#define DEFAULT_SYRO_WORKERS 2
+#define MAX_CALLS_PER_SYRO_WORKER 2
+#define ANY_SYRO_WORKER -1
+// a worker is retired if a call it's on goes this long without a response,
+// plus SYRO_WORKER_TIMEOUT_MS_PER_MB for each MB of sample data the call
+// carries
+#define SYRO_WORKER_TIMEOUT_MS 60000
+#define SYRO_WORKER_TIMEOUT_MS_PER_MB 10000
+#define SYRO_WORKER_CHECK_INTERVAL_MS 5000
+
+// When a call went through each stage, from emscripten_get_now.
+typedef struct SyroCallTiming {
+  double queuedAt;
+  // when it went out to a worker
+  double dispatchedAt;
+  // when the worker got to it, as far as we can tell: the later of going out
+  // and the worker's previous response
+  double startedAt;
+  double respondedAt;
+  int32_t workerIndex;
+  const char *funcName;
+} SyroCallTiming;
+
+typedef struct SyroPoolCall {
+  int32_t priority;
+  // ANY_SYRO_WORKER until dispatched, unless pinned
+  int32_t workerIndex;
+  const char *funcName;
+  char *data;
+  int size;
+  // sample data to post right before the call (see postSyroSampleData)
+  SyroData *syro_data;
+  uint32_t NumOfData;
+  // if set, the syro data is freed once posted (or once the call is dropped)
+  bool ownsSyroData;
+  // may be NULL. the worker must respond either way.
+  em_worker_callback_func callback;
+  void *arg;
+  // how long the worker gets to respond once it's on the call
+  double timeoutMs;
+  // the next call in a list of calls being failed (see retireSyroWorker)
+  struct SyroPoolCall *nextFailed;
+  SyroCallTiming timing;
+} SyroPoolCall;
+
+typedef struct SyroPoolWorker {
+  worker_handle worker;
+  uint32_t callsInFlight;
+  // the calls out on this worker, in the order they went out
+  SyroPoolCall *calls[MAX_CALLS_PER_SYRO_WORKER];
+  // jobs that have pinned their calls to this worker
+  uint32_t pinnedJobs;
+  // counts the workers this one replaced (see retireSyroWorker)
+  uint32_t generation;
+  // when the latest response from this worker arrived
+  double lastResponseAt;
+} SyroPoolWorker;
+
+static SyroPoolWorker syroWorkers[MAX_SYRO_WORKERS];
+// for the call whose callback is running (see onSyroWorkerResponse)
+static SyroCallTiming currentSyroCallTiming;
+static uint32_t numOfSyroWorkers = 0;
+static SyroPoolCall **syroCallQueue = NULL;
+static uint32_t syroCallQueueLength = 0;
+static uint32_t syroCallQueueCapacity = 0;
+static bool syroWorkerCheckScheduled = false;
+
+// Posts a copy of a sample's data to a worker as a transferred ArrayBuffer,
+// for the next worker function that takes sample data (syro-worker-pre.js
+// holds it until then). Messages arrive in order, so this goes out right
+// before the call that needs it.
+EM_JS(void, postSyroSampleData,
+      (worker_handle worker, uint8_t *pData, uint32_t size), {
+        var data = HEAPU8.slice(pData, pData + size);
+        Browser.workers[worker].worker.postMessage(
+            {syroSampleData : data.buffer}, [data.buffer]);
+      });
+
+static void postSyroDataSamples(worker_handle worker, SyroData *syro_data,
+                                uint32_t NumOfData) {
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (syro_data[i].Size) {
+      postSyroSampleData(worker, syro_data[i].pData, syro_data[i].Size);
+    }
+  }
+}
+
+/**
+ * Packs the message for startSyroBufferWork (or encodeSyroStreamWork), to be
+ * freed by the caller. Each sample's data goes to the worker on its own (see
+ * postSyroSampleData), so only the syro data list and any compressed blocks we
+ * already have are packed here, letting the worker skip compressing those
+ * samples. Returns NULL if out of memory (callSyroWorker then fails the call).
+ */
+static uint8_t *createSyroStartMessage(SyroData *syro_data, uint32_t NumOfData,
+                                       uint32_t chunkBudgetMs, int *size) {
+  SyroCompBlock **compBlocks = malloc(sizeof(SyroCompBlock *) * NumOfData);
+  uint32_t NumOfBlocks = 0;
+  // (without room for the list, the worker just compresses every sample)
+  for (uint32_t i = 0; compBlocks && i < NumOfData; i++) {
+    SyroData *current_syro_data = syro_data + i;
+    if (current_syro_data->DataType == DataType_Sample_Compress &&
+        current_syro_data->Size) {
+      SyroCompBlock *compBlock =
+          getSyroCompBlock(getSyroCompKeyForSyroData(current_syro_data));
+      if (compBlock) {
+        compBlocks[NumOfBlocks++] = compBlock;
+      }
+    }
+  }
+
+  // buffer contains:
+  // NumOfData:ChunkBudgetMs:SyroDataList:NumOfBlocks:BlockList
+  int startMessageBufferSize = 0;
+  startMessageBufferSize += sizeof(uint32_t) * 2;
+  startMessageBufferSize += sizeof(SyroData) * NumOfData;
+  startMessageBufferSize += sizeof(uint32_t);
+  for (uint32_t i = 0; i < NumOfBlocks; i++) {
+    startMessageBufferSize += sizeof(SyroCompBlock) + compBlocks[i]->blockSize;
+  }
+
+  uint8_t *startMessageBuffer = malloc(startMessageBufferSize);
+  if (!startMessageBuffer) {
+    for (uint32_t i = 0; i < NumOfBlocks; i++) {
+      free(compBlocks[i]);
+    }
+    free(compBlocks);
+    *size = 0;
+    return NULL;
+  }
+
+  // write NumOfData and ChunkBudgetMs to buffer
+  uint32_t *numOfDataBuffer = (uint32_t *)startMessageBuffer;
+  numOfDataBuffer[0] = NumOfData;
+  numOfDataBuffer[1] = chunkBudgetMs;
+
+  // copy syro data list into buffer (the worker replaces the pData pointers)
+  SyroData *syroDataCopy =
+      (SyroData *)(startMessageBuffer + sizeof(uint32_t) * 2);
+  memcpy(syroDataCopy, syro_data, sizeof(SyroData) * NumOfData);
+
+  // append the compressed blocks
+  uint8_t *blockList = (uint8_t *)(syroDataCopy + NumOfData);
+  memcpy(blockList, &NumOfBlocks, sizeof(uint32_t));
+  blockList += sizeof(uint32_t);
+  for (uint32_t i = 0; i < NumOfBlocks; i++) {
+    uint32_t compBlockSize = sizeof(SyroCompBlock) + compBlocks[i]->blockSize;
+    memcpy(blockList, compBlocks[i], compBlockSize);
+    blockList += compBlockSize;
+    free(compBlocks[i]);
+  }
+  free(compBlocks);
+
+  *size = startMessageBufferSize;
+  return startMessageBuffer;
+}
+
+// A worker that throws (e.g. on a trap) never responds to the call it was on,
+// and is no use for any call after it.
+EM_JS(void, watchSyroWorkerErrors, (worker_handle worker), {
+  Browser.workers[worker].worker.addEventListener(
+      'error', function() { _onSyroWorkerError(worker); });
+});
+
+static void startSyroPoolWorker(SyroPoolWorker *poolWorker) {
+  poolWorker->worker = emscripten_create_worker("syro-worker.js");
+  watchSyroWorkerErrors(poolWorker->worker);
+  poolWorker->callsInFlight = 0;
+  poolWorker->lastResponseAt = 0;
+}
+
+/**
+ * Creates the pool's workers up front, so they're loaded by the time the
+ * first transfer needs them. Does nothing if the pool already exists.
+ */
+EMSCRIPTEN_KEEPALIVE
+void initSyroWorkerPool(uint32_t numOfWorkers) {
+  if (numOfSyroWorkers) {
+    return;
+  }
+  if (numOfWorkers < 1) {
+    numOfWorkers = 1;
+  } else if (numOfWorkers > MAX_SYRO_WORKERS) {
+    numOfWorkers = MAX_SYRO_WORKERS;
+  }
+  for (uint32_t i = 0; i < numOfWorkers; i++) {
+    startSyroPoolWorker(syroWorkers + i);
+    syroWorkers[i].pinnedJobs = 0;
+    syroWorkers[i].generation = 0;
+  }
+  numOfSyroWorkers = numOfWorkers;
+}
+
+/**
+ * Picks the worker with the fewest pinned jobs for a new job to pin its calls
+ * to, and sets generation for isSyroWorkerCurrent. Release it with
+ * releaseSyroWorker once the job is over.
+ */
+static int32_t acquireSyroWorker(uint32_t *generation) {
+  initSyroWorkerPool(DEFAULT_SYRO_WORKERS);
+  uint32_t best = 0;
+  for (uint32_t i = 1; i < numOfSyroWorkers; i++) {
+    SyroPoolWorker *candidate = syroWorkers + i;
+    if (candidate->pinnedJobs < syroWorkers[best].pinnedJobs ||
+        (candidate->pinnedJobs == syroWorkers[best].pinnedJobs &&
+         candidate->callsInFlight < syroWorkers[best].callsInFlight)) {
+      best = i;
+    }
+  }
+  syroWorkers[best].pinnedJobs++;
+  *generation = syroWorkers[best].generation;
+  return (int32_t)best;
+}
+
+static void releaseSyroWorker(int32_t workerIndex) {
+  syroWorkers[workerIndex].pinnedJobs--;
+}
+
+/**
+ * Whether the worker acquired with this generation is still there, i.e. any
+ * state a job keeps on it is too.
+ */
+static bool isSyroWorkerCurrent(int32_t workerIndex, uint32_t generation) {
+  return syroWorkers[workerIndex].generation == generation;
+}
+
+static void freeSyroPoolCall(SyroPoolCall *call) {
+  if (call->ownsSyroData && call->syro_data) {
+    free_syrodata(call->syro_data, call->NumOfData);
+    free(call->syro_data);
+  }
+  free(call);
+}
+
+static void dispatchSyroWorkerCalls(void);
+
+// (workers take their calls one at a time, in the order they went out, so a
+// call starts once the worker's previous response is in)
+static double getSyroCallStartedAt(SyroPoolCall *call,
+                                   SyroPoolWorker *poolWorker) {
+  return call->timing.dispatchedAt > poolWorker->lastResponseAt
+             ? call->timing.dispatchedAt
+             : poolWorker->lastResponseAt;
+}
+
+// Calls the call's callback (if any) with the response, and frees the call.
+static void completeSyroPoolCall(SyroPoolCall *call, char *data, int size) {
+  if (call->callback) {
+    currentSyroCallTiming = call->timing;
+    call->callback(data, size, call->arg);
+  }
+  freeSyroPoolCall(call);
+}
+
+static void onSyroWorkerResponse(char *data, int size, void *callPointer) {
+  SyroPoolCall *call = (SyroPoolCall *)callPointer;
+  SyroPoolWorker *poolWorker = syroWorkers + call->workerIndex;
+  for (uint32_t i = 0; i < poolWorker->callsInFlight; i++) {
+    if (poolWorker->calls[i] == call) {
+      memmove(poolWorker->calls + i, poolWorker->calls + i + 1,
+              sizeof(SyroPoolCall *) * (poolWorker->callsInFlight - i - 1));
+      break;
+    }
+  }
+  poolWorker->callsInFlight--;
+  SyroCallTiming *timing = &call->timing;
+  timing->workerIndex = call->workerIndex;
+  timing->funcName = call->funcName;
+  timing->respondedAt = emscripten_get_now();
+  timing->startedAt = getSyroCallStartedAt(call, poolWorker);
+  poolWorker->lastResponseAt = timing->respondedAt;
+  completeSyroPoolCall(call, data, size);
+  dispatchSyroWorkerCalls();
+}
+
+/**
+ * Replaces a worker that died or stopped responding with a fresh one. The
+ * calls it had, and those still queued for it, fail: they're completed with
+ * no data, as if the worker had nothing to say.
+ */
+static void retireSyroWorker(uint32_t workerIndex) {
+  SyroPoolWorker *poolWorker = syroWorkers + workerIndex;
+  double now = emscripten_get_now();
+  // (linked through the calls themselves, in the order they're failed)
+  SyroPoolCall *failedCalls = NULL;
+  SyroPoolCall **lastFailedCall = &failedCalls;
+  for (uint32_t i = 0; i < poolWorker->callsInFlight; i++) {
+    SyroPoolCall *call = poolWorker->calls[i];
+    call->timing.startedAt = getSyroCallStartedAt(call, poolWorker);
+    *lastFailedCall = call;
+    lastFailedCall = &call->nextFailed;
+  }
+  // calls pinned to it are for state that's gone with it
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < syroCallQueueLength; i++) {
+    SyroPoolCall *call = syroCallQueue[i];
+    if (call->workerIndex == (int32_t)workerIndex) {
+      call->timing.startedAt = now;
+      *lastFailedCall = call;
+      lastFailedCall = &call->nextFailed;
+    } else {
+      syroCallQueue[kept++] = call;
+    }
+  }
+  *lastFailedCall = NULL;
+  syroCallQueueLength = kept;
+  emscripten_destroy_worker(poolWorker->worker);
+  startSyroPoolWorker(poolWorker);
+  poolWorker->generation++;
+  // (the callbacks may queue calls of their own, for the fresh worker too)
+  while (failedCalls) {
+    SyroPoolCall *call = failedCalls;
+    failedCalls = call->nextFailed;
+    call->workerIndex = (int32_t)workerIndex;
+    call->timing.workerIndex = (int32_t)workerIndex;
+    call->timing.funcName = call->funcName;
+    call->timing.respondedAt = now;
+    completeSyroPoolCall(call, NULL, 0);
+  }
+  dispatchSyroWorkerCalls();
+}
+
+EMSCRIPTEN_KEEPALIVE
+void onSyroWorkerError(worker_handle worker) {
+  for (uint32_t i = 0; i < numOfSyroWorkers; i++) {
+    // (it may have been retired already)
+    if (syroWorkers[i].worker == worker) {
+      printf("Syro worker %u failed, so it was replaced.\n", i);
+      retireSyroWorker(i);
+      return;
+    }
+  }
+}
+
+static void checkSyroWorkers(void *arg);
+
+// Keeps an eye on workers for as long as any of them have calls out.
+static void scheduleSyroWorkerCheck(void) {
+  if (syroWorkerCheckScheduled) {
+    return;
+  }
+  for (uint32_t i = 0; i < numOfSyroWorkers; i++) {
+    if (syroWorkers[i].callsInFlight) {
+      syroWorkerCheckScheduled = true;
+      emscripten_async_call(checkSyroWorkers, NULL,
+                            SYRO_WORKER_CHECK_INTERVAL_MS);
+      return;
+    }
+  }
+}
+
+static void checkSyroWorkers(void *arg) {
+  syroWorkerCheckScheduled = false;
+  double now = emscripten_get_now();
+  for (uint32_t i = 0; i < numOfSyroWorkers; i++) {
+    SyroPoolWorker *poolWorker = syroWorkers + i;
+    if (poolWorker->callsInFlight &&
+        now - getSyroCallStartedAt(poolWorker->calls[0], poolWorker) >
+            poolWorker->calls[0]->timeoutMs) {
+      printf("Syro worker %u stopped responding, so it was replaced.\n", i);
+      retireSyroWorker(i);
+    }
+  }
+  scheduleSyroWorkerCheck();
+}
+
+// index of the next queued call that can run on the worker, or -1
+static int32_t findNextSyroWorkerCall(uint32_t workerIndex) {
+  int32_t next = -1;
+  for (uint32_t i = 0; i < syroCallQueueLength; i++) {
+    SyroPoolCall *call = syroCallQueue[i];
+    if (call->workerIndex != ANY_SYRO_WORKER &&
+        call->workerIndex != (int32_t)workerIndex) {
+      continue;
+    }
+    // the queue is in the order calls were made, so only a higher priority
+    // wins
+    if (next == -1 || call->priority > syroCallQueue[next]->priority) {
+      next = (int32_t)i;
+    }
+  }
+  return next;
+}
+
+static void dispatchSyroWorkerCalls(void) {
+  bool dispatched = true;
+  // hand out one call per worker per pass, so unpinned calls spread out
+  while (dispatched) {
+    dispatched = false;
+    for (uint32_t w = 0; w < numOfSyroWorkers; w++) {
+      SyroPoolWorker *poolWorker = syroWorkers + w;
+      if (poolWorker->callsInFlight >= MAX_CALLS_PER_SYRO_WORKER) {
+        continue;
+      }
+      int32_t next = findNextSyroWorkerCall(w);
+      if (next == -1) {
+        continue;
+      }
+      SyroPoolCall *call = syroCallQueue[next];
+      memmove(syroCallQueue + next, syroCallQueue + next + 1,
+              sizeof(SyroPoolCall *) * (syroCallQueueLength - next - 1));
+      syroCallQueueLength--;
+      call->workerIndex = (int32_t)w;
+      if (call->syro_data) {
+        postSyroDataSamples(poolWorker->worker, call->syro_data,
+                            call->NumOfData);
+        if (call->ownsSyroData) {
+          free_syrodata(call->syro_data, call->NumOfData);
+          free(call->syro_data);
+          call->syro_data = NULL;
+        }
+      }
+      call->timing.dispatchedAt = emscripten_get_now();
+      emscripten_call_worker(poolWorker->worker, call->funcName, call->data,
+                             call->size, onSyroWorkerResponse, (void *)call);
+      poolWorker->calls[poolWorker->callsInFlight++] = call;
+      dispatched = true;
+    }
+  }
+  scheduleSyroWorkerCheck();
+}
+
+// Completes a call that couldn't be queued with no data, like a call failed by
+// retireSyroWorker. That happens on a later tick, as a response would, since
+// callers only count the call as in flight once they've made it.
+EM_JS(void, failSyroWorkerCallLater,
+      (em_worker_callback_func callback, void *arg, const char *funcName), {
+        setTimeout(function() {
+          _onSyroWorkerCallFailed(callback, arg, funcName);
+        }, 0);
+      });
+
+EMSCRIPTEN_KEEPALIVE
+void onSyroWorkerCallFailed(em_worker_callback_func callback, void *arg,
+                            const char *funcName) {
+  double now = emscripten_get_now();
+  currentSyroCallTiming.queuedAt = now;
+  currentSyroCallTiming.dispatchedAt = now;
+  currentSyroCallTiming.startedAt = now;
+  currentSyroCallTiming.respondedAt = now;
+  currentSyroCallTiming.workerIndex = ANY_SYRO_WORKER;
+  currentSyroCallTiming.funcName = funcName;
+  callback(NULL, 0, arg);
+}
+
+/**
+ * Queues a call to a pool worker (ANY_SYRO_WORKER, or an index from
+ * acquireSyroWorker). data is copied. If syro_data is given, its sample data
+ * is posted to the same worker just before the call, and if ownsSyroData is
+ * set it's freed after that (the call takes ownership). The callback can read
+ * currentSyroCallTiming to see where the call's time went. If data is NULL
+ * (e.g. createSyroStartMessage ran out of memory) or the call can't be
+ * queued, the call fails: the callback gets no data, as if a worker had
+ * failed it.
+ */
+static void callSyroWorker(int32_t workerIndex, int32_t priority,
+                           const char *funcName, char *data, int size,
+                           SyroData *syro_data, uint32_t NumOfData,
+                           bool ownsSyroData, em_worker_callback_func callback,
+                           void *arg) {
+  initSyroWorkerPool(DEFAULT_SYRO_WORKERS);
+  if (syroCallQueueLength == syroCallQueueCapacity) {
+    uint32_t capacity = syroCallQueueCapacity ? syroCallQueueCapacity * 2 : 16;
+    SyroPoolCall **grown =
+        realloc(syroCallQueue, sizeof(SyroPoolCall *) * capacity);
+    if (grown) {
+      syroCallQueue = grown;
+      syroCallQueueCapacity = capacity;
+    }
+  }
+  // (the data is kept right after the call)
+  SyroPoolCall *call =
+      data && syroCallQueueLength < syroCallQueueCapacity
+          ? malloc(sizeof(SyroPoolCall) + size)
+          : NULL;
+  if (!call) {
+    printf("Out of memory for a %s call, so it failed.\n", funcName);
+    if (ownsSyroData && syro_data) {
+      free_syrodata(syro_data, NumOfData);
+      free(syro_data);
+    }
+    if (callback) {
+      failSyroWorkerCallLater(callback, arg, funcName);
+    }
+    return;
+  }
+  call->priority = priority;
+  call->workerIndex = workerIndex;
+  call->funcName = funcName;
+  call->data = (char *)(call + 1);
+  memcpy(call->data, data, size);
+  call->size = size;
+  call->syro_data = syro_data;
+  call->NumOfData = NumOfData;
+  call->ownsSyroData = ownsSyroData;
+  call->callback = callback;
+  call->arg = arg;
+  double sampleMegabytes = 0;
+  for (uint32_t i = 0; syro_data && i < NumOfData; i++) {
+    sampleMegabytes += syro_data[i].Size / (1024.0 * 1024.0);
+  }
+  call->timeoutMs =
+      SYRO_WORKER_TIMEOUT_MS + sampleMegabytes * SYRO_WORKER_TIMEOUT_MS_PER_MB;
+  call->timing.queuedAt = emscripten_get_now();
+  syroCallQueue[syroCallQueueLength++] = call;
+  dispatchSyroWorkerCalls();
+}
+
+/**
+ * Drops queued calls made with arg that haven't gone out to a worker yet
+ * (their callbacks are never called). Returns how many were dropped.
+ */
+static uint32_t cancelSyroWorkerCalls(void *arg) {
+  uint32_t kept = 0;
+  uint32_t dropped = 0;
+  for (uint32_t i = 0; i < syroCallQueueLength; i++) {
+    SyroPoolCall *call = syroCallQueue[i];
+    if (call->arg == arg) {
+      freeSyroPoolCall(call);
+      dropped++;
+    } else {
+      syroCallQueue[kept++] = call;
+    }
+  }
+  syroCallQueueLength = kept;
+  return dropped;
+}
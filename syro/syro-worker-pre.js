@@ -0,0 +1,16 @@
+// Prepended to syro-worker.js (--pre-js). Sample data is posted to the worker
+// as transferred ArrayBuffers, next to the emscripten_call_worker messages
+// rather than inside them, so the main thread doesn't have to pack every
+// sample into one big message buffer first. This listener is registered
+// before the one emscripten installs, so it can hold those buffers back (in
+// order) until a worker function asks for them with takeSyroSampleData.
+
+/** @type {ArrayBuffer[]} */
+var pendingSyroSampleData = [];
+
+self.addEventListener('message', function (e) {
+  if (e.data && e.data.syroSampleData) {
+    pendingSyroSampleData.push(e.data.syroSampleData);
+    e.stopImmediatePropagation();
+  }
+});
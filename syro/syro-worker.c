@@ -2,56 +2,336 @@
 #include "./syro-utils.c"
 #include <emscripten.h>
 
+// Everything a stream needs on the worker comes from its arena, which is
+// released in one go when the main thread is done with the stream.
+typedef struct SyroWorkerStream {
+  SyroArena arena;
+  SampleBufferContainer *sampleBuffer;
+  // each response is put together here, big enough for a full ring
+  uint8_t *messageBuffer;
+  uint32_t NumOfData;
+  uint32_t chunkBudgetMs;
+  // observed encoding speed, 0 until the first chunk has been timed
+  double framesPerMs;
+  // time spent starting the stream, reported with the first chunk
+  double startMs;
+} SyroWorkerStream;
+
+static uint32_t getNextIterationInterval(SyroWorkerStream *stream) {
+  if (!stream->framesPerMs) {
+    return INITIAL_ITERATION_INTERVAL;
+  }
+  double frames = stream->framesPerMs * stream->chunkBudgetMs;
+  if (frames < MIN_ITERATION_INTERVAL) {
+    return MIN_ITERATION_INTERVAL;
+  }
+  if (frames > MAX_ITERATION_INTERVAL) {
+    return MAX_ITERATION_INTERVAL;
+  }
+  return (uint32_t)frames;
+}
+
 EMSCRIPTEN_KEEPALIVE
 void iterateSyroBufferWork(char *data, int size) {
-  SampleBufferContainer *sampleBuffer = *(SampleBufferContainer **)data;
+  SyroWorkerStream *stream = *(SyroWorkerStream **)data;
+  SampleBufferContainer *sampleBuffer = stream->sampleBuffer;
 
-  uint32_t chunkStartIndex = sampleBuffer->progress;
-  // if we just started iterating we won't have sent an update for the wav
-  // header data so we should make sure we send it
-  if (chunkStartIndex == 44) {
-    chunkStartIndex = 0;
+  uint32_t progressBefore = sampleBuffer->progress;
+  double startTime = emscripten_get_now();
+  iterateSampleBuffer(sampleBuffer, getNextIterationInterval(stream));
+  double elapsedMs = emscripten_get_now() - startTime;
+  uint32_t frames = (sampleBuffer->progress - progressBefore) / 4;
+  // chunks too quick to time reliably (e.g. the short last one) don't count
+  if (frames >= MIN_ITERATION_INTERVAL && elapsedMs > 1) {
+    double framesPerMs = frames / elapsedMs;
+    // smoothed, so one chunk interrupted by the OS doesn't shrink the next
+    stream->framesPerMs = stream->framesPerMs
+                              ? stream->framesPerMs * 0.5 + framesPerMs * 0.5
+                              : framesPerMs;
   }
 
-  // TODO: adapt this iteration count based on observed speed?
-  iterateSampleBuffer(sampleBuffer, ITERATION_INTERVAL);
-
-  uint32_t chunkSize = sampleBuffer->progress - chunkStartIndex;
+  // everything not yet sent goes out with this update (including the wav
+  // header the first time), which also frees up the ring for the next chunk
+  uint32_t chunkSize = sampleBuffer->progress - sampleBuffer->consumed;
 
+  double copyStartTime = emscripten_get_now();
   int messageBufferSize = sizeof(SampleBufferUpdate) + chunkSize;
-  uint8_t *messageBuffer = malloc(messageBufferSize);
+  uint8_t *messageBuffer = stream->messageBuffer;
   SampleBufferUpdate *sampleBufferUpdate = (SampleBufferUpdate *)messageBuffer;
-  sampleBufferUpdate->sampleBufferPointer = (void *)sampleBuffer;
-  sampleBufferUpdate->chunk = NULL; // to be defined in main thread
-  sampleBufferUpdate->chunkSize = sampleBuffer->progress - chunkStartIndex;
+  sampleBufferUpdate->sampleBufferPointer = (void *)stream;
+  sampleBufferUpdate->transfer = NULL; // to be defined in main thread
+  sampleBufferUpdate->chunk = NULL;    // to be defined in main thread
+  sampleBufferUpdate->chunkSize = chunkSize;
   sampleBufferUpdate->progress = sampleBuffer->progress;
   sampleBufferUpdate->totalSize = sampleBuffer->size;
   memcpy(sampleBufferUpdate->dataStartPoints, sampleBuffer->dataStartPoints,
          sizeof(sampleBuffer->dataStartPoints));
   uint8_t *chunk = messageBuffer + sizeof(SampleBufferUpdate);
-  memcpy(chunk, sampleBuffer->buffer + chunkStartIndex, chunkSize);
+  readSampleBuffer(sampleBuffer, chunk, chunkSize);
+  sampleBufferUpdate->timings.startMs = stream->startMs;
+  sampleBufferUpdate->timings.encodeMs = elapsedMs;
+  sampleBufferUpdate->timings.copyMs = emscripten_get_now() - copyStartTime;
+  sampleBufferUpdate->timings.frames = frames;
+  sampleBufferUpdate->memoryBytes = stream->arena.bytes;
+  sampleBufferUpdate->peakMemoryBytes = stream->arena.peakBytes;
+  stream->startMs = 0;
+  // (the message is copied as it's sent, so the buffer is free again)
   emscripten_worker_respond((char *)messageBuffer, messageBufferSize);
-  free(messageBuffer);
 }
 
+// Sample data arrives ahead of the call that needs it, as transferred
+// ArrayBuffers held by syro-worker-pre.js (see postSyroSampleData in
+// syro-bindings.c). This copies the oldest one into dest, which is the only
+// copy on this side.
+EM_JS(void, takeSyroSampleData, (uint8_t *dest, uint32_t size), {
+  HEAPU8.set(new Uint8Array(pendingSyroSampleData.shift(), 0, size), dest);
+});
+
+EM_JS(void, dropSyroSampleData, (), { pendingSyroSampleData.shift(); });
+
+// The pData pointers we receive point to memory in the main thread, not the
+// worker thread, so they are replaced with our own copies (from arena, unless
+// it's NULL).
+static bool receiveSyroSampleData(SyroData *syro_data, SyroArena *arena) {
+  if (!syro_data->Size) {
+    syro_data->pData = NULL;
+    return true;
+  }
+  syro_data->pData = arena ? allocateInSyroArena(arena, syro_data->Size)
+                           : malloc(syro_data->Size);
+  if (!syro_data->pData) {
+    // still take it so the next sample lines up
+    dropSyroSampleData();
+    return false;
+  }
+  takeSyroSampleData(syro_data->pData, syro_data->Size);
+  return true;
+}
+
+// Reads a start message (see startSampleBufferWorker in syro-bindings.c),
+// along with the sample data posted ahead of it. Returns our own copy of the
+// syro data list, allocated (along with the sample data) from arena, or NULL
+// if out of memory. All of the sample data is taken either way, so the next
+// message's lines up.
+static SyroData *receiveSyroStartMessage(char *data, SyroArena *arena,
+                                         uint32_t *NumOfData,
+                                         uint32_t *chunkBudgetMs) {
+  *NumOfData = *(uint32_t *)data;
+  *chunkBudgetMs = *(uint32_t *)(data + sizeof(uint32_t));
+  const SyroData *sent_syro_data =
+      (const SyroData *)(data + sizeof(uint32_t) * 2);
+  // the input buffer is reused for the next message, so everything we keep
+  // has to be copied out
+  SyroData *syro_data =
+      allocateInSyroArena(arena, sizeof(SyroData) * *NumOfData);
+  bool received = syro_data != NULL;
+  if (received) {
+    memcpy(syro_data, sent_syro_data, sizeof(SyroData) * *NumOfData);
+  }
+  for (uint32_t i = 0; i < *NumOfData; i++) {
+    if (received) {
+      received = receiveSyroSampleData(syro_data + i, arena);
+    } else if (sent_syro_data[i].Size) {
+      dropSyroSampleData();
+    }
+  }
+  if (!received) {
+    return NULL;
+  }
+
+  // Any blocks the main thread already compressed come after the syro data
+  // list, so SyroVolcaSample_Start can find them instead of compressing again.
+  uint8_t *blockList =
+      (uint8_t *)data + sizeof(uint32_t) * 2 + sizeof(SyroData) * *NumOfData;
+  uint32_t NumOfBlocks;
+  memcpy(&NumOfBlocks, blockList, sizeof(uint32_t));
+  blockList += sizeof(uint32_t);
+  for (uint32_t i = 0; i < NumOfBlocks; i++) {
+    SyroCompBlock compBlock;
+    memcpy(&compBlock, blockList, sizeof(SyroCompBlock));
+    blockList += sizeof(SyroCompBlock);
+    addSyroCompBlock(compBlock.key, compBlock.compSize, blockList,
+                     compBlock.blockSize, compBlock.checksum);
+    blockList += compBlock.blockSize;
+  }
+  return syro_data;
+}
+
+/**
+ * Starts a stream, responding like iterateSyroBufferWork with its first
+ * chunk, or with nothing if it couldn't be started (e.g. out of memory), in
+ * which case nothing is left of it here.
+ */
 EMSCRIPTEN_KEEPALIVE
 void startSyroBufferWork(char *data, int size) {
-  uint32_t NumOfData = *(uint32_t *)data;
-  SyroData *syro_data = (SyroData *)(data + sizeof(uint32_t));
-  // The passed pData pointer points to memory in the main thread, not the
-  // worker thread. We pass the actual data as part of the input buffer so
-  // we can replace the pData pointer with one that references memory in the
-  // worker thread.
-  uint8_t *pDataBuffer =
-      (uint8_t *)data + sizeof(uint32_t) + sizeof(SyroData) * NumOfData;
-  uint32_t pDataOffset = 0;
-  for (uint32_t i = 0; i < NumOfData; i++) {
-    SyroData *current_syro_data = syro_data + i;
-    current_syro_data->pData = (uint8_t *)(pDataBuffer + pDataOffset);
-    pDataOffset += current_syro_data->Size;
-  }
-
-  SampleBufferContainer *sampleBuffer = startSampleBuffer(syro_data, NumOfData);
-
-  iterateSyroBufferWork((char *)&sampleBuffer, sizeof(SampleBufferContainer *));
+  SyroArena arena;
+  initSyroArena(&arena);
+  uint32_t NumOfData;
+  uint32_t chunkBudgetMs;
+  SyroData *syro_data =
+      receiveSyroStartMessage(data, &arena, &NumOfData, &chunkBudgetMs);
+  SyroWorkerStream *stream =
+      syro_data ? malloc(sizeof(SyroWorkerStream)) : NULL;
+  if (!stream) {
+    releaseSyroArena(&arena);
+    emscripten_worker_respond(NULL, 0);
+    return;
+  }
+  // (nothing points at the arena itself yet, so it can move)
+  stream->arena = arena;
+
+  // the worker never holds more than one chunk of output, however long the
+  // stream is
+  double startTime = emscripten_get_now();
+  SampleBufferContainer *sampleBuffer = startSampleBufferStreamInArena(
+      &stream->arena, syro_data, NumOfData, SAMPLE_BUFFER_STREAM_SIZE);
+  stream->messageBuffer = NULL;
+  if (sampleBuffer) {
+    // a chunk is never more than the ring holds
+    stream->messageBuffer = allocateInSyroArena(
+        &stream->arena, sizeof(SampleBufferUpdate) + sampleBuffer->bufferSize);
+  }
+  if (!stream->messageBuffer) {
+    if (sampleBuffer) {
+      SyroVolcaSample_End(sampleBuffer->syro_handle);
+    }
+    releaseSyroArena(&stream->arena);
+    free(stream);
+    emscripten_worker_respond(NULL, 0);
+    return;
+  }
+
+  stream->sampleBuffer = sampleBuffer;
+  stream->NumOfData = NumOfData;
+  stream->chunkBudgetMs =
+      chunkBudgetMs ? chunkBudgetMs : DEFAULT_CHUNK_BUDGET_MS;
+  stream->framesPerMs = 0;
+  stream->startMs = emscripten_get_now() - startTime;
+
+  iterateSyroBufferWork((char *)&stream, sizeof(SyroWorkerStream *));
+}
+
+/**
+ * Workers are kept around between transfers, so the main thread sends this
+ * once it's done with a stream (finished or not).
+ */
+EMSCRIPTEN_KEEPALIVE
+void endSyroBufferWork(char *data, int size) {
+  SyroWorkerStream *stream = *(SyroWorkerStream **)data;
+  SampleBufferContainer *sampleBuffer = stream->sampleBuffer;
+  if (sampleBuffer->progress < sampleBuffer->size) {
+    SyroVolcaSample_End(sampleBuffer->syro_handle);
+  }
+  // (the sample data, the sample buffer and the message buffer all go with
+  // the arena)
+  releaseSyroArena(&stream->arena);
+  free(stream);
+  emscripten_worker_respond(NULL, 0);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void compressSyroDataWork(char *data, int size) {
+  SyroData syro_data;
+  memcpy(&syro_data, data, sizeof(SyroData));
+  SyroCompBlock *compBlock = NULL;
+  if (receiveSyroSampleData(&syro_data, NULL) &&
+      precompressSyroData(&syro_data)) {
+    compBlock = getSyroCompBlock(getSyroCompKeyForSyroData(&syro_data));
+  }
+  free_syrodata(&syro_data, 1);
+  if (!compBlock) {
+    emscripten_worker_respond(NULL, 0);
+    return;
+  }
+  // the block bytes directly follow the struct in the copy we get back
+  emscripten_worker_respond((char *)compBlock,
+                            sizeof(SyroCompBlock) + compBlock->blockSize);
+  free(compBlock);
+}
+
+/**
+ * Responds with the compSize of a compressed sample (a uint32), for
+ * measureSyroCompSize in syro-bindings.c. Only the compressor's size pass
+ * runs, and nothing is kept. Responds with nothing if out of memory.
+ */
+EMSCRIPTEN_KEEPALIVE
+void measureSyroCompSizeWork(char *data, int size) {
+  SyroData syro_data;
+  memcpy(&syro_data, data, sizeof(SyroData));
+  if (!receiveSyroSampleData(&syro_data, NULL)) {
+    emscripten_worker_respond(NULL, 0);
+    return;
+  }
+  uint32_t compSize = syro_data.Size
+                          ? SyroComp_GetCompSize(
+                                syro_data.pData, syro_data.Size / 2,
+                                syro_data.Quality, syro_data.SampleEndian)
+                          : 0;
+  free_syrodata(&syro_data, 1);
+  emscripten_worker_respond((char *)&compSize, sizeof(compSize));
+}
+
+/**
+ * Encodes a whole stream in one go, for the main thread's segment cache. Takes
+ * the same message as startSyroBufferWork and responds with a
+ * SyroStreamUpdate followed by the entire stream, or nothing if the stream
+ * couldn't be started.
+ */
+EMSCRIPTEN_KEEPALIVE
+void encodeSyroStreamWork(char *data, int size) {
+  // everything here is gone again by the end of the call
+  SyroArena arena;
+  initSyroArena(&arena);
+  uint32_t NumOfData;
+  uint32_t chunkBudgetMs;
+  SyroData *syro_data =
+      receiveSyroStartMessage(data, &arena, &NumOfData, &chunkBudgetMs);
+  uint64_t segmentKey = syro_data ? getSyroSegmentKey(syro_data) : 0;
+  double startTime = emscripten_get_now();
+  // The segment cache checks streams it puts together against the frame
+  // count for their entries' data sizes, so a compressed entry is compressed
+  // ahead of Start (which then only looks the block up) to learn its compSize.
+  uint32_t dataSize = 0;
+  if (syro_data && syro_data->Size) {
+    precompressSyroData(syro_data);
+    dataSize = syro_data->DataType == DataType_Sample_Compress
+                   ? SyroComp_GetCompSize(syro_data->pData, syro_data->Size / 2,
+                                          syro_data->Quality,
+                                          syro_data->SampleEndian)
+                   : syro_data->Size;
+  }
+  SampleBufferContainer *sampleBuffer =
+      syro_data
+          ? startSampleBufferStreamInArena(&arena, syro_data, NumOfData, 0)
+          : NULL;
+  int messageBufferSize =
+      sampleBuffer ? sizeof(SyroStreamUpdate) + sampleBuffer->size : 0;
+  uint8_t *messageBuffer =
+      sampleBuffer ? allocateInSyroArena(&arena, messageBufferSize) : NULL;
+  if (!messageBuffer) {
+    if (sampleBuffer) {
+      SyroVolcaSample_End(sampleBuffer->syro_handle);
+    }
+    releaseSyroArena(&arena);
+    emscripten_worker_respond(NULL, 0);
+    return;
+  }
+  double encodeStartTime = emscripten_get_now();
+  iterateSampleBuffer(sampleBuffer, INT32_MAX);
+  double copyStartTime = emscripten_get_now();
+
+  SyroStreamUpdate *streamUpdate = (SyroStreamUpdate *)messageBuffer;
+  streamUpdate->segmentKey = segmentKey;
+  streamUpdate->dataSize = dataSize;
+  streamUpdate->totalSize = sampleBuffer->size;
+  memcpy(streamUpdate->dataStartPoints, sampleBuffer->dataStartPoints,
+         sizeof(sampleBuffer->dataStartPoints));
+  memcpy(messageBuffer + sizeof(SyroStreamUpdate), sampleBuffer->buffer,
+         sampleBuffer->size);
+  streamUpdate->timings.startMs = encodeStartTime - startTime;
+  streamUpdate->timings.encodeMs = copyStartTime - encodeStartTime;
+  streamUpdate->timings.copyMs = emscripten_get_now() - copyStartTime;
+  streamUpdate->timings.frames = (sampleBuffer->size - sizeof(wav_header)) / 4;
+  emscripten_worker_respond((char *)messageBuffer, messageBufferSize);
+  releaseSyroArena(&arena);
 }
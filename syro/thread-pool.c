@@ -0,0 +1,130 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Fixed-size pool of worker threads that run indexed tasks in parallel.
+ * Tasks are handed out in index order, so callers that care about which
+ * results become available first should order their work accordingly.
+ */
+typedef void (*ThreadPoolTask)(uint32_t index, void *arg);
+
+typedef struct ThreadPool {
+  pthread_t *threads;
+  uint32_t numOfThreads;
+  pthread_mutex_t mutex;
+  pthread_cond_t workAvailable;
+  pthread_cond_t workDone;
+  // current batch
+  ThreadPoolTask task;
+  void *arg;
+  uint32_t nextIndex;
+  uint32_t count;
+  uint32_t running;
+  bool shuttingDown;
+} ThreadPool;
+
+uint32_t getNumberOfCores(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (uint32_t)cores : 1;
+}
+
+static void *threadPoolWorker(void *poolPointer) {
+  ThreadPool *pool = (ThreadPool *)poolPointer;
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (!pool->shuttingDown && pool->nextIndex >= pool->count) {
+      pthread_cond_wait(&pool->workAvailable, &pool->mutex);
+    }
+    if (pool->shuttingDown) {
+      break;
+    }
+    uint32_t index = pool->nextIndex++;
+    ThreadPoolTask task = pool->task;
+    void *arg = pool->arg;
+    pool->running++;
+    pthread_mutex_unlock(&pool->mutex);
+    task(index, arg);
+    pthread_mutex_lock(&pool->mutex);
+    pool->running--;
+    if (pool->nextIndex >= pool->count && !pool->running) {
+      pthread_cond_broadcast(&pool->workDone);
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+/**
+ * Returns a non-zero pointer if successful or 0 if not. Passing 0 for
+ * numOfThreads uses one thread per available core.
+ */
+ThreadPool *createThreadPool(uint32_t numOfThreads) {
+  if (!numOfThreads) {
+    numOfThreads = getNumberOfCores();
+  }
+  ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+  if (!pool) {
+    return 0;
+  }
+  pool->threads = malloc(sizeof(pthread_t) * numOfThreads);
+  if (!pool->threads) {
+    free(pool);
+    return 0;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->workAvailable, NULL);
+  pthread_cond_init(&pool->workDone, NULL);
+  for (uint32_t i = 0; i < numOfThreads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, threadPoolWorker, pool)) {
+      break;
+    }
+    pool->numOfThreads++;
+  }
+  if (!pool->numOfThreads) {
+    free(pool->threads);
+    free(pool);
+    return 0;
+  }
+  return pool;
+}
+
+/**
+ * Runs task(0..count-1, arg) across the pool and blocks until every task has
+ * returned. Only one batch may run on a pool at a time.
+ */
+void threadPoolRun(ThreadPool *pool, uint32_t count, ThreadPoolTask task,
+                   void *arg) {
+  if (!count) {
+    return;
+  }
+  pthread_mutex_lock(&pool->mutex);
+  pool->task = task;
+  pool->arg = arg;
+  pool->nextIndex = 0;
+  pool->count = count;
+  pthread_cond_broadcast(&pool->workAvailable);
+  while (pool->nextIndex < pool->count || pool->running) {
+    pthread_cond_wait(&pool->workDone, &pool->mutex);
+  }
+  pool->count = 0;
+  pool->nextIndex = 0;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void freeThreadPool(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->shuttingDown = true;
+  pthread_cond_broadcast(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->mutex);
+  for (uint32_t i = 0; i < pool->numOfThreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->workAvailable);
+  pthread_cond_destroy(&pool->workDone);
+  free(pool->threads);
+  free(pool);
+}
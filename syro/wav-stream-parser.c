@@ -0,0 +1,478 @@
+// A push-style parser for wav and aiff files: it's handed the file a chunk at a
+// time, in pieces of any size, and converts sample frames to 1ch, 16Bit as
+// soon as they arrive, so reading a file can overlap with converting it and
+// the whole file never has to be in memory at once. Besides the 16/24Bit PCM
+// setup_file_sample takes, it understands 8/16/24/32Bit integer and 32Bit
+// float samples with any number of channels, WAVE_FORMAT_EXTENSIBLE, and
+// AIFF/AIFC (uncompressed, byte swapped 'sowt' or 32Bit float).
+//
+// Unlike Korg's loop, samples wider than 16 bits are scaled down to 16 bits
+// rather than cut to their low 16 bits (test/benchmark.c keeps Korg's loop for
+// comparison). 16Bit wav files come out exactly as setup_file_sample would
+// have them (see convertWavDataToMono16).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAV_STREAM_MAX_CHANNELS 16
+#define WAV_STREAM_MAX_SAMPLE_BYTES 4
+// bytes kept of a 'fmt ' or 'COMM' chunk (WAVE_FORMAT_EXTENSIBLE needs 40,
+// AIFC's COMM 22 before the compression name, which we don't need)
+#define WAV_STREAM_FORMAT_BYTES 40
+// frames reserved up front from a 'data' chunk's size, beyond which the output
+// grows as frames arrive (so a bogus size can't make us allocate gigabytes)
+#define WAV_STREAM_MAX_RESERVED_FRAMES (1 << 24)
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// the last 14 bytes of KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT (the first 2
+// are the format code)
+static const uint8_t wavExtensibleSubFormatSuffix[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80,
+    0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+
+typedef enum {
+  WavStreamState_FileHeader,
+  WavStreamState_ChunkHeader,
+  WavStreamState_FormatChunk,
+  WavStreamState_SoundDataHeader,
+  WavStreamState_Data,
+  WavStreamState_Error,
+} WavStreamState;
+
+typedef struct WavStreamParser {
+  WavStreamState state;
+  bool aiff;
+  bool aifc;
+  // header bytes collected so far for the current state
+  uint8_t header[WAV_STREAM_FORMAT_BYTES];
+  uint32_t headerSize;
+  uint32_t headerFill;
+  // bytes still to be skipped (the unwanted part of a chunk, or a pad byte)
+  uint64_t skip;
+  // bytes left in the chunk being read
+  uint32_t chunkRemaining;
+  bool chunkPadded;
+  // sample format, from 'fmt ' or 'COMM'
+  bool hasFormat;
+  uint16_t numOfChannels;
+  uint16_t bytesPerSample;
+  bool isFloat;
+  bool bigEndian;
+  // 8Bit wav samples are offset by 128, 8Bit aiff ones aren't
+  bool isUnsigned;
+  uint32_t sampleRate;
+  // frame bytes from the end of one chunk of input, waiting for the rest
+  uint8_t partialFrame[WAV_STREAM_MAX_CHANNELS * WAV_STREAM_MAX_SAMPLE_BYTES];
+  uint32_t partialFrameFill;
+  bool foundData;
+  // the 1ch, 16Bit output so far
+  int16_t *frames;
+  uint32_t numOfFrames;
+  uint32_t framesCapacity;
+} WavStreamParser;
+
+static inline uint16_t readWavStream16(const uint8_t *src, bool bigEndian) {
+  return bigEndian ? (uint16_t)((src[0] << 8) | src[1])
+                   : (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static inline uint32_t readWavStream32(const uint8_t *src, bool bigEndian) {
+  return bigEndian ? ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+                         ((uint32_t)src[2] << 8) | src[3]
+                   : src[0] | ((uint32_t)src[1] << 8) |
+                         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+// an 80Bit extended float, as aiff stores its sample rate in
+static uint32_t readExtendedSampleRate(const uint8_t *src) {
+  int exponent = ((src[0] & 0x7F) << 8 | src[1]) - 16383;
+  uint64_t mantissa = 0;
+  for (int i = 2; i < 10; i++) {
+    mantissa = (mantissa << 8) | src[i];
+  }
+  if ((src[0] & 0x80) || exponent < 0 || exponent > 31) {
+    return 0;
+  }
+  return (uint32_t)floor(ldexp((double)mantissa, exponent - 63) + 0.5);
+}
+
+static void initWavStreamParser(WavStreamParser *parser) {
+  memset(parser, 0, sizeof(WavStreamParser));
+  parser->state = WavStreamState_FileHeader;
+  parser->headerSize = 12;
+}
+
+/**
+ * Frees the output, if it hasn't been taken.
+ */
+static void clearWavStreamParser(WavStreamParser *parser) {
+  free(parser->frames);
+  parser->frames = NULL;
+  parser->numOfFrames = 0;
+  parser->framesCapacity = 0;
+}
+
+static bool failWavStream(WavStreamParser *parser, const char *message) {
+  printf("%s file error, %s\n", parser->aiff ? "aiff" : "wav", message);
+  parser->state = WavStreamState_Error;
+  return false;
+}
+
+static bool reserveWavStreamFrames(WavStreamParser *parser,
+                                   uint32_t numOfFrames) {
+  if (numOfFrames <= parser->framesCapacity) {
+    return true;
+  }
+  uint32_t capacity = parser->framesCapacity ? parser->framesCapacity : 4096;
+  while (capacity < numOfFrames) {
+    capacity = capacity > UINT32_MAX / 4 ? UINT32_MAX / 2 : capacity * 2;
+  }
+  int16_t *frames = realloc(parser->frames, capacity * sizeof(int16_t));
+  if (!frames) {
+    printf("not enough memory to setup file. \n");
+    parser->state = WavStreamState_Error;
+    return false;
+  }
+  parser->frames = frames;
+  parser->framesCapacity = capacity;
+  return true;
+}
+
+// one sample at 16 bits, before the channels are mixed
+static inline int32_t readWavStreamSample(const WavStreamParser *parser,
+                                          const uint8_t *src) {
+  bool bigEndian = parser->bigEndian;
+  switch (parser->bytesPerSample) {
+  case 1:
+    return (parser->isUnsigned ? (int32_t)src[0] - 128
+                               : (int32_t)(int8_t)src[0]) *
+           256;
+  case 2:
+    return (int16_t)readWavStream16(src, bigEndian);
+  case 3: {
+    uint32_t value = bigEndian ? ((uint32_t)src[0] << 16) |
+                                     ((uint32_t)src[1] << 8) | src[2]
+                               : src[0] | ((uint32_t)src[1] << 8) |
+                                     ((uint32_t)src[2] << 16);
+    // sign extend, then drop the low 8 bits
+    return (int32_t)(value << 8) >> 16;
+  }
+  default: {
+    uint32_t value = readWavStream32(src, bigEndian);
+    if (!parser->isFloat) {
+      return (int32_t)value >> 16;
+    }
+    float sample;
+    memcpy(&sample, &value, sizeof(float));
+    sample *= 32768;
+    if (sample != sample) {
+      return 0;
+    }
+    if (sample > 32767) {
+      return 32767;
+    }
+    if (sample < -32768) {
+      return -32768;
+    }
+    return (int32_t)sample;
+  }
+  }
+}
+
+/**
+ * Converts whole frames to 1ch, 16Bit, averaging the channels (rounding
+ * towards zero, like Korg's loop), onto the end of the output.
+ */
+static bool convertWavStreamFrames(WavStreamParser *parser, const uint8_t *src,
+                                   uint32_t numOfFrames) {
+  if (!reserveWavStreamFrames(parser, parser->numOfFrames + numOfFrames)) {
+    return false;
+  }
+  int16_t *dest = parser->frames + parser->numOfFrames;
+  parser->numOfFrames += numOfFrames;
+  uint32_t numOfChannels = parser->numOfChannels;
+  uint32_t bytesPerSample = parser->bytesPerSample;
+  if (bytesPerSample == 2 && !parser->bigEndian && numOfChannels <= 2) {
+    convertWavDataToMono16(src, dest, numOfFrames, numOfChannels);
+    return true;
+  }
+  uint32_t frameSize = numOfChannels * bytesPerSample;
+  for (uint32_t i = 0; i < numOfFrames; i++) {
+    const uint8_t *frame = src + i * frameSize;
+    int32_t sum = 0;
+    for (uint32_t ch = 0; ch < numOfChannels; ch++) {
+      sum += readWavStreamSample(parser, frame + ch * bytesPerSample);
+    }
+    dest[i] = (int16_t)(sum / (int32_t)numOfChannels);
+  }
+  return true;
+}
+
+static bool readWavFormatChunk(WavStreamParser *parser) {
+  const uint8_t *fmt = parser->header;
+  uint16_t format = readWavStream16(fmt, false);
+  uint16_t numOfChannels = readWavStream16(fmt + 2, false);
+  uint16_t blockAlign = readWavStream16(fmt + 12, false);
+  uint16_t bitsPerSample = readWavStream16(fmt + 14, false);
+  if (format == WAVE_FORMAT_EXTENSIBLE) {
+    if (parser->headerSize < 40 ||
+        memcmp(fmt + 26, wavExtensibleSubFormatSuffix,
+               sizeof(wavExtensibleSubFormatSuffix))) {
+      return failWavStream(parser, "unknown WAVE_FORMAT_EXTENSIBLE format.");
+    }
+    format = readWavStream16(fmt + 24, false);
+  }
+  if (format != WAVE_FORMAT_PCM && format != WAVE_FORMAT_IEEE_FLOAT) {
+    return failWavStream(parser, "encode must be PCM or float.");
+  }
+  if (!numOfChannels || numOfChannels > WAV_STREAM_MAX_CHANNELS ||
+      blockAlign % numOfChannels) {
+    return failWavStream(parser, "unsupported channel count.");
+  }
+  // the container size, which bitsPerSample may be smaller than
+  uint16_t bytesPerSample = blockAlign / numOfChannels;
+  if (format == WAVE_FORMAT_IEEE_FLOAT
+          ? bytesPerSample != 4 || bitsPerSample != 32
+          : !bytesPerSample || bytesPerSample > 4 ||
+                bitsPerSample > bytesPerSample * 8) {
+    return failWavStream(parser, "bit must be 8, 16, 24 or 32.");
+  }
+  parser->numOfChannels = numOfChannels;
+  parser->bytesPerSample = bytesPerSample;
+  parser->isFloat = format == WAVE_FORMAT_IEEE_FLOAT;
+  parser->bigEndian = false;
+  parser->isUnsigned = bytesPerSample == 1;
+  parser->sampleRate = readWavStream32(fmt + 4, false);
+  parser->hasFormat = true;
+  return true;
+}
+
+static bool readAiffCommonChunk(WavStreamParser *parser) {
+  const uint8_t *comm = parser->header;
+  bool aifc = parser->aifc;
+  if (aifc && parser->headerSize < 22) {
+    return failWavStream(parser, "'COMM' chunk is too small.");
+  }
+  uint16_t numOfChannels = readWavStream16(comm, true);
+  uint16_t bitsPerSample = readWavStream16(comm + 6, true);
+  bool isFloat = false;
+  bool bigEndian = true;
+  if (aifc) {
+    const uint8_t *compression = comm + 18;
+    if (!memcmp(compression, "sowt", 4)) {
+      bigEndian = false;
+    } else if (!memcmp(compression, "fl32", 4) ||
+               !memcmp(compression, "FL32", 4)) {
+      isFloat = true;
+    } else if (memcmp(compression, "NONE", 4)) {
+      return failWavStream(parser, "compressed AIFC is not supported.");
+    }
+  }
+  if (!numOfChannels || numOfChannels > WAV_STREAM_MAX_CHANNELS) {
+    return failWavStream(parser, "unsupported channel count.");
+  }
+  uint16_t bytesPerSample = isFloat ? 4 : (bitsPerSample + 7) / 8;
+  if (!bytesPerSample || bytesPerSample > 4) {
+    return failWavStream(parser, "bit must be 8, 16, 24 or 32.");
+  }
+  parser->numOfChannels = numOfChannels;
+  parser->bytesPerSample = bytesPerSample;
+  parser->isFloat = isFloat;
+  parser->bigEndian = bigEndian;
+  parser->isUnsigned = false;
+  parser->sampleRate = readExtendedSampleRate(comm + 8);
+  parser->hasFormat = true;
+  return true;
+}
+
+// Moves on to the chunk after the current one.
+static void endWavStreamChunk(WavStreamParser *parser) {
+  parser->skip += parser->chunkRemaining + (parser->chunkPadded ? 1 : 0);
+  parser->chunkRemaining = 0;
+  parser->state = WavStreamState_ChunkHeader;
+  parser->headerSize = 8;
+  parser->headerFill = 0;
+}
+
+static bool startWavStreamData(WavStreamParser *parser) {
+  if (!parser->hasFormat) {
+    return failWavStream(parser, parser->aiff
+                                     ? "'COMM' must come before 'SSND'."
+                                     : "'fmt ' must come before 'data'.");
+  }
+  parser->foundData = true;
+  parser->state = WavStreamState_Data;
+  uint32_t frameSize = parser->numOfChannels * parser->bytesPerSample;
+  uint32_t expectedFrames = parser->chunkRemaining / frameSize;
+  if (expectedFrames > WAV_STREAM_MAX_RESERVED_FRAMES) {
+    expectedFrames = WAV_STREAM_MAX_RESERVED_FRAMES;
+  }
+  return reserveWavStreamFrames(parser, expectedFrames);
+}
+
+// Acts on a complete header (the 12 byte file header, an 8 byte chunk header,
+// or the part of a chunk we keep).
+static bool readWavStreamHeader(WavStreamParser *parser) {
+  const uint8_t *header = parser->header;
+  switch (parser->state) {
+  case WavStreamState_FileHeader:
+    if (!memcmp(header, "FORM", 4) &&
+        (!memcmp(header + 8, "AIFF", 4) || !memcmp(header + 8, "AIFC", 4))) {
+      parser->aiff = true;
+      parser->aifc = header[11] == 'C';
+    } else if (memcmp(header, "RIFF", 4)) {
+      return failWavStream(parser, "'RIFF' is not found.");
+    } else if (memcmp(header + 8, "WAVE", 4)) {
+      return failWavStream(parser, "'WAVE' is not found.");
+    }
+    // (the RIFF/FORM size is ignored, since streamed files often get it
+    // wrong)
+    endWavStreamChunk(parser);
+    return true;
+  case WavStreamState_ChunkHeader: {
+    const uint8_t *id = header;
+    parser->chunkRemaining = readWavStream32(header + 4, parser->aiff);
+    parser->chunkPadded = parser->chunkRemaining & 1;
+    if (parser->foundData) {
+      endWavStreamChunk(parser);
+    } else if (!memcmp(id, parser->aiff ? "COMM" : "fmt ", 4)) {
+      if (parser->chunkRemaining < (parser->aiff ? 18 : 16)) {
+        return failWavStream(parser, parser->aiff
+                                         ? "'COMM' chunk is too small."
+                                         : "'fmt ' chunk is too small.");
+      }
+      parser->state = WavStreamState_FormatChunk;
+      parser->headerSize = parser->chunkRemaining < WAV_STREAM_FORMAT_BYTES
+                               ? parser->chunkRemaining
+                               : WAV_STREAM_FORMAT_BYTES;
+      parser->headerFill = 0;
+    } else if (!memcmp(id, parser->aiff ? "SSND" : "data", 4)) {
+      if (parser->aiff) {
+        if (parser->chunkRemaining < 8) {
+          return failWavStream(parser, "'SSND' chunk is too small.");
+        }
+        parser->state = WavStreamState_SoundDataHeader;
+        parser->headerSize = 8;
+        parser->headerFill = 0;
+      } else {
+        return startWavStreamData(parser);
+      }
+    } else {
+      endWavStreamChunk(parser);
+    }
+    return true;
+  }
+  case WavStreamState_FormatChunk: {
+    parser->chunkRemaining -= parser->headerSize;
+    bool ok = parser->aiff ? readAiffCommonChunk(parser)
+                           : readWavFormatChunk(parser);
+    if (ok) {
+      endWavStreamChunk(parser);
+    }
+    return ok;
+  }
+  case WavStreamState_SoundDataHeader: {
+    uint32_t offset = readWavStream32(header, true);
+    parser->chunkRemaining -= 8;
+    if (offset > parser->chunkRemaining) {
+      return failWavStream(parser, "illegal 'SSND' offset.");
+    }
+    parser->skip += offset;
+    parser->chunkRemaining -= offset;
+    return startWavStreamData(parser);
+  }
+  default:
+    return false;
+  }
+}
+
+/**
+ * Parses the next size bytes of the file, converting any whole frames in
+ * them. Bytes after the sample data are skipped. Returns false (having
+ * printed why) if the file can't be read, after which it does nothing.
+ */
+static bool pushWavStreamBytes(WavStreamParser *parser, const uint8_t *bytes,
+                               uint32_t size) {
+  while (size && parser->state != WavStreamState_Error) {
+    if (parser->skip) {
+      uint32_t n = parser->skip < size ? (uint32_t)parser->skip : size;
+      parser->skip -= n;
+      bytes += n;
+      size -= n;
+      continue;
+    }
+    if (parser->state != WavStreamState_Data) {
+      uint32_t n = parser->headerSize - parser->headerFill;
+      if (n > size) {
+        n = size;
+      }
+      memcpy(parser->header + parser->headerFill, bytes, n);
+      parser->headerFill += n;
+      bytes += n;
+      size -= n;
+      if (parser->headerFill == parser->headerSize) {
+        readWavStreamHeader(parser);
+      }
+      continue;
+    }
+    uint32_t available =
+        size < parser->chunkRemaining ? size : parser->chunkRemaining;
+    if (!available) {
+      endWavStreamChunk(parser);
+      continue;
+    }
+    uint32_t frameSize = parser->numOfChannels * parser->bytesPerSample;
+    uint32_t used = 0;
+    if (parser->partialFrameFill) {
+      used = frameSize - parser->partialFrameFill;
+      if (used > available) {
+        used = available;
+      }
+      memcpy(parser->partialFrame + parser->partialFrameFill, bytes, used);
+      parser->partialFrameFill += used;
+      if (parser->partialFrameFill == frameSize) {
+        parser->partialFrameFill = 0;
+        if (!convertWavStreamFrames(parser, parser->partialFrame, 1)) {
+          return false;
+        }
+      }
+    }
+    uint32_t numOfFrames = (available - used) / frameSize;
+    if (numOfFrames &&
+        !convertWavStreamFrames(parser, bytes + used, numOfFrames)) {
+      return false;
+    }
+    used += numOfFrames * frameSize;
+    if (used < available) {
+      parser->partialFrameFill = available - used;
+      memcpy(parser->partialFrame, bytes + used, parser->partialFrameFill);
+      used = available;
+    }
+    parser->chunkRemaining -= used;
+    bytes += used;
+    size -= used;
+  }
+  return parser->state != WavStreamState_Error;
+}
+
+/**
+ * Checks the whole file has been parsed. A file that ends partway through its
+ * sample data keeps the frames it has.
+ */
+static bool finishWavStream(WavStreamParser *parser) {
+  if (parser->state == WavStreamState_Error) {
+    return false;
+  }
+  if (!parser->foundData) {
+    return failWavStream(parser, parser->aiff ? "'SSND' chunk not found."
+                                              : "'data' chunk not found.");
+  }
+  return true;
+}
@@ -0,0 +1,145 @@
+// A min/max pyramid over a sample's frames, so waveform peaks for any trim and
+// width can be read off in time proportional to the number of pixels rather
+// than the length of the sample (see getPeaksFromIndex in waveform.js, which
+// relies on the layout described at buildWaveformPeaks).
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+// frames per entry at the finest level (a multiple of 4 for the SIMD loop).
+// WAVEFORM_PEAK_BLOCK_SIZE in waveform.js has to match.
+#define WAVEFORM_PEAK_BLOCK 16
+
+/**
+ * The number of floats in the index for numOfFrames frames.
+ */
+static uint32_t getWaveformPeakIndexLength(uint32_t numOfFrames) {
+  uint32_t length = 0;
+  uint32_t count =
+      (numOfFrames + WAVEFORM_PEAK_BLOCK - 1) / WAVEFORM_PEAK_BLOCK;
+  while (count) {
+    length += count * 2;
+    count = count > 1 ? (count + 1) / 2 : 0;
+  }
+  return length;
+}
+
+// Like `sample > max` in JS, where NaN never wins. (wasm_f32x4_pmax and pmin
+// behave the same way when the accumulator is the first argument.)
+static inline float maxIgnoringNaN(float max, float sample) {
+  return max < sample ? sample : max;
+}
+
+static inline float minIgnoringNaN(float min, float sample) {
+  return sample < min ? sample : min;
+}
+
+/**
+ * Finds the peaks of the first level's entries, one per WAVEFORM_PEAK_BLOCK
+ * frames (the last one may cover fewer).
+ */
+static void findWaveformBlockPeaks(const float *samples, uint32_t numOfFrames,
+                                   float *max, float *min) {
+  uint32_t block = 0;
+  uint32_t start = 0;
+#if defined(__wasm_simd128__)
+  for (; start + WAVEFORM_PEAK_BLOCK <= numOfFrames;
+       start += WAVEFORM_PEAK_BLOCK, block++) {
+    v128_t blockMax = wasm_f32x4_splat(-INFINITY);
+    v128_t blockMin = wasm_f32x4_splat(INFINITY);
+    for (uint32_t i = 0; i < WAVEFORM_PEAK_BLOCK; i += 4) {
+      v128_t vector = wasm_v128_load(samples + start + i);
+      blockMax = wasm_f32x4_pmax(blockMax, vector);
+      blockMin = wasm_f32x4_pmin(blockMin, vector);
+    }
+    max[block] = maxIgnoringNaN(
+        maxIgnoringNaN(wasm_f32x4_extract_lane(blockMax, 0),
+                       wasm_f32x4_extract_lane(blockMax, 1)),
+        maxIgnoringNaN(wasm_f32x4_extract_lane(blockMax, 2),
+                       wasm_f32x4_extract_lane(blockMax, 3)));
+    min[block] = minIgnoringNaN(
+        minIgnoringNaN(wasm_f32x4_extract_lane(blockMin, 0),
+                       wasm_f32x4_extract_lane(blockMin, 1)),
+        minIgnoringNaN(wasm_f32x4_extract_lane(blockMin, 2),
+                       wasm_f32x4_extract_lane(blockMin, 3)));
+  }
+#endif
+  for (; start < numOfFrames; start += WAVEFORM_PEAK_BLOCK, block++) {
+    uint32_t end = start + WAVEFORM_PEAK_BLOCK;
+    if (end > numOfFrames) {
+      end = numOfFrames;
+    }
+    float blockMax = -INFINITY;
+    float blockMin = INFINITY;
+    for (uint32_t i = start; i < end; i++) {
+      blockMax = maxIgnoringNaN(blockMax, samples[i]);
+      blockMin = minIgnoringNaN(blockMin, samples[i]);
+    }
+    max[block] = blockMax;
+    min[block] = blockMin;
+  }
+}
+
+/**
+ * Merges each pair of a level's entries into one of the next level's (an odd
+ * one out at the end is carried over as it is).
+ */
+static void mergeWaveformPeaks(const float *max, const float *min,
+                               uint32_t count, float *nextMax,
+                               float *nextMin) {
+  uint32_t j = 0;
+#if defined(__wasm_simd128__)
+  for (; (j + 4) * 2 <= count; j += 4) {
+    v128_t maxA = wasm_v128_load(max + j * 2);
+    v128_t maxB = wasm_v128_load(max + j * 2 + 4);
+    v128_t minA = wasm_v128_load(min + j * 2);
+    v128_t minB = wasm_v128_load(min + j * 2 + 4);
+    // split into even and odd entries, then merge those
+    v128_t evenMax = wasm_i32x4_shuffle(maxA, maxB, 0, 2, 4, 6);
+    v128_t oddMax = wasm_i32x4_shuffle(maxA, maxB, 1, 3, 5, 7);
+    v128_t evenMin = wasm_i32x4_shuffle(minA, minB, 0, 2, 4, 6);
+    v128_t oddMin = wasm_i32x4_shuffle(minA, minB, 1, 3, 5, 7);
+    wasm_v128_store(nextMax + j, wasm_f32x4_pmax(evenMax, oddMax));
+    wasm_v128_store(nextMin + j, wasm_f32x4_pmin(evenMin, oddMin));
+  }
+#endif
+  for (; j * 2 < count; j++) {
+    if (j * 2 + 1 < count) {
+      nextMax[j] = maxIgnoringNaN(max[j * 2], max[j * 2 + 1]);
+      nextMin[j] = minIgnoringNaN(min[j * 2], min[j * 2 + 1]);
+    } else {
+      nextMax[j] = max[j * 2];
+      nextMin[j] = min[j * 2];
+    }
+  }
+}
+
+/**
+ * Builds the index for numOfFrames samples into dest, which must have room
+ * for getWaveformPeakIndexLength(numOfFrames) floats. Level 0 has an entry
+ * for every WAVEFORM_PEAK_BLOCK frames, and each level after it an entry for
+ * every 2 of the level before, down to a single entry. Each level is stored
+ * as its entries' maxima followed by their minima. A block with no numbers in
+ * it has a maximum of -Infinity and a minimum of Infinity.
+ */
+static void buildWaveformPeaks(const float *samples, uint32_t numOfFrames,
+                               float *dest) {
+  uint32_t count =
+      (numOfFrames + WAVEFORM_PEAK_BLOCK - 1) / WAVEFORM_PEAK_BLOCK;
+  if (!count) {
+    return;
+  }
+  findWaveformBlockPeaks(samples, numOfFrames, dest, dest + count);
+  while (count > 1) {
+    uint32_t nextCount = (count + 1) / 2;
+    float *next = dest + count * 2;
+    mergeWaveformPeaks(dest, dest + count, count, next, next + nextCount);
+    dest = next;
+    count = nextCount;
+  }
+}
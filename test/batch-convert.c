@@ -0,0 +1,1205 @@
+#include "../syro/shared-worker-types.h"
+#include "../syro/syro-utils.c"
+#include "../syro/syro-parallel-stream.c"
+#include "./file-utils.c"
+#include "./prepared-input-cache.c"
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_MANIFEST_LINE 4096
+#define PROGRESS_REPORT_INTERVAL 0.25
+#define MAX_DAEMON_CLIENTS 64
+// one per slot on the volca
+#define MAX_GROUP_ENTRIES 100
+
+// taken from syro example
+static bool write_file(char *filename, uint8_t *buf, uint32_t size) {
+  FILE *fp;
+
+  fp = fopen(filename, "wb");
+  if (!fp) {
+    printf(" File open error, %s \n", filename);
+    return false;
+  }
+
+  if (fwrite(buf, 1, size, fp) < size) {
+    printf(" File write error(perhaps disk space is not enough), %s \n",
+           filename);
+    fclose(fp);
+    return false;
+  }
+
+  fclose(fp);
+
+  return true;
+}
+
+#define WAV_FILE_READ_SIZE (64 * 1024)
+
+// Feeds a wav or aiff file to parser as it's read, a block at a time, so
+// frames are converted while the rest of the file is still on its way and
+// only the converted samples are ever held in memory. Call finishWavStream
+// (or getSyroDataForWavStream) afterwards.
+static bool parse_wav_file(char *filename, WavStreamParser *parser) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf(" File open error, %s \n", filename);
+    return false;
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  uint8_t block[WAV_FILE_READ_SIZE];
+  for (;;) {
+    ssize_t got = read(fd, block, sizeof(block));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      printf(" File read error, %s \n", filename);
+      close(fd);
+      return false;
+    }
+    if (!got) {
+      break;
+    }
+    if (!pushWavStreamBytes(parser, block, (uint32_t)got)) {
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+  return true;
+}
+
+typedef struct BatchEntry {
+  char *wavFilename;
+  uint32_t slotNumber;
+  uint32_t quality;
+  uint32_t useCompression;
+  uint32_t groupIndex;
+  SyroData syro_data;
+  bool ok;
+  // for the daemon's per-job stats
+  double prepareSeconds;
+  bool cachedInput;
+} BatchEntry;
+
+typedef struct BatchGroup {
+  char *name;
+  char *outputFilename;
+  uint32_t *entryIndices;
+  uint32_t numOfEntries;
+  // where each entry's data starts in the group's stream, and its size
+  uint32_t dataStartPoints[110];
+  uint32_t streamSize;
+  bool ok;
+  double encodeSeconds;
+} BatchGroup;
+
+typedef struct BatchJob {
+  BatchEntry *entries;
+  uint32_t numOfEntries;
+  BatchGroup *groups;
+  uint32_t numOfGroups;
+  // progress
+  atomic_uint_fast64_t bytesWritten;
+  atomic_uint groupsDone;
+  pthread_mutex_t progressMutex;
+  double startTime;
+  double lastReportTime;
+  // output file for encodeGroupInParallel
+  int parallelOutputFd;
+  // rate to resample every entry to first, or 0 to leave them as they are
+  uint32_t resampleRate;
+  // the pack the entries come from, if it's a pack rather than a manifest
+  MappedFile packFile;
+  SyroPack pack;
+  // samples prepared by earlier jobs, if there have been any (daemon mode)
+  PreparedInputCache *inputCache;
+  // no progress line on stderr
+  bool quiet;
+} BatchJob;
+
+static double getSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void reportProgress(BatchJob *job, bool force) {
+  if (job->quiet) {
+    return;
+  }
+  double now = getSeconds();
+  // skip the report if another thread is already printing one
+  if (force) {
+    pthread_mutex_lock(&job->progressMutex);
+  } else if (pthread_mutex_trylock(&job->progressMutex)) {
+    return;
+  }
+  if (force || now - job->lastReportTime >= PROGRESS_REPORT_INTERVAL) {
+    double elapsed = now - job->startTime;
+    double megabytes = atomic_load(&job->bytesWritten) / 1e6;
+    fprintf(stderr, "\r[batch] %u/%u streams, %.1f MB, %.1f MB/s   ",
+            atomic_load(&job->groupsDone), job->numOfGroups, megabytes,
+            elapsed > 0 ? megabytes / elapsed : 0);
+    job->lastReportTime = now;
+  }
+  pthread_mutex_unlock(&job->progressMutex);
+}
+
+static char *copyString(const char *str, size_t length) {
+  char *copy = malloc(length + 1);
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+static uint32_t findOrAddGroup(BatchJob *job, const char *name) {
+  for (uint32_t i = 0; i < job->numOfGroups; i++) {
+    if (!strcmp(job->groups[i].name, name)) {
+      return i;
+    }
+  }
+  job->groups =
+      realloc(job->groups, sizeof(BatchGroup) * (job->numOfGroups + 1));
+  BatchGroup *group = job->groups + job->numOfGroups;
+  memset(group, 0, sizeof(BatchGroup));
+  group->name = copyString(name, strlen(name));
+  return job->numOfGroups++;
+}
+
+typedef struct ManifestLine {
+  uint32_t slotNumber;
+  uint32_t quality;
+  uint32_t useCompression;
+  char groupName[256];
+  // the rest of the line
+  char *path;
+} ManifestLine;
+
+/**
+ * Manifest lines have the form:
+ *   <slot> <quality> <compression 0|1> <group> <wav path>
+ * The path is the remainder of the line (so it may contain spaces). Returns
+ * false (having printed why) if the line doesn't.
+ */
+static bool parseManifestLine(char *line, uint32_t lineNumber,
+                              ManifestLine *parsed) {
+  int pathStart = 0;
+  if (sscanf(line, "%u %u %u %255s %n", &parsed->slotNumber, &parsed->quality,
+             &parsed->useCompression, parsed->groupName, &pathStart) != 4 ||
+      !line[pathStart]) {
+    printf("Manifest error, line %u: expected "
+           "'<slot> <quality> <compression> <group> <wav path>'\n",
+           lineNumber);
+    return false;
+  }
+  if (parsed->slotNumber > 99 || parsed->quality < 8 ||
+      parsed->quality > 16 || parsed->useCompression > 1) {
+    printf("Manifest error, line %u: slot must be 0-99, quality 8-16 and "
+           "compression 0 or 1\n",
+           lineNumber);
+    return false;
+  }
+  parsed->path = line + pathStart;
+  return true;
+}
+
+/**
+ * Adds an entry for a manifest line, with its path resolved relative to the
+ * first baseDirLength characters of baseDir unless it is absolute.
+ */
+static BatchEntry *addBatchEntry(BatchJob *job, const ManifestLine *parsed,
+                                 const char *baseDir, size_t baseDirLength) {
+  const char *path = parsed->path;
+  job->entries =
+      realloc(job->entries, sizeof(BatchEntry) * (job->numOfEntries + 1));
+  BatchEntry *entry = job->entries + job->numOfEntries++;
+  memset(entry, 0, sizeof(BatchEntry));
+  if (path[0] == '/' || !baseDirLength) {
+    entry->wavFilename = copyString(path, strlen(path));
+  } else {
+    entry->wavFilename = malloc(baseDirLength + strlen(path) + 1);
+    memcpy(entry->wavFilename, baseDir, baseDirLength);
+    strcpy(entry->wavFilename + baseDirLength, path);
+  }
+  entry->slotNumber = parsed->slotNumber;
+  entry->quality = parsed->quality;
+  entry->useCompression = parsed->useCompression;
+  entry->groupIndex = findOrAddGroup(job, parsed->groupName);
+  return entry;
+}
+
+/**
+ * Reads a manifest of lines as in parseManifestLine. Paths are resolved
+ * relative to the manifest's directory unless they are absolute. Blank lines
+ * and lines starting with '#' are ignored.
+ */
+static bool readManifest(char *manifestFilename, BatchJob *job) {
+  FILE *fp = fopen(manifestFilename, "r");
+  if (!fp) {
+    printf(" File open error, %s \n", manifestFilename);
+    return false;
+  }
+  const char *lastSlash = strrchr(manifestFilename, '/');
+  size_t baseDirLength = lastSlash ? lastSlash - manifestFilename + 1 : 0;
+
+  char line[MAX_MANIFEST_LINE];
+  uint32_t lineNumber = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    lineNumber++;
+    size_t length = strcspn(line, "\r\n");
+    line[length] = '\0';
+    if (!length || line[0] == '#') {
+      continue;
+    }
+    ManifestLine parsed;
+    if (!parseManifestLine(line, lineNumber, &parsed)) {
+      fclose(fp);
+      return false;
+    }
+    addBatchEntry(job, &parsed, manifestFilename, baseDirLength);
+  }
+  fclose(fp);
+  return true;
+}
+
+/**
+ * Takes the entries from a pack written with -p instead of a manifest, all in
+ * one group named after the pack.
+ */
+static bool readPack(char *packFilename, BatchJob *job) {
+  if (!map_file(packFilename, &job->packFile)) {
+    return false;
+  }
+  if (!openSyroPack(job->packFile.data, job->packFile.size, &job->pack)) {
+    printf("Could not read %s\n", packFilename);
+    return false;
+  }
+  const char *lastSlash = strrchr(packFilename, '/');
+  const char *baseName = lastSlash ? lastSlash + 1 : packFilename;
+  char *groupName = copyString(baseName, strcspn(baseName, "."));
+  uint32_t groupIndex = findOrAddGroup(job, groupName);
+  free(groupName);
+  job->numOfEntries = job->pack.header->numOfEntries;
+  job->entries = calloc(job->numOfEntries ? job->numOfEntries : 1,
+                        sizeof(BatchEntry));
+  for (uint32_t i = 0; i < job->numOfEntries; i++) {
+    BatchEntry *entry = job->entries + i;
+    entry->wavFilename = copyString(packFilename, strlen(packFilename));
+    entry->slotNumber = job->pack.entries[i].slotNumber;
+    entry->quality = job->pack.entries[i].quality;
+    entry->useCompression =
+        job->pack.entries[i].dataType == DataType_Sample_Compress;
+    entry->groupIndex = groupIndex;
+  }
+  return true;
+}
+
+/**
+ * Reads (and resamples) an entry's wav file into its syro data, or takes the
+ * samples from the job's input cache if an earlier job already did.
+ */
+static bool readEntrySamples(BatchJob *job, BatchEntry *entry) {
+  struct stat st;
+  bool cacheable = job->inputCache && !stat(entry->wavFilename, &st);
+  if (cacheable && takePreparedInput(job->inputCache, entry->wavFilename, &st,
+                                     job->resampleRate, &entry->syro_data)) {
+    entry->syro_data.DataType = entry->useCompression == 0
+                                    ? DataType_Sample_Liner
+                                    : DataType_Sample_Compress;
+    entry->syro_data.Number = entry->slotNumber;
+    entry->syro_data.Quality = entry->quality;
+    entry->cachedInput = true;
+    return true;
+  }
+  WavStreamParser parser;
+  initWavStreamParser(&parser);
+  if (!parse_wav_file(entry->wavFilename, &parser)) {
+    clearWavStreamParser(&parser);
+    printf("Could not prepare %s\n", entry->wavFilename);
+    return false;
+  }
+  SyroData *syro_data = getSyroDataForWavStream(
+      &parser, entry->slotNumber, entry->quality, entry->useCompression);
+  if (!syro_data) {
+    printf("Could not prepare %s\n", entry->wavFilename);
+    return false;
+  }
+  entry->syro_data = *syro_data;
+  free(syro_data);
+  if (job->resampleRate &&
+      !resampleSyroData(&entry->syro_data, job->resampleRate)) {
+    printf("Could not resample %s\n", entry->wavFilename);
+    return false;
+  }
+  if (cacheable) {
+    addPreparedInput(job->inputCache, entry->wavFilename, &st,
+                     job->resampleRate, &entry->syro_data);
+  }
+  return true;
+}
+
+static void prepareEntryTask(uint32_t index, void *jobPointer) {
+  BatchJob *job = (BatchJob *)jobPointer;
+  BatchEntry *entry = job->entries + index;
+  double startTime = getSeconds();
+  if (job->pack.data) {
+    // already prepared and compressed
+    entry->ok = setupSyroDataFromSyroPack(&job->pack, index, &entry->syro_data);
+    if (!entry->ok) {
+      printf("Could not prepare %s entry %u\n", entry->wavFilename, index);
+    }
+  } else if (readEntrySamples(job, entry)) {
+    // compress here, in parallel, so SyroVolcaSample_Start only has to look
+    // the block up later
+    entry->ok = precompressSyroData(&entry->syro_data);
+    if (!entry->ok) {
+      printf("Could not compress %s\n", entry->wavFilename);
+    }
+  }
+  entry->prepareSeconds = getSeconds() - startTime;
+}
+
+static void encodeGroupTask(uint32_t index, void *jobPointer) {
+  BatchJob *job = (BatchJob *)jobPointer;
+  BatchGroup *group = job->groups + index;
+  uint32_t NumOfData = group->numOfEntries;
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    if (!job->entries[group->entryIndices[i]].ok) {
+      // (only the daemon carries on past entries that couldn't be prepared)
+      atomic_fetch_add(&job->groupsDone, 1);
+      return;
+    }
+  }
+  double startTime = getSeconds();
+  SyroData *syro_data = malloc(sizeof(SyroData) * NumOfData);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    BatchEntry *entry = job->entries + group->entryIndices[i];
+    syro_data[i] = entry->syro_data;
+    // the group's copy owns the sample data from now on
+    entry->syro_data.pData = NULL;
+  }
+  // the stream is written out straight from the ring as it is encoded, so
+  // memory use doesn't grow with its length
+  bool toStdout = !strcmp(group->outputFilename, "-");
+  if (toStdout) {
+    // (anything printed so far has to go out ahead of the stream)
+    fflush(stdout);
+  }
+  int fd = toStdout ? STDOUT_FILENO
+                    : open(group->outputFilename, O_WRONLY | O_CREAT | O_TRUNC,
+                           0644);
+  if (fd < 0) {
+    printf(" File open error, %s \n", group->outputFilename);
+    free_syrodata(syro_data, NumOfData);
+    free(syro_data);
+    return;
+  }
+  SampleBufferContainer *sampleBuffer = startSampleBufferStream(
+      syro_data, NumOfData, SAMPLE_BUFFER_STREAM_SIZE);
+  if (!sampleBuffer) {
+    if (!toStdout) {
+      close(fd);
+    }
+    free_syrodata(syro_data, NumOfData);
+    free(syro_data);
+    return;
+  }
+  bool ok = true;
+  while (ok && sampleBuffer->consumed < sampleBuffer->size) {
+    iterateSampleBuffer(sampleBuffer, ITERATION_INTERVAL);
+    uint8_t *parts[2];
+    uint32_t partSizes[2];
+    uint32_t chunkSize = peekSampleBuffer(sampleBuffer, parts, partSizes);
+    if (!write_parts(fd, parts, partSizes, 2)) {
+      printf(" File write error, %s \n", group->outputFilename);
+      ok = false;
+    }
+    skipSampleBuffer(sampleBuffer, chunkSize);
+    atomic_fetch_add(&job->bytesWritten, chunkSize);
+    reportProgress(job, false);
+  }
+  memcpy(group->dataStartPoints, sampleBuffer->dataStartPoints,
+         sizeof(group->dataStartPoints));
+  group->streamSize = sampleBuffer->size;
+  if (!toStdout) {
+    ok = close(fd) == 0 && ok;
+  }
+  group->ok = ok;
+  free_syrodata(syro_data, NumOfData);
+  freeSampleBuffer(sampleBuffer);
+  group->encodeSeconds = getSeconds() - startTime;
+  atomic_fetch_add(&job->groupsDone, 1);
+  reportProgress(job, false);
+}
+
+static bool writeGroupOutput(uint32_t offset, const uint8_t *bytes,
+                             uint32_t size, void *jobPointer) {
+  BatchJob *job = (BatchJob *)jobPointer;
+  int fd = job->parallelOutputFd;
+  while (size) {
+    ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    offset += written;
+    size -= written;
+    atomic_fetch_add(&job->bytesWritten, written);
+  }
+  reportProgress(job, false);
+  return true;
+}
+
+/**
+ * Encodes a group with its samples spread across the pool, for when there's
+ * only one group to keep the threads busy. Each sample's part of the stream
+ * is written at its own place in the file, so this needs a real file rather
+ * than stdout. Returns false (having done nothing) if the group has to be
+ * encoded in order with encodeGroupTask.
+ */
+static bool encodeGroupInParallel(ThreadPool *pool, BatchJob *job,
+                                  uint32_t index) {
+  BatchGroup *group = job->groups + index;
+  uint32_t NumOfData = group->numOfEntries;
+  if (!strcmp(group->outputFilename, "-")) {
+    return false;
+  }
+  double startTime = getSeconds();
+  SyroData *syro_data = malloc(sizeof(SyroData) * NumOfData);
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    syro_data[i] = job->entries[group->entryIndices[i]].syro_data;
+  }
+  ParallelSyroStream *stream =
+      startParallelSyroStream(pool, syro_data, NumOfData);
+  if (!stream) {
+    free(syro_data);
+    return false;
+  }
+  for (uint32_t i = 0; i < NumOfData; i++) {
+    // the group's copy owns the sample data from now on
+    job->entries[group->entryIndices[i]].syro_data.pData = NULL;
+  }
+  job->parallelOutputFd =
+      open(group->outputFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (job->parallelOutputFd == -1) {
+    printf(" File open error, %s \n", group->outputFilename);
+  } else {
+    group->ok = runParallelSyroStream(pool, stream, NULL, writeGroupOutput,
+                                      job, group->dataStartPoints, NULL, NULL);
+    group->streamSize = stream->size;
+    if (!group->ok) {
+      printf(" File write error, %s \n", group->outputFilename);
+    }
+    group->ok = close(job->parallelOutputFd) == 0 && group->ok;
+  }
+  freeParallelSyroStream(stream);
+  free_syrodata(syro_data, NumOfData);
+  free(syro_data);
+  group->encodeSeconds = getSeconds() - startTime;
+  atomic_fetch_add(&job->groupsDone, 1);
+  reportProgress(job, false);
+  return true;
+}
+
+/**
+ * Sets every group's output file (one per group in outputDir) and entry list.
+ */
+static void setupBatchGroups(BatchJob *job, const char *outputDir) {
+  for (uint32_t i = 0; outputDir && i < job->numOfGroups; i++) {
+    BatchGroup *group = job->groups + i;
+    const char suffix[] = ".syrostream.wav";
+    group->outputFilename =
+        malloc(strlen(outputDir) + 1 + strlen(group->name) + sizeof(suffix));
+    sprintf(group->outputFilename, "%s/%s%s", outputDir, group->name, suffix);
+  }
+  for (uint32_t i = 0; i < job->numOfEntries; i++) {
+    BatchGroup *group = job->groups + job->entries[i].groupIndex;
+    group->entryIndices = realloc(group->entryIndices,
+                                  sizeof(uint32_t) * (group->numOfEntries + 1));
+    group->entryIndices[group->numOfEntries++] = i;
+  }
+}
+
+/**
+ * Checks every group fits in one stream: no more than MAX_GROUP_ENTRIES
+ * samples, and no two of them for the same slot. Returns false (having
+ * printed why) if one doesn't.
+ */
+static bool checkBatchGroups(BatchJob *job) {
+  for (uint32_t i = 0; i < job->numOfGroups; i++) {
+    BatchGroup *group = job->groups + i;
+    if (group->numOfEntries > MAX_GROUP_ENTRIES) {
+      printf("Manifest error, group '%s' has %u samples but a stream can only "
+             "hold %u\n",
+             group->name, group->numOfEntries, MAX_GROUP_ENTRIES);
+      return false;
+    }
+    bool slotTaken[MAX_GROUP_ENTRIES] = {false};
+    for (uint32_t j = 0; j < group->numOfEntries; j++) {
+      uint32_t slotNumber = job->entries[group->entryIndices[j]].slotNumber;
+      if (slotTaken[slotNumber]) {
+        printf("Manifest error, group '%s' has more than one sample for slot "
+               "%u\n",
+               group->name, slotNumber);
+        return false;
+      }
+      slotTaken[slotNumber] = true;
+    }
+  }
+  return true;
+}
+
+static void freeBatchJob(BatchJob *job) {
+  for (uint32_t i = 0; i < job->numOfEntries; i++) {
+    free(job->entries[i].wavFilename);
+    // (left behind by entries whose group was never encoded)
+    free(job->entries[i].syro_data.pData);
+  }
+  for (uint32_t i = 0; i < job->numOfGroups; i++) {
+    free(job->groups[i].name);
+    free(job->groups[i].outputFilename);
+    free(job->groups[i].entryIndices);
+  }
+  free(job->entries);
+  free(job->groups);
+  if (job->pack.data) {
+    unmap_file(&job->packFile);
+  }
+  pthread_mutex_destroy(&job->progressMutex);
+}
+
+// daemon mode (-s): jobs come in as lines on stdin or a unix socket, and a
+// line of JSON goes back for each one once its stream has been written. The
+// thread pool, the compression cache and the input cache stay warm between
+// batches, so a sample that comes up again costs next to nothing to prepare.
+
+typedef struct DaemonClient {
+  int fd;
+  // where replies go (a dup of stdout when fd is stdin)
+  int replyFd;
+  char line[MAX_MANIFEST_LINE];
+  size_t length;
+  // the current line didn't fit, so it's skipped up to its end
+  bool overlong;
+  // closed once its pending requests have been answered
+  bool hungUp;
+} DaemonClient;
+
+typedef struct DaemonRequest {
+  DaemonClient *client;
+  // NULL for a line that was too long
+  char *line;
+  double receivedTime;
+} DaemonRequest;
+
+typedef struct DaemonStats {
+  uint64_t jobs;
+  uint64_t failed;
+  uint64_t deduped;
+  uint64_t cachedInputs;
+  uint64_t batches;
+  uint64_t bytes;
+  uint64_t frames;
+  double latencySeconds;
+  double maxLatencySeconds;
+  // time spent running batches
+  double busySeconds;
+} DaemonStats;
+
+typedef struct Daemon {
+  ThreadPool *pool;
+  PreparedInputCache inputCache;
+  const char *outputDir;
+  uint32_t resampleRate;
+  DaemonClient clients[MAX_DAEMON_CLIENTS];
+  uint32_t numOfClients;
+  DaemonRequest *requests;
+  uint32_t numOfRequests;
+  DaemonStats stats;
+  bool quit;
+} Daemon;
+
+static void writeDaemonReply(DaemonClient *client, const char *reply) {
+  size_t size = strlen(reply);
+  while (size) {
+    ssize_t written = write(client->replyFd, reply, size);
+    if (written <= 0) {
+      // the client has gone, it can't be told
+      return;
+    }
+    reply += written;
+    size -= written;
+  }
+}
+
+static void writeDaemonError(DaemonClient *client, const char *id,
+                             const char *error) {
+  char reply[512];
+  snprintf(reply, sizeof(reply),
+           "{ \"id\": \"%s\", \"ok\": false, \"error\": \"%s\" }\n", id,
+           error);
+  writeDaemonReply(client, reply);
+}
+
+/**
+ * Job ids name the output file, so they're kept to characters that are safe
+ * there (and in JSON).
+ */
+static bool isValidJobId(const char *id) {
+  if (id[0] == '.') {
+    return false;
+  }
+  for (const char *c = id; *c; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '.' && *c != '_' && *c != '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Runs a batch of job lines, each of the form
+ *   <slot> <quality> <compression 0|1> <id> <wav path>
+ * (a manifest line, with the group as the job's id), writing
+ * <outputDir>/<id>.syrostream.wav for each. Jobs with the same sample
+ * settings and path as an earlier one in the batch aren't run twice; they're
+ * answered with its stream instead.
+ */
+static void runDaemonBatch(Daemon *daemon, DaemonRequest *requests,
+                           uint32_t numOfRequests) {
+  double startTime = getSeconds();
+  BatchJob job;
+  memset(&job, 0, sizeof(BatchJob));
+  pthread_mutex_init(&job.progressMutex, NULL);
+  job.resampleRate = daemon->resampleRate;
+  job.inputCache = &daemon->inputCache;
+  job.quiet = true;
+  ManifestLine *parsed = malloc(sizeof(ManifestLine) * numOfRequests);
+  // the request each one was deduped to (itself if it wasn't), or -1 if it
+  // was turned down
+  int32_t *primaries = malloc(sizeof(int32_t) * numOfRequests);
+  const char **errors = calloc(numOfRequests, sizeof(char *));
+  // the entry (and group) each primary request got
+  uint32_t *entryIndices = malloc(sizeof(uint32_t) * numOfRequests);
+  for (uint32_t i = 0; i < numOfRequests; i++) {
+    DaemonRequest *request = requests + i;
+    primaries[i] = -1;
+    parsed[i].groupName[0] = '\0';
+    if (!request->line) {
+      errors[i] = "line too long";
+      continue;
+    }
+    if (!parseManifestLine(request->line, i + 1, parsed + i) ||
+        !isValidJobId(parsed[i].groupName)) {
+      parsed[i].groupName[0] = '\0';
+      errors[i] = "bad job line";
+      continue;
+    }
+    bool duplicateId = false;
+    for (uint32_t j = 0; j < i && !duplicateId; j++) {
+      duplicateId = primaries[j] != -1 &&
+                    !strcmp(parsed[j].groupName, parsed[i].groupName);
+    }
+    if (duplicateId) {
+      errors[i] = "id already in this batch";
+      continue;
+    }
+    primaries[i] = i;
+    for (uint32_t j = 0; j < i; j++) {
+      if (primaries[j] == (int32_t)j &&
+          parsed[j].slotNumber == parsed[i].slotNumber &&
+          parsed[j].quality == parsed[i].quality &&
+          parsed[j].useCompression == parsed[i].useCompression &&
+          !strcmp(parsed[j].path, parsed[i].path)) {
+        primaries[i] = j;
+        break;
+      }
+    }
+    if (primaries[i] == (int32_t)i) {
+      // each job is a group of its own, named after its id
+      addBatchEntry(&job, parsed + i, "", 0);
+      entryIndices[i] = job.numOfEntries - 1;
+    }
+  }
+  setupBatchGroups(&job, daemon->outputDir);
+
+  if (job.numOfEntries) {
+    threadPoolRun(daemon->pool, job.numOfEntries, prepareEntryTask, &job);
+    // a lone stream would only keep one thread busy
+    if (job.numOfGroups > 1 || daemon->pool->numOfThreads < 2 ||
+        !job.entries[0].ok || !encodeGroupInParallel(daemon->pool, &job, 0)) {
+      threadPoolRun(daemon->pool, job.numOfGroups, encodeGroupTask, &job);
+    }
+  }
+
+  double endTime = getSeconds();
+  DaemonStats *stats = &daemon->stats;
+  stats->batches++;
+  stats->busySeconds += endTime - startTime;
+  for (uint32_t i = 0; i < numOfRequests; i++) {
+    DaemonRequest *request = requests + i;
+    BatchEntry *entry =
+        errors[i] ? NULL : job.entries + entryIndices[primaries[i]];
+    BatchGroup *group = entry ? job.groups + entry->groupIndex : NULL;
+    if (entry && !entry->ok) {
+      errors[i] = "could not prepare sample";
+    } else if (group && !group->ok) {
+      errors[i] = "could not write stream";
+    }
+    stats->jobs++;
+    if (errors[i]) {
+      stats->failed++;
+      writeDaemonError(request->client, parsed[i].groupName, errors[i]);
+      continue;
+    }
+    bool deduped = primaries[i] != (int32_t)i;
+    double latency = endTime - request->receivedTime;
+    double workSeconds = entry->prepareSeconds + group->encodeSeconds;
+    uint32_t numOfFrames = group->streamSize / 4;
+    stats->deduped += deduped;
+    stats->cachedInputs += entry->cachedInput && !deduped;
+    stats->latencySeconds += latency;
+    if (latency > stats->maxLatencySeconds) {
+      stats->maxLatencySeconds = latency;
+    }
+    if (!deduped) {
+      stats->bytes += group->streamSize;
+      stats->frames += numOfFrames;
+    }
+    char reply[MAX_MANIFEST_LINE + 512];
+    snprintf(reply, sizeof(reply),
+             "{ \"id\": \"%s\", \"ok\": true, \"stream\": \"%s\", "
+             "\"bytes\": %u, \"queueSeconds\": %.4f, \"prepareSeconds\": "
+             "%.4f, \"encodeSeconds\": %.4f, \"totalSeconds\": %.4f, "
+             "\"framesPerSecond\": %.0f, \"cachedInput\": %s, "
+             "\"deduped\": %s }\n",
+             parsed[i].groupName, group->outputFilename, group->streamSize,
+             startTime - request->receivedTime, entry->prepareSeconds,
+             group->encodeSeconds, latency,
+             workSeconds > 0 ? numOfFrames / workSeconds : 0,
+             entry->cachedInput ? "true" : "false",
+             deduped ? "true" : "false");
+    writeDaemonReply(request->client, reply);
+  }
+  free(parsed);
+  free(primaries);
+  free(errors);
+  free(entryIndices);
+  freeBatchJob(&job);
+}
+
+static void writeDaemonStats(Daemon *daemon, DaemonClient *client) {
+  DaemonStats *stats = &daemon->stats;
+  uint64_t answered = stats->jobs - stats->failed;
+  char reply[512];
+  snprintf(reply, sizeof(reply),
+           "{ \"jobs\": %llu, \"failed\": %llu, \"deduped\": %llu, "
+           "\"cachedInputs\": %llu, \"batches\": %llu, \"bytes\": %llu, "
+           "\"meanSeconds\": %.4f, \"maxSeconds\": %.4f, "
+           "\"framesPerSecond\": %.0f }\n",
+           (unsigned long long)stats->jobs, (unsigned long long)stats->failed,
+           (unsigned long long)stats->deduped,
+           (unsigned long long)stats->cachedInputs,
+           (unsigned long long)stats->batches,
+           (unsigned long long)stats->bytes,
+           answered ? stats->latencySeconds / answered : 0,
+           stats->maxLatencySeconds,
+           stats->busySeconds > 0 ? stats->frames / stats->busySeconds : 0);
+  writeDaemonReply(client, reply);
+}
+
+/**
+ * Runs the pending requests in order: job lines in batches, as many at a time
+ * as there are before the next command ("stats" or "quit").
+ */
+static void runDaemonRequests(Daemon *daemon) {
+  uint32_t batchStart = 0;
+  for (uint32_t i = 0; i <= daemon->numOfRequests; i++) {
+    DaemonRequest *request = daemon->requests + i;
+    bool isStats = i < daemon->numOfRequests && request->line &&
+                   !strcmp(request->line, "stats");
+    bool isQuit = i < daemon->numOfRequests && request->line &&
+                  !strcmp(request->line, "quit");
+    if (i < daemon->numOfRequests && !isStats && !isQuit) {
+      continue;
+    }
+    if (i > batchStart) {
+      runDaemonBatch(daemon, daemon->requests + batchStart, i - batchStart);
+    }
+    batchStart = i + 1;
+    if (isStats) {
+      writeDaemonStats(daemon, request->client);
+    } else if (isQuit) {
+      daemon->quit = true;
+      break;
+    }
+  }
+  for (uint32_t i = 0; i < daemon->numOfRequests; i++) {
+    free(daemon->requests[i].line);
+  }
+  daemon->numOfRequests = 0;
+}
+
+static void addDaemonRequest(Daemon *daemon, DaemonClient *client, char *line,
+                             size_t length, double receivedTime) {
+  daemon->requests =
+      realloc(daemon->requests,
+              sizeof(DaemonRequest) * (daemon->numOfRequests + 1));
+  DaemonRequest *request = daemon->requests + daemon->numOfRequests++;
+  request->client = client;
+  request->line = line ? copyString(line, length) : NULL;
+  request->receivedTime = receivedTime;
+}
+
+/**
+ * Reads whatever the client has sent, queueing a request for each complete
+ * line (blank lines and '#' comments aside).
+ */
+static void readDaemonClient(Daemon *daemon, DaemonClient *client) {
+  ssize_t size = read(client->fd, client->line + client->length,
+                      sizeof(client->line) - client->length);
+  if (size <= 0) {
+    if (size < 0 && errno == EINTR) {
+      return;
+    }
+    client->hungUp = true;
+    if (!client->length || client->overlong) {
+      return;
+    }
+    // (a last line without a newline still counts)
+    client->line[client->length] = '\n';
+    size = 1;
+  }
+  double now = getSeconds();
+  client->length += size;
+  size_t lineStart = 0;
+  for (size_t i = client->length - size; i < client->length; i++) {
+    if (client->line[i] != '\n') {
+      continue;
+    }
+    char *line = client->line + lineStart;
+    size_t length = i - lineStart;
+    if (length && line[length - 1] == '\r') {
+      length--;
+    }
+    if (client->overlong) {
+      addDaemonRequest(daemon, client, NULL, 0, now);
+      client->overlong = false;
+    } else if (length && line[0] != '#') {
+      addDaemonRequest(daemon, client, line, length, now);
+    }
+    lineStart = i + 1;
+  }
+  client->length -= lineStart;
+  memmove(client->line, client->line + lineStart, client->length);
+  if (client->length == sizeof(client->line)) {
+    client->overlong = true;
+    client->length = 0;
+  }
+}
+
+static void closeDaemonClient(DaemonClient *client) {
+  if (client->fd != STDIN_FILENO) {
+    close(client->fd);
+  }
+  if (client->replyFd != client->fd) {
+    close(client->replyFd);
+  }
+}
+
+static int listenOnSocket(const char *socketPath) {
+  struct sockaddr_un address;
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    printf("Socket path is too long, %s\n", socketPath);
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // (a socket left behind by an earlier run would be in the way)
+  unlink(socketPath);
+  if (fd == -1 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+      listen(fd, MAX_DAEMON_CLIENTS) == -1) {
+    printf("Could not listen on %s\n", socketPath);
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Serves jobs from stdin (socketPath "-") or from clients of a unix socket
+ * until a "quit" (or the end of stdin), writing streams into outputDir.
+ */
+static int runDaemon(const char *socketPath, const char *outputDir,
+                     uint32_t numOfThreads, uint32_t resampleRate) {
+  Daemon *daemon = calloc(1, sizeof(Daemon));
+  daemon->outputDir = outputDir;
+  daemon->resampleRate = resampleRate;
+  initPreparedInputCache(&daemon->inputCache);
+  // replies have to get through whatever the client does
+  signal(SIGPIPE, SIG_IGN);
+  bool useStdin = !strcmp(socketPath, "-");
+  int listenFd = -1;
+  if (useStdin) {
+    DaemonClient *client = daemon->clients + daemon->numOfClients++;
+    client->fd = STDIN_FILENO;
+    client->replyFd = dup(STDOUT_FILENO);
+    // stdout is only for replies, so messages printed along the way go to
+    // stderr
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+  } else if ((listenFd = listenOnSocket(socketPath)) == -1) {
+    free(daemon);
+    return 1;
+  }
+  daemon->pool = createThreadPool(numOfThreads);
+  if (!daemon->pool) {
+    printf("Could not start worker threads\n");
+    free(daemon);
+    return 1;
+  }
+  fprintf(stderr, "[daemon] %u threads, streams go to %s\n",
+          daemon->pool->numOfThreads, outputDir);
+
+  struct pollfd fds[MAX_DAEMON_CLIENTS + 1];
+  while (!daemon->quit && (listenFd != -1 || daemon->numOfClients)) {
+    uint32_t numOfFds = 0;
+    for (uint32_t i = 0; i < daemon->numOfClients; i++) {
+      fds[numOfFds++] = (struct pollfd){daemon->clients[i].fd, POLLIN, 0};
+    }
+    if (listenFd != -1 && daemon->numOfClients < MAX_DAEMON_CLIENTS) {
+      fds[numOfFds++] = (struct pollfd){listenFd, POLLIN, 0};
+    }
+    if (poll(fds, numOfFds, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("poll failed\n");
+      break;
+    }
+    bool accepting = listenFd != -1 && fds[numOfFds - 1].fd == listenFd &&
+                     fds[numOfFds - 1].revents;
+    for (uint32_t i = 0; i < daemon->numOfClients; i++) {
+      if (fds[i].revents) {
+        readDaemonClient(daemon, daemon->clients + i);
+      }
+    }
+    runDaemonRequests(daemon);
+    for (uint32_t i = 0; i < daemon->numOfClients;) {
+      DaemonClient *client = daemon->clients + i;
+      if (!client->hungUp) {
+        i++;
+        continue;
+      }
+      closeDaemonClient(client);
+      *client = daemon->clients[--daemon->numOfClients];
+    }
+    if (accepting) {
+      int fd = accept(listenFd, NULL, NULL);
+      if (fd != -1) {
+        DaemonClient *client = daemon->clients + daemon->numOfClients++;
+        memset(client, 0, sizeof(DaemonClient));
+        client->fd = fd;
+        client->replyFd = fd;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < daemon->numOfClients; i++) {
+    closeDaemonClient(daemon->clients + i);
+  }
+  if (listenFd != -1) {
+    close(listenFd);
+    unlink(socketPath);
+  }
+  freeThreadPool(daemon->pool);
+  freePreparedInputCache(&daemon->inputCache);
+  free(daemon->requests);
+  free(daemon);
+  return 0;
+}
+
+static void printUsage(void) {
+  printf("Usage: batch-convert [-j threads] [-r rate] [-p pack.syropack] "
+         "(-o output.wav | -d output_dir) (manifest.txt | input.syropack)\n"
+         "  -o  write every manifest entry into one combined syrostream\n"
+         "      (- for stdout, in which case the summary goes to stderr)\n"
+         "  -d  write one syrostream per manifest group into output_dir\n"
+         "  -r  first resample wav files at other rates to this one (the\n"
+         "      volca plays everything at 31250)\n"
+         "  -p  also write the prepared entries to a pack, which can take\n"
+         "      the place of the manifest next time (needs -o)\n"
+         "   or: batch-convert [-j threads] [-r rate] -s (socket | -) "
+         "-d output_dir\n"
+         "  -s  keep running, taking manifest lines as jobs from a unix\n"
+         "      socket (or stdin) and answering each with a line of JSON\n");
+}
+
+int main(int argc, char **argv) {
+  uint32_t numOfThreads = 0;
+  char *outputFilename = NULL;
+  char *outputDir = NULL;
+  char *manifestFilename = NULL;
+  char *packFilename = NULL;
+  char *socketPath = NULL;
+  uint32_t resampleRate = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      numOfThreads = (uint32_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      outputFilename = argv[++i];
+    } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+      outputDir = argv[++i];
+    } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+      packFilename = argv[++i];
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      resampleRate = (uint32_t)atoi(argv[++i]);
+      if (!resampleRate) {
+        printUsage();
+        return 1;
+      }
+    } else if (!manifestFilename && argv[i][0] != '-') {
+      manifestFilename = argv[i];
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (socketPath) {
+    if (manifestFilename || outputFilename || packFilename || !outputDir) {
+      printUsage();
+      return 1;
+    }
+    return runDaemon(socketPath, outputDir, numOfThreads, resampleRate);
+  }
+  if (!manifestFilename || !outputFilename == !outputDir ||
+      (packFilename && !outputFilename)) {
+    printUsage();
+    return 1;
+  }
+
+  BatchJob job;
+  memset(&job, 0, sizeof(BatchJob));
+  pthread_mutex_init(&job.progressMutex, NULL);
+  job.resampleRate = resampleRate;
+  size_t manifestLength = strlen(manifestFilename);
+  bool isPack = manifestLength > 9 &&
+                !strcmp(manifestFilename + manifestLength - 9, ".syropack");
+  if (!(isPack ? readPack(manifestFilename, &job)
+               : readManifest(manifestFilename, &job))) {
+    return 1;
+  }
+  if (!job.numOfEntries) {
+    printf("Manifest has no entries\n");
+    return 1;
+  }
+
+  if (outputFilename) {
+    // combined output: every entry goes into a single stream in manifest
+    // order, regardless of the group column
+    for (uint32_t i = 0; i < job.numOfGroups; i++) {
+      free(job.groups[i].name);
+    }
+    job.numOfGroups = 1;
+    job.groups[0].name = copyString("combined", strlen("combined"));
+    job.groups[0].outputFilename =
+        copyString(outputFilename, strlen(outputFilename));
+    for (uint32_t i = 0; i < job.numOfEntries; i++) {
+      job.entries[i].groupIndex = 0;
+    }
+  }
+  setupBatchGroups(&job, outputDir);
+  if (!checkBatchGroups(&job)) {
+    return 1;
+  }
+
+  ThreadPool *pool = createThreadPool(numOfThreads);
+  if (!pool) {
+    printf("Could not start worker threads\n");
+    return 1;
+  }
+  uint32_t threadsUsed = pool->numOfThreads;
+  job.startTime = getSeconds();
+
+  threadPoolRun(pool, job.numOfEntries, prepareEntryTask, &job);
+  for (uint32_t i = 0; i < job.numOfEntries; i++) {
+    if (!job.entries[i].ok) {
+      printf("Oops\n");
+      return 1;
+    }
+  }
+  double preparedTime = getSeconds();
+  // the pack is built now, while the entries still have their sample data,
+  // and its stream layout filled in once the stream is encoded
+  uint8_t *pack = NULL;
+  uint32_t packSize = 0;
+  if (packFilename) {
+    SyroData *syro_data = malloc(sizeof(SyroData) * job.numOfEntries);
+    for (uint32_t i = 0; i < job.numOfEntries; i++) {
+      syro_data[i] = job.entries[i].syro_data;
+    }
+    pack = createSyroPack(syro_data, job.numOfEntries, NULL, 0, &packSize);
+    free(syro_data);
+    if (!pack) {
+      printf("Oops\n");
+      return 1;
+    }
+  }
+
+  // a single stream (like combined output) would only keep one thread busy
+  if (job.numOfGroups > 1 || threadsUsed < 2 ||
+      !encodeGroupInParallel(pool, &job, 0)) {
+    threadPoolRun(pool, job.numOfGroups, encodeGroupTask, &job);
+  }
+  reportProgress(&job, true);
+  fprintf(stderr, "\n");
+  freeThreadPool(pool);
+  if (pack) {
+    setSyroPackStreamLayout(pack, job.groups[0].dataStartPoints,
+                            job.groups[0].streamSize);
+    if (!write_file(packFilename, pack, packSize)) {
+      job.groups[0].ok = false;
+    }
+    free(pack);
+  }
+
+  double elapsed = getSeconds() - job.startTime;
+  uint64_t bytesWritten = atomic_load(&job.bytesWritten);
+  FILE *summary =
+      outputFilename && !strcmp(outputFilename, "-") ? stderr : stdout;
+  fprintf(summary, "{ \"streams\": [");
+  int err = 0;
+  for (uint32_t i = 0; i < job.numOfGroups; i++) {
+    BatchGroup *group = job.groups + i;
+    if (!group->ok) {
+      err = 1;
+    }
+    fprintf(summary, "%s\"%s\"", i ? ", " : " ", group->outputFilename);
+  }
+  fprintf(summary, " ], \"samples\": %u, \"threads\": %u, \"prepareSeconds\": %.3f, "
+         "\"totalSeconds\": %.3f, \"framesPerSecond\": %.0f }\n",
+         job.numOfEntries, threadsUsed,
+         preparedTime - job.startTime, elapsed,
+         elapsed > 0 ? bytesWritten / 4 / elapsed : 0);
+  freeBatchJob(&job);
+  return err;
+}
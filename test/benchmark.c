@@ -0,0 +1,568 @@
+#include "../syro/shared-worker-types.h"
+#include "../syro/syro-utils.c"
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCHMARK_SAMPLE_RATE 44100
+// the rate the volca plays at
+#define BENCHMARK_RESAMPLE_RATE 31250
+#define MAX_BENCHMARK_LENGTHS 16
+// the size batch-convert reads wav files in
+#define BENCHMARK_READ_SIZE (64 * 1024)
+
+typedef enum {
+  // what the converters and bindings load wav files with
+  Phase_Setup = 0,
+  Phase_Resample,
+  Phase_Start,
+  Phase_Iterate,
+  Phase_EndToEnd,
+  // Korg's loader, for comparison only
+  Phase_KorgSetup,
+  NUM_OF_PHASES,
+} BenchmarkPhase;
+
+static const char *phaseNames[NUM_OF_PHASES] = {
+    "setupSyroDataFromWavStream",
+    "resampleSyroData",
+    "SyroVolcaSample_Start",
+    "iterateSampleBuffer",
+    "endToEnd",
+    "setup_file_sample",
+};
+
+typedef struct BenchmarkCase {
+  double lengthSeconds;
+  uint16_t bitDepth;
+  uint16_t channels;
+  uint32_t quality;
+  bool compressed;
+} BenchmarkCase;
+
+// sent back from the child process that ran the case
+typedef struct BenchmarkResult {
+  bool ok;
+  uint32_t sampleFrames;
+  uint32_t streamFrames;
+  // fastest of the repetitions
+  double seconds[NUM_OF_PHASES];
+} BenchmarkResult;
+
+// The rest of the Korg example's loader (see syro-example-helpers.c). The
+// converters all read wav files with wav-stream-parser.c now, so this is only
+// kept for comparison.
+
+/*----------------------------------------------------------------------------
+        Read 32Bit Value
+ ----------------------------------------------------------------------------*/
+static uint32_t get_32Bit_value(uint8_t *ptr) {
+  int i;
+  uint32_t dat;
+
+  dat = 0;
+
+  for (i = 0; i < 4; i++) {
+    dat <<= 8;
+    dat |= (uint32_t)ptr[3 - i];
+  }
+  return dat;
+}
+
+/*----------------------------------------------------------------------------
+        Read 16Bit Value
+ ----------------------------------------------------------------------------*/
+static uint16_t get_16Bit_value(uint8_t *ptr) {
+  uint16_t dat;
+
+  dat = (uint16_t)ptr[1];
+  dat <<= 8;
+  dat |= (uint16_t)ptr[0];
+
+  return dat;
+}
+
+// Korg's loop for 24Bit samples, which keeps only their low 16 bits (the
+// parser scales them down instead)
+static inline int32_t readWavSample24(const uint8_t *src) {
+  return (int32_t)((uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+                   ((uint32_t)(int32_t)(int8_t)src[2] << 16));
+}
+
+static void convert24BitWavDataToMono16(const uint8_t *src, int16_t *dest,
+                                        uint32_t num_of_frame,
+                                        uint16_t num_of_ch) {
+  for (uint32_t i = 0; i < num_of_frame; i++) {
+    const uint8_t *frame = src + i * 3 * num_of_ch;
+    int32_t sum = readWavSample24(frame);
+    if (num_of_ch == 2) {
+      sum += readWavSample24(frame + 3);
+      sum /= 2;
+    }
+    dest[i] = (int16_t)sum;
+  }
+}
+
+/*----------------------------------------------------------------------------
+        setup & load file (sample)
+ ----------------------------------------------------------------------------*/
+static bool setup_file_sample(uint8_t *src, uint32_t size,
+                              SyroData *syro_data) {
+  uint32_t wav_pos, chunk_size;
+  uint32_t wav_fs;
+  uint16_t num_of_ch, sample_byte;
+  uint32_t num_of_frame;
+
+  if (!src) {
+    printf("No src provided\n");
+    return false;
+  }
+
+  if (size <= sizeof(wav_header)) {
+    printf("wav file error, too small.\n");
+    return false;
+  }
+
+  //------- check header/fmt -------*/
+  if (memcmp(src, wav_header, 4)) {
+    printf("wav file error, 'RIFF' is not found.\n");
+    return false;
+  }
+
+  if (memcmp((src + WAV_POS_WAVEFMT), (wav_header + WAV_POS_WAVEFMT), 8)) {
+    printf("wav file error, 'WAVE' or 'fmt ' is not found.\n");
+    return false;
+  }
+
+  wav_pos = WAV_POS_WAVEFMT + 4; // 'fmt ' pos
+
+  if (get_16Bit_value(src + wav_pos + 8 + WAVFMT_POS_ENCODE) != 1) {
+    printf("wav file error, encode must be '1'.\n");
+    return false;
+  }
+
+  num_of_ch = get_16Bit_value(src + wav_pos + 8 + WAVFMT_POS_CHANNEL);
+  if ((num_of_ch != 1) && (num_of_ch != 2)) {
+    printf("wav file error, channel must be 1 or 2.\n");
+    return false;
+  }
+
+  {
+    uint16_t num_of_bit;
+
+    num_of_bit = get_16Bit_value(src + wav_pos + 8 + WAVFMT_POS_BIT);
+    if ((num_of_bit != 16) && (num_of_bit != 24)) {
+      printf("wav file error, bit must be 16 or 24.\n");
+      return false;
+    }
+
+    sample_byte = (num_of_bit / 8);
+  }
+  wav_fs = get_32Bit_value(src + wav_pos + 8 + WAVFMT_POS_FS);
+
+  //------- search 'data' -------*/
+  for (;;) {
+    chunk_size = get_32Bit_value(src + wav_pos + 4);
+    if (!memcmp((src + wav_pos), "data", 4)) {
+      break;
+    }
+    wav_pos += chunk_size + 8;
+    if ((wav_pos + 8) > size) {
+      printf("wav file error, 'data' chunk not found.\n");
+      return false;
+    }
+  }
+
+  if ((wav_pos + chunk_size + 8) > size) {
+    printf("wav file error, illegal 'data' chunk size.\n");
+    return false;
+  }
+
+  //------- setup  -------*/
+  num_of_frame = chunk_size / (num_of_ch * sample_byte);
+  chunk_size = (num_of_frame * 2);
+  syro_data->pData = malloc(chunk_size);
+  if (!syro_data->pData) {
+    printf("not enough memory to setup file. \n");
+    return false;
+  }
+
+  //------- convert to 1ch, 16Bit  -------*/
+  if (sample_byte == 2) {
+    convertWavDataToMono16(src + wav_pos + 8, (int16_t *)syro_data->pData,
+                           num_of_frame, num_of_ch);
+  } else {
+    convert24BitWavDataToMono16(src + wav_pos + 8,
+                                (int16_t *)syro_data->pData, num_of_frame,
+                                num_of_ch);
+  }
+
+  syro_data->Size = chunk_size;
+  syro_data->Fs = wav_fs;
+  syro_data->SampleEndian = LittleEndian;
+
+  return true;
+}
+
+static double getSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Builds a wav file of a chord with some noise on top, so compression has
+ * something realistic to work with. The same case always gives the same
+ * bytes.
+ */
+static uint8_t *createBenchmarkWav(BenchmarkCase *benchmarkCase,
+                                   uint32_t *bytes) {
+  uint32_t frames =
+      (uint32_t)(benchmarkCase->lengthSeconds * BENCHMARK_SAMPLE_RATE);
+  uint16_t sampleBytes = benchmarkCase->bitDepth / 8;
+  uint16_t blockAlign = sampleBytes * benchmarkCase->channels;
+  uint32_t dataSize = frames * blockAlign;
+  *bytes = sizeof(wav_header) + dataSize;
+  uint8_t *wav = malloc(*bytes);
+  if (!wav) {
+    return NULL;
+  }
+  memcpy(wav, wav_header, sizeof(wav_header));
+  set_32Bit_value(wav + WAV_POS_RIFF_SIZE, dataSize + 0x24);
+  uint8_t *fmt = wav + WAV_POS_WAVEFMT + 4 + 8;
+  fmt[WAVFMT_POS_CHANNEL] = (uint8_t)benchmarkCase->channels;
+  set_32Bit_value(fmt + WAVFMT_POS_FS, BENCHMARK_SAMPLE_RATE);
+  set_32Bit_value(fmt + 8, BENCHMARK_SAMPLE_RATE * blockAlign);
+  fmt[12] = (uint8_t)blockAlign;
+  fmt[WAVFMT_POS_BIT] = (uint8_t)benchmarkCase->bitDepth;
+  set_32Bit_value(wav + WAV_POS_DATA_SIZE, dataSize);
+
+  uint8_t *dest = wav + sizeof(wav_header);
+  uint32_t seed = 1;
+  double maxValue = (1 << (benchmarkCase->bitDepth - 1)) - 1;
+  for (uint32_t i = 0; i < frames; i++) {
+    double t = (double)i / BENCHMARK_SAMPLE_RATE;
+    for (uint16_t ch = 0; ch < benchmarkCase->channels; ch++) {
+      seed = seed * 1103515245 + 12345;
+      double noise = ((seed >> 16) & 0x7fff) / 32767.0 - 0.5;
+      double value = 0.3 * sin(2 * M_PI * (220 + ch) * t) +
+                     0.2 * sin(2 * M_PI * 277.2 * t) +
+                     0.2 * sin(2 * M_PI * 329.6 * t) + 0.1 * noise;
+      int32_t sample = (int32_t)(value * maxValue);
+      for (uint16_t b = 0; b < sampleBytes; b++) {
+        *dest++ = (uint8_t)(sample >> (8 * b));
+      }
+    }
+  }
+  return wav;
+}
+
+/**
+ * Sets up the case's syro data the way the converters do, feeding the wav to
+ * a WavStreamParser a read at a time.
+ */
+static SyroData *setupBenchmarkSyroData(BenchmarkCase *benchmarkCase,
+                                        uint8_t *wav, uint32_t bytes) {
+  WavStreamParser parser;
+  initWavStreamParser(&parser);
+  for (uint32_t offset = 0; offset < bytes; offset += BENCHMARK_READ_SIZE) {
+    uint32_t readSize = bytes - offset < BENCHMARK_READ_SIZE
+                            ? bytes - offset
+                            : BENCHMARK_READ_SIZE;
+    if (!pushWavStreamBytes(&parser, wav + offset, readSize)) {
+      clearWavStreamParser(&parser);
+      return NULL;
+    }
+  }
+  return getSyroDataForWavStream(&parser, 0, benchmarkCase->quality,
+                                 benchmarkCase->compressed);
+}
+
+// Sets up the case's syro data with Korg's loader instead.
+static SyroData *setupKorgBenchmarkSyroData(BenchmarkCase *benchmarkCase,
+                                            uint8_t *wav, uint32_t bytes) {
+  SyroData *syro_data = malloc(sizeof(SyroData));
+  if (!syro_data) {
+    return NULL;
+  }
+  syro_data->DataType = benchmarkCase->compressed ? DataType_Sample_Compress
+                                                  : DataType_Sample_Liner;
+  syro_data->Number = 0;
+  syro_data->Quality = benchmarkCase->quality;
+  if (!setup_file_sample(wav, bytes, syro_data)) {
+    free(syro_data);
+    return NULL;
+  }
+  return syro_data;
+}
+
+static void iterateToEnd(SampleBufferContainer *sampleBuffer) {
+  while (sampleBuffer->progress < sampleBuffer->size) {
+    iterateSampleBuffer(sampleBuffer, ITERATION_INTERVAL);
+  }
+}
+
+static void keepFastest(BenchmarkResult *result, BenchmarkPhase phase,
+                        double seconds) {
+  if (!result->seconds[phase] || seconds < result->seconds[phase]) {
+    result->seconds[phase] = seconds;
+  }
+}
+
+/**
+ * Times each phase on its own, then all of them in one go, keeping the
+ * fastest of the repetitions. Setup is the parser path the converters use
+ * (see setupBenchmarkSyroData), and Korg's loader is timed alongside it. The
+ * compressed block cache is cleared before every Start so compression is
+ * always measured.
+ */
+static BenchmarkResult runBenchmarkCase(BenchmarkCase *benchmarkCase,
+                                        uint32_t repetitions) {
+  BenchmarkResult result;
+  memset(&result, 0, sizeof(BenchmarkResult));
+  uint32_t bytes;
+  uint8_t *wav = createBenchmarkWav(benchmarkCase, &bytes);
+  if (!wav) {
+    return result;
+  }
+  for (uint32_t r = 0; r < repetitions; r++) {
+    double start = getSeconds();
+    SyroData *syro_data = setupBenchmarkSyroData(benchmarkCase, wav, bytes);
+    keepFastest(&result, Phase_Setup, getSeconds() - start);
+    if (!syro_data) {
+      free(wav);
+      return result;
+    }
+    result.sampleFrames = syro_data->Size / 2;
+
+    start = getSeconds();
+    SyroData *korg_syro_data =
+        setupKorgBenchmarkSyroData(benchmarkCase, wav, bytes);
+    keepFastest(&result, Phase_KorgSetup, getSeconds() - start);
+    if (!korg_syro_data) {
+      free_syrodata(syro_data, 1);
+      free(syro_data);
+      free(wav);
+      return result;
+    }
+    free_syrodata(korg_syro_data, 1);
+    free(korg_syro_data);
+
+    // on a copy, so the other phases still get the sample at its own rate
+    SyroData *resampled = setupBenchmarkSyroData(benchmarkCase, wav, bytes);
+    start = getSeconds();
+    bool resampledOk =
+        resampled && resampleSyroData(resampled, BENCHMARK_RESAMPLE_RATE);
+    keepFastest(&result, Phase_Resample, getSeconds() - start);
+    if (resampled) {
+      free_syrodata(resampled, 1);
+      free(resampled);
+    }
+    if (!resampledOk) {
+      free_syrodata(syro_data, 1);
+      free(syro_data);
+      free(wav);
+      return result;
+    }
+
+    clearSyroCompCache();
+    start = getSeconds();
+    SampleBufferContainer *sampleBuffer = startSampleBuffer(syro_data, 1);
+    keepFastest(&result, Phase_Start, getSeconds() - start);
+    if (!sampleBuffer) {
+      free_syrodata(syro_data, 1);
+      free(syro_data);
+      free(wav);
+      return result;
+    }
+    result.streamFrames = (sampleBuffer->size - sizeof(wav_header)) / 4;
+
+    start = getSeconds();
+    iterateToEnd(sampleBuffer);
+    keepFastest(&result, Phase_Iterate, getSeconds() - start);
+    free_syrodata(syro_data, 1);
+    freeSampleBuffer(sampleBuffer);
+
+    clearSyroCompCache();
+    start = getSeconds();
+    syro_data = setupBenchmarkSyroData(benchmarkCase, wav, bytes);
+    if (!syro_data) {
+      free(wav);
+      return result;
+    }
+    sampleBuffer = startSampleBuffer(syro_data, 1);
+    if (!sampleBuffer) {
+      free_syrodata(syro_data, 1);
+      free(syro_data);
+      free(wav);
+      return result;
+    }
+    iterateToEnd(sampleBuffer);
+    keepFastest(&result, Phase_EndToEnd, getSeconds() - start);
+    free_syrodata(syro_data, 1);
+    freeSampleBuffer(sampleBuffer);
+  }
+  free(wav);
+  result.ok = true;
+  return result;
+}
+
+/**
+ * Runs the case in a child process, so its peak memory use can be measured
+ * on its own. Returns the peak resident set size in bytes, or 0 if the case
+ * failed.
+ */
+static uint64_t runBenchmarkCaseInChild(BenchmarkCase *benchmarkCase,
+                                        uint32_t repetitions,
+                                        BenchmarkResult *result) {
+  int fds[2];
+  if (pipe(fds)) {
+    return 0;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  }
+  if (!pid) {
+    close(fds[0]);
+    BenchmarkResult childResult = runBenchmarkCase(benchmarkCase, repetitions);
+    ssize_t written = write(fds[1], &childResult, sizeof(BenchmarkResult));
+    _exit(written == sizeof(BenchmarkResult) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t got = read(fds[0], result, sizeof(BenchmarkResult));
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) || got != sizeof(BenchmarkResult) || !result->ok) {
+    return 0;
+  }
+#ifdef __APPLE__
+  // (already bytes on macOS)
+  return (uint64_t)usage.ru_maxrss;
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static void printBenchmarkResult(FILE *out, BenchmarkCase *benchmarkCase,
+                                 BenchmarkResult *result,
+                                 uint64_t peakMemoryBytes, bool first) {
+  fprintf(out,
+          "%s\n    { \"lengthSeconds\": %g, \"bitDepth\": %u, \"channels\": "
+          "%u, \"quality\": %u, \"compressed\": %s, \"sampleFrames\": %u, "
+          "\"streamFrames\": %u, \"peakMemoryBytes\": %llu, \"phases\": {",
+          first ? "" : ",", benchmarkCase->lengthSeconds,
+          benchmarkCase->bitDepth, benchmarkCase->channels,
+          benchmarkCase->quality, benchmarkCase->compressed ? "true" : "false",
+          result->sampleFrames, result->streamFrames,
+          (unsigned long long)peakMemoryBytes);
+  for (uint32_t phase = 0; phase < NUM_OF_PHASES; phase++) {
+    // the frame loop produces stream frames, everything else is measured
+    // against the sample
+    uint32_t frames = phase == Phase_Iterate ? result->streamFrames
+                                             : result->sampleFrames;
+    double seconds = result->seconds[phase];
+    fprintf(out,
+            "%s \"%s\": { \"seconds\": %.6f, \"framesPerSecond\": %.0f }",
+            phase ? "," : "", phaseNames[phase], seconds,
+            seconds > 0 ? frames / seconds : 0);
+  }
+  fprintf(out, " } }");
+}
+
+static void printUsage(void) {
+  printf("Usage: benchmark [-r repetitions] [-l seconds,...] [-o output.json]\n"
+         "  -r  runs per case, keeping the fastest (default 3)\n"
+         "  -l  sample lengths to test, in seconds (default 1,10,60)\n"
+         "  -o  write the JSON report to a file instead of stdout\n");
+}
+
+int main(int argc, char **argv) {
+  uint32_t repetitions = 3;
+  double lengths[MAX_BENCHMARK_LENGTHS] = {1, 10, 60};
+  uint32_t numOfLengths = 3;
+  char *outputFilename = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      repetitions = (uint32_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+      numOfLengths = 0;
+      for (char *length = strtok(argv[++i], ",");
+           length && numOfLengths < MAX_BENCHMARK_LENGTHS;
+           length = strtok(NULL, ",")) {
+        lengths[numOfLengths++] = atof(length);
+      }
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      outputFilename = argv[++i];
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (!repetitions || !numOfLengths) {
+    printUsage();
+    return 1;
+  }
+  for (uint32_t i = 0; i < numOfLengths; i++) {
+    if (!(lengths[i] > 0)) {
+      printUsage();
+      return 1;
+    }
+  }
+  FILE *out = outputFilename ? fopen(outputFilename, "w") : stdout;
+  if (!out) {
+    printf(" File open error, %s \n", outputFilename);
+    return 1;
+  }
+
+  const uint16_t bitDepths[] = {16, 24};
+  const uint16_t channelCounts[] = {1, 2};
+  // linear samples are always stored at 16 bits, so quality only matters
+  // when compressing
+  const uint32_t compressedQualities[] = {8, 12, 16};
+  int err = 0;
+  bool first = true;
+  fprintf(out, "{ \"repetitions\": %u, \"sampleRate\": %u, \"cases\": [",
+          repetitions, BENCHMARK_SAMPLE_RATE);
+  for (uint32_t l = 0; l < numOfLengths; l++) {
+    for (uint32_t b = 0; b < 2; b++) {
+      for (uint32_t c = 0; c < 2; c++) {
+        for (int32_t q = -1; q < 3; q++) {
+          BenchmarkCase benchmarkCase = {
+              .lengthSeconds = lengths[l],
+              .bitDepth = bitDepths[b],
+              .channels = channelCounts[c],
+              .quality = q == -1 ? 16 : compressedQualities[q],
+              .compressed = q != -1,
+          };
+          BenchmarkResult result;
+          uint64_t peakMemoryBytes =
+              runBenchmarkCaseInChild(&benchmarkCase, repetitions, &result);
+          if (!peakMemoryBytes) {
+            fprintf(stderr, "Case failed: %gs, %u bit, %uch, quality %u%s\n",
+                    benchmarkCase.lengthSeconds, benchmarkCase.bitDepth,
+                    benchmarkCase.channels, benchmarkCase.quality,
+                    benchmarkCase.compressed ? ", compressed" : "");
+            err = 1;
+            continue;
+          }
+          printBenchmarkResult(out, &benchmarkCase, &result, peakMemoryBytes,
+                               first);
+          first = false;
+          fflush(out);
+        }
+      }
+    }
+  }
+  fprintf(out, "\n  ] }\n");
+  if (outputFilename) {
+    err = fclose(out) ? 1 : err;
+  }
+  return err;
+}
@@ -2,6 +2,26 @@ gcc \
   -O3 \
   ../syro/volcasample/syro/korg_syro_volcasample.c \
   ../syro/volcasample/syro/korg_syro_func.c \
-  ../syro/volcasample/syro/korg_syro_comp.c \
+  ../syro/syro-comp-cache.c \
   ./convert-sample.c \
+  -lm \
   -o ./convert-sample
+
+gcc \
+  -O3 \
+  -pthread \
+  ../syro/volcasample/syro/korg_syro_volcasample.c \
+  ../syro/volcasample/syro/korg_syro_func.c \
+  ../syro/syro-comp-cache.c \
+  ./batch-convert.c \
+  -lm \
+  -o ./batch-convert
+
+gcc \
+  -O3 \
+  ../syro/volcasample/syro/korg_syro_volcasample.c \
+  ../syro/volcasample/syro/korg_syro_func.c \
+  ../syro/syro-comp-cache.c \
+  ./benchmark.c \
+  -lm \
+  -o ./benchmark
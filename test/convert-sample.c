@@ -1,62 +1,6 @@
+#include "../syro/shared-worker-types.h"
 #include "../syro/syro-utils.c"
-
-// taken from syro example
-static bool write_file(char *filename, uint8_t *buf, uint32_t size) {
-  FILE *fp;
-
-  fp = fopen(filename, "wb");
-  if (!fp) {
-    printf(" File open error, %s \n", filename);
-    return false;
-  }
-
-  if (fwrite(buf, 1, size, fp) < size) {
-    printf(" File write error(perhaps disk space is not enough), %s \n",
-           filename);
-    fclose(fp);
-    return false;
-  }
-
-  fclose(fp);
-
-  return true;
-}
-
-// taken from syro example
-static uint8_t *read_file(char *filename, uint32_t *psize) {
-  FILE *fp;
-  uint8_t *buf;
-  uint32_t size;
-
-  fp = fopen((const char *)filename, "rb");
-  if (!fp) {
-    printf(" File open error, %s \n", filename);
-    return NULL;
-  }
-
-  fseek(fp, 0, SEEK_END);
-  size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  buf = malloc(size);
-  if (!buf) {
-    printf(" Not enough memory for read file.\n");
-    fclose(fp);
-    return NULL;
-  }
-
-  if (fread(buf, 1, size, fp) < size) {
-    printf(" File read error, %s \n", filename);
-    fclose(fp);
-    free(buf);
-    return NULL;
-  }
-
-  fclose(fp);
-
-  *psize = size;
-  return buf;
-}
+#include "./file-utils.c"
 
 int lastSlashIndex(char *filename, int length) {
   int last = -1;
@@ -68,22 +12,51 @@ int lastSlashIndex(char *filename, int length) {
   return last;
 }
 
+// The stream is written out as it's generated, one ring's worth at a time, so
+// memory use doesn't grow with the length of the sample.
 int convertSample(char *filename, uint8_t *inputArray, uint32_t bytes,
                   uint32_t slotNumber, bool useCompression) {
   SyroData *syro_data = getSyroDataForWavData(inputArray, bytes, slotNumber, 16,
                                               useCompression ? 1 : 0);
-  SampleBufferContainer *sampleBuffer = startSampleBuffer(syro_data, 1);
+  if (!syro_data) {
+    return 1;
+  }
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf(" File open error, %s \n", filename);
+    free_syrodata(syro_data, 1);
+    free(syro_data);
+    return 1;
+  }
+  SampleBufferContainer *sampleBuffer =
+      startSampleBufferStream(syro_data, 1, SAMPLE_BUFFER_STREAM_SIZE);
   if (!sampleBuffer) {
     printf("Oops!\n");
+    close(fd);
+    free_syrodata(syro_data, 1);
+    free(syro_data);
     return 1;
   }
-  iterateSampleBuffer(sampleBuffer, INT32_MAX);
-
-  if (write_file(filename, sampleBuffer->buffer, sampleBuffer->size)) {
-    freeSampleBuffer(sampleBuffer);
-  } else {
+  bool ok = true;
+  while (ok && sampleBuffer->consumed < sampleBuffer->size) {
+    iterateSampleBuffer(sampleBuffer, ITERATION_INTERVAL);
+    uint8_t *parts[2];
+    uint32_t partSizes[2];
+    uint32_t chunkSize = peekSampleBuffer(sampleBuffer, parts, partSizes);
+    if (!write_parts(fd, parts, partSizes, 2)) {
+      printf(" File write error(perhaps disk space is not enough), %s \n",
+             filename);
+      ok = false;
+    }
+    skipSampleBuffer(sampleBuffer, chunkSize);
+  }
+  if (sampleBuffer->progress < sampleBuffer->size) {
+    SyroVolcaSample_End(sampleBuffer->syro_handle);
+  }
+  free_syrodata(syro_data, 1);
+  freeSampleBuffer(sampleBuffer);
+  if (close(fd) != 0 || !ok) {
     printf("Oops\n");
-    freeSampleBuffer(sampleBuffer);
     return 1;
   }
   return 0;
@@ -104,12 +77,14 @@ int main(int argc, char **argv) {
     printf("Expected slotNumber between 0 and 99\n");
     return 1;
   }
-  uint32_t bytes;
-  uint8_t *inputArray = read_file(wavfilename, &bytes);
-  if (!inputArray) {
+  // both variants are converted from the one mapping
+  MappedFile input;
+  if (!map_file(wavfilename, &input)) {
     printf("Oops\n");
     return 1;
   }
+  uint8_t *inputArray = input.data;
+  uint32_t bytes = input.size;
 
   int afterLastSlashIndex =
       lastSlashIndex(wavfilename, strlen(wavfilename)) + 1;
@@ -123,12 +98,14 @@ int main(int argc, char **argv) {
   // generate compressed
   {
     char label[] = " [native] (compressed).syrostream";
-    char *filename = malloc(base_name_len + strlen(label));
+    char *filename = malloc(base_name_len + strlen(label) + 1);
     strcpy(filename, base_name);
     strcpy(filename + base_name_len - 4, label);
     strcpy(filename + base_name_len + strlen(label) - 4, ".wav");
     err = convertSample(filename, inputArray, bytes, slotNumber, true);
     if (err) {
+      free(filename);
+      unmap_file(&input);
       return 1;
     }
     compressed_filename = filename;
@@ -136,19 +113,24 @@ int main(int argc, char **argv) {
   // generate uncompressed
   {
     char label[] = " [native] (uncompressed).syrostream";
-    char *filename = malloc(base_name_len + strlen(label));
+    char *filename = malloc(base_name_len + strlen(label) + 1);
     strcpy(filename, base_name);
     strcpy(filename + base_name_len - 4, label);
     strcpy(filename + base_name_len + strlen(label) - 4, ".wav");
     err = convertSample(filename, inputArray, bytes, slotNumber, false);
     if (err) {
+      free(filename);
+      free(compressed_filename);
+      unmap_file(&input);
       return 1;
     }
     uncompressed_filename = filename;
   }
 
-  free(inputArray);
+  unmap_file(&input);
   printf("{ \"compressed\": \"%s\", \"uncompressed\": \"%s\" }\n",
          compressed_filename, uncompressed_filename);
+  free(compressed_filename);
+  free(uncompressed_filename);
   return 0;
 }
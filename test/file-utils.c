@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// taken from syro example
+static uint8_t *read_file(char *filename, uint32_t *psize) {
+  FILE *fp;
+  uint8_t *buf;
+  uint32_t size;
+
+  fp = fopen((const char *)filename, "rb");
+  if (!fp) {
+    printf(" File open error, %s \n", filename);
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  buf = malloc(size);
+  if (!buf) {
+    printf(" Not enough memory for read file.\n");
+    fclose(fp);
+    return NULL;
+  }
+
+  if (fread(buf, 1, size, fp) < size) {
+    printf(" File read error, %s \n", filename);
+    fclose(fp);
+    free(buf);
+    return NULL;
+  }
+
+  fclose(fp);
+
+  *psize = size;
+  return buf;
+}
+
+typedef struct MappedFile {
+  uint8_t *data;
+  uint32_t size;
+  // false if the file was read into memory instead
+  bool mapped;
+} MappedFile;
+
+// Maps a whole file read-only, so the page cache backs it rather than a copy
+// of our own. Falls back to read_file for anything that can't be mapped (empty
+// files, pipes). Release it with unmap_file.
+static bool map_file(char *filename, MappedFile *file) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf(" File open error, %s \n", filename);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (uint64_t)st.st_size <= UINT32_MAX) {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      close(fd);
+      // it's read front to back once
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      file->data = data;
+      file->size = (uint32_t)st.st_size;
+      file->mapped = true;
+      return true;
+    }
+  }
+  close(fd);
+  file->data = read_file(filename, &file->size);
+  file->mapped = false;
+  return file->data != NULL;
+}
+
+static void unmap_file(MappedFile *file) {
+  if (file->mapped) {
+    munmap(file->data, file->size);
+  } else {
+    free(file->data);
+  }
+  file->data = NULL;
+}
+
+// Writes every byte of up to two parts (e.g. the two halves of a ring buffer)
+// to fd, with as few writev calls as it takes.
+static bool write_parts(int fd, uint8_t **parts, uint32_t *partSizes,
+                        uint32_t numOfParts) {
+  struct iovec iov[2];
+  int iovcnt = 0;
+  for (uint32_t i = 0; i < numOfParts && iovcnt < 2; i++) {
+    if (partSizes[i]) {
+      iov[iovcnt].iov_base = parts[i];
+      iov[iovcnt].iov_len = partSizes[i];
+      iovcnt++;
+    }
+  }
+  struct iovec *next = iov;
+  while (iovcnt) {
+    ssize_t written = writev(fd, next, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    // skip whatever was written, which may end partway through a part
+    while (iovcnt && (size_t)written >= next->iov_len) {
+      written -= next->iov_len;
+      next++;
+      iovcnt--;
+    }
+    if (iovcnt) {
+      next->iov_base = (uint8_t *)next->iov_base + written;
+      next->iov_len -= written;
+    }
+  }
+  return true;
+}
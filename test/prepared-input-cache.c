@@ -0,0 +1,171 @@
+// Prepared samples kept between batches by batch-convert's daemon mode (-s),
+// so a wav file that comes up again is neither read nor parsed (nor
+// resampled) again. Each is keyed by the file as it was when it was read
+// (device, inode, size and modification time), so a file that has changed
+// since is read afresh. Compressed blocks live on in the compression cache
+// anyway, so a sample that comes up again skips that step too.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// least recently used samples are let go past this
+#define PREPARED_INPUT_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+typedef struct PreparedInput {
+  char *wavFilename;
+  dev_t device;
+  ino_t inode;
+  off_t fileSize;
+  struct timespec modified;
+  uint32_t resampleRate;
+  // the prepared 16Bit samples and their rate
+  uint8_t *pData;
+  uint32_t Size;
+  uint32_t Fs;
+  uint64_t lastUsed;
+} PreparedInput;
+
+typedef struct PreparedInputCache {
+  pthread_mutex_t mutex;
+  PreparedInput *inputs;
+  uint32_t length;
+  uint32_t capacity;
+  uint64_t bytes;
+  // ticks on every lookup, for lastUsed
+  uint64_t clock;
+} PreparedInputCache;
+
+static void initPreparedInputCache(PreparedInputCache *cache) {
+  memset(cache, 0, sizeof(PreparedInputCache));
+  pthread_mutex_init(&cache->mutex, NULL);
+}
+
+static void freePreparedInputCache(PreparedInputCache *cache) {
+  for (uint32_t i = 0; i < cache->length; i++) {
+    free(cache->inputs[i].wavFilename);
+    free(cache->inputs[i].pData);
+  }
+  free(cache->inputs);
+  pthread_mutex_destroy(&cache->mutex);
+}
+
+static bool isSamePreparedInput(const PreparedInput *input,
+                                const char *wavFilename, const struct stat *st,
+                                uint32_t resampleRate) {
+  return input->device == st->st_dev && input->inode == st->st_ino &&
+         input->fileSize == st->st_size &&
+         input->modified.tv_sec == st->st_mtim.tv_sec &&
+         input->modified.tv_nsec == st->st_mtim.tv_nsec &&
+         input->resampleRate == resampleRate &&
+         !strcmp(input->wavFilename, wavFilename);
+}
+
+/**
+ * Sets up syro_data's samples (a copy, owned by it as usual) from the file
+ * described by st, if they're cached. Returns false if they aren't, or if out
+ * of memory.
+ */
+static bool takePreparedInput(PreparedInputCache *cache,
+                              const char *wavFilename, const struct stat *st,
+                              uint32_t resampleRate, SyroData *syro_data) {
+  bool found = false;
+  pthread_mutex_lock(&cache->mutex);
+  for (uint32_t i = 0; i < cache->length; i++) {
+    PreparedInput *input = cache->inputs + i;
+    if (!isSamePreparedInput(input, wavFilename, st, resampleRate)) {
+      continue;
+    }
+    syro_data->pData = malloc(input->Size ? input->Size : 1);
+    if (syro_data->pData) {
+      memcpy(syro_data->pData, input->pData, input->Size);
+      syro_data->Size = input->Size;
+      syro_data->Fs = input->Fs;
+      syro_data->SampleEndian = LittleEndian;
+      input->lastUsed = ++cache->clock;
+      found = true;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return found;
+}
+
+// call with the mutex held
+static void evictPreparedInput(PreparedInputCache *cache, uint32_t index) {
+  PreparedInput *input = cache->inputs + index;
+  cache->bytes -= input->Size;
+  free(input->wavFilename);
+  free(input->pData);
+  *input = cache->inputs[--cache->length];
+}
+
+/**
+ * Keeps a copy of syro_data's samples, prepared from the file described by
+ * st, for takePreparedInput. Does nothing if out of memory or if they'd take
+ * up more than the whole cache.
+ */
+static void addPreparedInput(PreparedInputCache *cache,
+                             const char *wavFilename, const struct stat *st,
+                             uint32_t resampleRate, const SyroData *syro_data) {
+  if (syro_data->Size > PREPARED_INPUT_CACHE_MAX_BYTES) {
+    return;
+  }
+  PreparedInput input = {
+      .device = st->st_dev,
+      .inode = st->st_ino,
+      .fileSize = st->st_size,
+      .modified = st->st_mtim,
+      .resampleRate = resampleRate,
+      .Size = syro_data->Size,
+      .Fs = syro_data->Fs,
+  };
+  input.wavFilename = malloc(strlen(wavFilename) + 1);
+  input.pData = malloc(syro_data->Size ? syro_data->Size : 1);
+  if (!input.wavFilename || !input.pData) {
+    free(input.wavFilename);
+    free(input.pData);
+    return;
+  }
+  strcpy(input.wavFilename, wavFilename);
+  memcpy(input.pData, syro_data->pData, syro_data->Size);
+  pthread_mutex_lock(&cache->mutex);
+  // an older version of the same file goes, then the least recently used
+  for (uint32_t i = 0; i < cache->length; i++) {
+    if (!strcmp(cache->inputs[i].wavFilename, wavFilename) &&
+        cache->inputs[i].resampleRate == resampleRate) {
+      evictPreparedInput(cache, i);
+      break;
+    }
+  }
+  while (cache->length &&
+         cache->bytes + input.Size > PREPARED_INPUT_CACHE_MAX_BYTES) {
+    uint32_t oldest = 0;
+    for (uint32_t i = 1; i < cache->length; i++) {
+      if (cache->inputs[i].lastUsed < cache->inputs[oldest].lastUsed) {
+        oldest = i;
+      }
+    }
+    evictPreparedInput(cache, oldest);
+  }
+  if (cache->length == cache->capacity) {
+    uint32_t capacity = cache->capacity ? cache->capacity * 2 : 16;
+    PreparedInput *inputs =
+        realloc(cache->inputs, sizeof(PreparedInput) * capacity);
+    if (!inputs) {
+      pthread_mutex_unlock(&cache->mutex);
+      free(input.wavFilename);
+      free(input.pData);
+      return;
+    }
+    cache->inputs = inputs;
+    cache->capacity = capacity;
+  }
+  input.lastUsed = ++cache->clock;
+  cache->inputs[cache->length++] = input;
+  cache->bytes += input.Size;
+  pthread_mutex_unlock(&cache->mutex);
+}
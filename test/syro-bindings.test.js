@@ -23,7 +23,15 @@ console.log('Files built.\n');
 const testPort = 5432;
 const moduleCache = {};
 const moduleMocks = {
-  localforage: 'export default { createInstance: () => ({}) };',
+  localforage: `
+export default {
+  createInstance: () => ({
+    getItem: async () => null,
+    setItem: async () => {},
+    removeItem: async () => {},
+  }),
+};
+  `,
   react: `
 export const createContext = () => {};
 export const createElement = () => {};
@@ -40,13 +48,20 @@ export const useLayoutEffect = () => {};
 export const encode = () => {};
 export const decode = () => {};
   `,
-  'wave-resampler': `
-export default { resample: () => new Float64Array() };
-export const resample = () => new Float64Array();
-  `,
 };
-function getTestServer() {
+/**
+ * @param {boolean} [crossOriginIsolated] send the headers that enable
+ * SharedArrayBuffer (and with it the pthreads build of the bindings)
+ */
+function getTestServer(crossOriginIsolated) {
   const testServer = express();
+  if (crossOriginIsolated) {
+    testServer.use((req, res, next) => {
+      res.set('Cross-Origin-Opener-Policy', 'same-origin');
+      res.set('Cross-Origin-Embedder-Policy', 'require-corp');
+      next();
+    });
+  }
   testServer.get('/', (req, res) => {
     res.send(`<!DOCTYPE html>`);
   });
@@ -115,12 +130,20 @@ const importMap = {
 };
 
 /**
- * @param {{ scripts?: string[]; modules?: { url: string; globalName: string }[] }} opts
+ * @param {{
+ *   scripts?: string[];
+ *   modules?: { url: string; globalName: string }[];
+ *   crossOriginIsolated?: boolean;
+ * }} opts
  * @param {(page: puppeteer.Page) => void | Promise<void>} callback
  * @param {test.Test} t
  */
-async function forEachBrowser({ scripts, modules }, callback, t) {
-  const testServer = getTestServer();
+async function forEachBrowser(
+  { scripts, modules, crossOriginIsolated },
+  callback,
+  t
+) {
+  const testServer = getTestServer(crossOriginIsolated);
   // TODO: support firefox when named import maps can work
   for (const product of ['chrome' /*, 'firefox'*/]) {
     // TODO: find another way to do this (needed for Drone at the moment
@@ -223,6 +246,158 @@ function printDiffForWavBuffers(t, receivedBuffer, expectedBuffer) {
   }
 }
 
+/**
+ * What convertFloatSamplesTo16Bit in sample-dsp.c should give, one sample at
+ * a time in float precision like its scalar loop.
+ * @param {number[]} samples
+ * @param {number} gain
+ * @param {number} qualityBitDepth
+ */
+function convertFloatSamplesTo16Bit(samples, gain, qualityBitDepth) {
+  const quantize = qualityBitDepth < 16;
+  const signedMax = 2 ** ((quantize ? qualityBitDepth : 16) - 1);
+  return samples.map((value) => {
+    let sample = Math.fround(value);
+    if (gain !== 1) {
+      sample = Math.fround(sample * gain);
+    }
+    if (quantize) {
+      const scaled = Math.fround(sample * signedMax);
+      const rounded = Math.floor(scaled);
+      sample = (scaled - rounded >= 0.5 ? rounded + 1 : rounded) / signedMax;
+    }
+    sample = Math.fround(sample * 32768);
+    if (Number.isNaN(sample)) {
+      return 0;
+    }
+    return Math.max(-32768, Math.min(32767, Math.trunc(sample))) | 0;
+  });
+}
+
+/**
+ * What resampleFloatSamples in sample-resample.c should give, worked out in
+ * double precision from the same filters.
+ * @param {number[]} samples
+ * @param {number} sourceRate
+ * @param {number} targetRate
+ */
+function resampleFloatSamples(samples, sourceRate, targetRate) {
+  const taps = 32;
+  const phases = 256;
+  const beta = 8;
+  /** @param {number} x */
+  const besselI0 = (x) => {
+    let sum = 1;
+    let term = 1;
+    for (let k = 1; k < 50 && term > sum * 1e-12; k++) {
+      const half = x / (2 * k);
+      term *= half * half;
+      sum += term;
+    }
+    return sum;
+  };
+  const cutoff =
+    targetRate < sourceRate ? (0.94 * targetRate) / sourceRate : 0.94;
+  /** @type {Float32Array[]} */
+  const filters = [];
+  for (let k = 0; k <= phases; k++) {
+    const filter = [];
+    for (let n = 0; n < taps; n++) {
+      const x = n - (taps / 2 - 1) - k / phases;
+      const sinc =
+        x === 0
+          ? 1
+          : Math.sin(Math.PI * cutoff * x) / (Math.PI * cutoff * x);
+      const r = x / (taps / 2);
+      filter.push(
+        r * r < 1
+          ? (sinc * besselI0(beta * Math.sqrt(1 - r * r))) / besselI0(beta)
+          : 0
+      );
+    }
+    const sum = filter.reduce((sum, tap) => sum + tap, 0);
+    filters.push(Float32Array.from(filter, (tap) => tap / sum));
+  }
+  const destFrames = Math.floor(
+    (samples.length * targetRate + Math.floor(sourceRate / 2)) / sourceRate
+  );
+  const dest = [];
+  for (let i = 0; i < destFrames; i++) {
+    const index = Math.floor((i * sourceRate) / targetRate);
+    const phase = (((i * sourceRate) % targetRate) * phases) / targetRate;
+    const k = Math.floor(phase);
+    const mix = Math.fround(phase - k);
+    let sum = 0;
+    for (let n = 0; n < taps; n++) {
+      const source = index - (taps / 2 - 1) + n;
+      const sample =
+        source >= 0 && source < samples.length
+          ? Math.fround(samples[source])
+          : 0;
+      const a = filters[k][n];
+      const b = filters[k + 1][n];
+      sum += sample * (a + mix * (b - a));
+    }
+    dest.push(sum);
+  }
+  return dest;
+}
+
+/**
+ * The peak index buildWaveformPeaks in waveform-peaks.c should give, as its
+ * levels' maxima and minima in the same order.
+ * @param {number[]} samples
+ */
+function buildWaveformPeaks(samples) {
+  const block = 16;
+  /** @type {number[]} */
+  let max = [];
+  /** @type {number[]} */
+  let min = [];
+  for (let start = 0; start < samples.length; start += block) {
+    let blockMax = -Infinity;
+    let blockMin = Infinity;
+    for (const sample of samples.slice(start, start + block)) {
+      const value = Math.fround(sample);
+      // (NaN never wins)
+      if (value > blockMax) blockMax = value;
+      if (value < blockMin) blockMin = value;
+    }
+    max.push(blockMax);
+    min.push(blockMin);
+  }
+  const index = [...max, ...min];
+  while (max.length > 1) {
+    const nextMax = [];
+    const nextMin = [];
+    for (let j = 0; j < max.length; j += 2) {
+      nextMax.push(j + 1 < max.length ? Math.max(max[j], max[j + 1]) : max[j]);
+      nextMin.push(j + 1 < min.length ? Math.min(min[j], min[j + 1]) : min[j]);
+    }
+    max = nextMax;
+    min = nextMin;
+    index.push(...max, ...min);
+  }
+  return index;
+}
+
+/**
+ * Float samples to run the kernels on, with values out of range, halfway
+ * between steps and NaN among them.
+ * @param {number} length
+ */
+function getTestFloatSamples(length) {
+  const special = [0, 0.5, -0.5, 1, -1, 1.5, -1.5, NaN, 2 ** -9, -(2 ** -9)];
+  let seed = 12345;
+  return Array.from({ length }, (_, i) => {
+    if (i % 7 === 3) {
+      return special[(i / 7) % special.length | 0];
+    }
+    seed = (seed * 1103515245 + 12345) % 2 ** 31;
+    return Math.fround((seed / 2 ** 31) * 2.4 - 1.2);
+  });
+}
+
 const samples = [
   {
     sourceFileId: '/factory-samples/02 Kick 3.wav',
@@ -305,14 +480,53 @@ test('syroBindings load correctly', async (t) => {
         'function',
         'createSyroDataFromWavData is defined'
       );
-      t.equal(
-        await page.evaluate(
-          (bindings) => typeof bindings.getDeleteBufferFromSyroData,
-          b
-        ),
-        'function',
-        'getDeleteBufferFromSyroData is defined'
-      );
+      for (const name of [
+        'createSyroDataFromWavDataWithCompressedBlock',
+        'getSyroDataCacheKey',
+        'exportCompressedBlock',
+        'getCompressedBlockPointer',
+        'getCompressedBlockSize',
+        'getCompressedBlockCompSize',
+        'getCompressedBlockChecksum',
+        'freeCompressedBlock',
+        'createWavStreamParser',
+        'feedWavStreamParser',
+        'createSyroDataFromWavStreamParser',
+        'freeWavStreamParser',
+        'pauseSampleBufferWork',
+        'resumeSampleBufferWork',
+        'allocateSampleData',
+        'freeSampleData',
+        'createSyroDataFromPcm',
+        'convertFloatPcmTo16Bit',
+        'getResampledPcmFrameCount',
+        'resampleFloatPcm',
+        'buildWaveformPeakIndex',
+        'getSyroPackEntryCount',
+        'createSyroDataFromSyroPack',
+        'getSyroPackFrameCount',
+        'getSyroPackPeaksPointer',
+        'createSyroDataFromFloatPcm',
+        'useCompressedBlockForSyroData',
+        'initSyroWorkerPool',
+        'precomputeEraseStreams',
+        'getSyroStreamFrameCount',
+        'measureSyroCompSize',
+        'getSampleBufferFailed',
+        'getSampleBufferStatsPointer',
+        'getSampleBufferTraceJson',
+        'setSyroTraceEnabled',
+      ]) {
+        t.equal(
+          await page.evaluate(
+            (bindings, name) => typeof bindings[name],
+            b,
+            name
+          ),
+          'function',
+          `${name} is defined`
+        );
+      }
       t.equal(
         await page.evaluate(
           (bindings) => typeof bindings.prepareSampleBufferFromSyroData,
@@ -361,11 +575,6 @@ test('syroBindings load correctly', async (t) => {
         'function',
         'getSampleBufferDataStartPointsPointer is defined'
       );
-      t.equal(
-        await page.evaluate((bindings) => typeof bindings.freeDeleteBuffer, b),
-        'function',
-        'freeDeleteBuffer is defined'
-      );
       t.equal(
         await page.evaluate(
           (bindings) => typeof bindings.cancelSampleBufferWork,
@@ -400,6 +609,289 @@ test('syroBindings load correctly', async (t) => {
   );
 });
 
+test('sample-dsp.c', async (t) => {
+  await forEachBrowser(
+    {
+      scripts: ['syro-bindings.js'],
+      modules: [
+        {
+          url: '/src/utils/getSyroBindings.js',
+          globalName: 'getSyroBindingsModule',
+        },
+      ],
+    },
+    async (page) => {
+      // (samples go over as strings so NaN survives the trip)
+      /**
+       * @param {number[]} samples
+       * @param {number} gain
+       * @param {number} qualityBitDepth
+       * @returns {Promise<number[]>}
+       */
+      const convert = (samples, gain, qualityBitDepth) =>
+        page.evaluate(
+          async (samples, gain, qualityBitDepth) => {
+            const {
+              allocateSampleData,
+              convertFloatPcmTo16Bit,
+              freeSampleData,
+              heap8Buffer,
+            } = await getSyroBindingsModule.getSyroBindings();
+            const pointer = allocateSampleData(samples.length, 4);
+            new Float32Array(heap8Buffer(), pointer, samples.length).set(
+              samples.map(Number)
+            );
+            const pcm16Pointer = convertFloatPcmTo16Bit(
+              pointer,
+              samples.length,
+              gain,
+              qualityBitDepth
+            );
+            const pcm16 = Array.from(
+              new Int16Array(heap8Buffer(), pcm16Pointer, samples.length)
+            );
+            freeSampleData(pcm16Pointer);
+            return pcm16;
+          },
+          samples.map(String),
+          gain,
+          qualityBitDepth
+        );
+      t.deepEqual(
+        await convert(
+          [0, 0.5, -0.5, 1, -1, 2, NaN, 0.25, -0.25, 2 ** -15],
+          1,
+          16
+        ),
+        [0, 16384, -16384, 32767, -32768, 32767, 0, 8192, -8192, 1],
+        'convertFloatPcmTo16Bit scales, clamps and zeroes NaN'
+      );
+      for (const [gain, qualityBitDepth] of [
+        [1, 16],
+        [0.8, 16],
+        [1.7, 8],
+        [1, 12],
+      ]) {
+        const samples = getTestFloatSamples(203);
+        t.deepEqual(
+          await convert(samples, gain, qualityBitDepth),
+          convertFloatSamplesTo16Bit(samples, gain, qualityBitDepth),
+          `convertFloatPcmTo16Bit gives the expected samples with gain ${gain} at ${qualityBitDepth} bits`
+        );
+      }
+      {
+        // the first 8 samples go through the SIMD loop and the rest through
+        // the scalar one
+        const samples = getTestFloatSamples(8);
+        const pcm16 = await convert(
+          [...samples, ...samples.slice(0, 7)],
+          1.7,
+          8
+        );
+        t.deepEqual(
+          pcm16.slice(8),
+          pcm16.slice(0, 7),
+          'convertFloatPcmTo16Bit gives the same samples from SIMD and scalar loops'
+        );
+      }
+
+      /**
+       * @param {number[]} samples
+       * @param {number} sourceRate
+       * @param {number} targetRate
+       * @returns {Promise<{ frameCount: number; resampled: number[] }>}
+       */
+      const resample = (samples, sourceRate, targetRate) =>
+        page.evaluate(
+          async (samples, sourceRate, targetRate) => {
+            const {
+              allocateSampleData,
+              getResampledPcmFrameCount,
+              resampleFloatPcm,
+              freeSampleData,
+              heap8Buffer,
+            } = await getSyroBindingsModule.getSyroBindings();
+            const pointer = allocateSampleData(samples.length, 4);
+            new Float32Array(heap8Buffer(), pointer, samples.length).set(
+              samples.map(Number)
+            );
+            const frameCount = getResampledPcmFrameCount(
+              samples.length,
+              sourceRate,
+              targetRate
+            );
+            const resampledPointer = resampleFloatPcm(
+              pointer,
+              samples.length,
+              sourceRate,
+              targetRate
+            );
+            const resampled = Array.from(
+              new Float32Array(heap8Buffer(), resampledPointer, frameCount)
+            );
+            freeSampleData(resampledPointer);
+            return { frameCount, resampled };
+          },
+          samples.map(String),
+          sourceRate,
+          targetRate
+        );
+      {
+        const { frameCount, resampled } = await resample(
+          Array(400).fill(0.5),
+          44100,
+          31250
+        );
+        t.equal(
+          frameCount,
+          283,
+          'resampleFloatPcm gives the rounded frame count'
+        );
+        t.ok(
+          resampled
+            .slice(16, -16)
+            .every((sample) => Math.abs(sample - 0.5) < 1e-4),
+          'resampleFloatPcm keeps a constant signal constant'
+        );
+      }
+      for (const [sourceRate, targetRate, expectedFrameCount] of [
+        [44100, 31250, 213],
+        [31250, 48000, 461],
+      ]) {
+        // (no NaN here, which would spread to every frame it's near)
+        const samples = getTestFloatSamples(300).map((sample) => sample || 0);
+        const { frameCount, resampled } = await resample(
+          samples,
+          sourceRate,
+          targetRate
+        );
+        t.equal(
+          frameCount,
+          expectedFrameCount,
+          `resampleFloatPcm gives ${expectedFrameCount} frames from 300 at ${sourceRate} to ${targetRate}`
+        );
+        const expected = resampleFloatSamples(samples, sourceRate, targetRate);
+        t.ok(
+          resampled.length === expected.length &&
+            resampled.every(
+              (sample, i) => Math.abs(sample - expected[i]) < 1e-5
+            ),
+          `resampleFloatPcm gives the expected frames from ${sourceRate} to ${targetRate}`
+        );
+      }
+
+      /**
+       * @param {number[]} samples
+       * @returns {Promise<number[]>}
+       */
+      const buildPeaks = (samples) =>
+        page.evaluate(async (samples) => {
+          const {
+            allocateSampleData,
+            buildWaveformPeakIndex,
+            freeSampleData,
+            heap8Buffer,
+          } = await getSyroBindingsModule.getSyroBindings();
+          const pointer = allocateSampleData(samples.length, 4);
+          new Float32Array(heap8Buffer(), pointer, samples.length).set(
+            samples.map(Number)
+          );
+          let length = 0;
+          for (let count = Math.ceil(samples.length / 16); count; ) {
+            length += count * 2;
+            count = count > 1 ? Math.ceil(count / 2) : 0;
+          }
+          const indexPointer = buildWaveformPeakIndex(pointer, samples.length);
+          freeSampleData(pointer);
+          const index = Array.from(
+            new Float32Array(heap8Buffer(), indexPointer, length)
+          );
+          freeSampleData(indexPointer);
+          return index;
+        }, samples.map(String));
+      {
+        const samples = getTestFloatSamples(149);
+        const index = await buildPeaks(samples);
+        t.deepEqual(
+          index,
+          buildWaveformPeaks(samples),
+          'buildWaveformPeakIndex gives the expected peaks'
+        );
+        t.deepEqual(
+          index.slice(-2),
+          [1.5, -1.5],
+          'buildWaveformPeakIndex ends with the highest and lowest samples'
+        );
+      }
+      {
+        // the first 2 blocks go through the SIMD loop and the last, which is
+        // a frame short but has the same peaks, through the scalar one
+        const block = getTestFloatSamples(16);
+        block[15] = 0;
+        const index = await buildPeaks([
+          ...block,
+          ...block,
+          ...block.slice(0, 15),
+        ]);
+        t.deepEqual(
+          [index[2], index[5]],
+          [index[0], index[3]],
+          'buildWaveformPeakIndex gives the same peaks from SIMD and scalar loops'
+        );
+      }
+
+      {
+        const samples = getTestFloatSamples(101);
+        const { header, pcm16 } = await page.evaluate(async (samples) => {
+          const {
+            allocateSyroData,
+            allocateSampleData,
+            createSyroDataFromFloatPcm,
+            heap8Buffer,
+          } = await getSyroBindingsModule.getSyroBindings();
+          const syroDataHandle = allocateSyroData(1);
+          const pointer = allocateSampleData(samples.length, 4);
+          new Float32Array(heap8Buffer(), pointer, samples.length).set(
+            samples.map(Number)
+          );
+          createSyroDataFromFloatPcm(
+            syroDataHandle,
+            0,
+            pointer,
+            samples.length,
+            31250,
+            5,
+            16,
+            0,
+            0.8
+          );
+          // DataType, pData, Number, Size, Quality, Fs, SampleEndian
+          const header = Array.from(
+            new Uint32Array(heap8Buffer(), syroDataHandle, 7)
+          );
+          return {
+            header,
+            pcm16: Array.from(
+              new Int16Array(heap8Buffer(), header[1], samples.length)
+            ),
+          };
+        }, samples.map(String));
+        t.deepEqual(
+          [header[2], header[3], header[4], header[5]],
+          [5, 202, 16, 31250],
+          'createSyroDataFromFloatPcm sets up the syro data'
+        );
+        t.deepEqual(
+          pcm16,
+          convertFloatSamplesTo16Bit(samples, 0.8, 16),
+          'createSyroDataFromFloatPcm gives the expected samples'
+        );
+      }
+    },
+    t
+  );
+});
+
 test('syro-utils.c', async (t) => {
   const { sourceFileId, slotNumber } = samples[0];
   /**
@@ -442,15 +934,510 @@ test('syro-utils.c', async (t) => {
   }
 });
 
+test('batch-convert.c', async (t) => {
+  const { sourceFileId, slotNumber } = samples[0];
+  const manifestFilename = path.join(artifactsDir, 'batch-manifest.txt');
+  await fs.writeFile(
+    manifestFilename,
+    [
+      `${slotNumber} 16 1 compressed ../../public${sourceFileId}`,
+      `${slotNumber} 16 0 uncompressed ../../public${sourceFileId}`,
+    ].join('\n')
+  );
+  /**
+   * @type {{ streams: string[] }}
+   */
+  const { streams } = JSON.parse(
+    child_process
+      .execSync(`../batch-convert -d . batch-manifest.txt`, {
+        cwd: artifactsDir,
+        stdio: ['ignore', 'pipe', 'ignore'],
+      })
+      .toString()
+  );
+  for (const key of /** @type {('compressed' | 'uncompressed')[]} */ ([
+    'compressed',
+    'uncompressed',
+  ])) {
+    const streamFilename = streams.find((s) => s.includes(`/${key}.`));
+    t.ok(streamFilename, `Batch output exists (${key})`);
+    if (!streamFilename) {
+      continue;
+    }
+    const batchSampleBufferContents = await fs.readFile(
+      path.join(artifactsDir, streamFilename)
+    );
+    t.ok(
+      batchSampleBufferContents.equals(snapshots[key]),
+      `Batch output should match snapshot (${key})`
+    );
+    if (!batchSampleBufferContents.equals(snapshots[key])) {
+      printDiffForWavBuffers(t, batchSampleBufferContents, snapshots[key]);
+    }
+  }
+  // streamed straight to stdout (combined output, so one entry only)
+  await fs.writeFile(
+    manifestFilename,
+    `${slotNumber} 16 1 compressed ../../public${sourceFileId}`
+  );
+  const streamedContents = child_process.execSync(
+    `../batch-convert -o - batch-manifest.txt`,
+    {
+      cwd: artifactsDir,
+      stdio: ['ignore', 'pipe', 'ignore'],
+      maxBuffer: 64 * 1024 * 1024,
+    }
+  );
+  t.ok(
+    streamedContents.equals(snapshots.compressed),
+    'Batch output streamed to stdout should match snapshot'
+  );
+  if (!streamedContents.equals(snapshots.compressed)) {
+    printDiffForWavBuffers(t, streamedContents, snapshots.compressed);
+  }
+  // more samples than a stream has slots for, then two for the same slot
+  for (const [lines, problem] of /** @type {[string[], string][]} */ ([
+    [
+      Array.from(
+        { length: 101 },
+        (_, i) => `${i % 100} 16 0 combined ../../public${sourceFileId}`
+      ),
+      'more than 100 samples',
+    ],
+    [
+      [
+        `${slotNumber} 16 0 combined ../../public${sourceFileId}`,
+        `${slotNumber} 16 1 combined ../../public${sourceFileId}`,
+      ],
+      'two samples for one slot',
+    ],
+  ])) {
+    await fs.writeFile(manifestFilename, lines.join('\n'));
+    t.throws(
+      () =>
+        child_process.execSync(
+          `../batch-convert -j 1 -o - batch-manifest.txt`,
+          { cwd: artifactsDir, stdio: 'ignore' }
+        ),
+      `Batch conversion should refuse a group with ${problem}`
+    );
+  }
+  // a combined stream encoded across threads, one sample per thread
+  await fs.writeFile(
+    manifestFilename,
+    samples
+      .flatMap(({ sourceFileId, slotNumber }) => [
+        `${slotNumber} 16 1 combined ../../public${sourceFileId}`,
+        `${slotNumber + 1} 16 0 combined ../../public${sourceFileId}`,
+      ])
+      .join('\n')
+  );
+  const [inOrderContents, parallelContents] = await Promise.all(
+    [1, 4].map(async (threads) => {
+      const outputFilename = `combined-j${threads}.syrostream.wav`;
+      child_process.execSync(
+        `../batch-convert -j ${threads} -o ${outputFilename} batch-manifest.txt`,
+        { cwd: artifactsDir, stdio: 'ignore' }
+      );
+      return fs.readFile(path.join(artifactsDir, outputFilename));
+    })
+  );
+  t.ok(
+    parallelContents.equals(inOrderContents),
+    'Batch output encoded across threads should match output encoded in order'
+  );
+  // the same kit written to a pack, then streamed from the pack alone
+  child_process.execSync(
+    `../batch-convert -o combined-packed.syrostream.wav -p kit.syropack batch-manifest.txt`,
+    { cwd: artifactsDir, stdio: 'ignore' }
+  );
+  child_process.execSync(
+    `../batch-convert -o combined-from-pack.syrostream.wav kit.syropack`,
+    { cwd: artifactsDir, stdio: 'ignore' }
+  );
+  const fromPackContents = await fs.readFile(
+    path.join(artifactsDir, 'combined-from-pack.syrostream.wav')
+  );
+  t.ok(
+    fromPackContents.equals(inOrderContents),
+    'Batch output from a pack should match output from the wav files'
+  );
+  // the same pack with a byte of its first compressed block changed
+  const packContents = await fs.readFile(
+    path.join(artifactsDir, 'kit.syropack')
+  );
+  const numOfPackEntries = packContents.readUInt32LE(12);
+  for (let i = 0; i < numOfPackEntries; i++) {
+    // SyroPackHeader is 32 bytes and each SyroPackEntry 64
+    const entryStart = 32 + i * 64;
+    if (packContents.readUInt32LE(entryStart + 8) === 1) {
+      packContents[packContents.readUInt32LE(entryStart + 32)] ^= 0xff;
+      break;
+    }
+  }
+  await fs.writeFile(path.join(artifactsDir, 'damaged.syropack'), packContents);
+  t.throws(
+    () =>
+      child_process.execSync(
+        `../batch-convert -o combined-from-damaged-pack.syrostream.wav damaged.syropack`,
+        { cwd: artifactsDir, stdio: 'ignore' }
+      ),
+    'Batch conversion should refuse a pack with a damaged compressed block'
+  );
+  // the same 16-bit samples as big endian aiff and as stereo float wav, which
+  // should convert to exactly the same stream
+  const sourceContents = await fs.readFile(
+    path.join(__dirname, '../public', sourceFileId)
+  );
+  const sampleRate = sourceContents.readUInt32LE(24);
+  let dataStart = 12;
+  while (
+    sourceContents.toString('latin1', dataStart, dataStart + 4) !== 'data'
+  ) {
+    const chunkSize = sourceContents.readUInt32LE(dataStart + 4);
+    dataStart += 8 + chunkSize + (chunkSize % 2);
+  }
+  const numOfFrames = sourceContents.readUInt32LE(dataStart + 4) / 2;
+  const pcm = Array.from({ length: numOfFrames }, (_, i) =>
+    sourceContents.readInt16LE(dataStart + 8 + i * 2)
+  );
+  const aiffContents = Buffer.alloc(54 + numOfFrames * 2);
+  aiffContents.write('FORM', 0, 'latin1');
+  aiffContents.writeUInt32BE(aiffContents.length - 8, 4);
+  aiffContents.write('AIFFCOMM', 8, 'latin1');
+  aiffContents.writeUInt32BE(18, 16);
+  aiffContents.writeUInt16BE(1, 20);
+  aiffContents.writeUInt32BE(numOfFrames, 22);
+  aiffContents.writeUInt16BE(16, 26);
+  // 80-bit extended sample rate
+  const exponent = Math.floor(Math.log2(sampleRate));
+  aiffContents.writeUInt16BE(16383 + exponent, 28);
+  aiffContents.writeUInt32BE(sampleRate * 2 ** (31 - exponent), 30);
+  aiffContents.write('SSND', 38, 'latin1');
+  aiffContents.writeUInt32BE(8 + numOfFrames * 2, 42);
+  pcm.forEach((value, i) => aiffContents.writeInt16BE(value, 54 + i * 2));
+  const floatContents = Buffer.alloc(44 + numOfFrames * 8);
+  floatContents.write('RIFF', 0, 'latin1');
+  floatContents.writeUInt32LE(floatContents.length - 8, 4);
+  floatContents.write('WAVEfmt ', 8, 'latin1');
+  floatContents.writeUInt32LE(16, 16);
+  floatContents.writeUInt16LE(3, 20);
+  floatContents.writeUInt16LE(2, 22);
+  floatContents.writeUInt32LE(sampleRate, 24);
+  floatContents.writeUInt32LE(sampleRate * 8, 28);
+  floatContents.writeUInt16LE(8, 32);
+  floatContents.writeUInt16LE(32, 34);
+  floatContents.write('data', 36, 'latin1');
+  floatContents.writeUInt32LE(numOfFrames * 8, 40);
+  pcm.forEach((value, i) => {
+    floatContents.writeFloatLE(value / 32768, 44 + i * 8);
+    floatContents.writeFloatLE(value / 32768, 48 + i * 8);
+  });
+  await fs.writeFile(path.join(artifactsDir, 'source.aif'), aiffContents);
+  await fs.writeFile(
+    path.join(artifactsDir, 'source-float.wav'),
+    floatContents
+  );
+  await fs.writeFile(
+    manifestFilename,
+    [
+      `${slotNumber} 16 1 aiff source.aif`,
+      `${slotNumber} 16 1 float source-float.wav`,
+    ].join('\n')
+  );
+  child_process.execSync(`../batch-convert -d . batch-manifest.txt`, {
+    cwd: artifactsDir,
+    stdio: 'ignore',
+  });
+  for (const key of ['aiff', 'float']) {
+    const formatContents = await fs.readFile(
+      path.join(artifactsDir, `${key}.syrostream.wav`)
+    );
+    t.ok(
+      formatContents.equals(snapshots.compressed),
+      `Batch output from ${key} input should match snapshot`
+    );
+  }
+  // daemon mode: a duplicate in the same batch is only converted once, and a
+  // later job for the same file takes its samples from the cache ("stats"
+  // ends a batch)
+  const source = `../../public${sourceFileId}`;
+  const replies = child_process
+    .execSync(`../batch-convert -s - -d .`, {
+      cwd: artifactsDir,
+      input: [
+        `${slotNumber} 16 1 daemon-a ${source}`,
+        `${slotNumber} 16 1 daemon-b ${source}`,
+        'stats',
+        `${slotNumber} 16 1 daemon-c ${source}`,
+        `${slotNumber} 16 1 ../daemon-d ${source}`,
+        'stats',
+      ].join('\n'),
+      stdio: ['pipe', 'pipe', 'ignore'],
+    })
+    .toString()
+    .trim()
+    .split('\n')
+    .map((line) => JSON.parse(line));
+  t.deepEqual(
+    replies.map(({ id, ok, deduped, cachedInput }) => ({
+      id,
+      ok,
+      deduped,
+      cachedInput,
+    })),
+    [
+      { id: 'daemon-a', ok: true, deduped: false, cachedInput: false },
+      { id: 'daemon-b', ok: true, deduped: true, cachedInput: false },
+      { id: undefined, ok: undefined, deduped: 1, cachedInput: undefined },
+      { id: 'daemon-c', ok: true, deduped: false, cachedInput: true },
+      { id: '', ok: false, deduped: undefined, cachedInput: undefined },
+      { id: undefined, ok: undefined, deduped: 1, cachedInput: undefined },
+    ],
+    'Daemon should answer every job in order'
+  );
+  t.deepEqual(
+    [replies[5].jobs, replies[5].failed, replies[5].cachedInputs],
+    [4, 1, 1],
+    'Daemon stats should count every job'
+  );
+  for (const { stream } of [replies[0], replies[1], replies[3]]) {
+    const daemonContents = await fs.readFile(path.join(artifactsDir, stream));
+    t.ok(
+      daemonContents.equals(snapshots.compressed),
+      `Daemon output should match snapshot (${stream})`
+    );
+  }
+});
+
+test('benchmark.c', async (t) => {
+  /**
+   * @type {{ cases: { compressed: boolean; peakMemoryBytes: number; phases: Record<string, { framesPerSecond: number }> }[] }}
+   */
+  const { cases } = JSON.parse(
+    child_process
+      .execSync('../benchmark -r 1 -l 0.1', {
+        cwd: artifactsDir,
+        stdio: ['ignore', 'pipe', 'ignore'],
+      })
+      .toString()
+  );
+  // 16/24 bit, mono/stereo, linear plus 3 compression qualities
+  t.equal(cases.length, 16, 'Benchmark reports every case');
+  t.ok(
+    cases.every(
+      ({ peakMemoryBytes, phases }) =>
+        peakMemoryBytes > 0 &&
+        Object.keys(phases).length === 6 &&
+        Object.values(phases).every(
+          ({ framesPerSecond }) => framesPerSecond > 0
+        )
+    ),
+    'Benchmark reports speed for each phase and peak memory'
+  );
+});
+
 test('getSyroSampleBuffer', async (t) => {
+  // the worker build, then the pthreads build
+  for (const crossOriginIsolated of [false, true]) {
+    await forEachBrowser(
+      {
+        scripts: ['syro-bindings.js'],
+        modules: [
+          {
+            url: '/src/store.js',
+            globalName: 'storeModule',
+          },
+          {
+            url: '/src/utils/syro.js',
+            globalName: 'syroUtilsModule',
+          },
+          {
+            url: '/src/utils/getSyroBindings.js',
+            globalName: 'getSyroBindingsModule',
+          },
+          {
+            url: '/src/utils/audioData.js',
+            globalName: 'audioDataModule',
+          },
+        ],
+        crossOriginIsolated,
+      },
+      async (page) => {
+        await page.evaluate(() => {
+          window.SampleContainer = storeModule.SampleContainer;
+          window.processPluginsForSample =
+            audioDataModule.processPluginsForSample;
+          window.getSyroSampleBuffer = syroUtilsModule.getSyroSampleBuffer;
+          window.getSyroTransferSeconds =
+            syroUtilsModule.getSyroTransferSeconds;
+        });
+        t.equal(
+          await page.evaluate(async () => {
+            const { sharedStream } =
+              await getSyroBindingsModule.getSyroBindings();
+            return Boolean(sharedStream);
+          }),
+          crossOriginIsolated,
+          crossOriginIsolated
+            ? 'Shared memory build is used when cross-origin isolated'
+            : 'Worker build is used when not cross-origin isolated'
+        );
+        for (const key of /** @type {('compressed' | 'uncompressed' | 'multi_compressed' | 'multi_uncompressed')[]} */ ([
+          'compressed',
+          'uncompressed',
+          'multi_compressed',
+          'multi_uncompressed',
+          // again, once the worker build can put them together from the
+          // segments cached by the first time around
+          ...(crossOriginIsolated
+            ? []
+            : ['multi_compressed', 'multi_uncompressed']),
+        ])) {
+          const samplesForKey = key.includes('multi_')
+            ? samples
+            : samples.slice(0, 1);
+          /**
+           * @type {puppeteer.JSHandle<(import('../src/store').SampleContainer)[]>}
+           */
+          const sampleContainersHandle = await page.evaluateHandle(
+            async (samples, useCompression) => {
+              /**
+               * @type {typeof import('../src/store').SampleContainer}
+               */
+              const SampleContainer = window.SampleContainer;
+              return samples.map(
+                ({ sourceFileId, slotNumber }) =>
+                  new SampleContainer.Mutable({
+                    name: 'textSample',
+                    sourceFileId,
+                    slotNumber,
+                    useCompression,
+                    trim: {
+                      frames: [0, 0],
+                      // for render only; irrelevant for test but required
+                      waveformPeaks: {
+                        positive: new Float32Array(),
+                        negative: new Float32Array(),
+                      },
+                    },
+                    normalize: null,
+                    pitchAdjustment: 1,
+                  })
+              );
+            },
+            samplesForKey,
+            ['compressed', 'multi_compressed'].includes(key)
+          );
+          // counted before encoding, so compressed samples aren't cached yet
+          // the first time around
+          const transferSeconds = await page.evaluate(
+            async (sampleContainers) => {
+              /**
+               * @type {typeof import('../src/utils/syro').getSyroTransferSeconds}
+               */
+              const getSyroTransferSeconds = window.getSyroTransferSeconds;
+              /**
+               * @type {typeof import('../src/utils/audioData').processPluginsForSample}
+               */
+              const processPluginsForSample = window.processPluginsForSample;
+              // what each sample's cached info would say
+              const postPluginFrameCounts = await Promise.all(
+                sampleContainers.map(
+                  async (sampleContainer) =>
+                    (await processPluginsForSample(sampleContainer)).length
+                )
+              );
+              return getSyroTransferSeconds(
+                sampleContainers,
+                postPluginFrameCounts
+              );
+            },
+            sampleContainersHandle
+          );
+          const { sampleBufferContents, stats, trace } = await page.evaluate(
+            async (sampleContainers) => {
+              /**
+               * @type {typeof import('../src/utils/syro').getSyroSampleBuffer}
+               */
+              const getSyroSampleBuffer = window.getSyroSampleBuffer;
+              /**
+               * @type {import('../src/utils/syro').SyroTransferStats | null}
+               */
+              let stats = null;
+              const { syroBuffer, trace } = await getSyroSampleBuffer(
+                sampleContainers,
+                (_, progressStats) => {
+                  stats = progressStats;
+                },
+                { trace: true }
+              ).syroBufferPromise;
+              const sampleBufferContents = [...syroBuffer];
+              return { sampleBufferContents, stats, trace };
+            },
+            sampleContainersHandle
+          );
+          const webSampleBufferContents = Buffer.from(sampleBufferContents);
+          t.equal(
+            stats && stats.bytes,
+            webSampleBufferContents.length,
+            `Transfer stats count every byte (${key})`
+          );
+          t.equal(
+            transferSeconds,
+            (webSampleBufferContents.length - 44) / 4 / 44100,
+            `Transfer time is known without encoding (${key})`
+          );
+          t.ok(
+            stats && stats.workerMemoryBytes <= stats.peakWorkerMemoryBytes,
+            `Transfer stats report the worker's memory use (${key})`
+          );
+          if (!crossOriginIsolated) {
+            t.ok(
+              trace && JSON.parse(trace).traceEvents.length,
+              `Transfer trace is exported (${key})`
+            );
+          }
+          await fs.writeFile(
+            path.join(
+              artifactsDir,
+              `${samplesForKey
+                .map((s) => s.sourceFileId.split('/').pop().split('.wav')[0])
+                .join(' + ')} [wasm${
+                crossOriginIsolated ? ' threaded' : ''
+              }] (${key}).syrostream.wav`
+            ),
+            webSampleBufferContents
+          );
+          const webSampleBufferHeader = webSampleBufferContents.slice(0, 44);
+          const snapshotSampleBufferHeader = snapshots[key].slice(0, 44);
+          t.deepEqual(
+            webSampleBufferHeader,
+            snapshotSampleBufferHeader,
+            `WASM WAV headers should match snapshot (${key})`
+          );
+          const webSampleBufferPcmData = webSampleBufferContents.slice(44);
+          const snapshotSampleBufferPcmData = snapshots[key].slice(44);
+          t.deepEqual(
+            webSampleBufferPcmData,
+            snapshotSampleBufferPcmData,
+            `WASM PCM data should match snapshot (${key})`
+          );
+          if (!webSampleBufferPcmData.equals(snapshotSampleBufferPcmData)) {
+            printDiffForWavBuffers(t, webSampleBufferContents, snapshots[key]);
+          }
+        }
+      },
+      t
+    );
+  }
+});
+
+test('getSyroDeleteBuffer', async (t) => {
   await forEachBrowser(
     {
       scripts: ['syro-bindings.js'],
       modules: [
-        {
-          url: '/src/store.js',
-          globalName: 'storeModule',
-        },
         {
           url: '/src/utils/syro.js',
           globalName: 'syroUtilsModule',
@@ -458,92 +1445,74 @@ test('getSyroSampleBuffer', async (t) => {
       ],
     },
     async (page) => {
-      await page.evaluate(() => {
-        window.SampleContainer = storeModule.SampleContainer;
-        window.getSyroSampleBuffer = syroUtilsModule.getSyroSampleBuffer;
-      });
-      for (const key of /** @type {('compressed' | 'uncompressed' | 'multi_compressed' | 'multi_uncompressed')[]} */ ([
-        'compressed',
-        'uncompressed',
-        'multi_compressed',
-        'multi_uncompressed',
-      ])) {
-        const samplesForKey = key.includes('multi_')
-          ? samples
-          : samples.slice(0, 1);
-        /**
-         * @type {puppeteer.JSHandle<(import('../src/store').SampleContainer)[]>}
-         */
-        const sampleContainersHandle = await page.evaluateHandle(
-          async (samples, useCompression) => {
-            /**
-             * @type {typeof import('../src/store').SampleContainer}
-             */
-            const SampleContainer = window.SampleContainer;
-            return samples.map(
-              ({ sourceFileId, slotNumber }) =>
-                new SampleContainer.Mutable({
-                  name: 'textSample',
-                  sourceFileId,
-                  slotNumber,
-                  useCompression,
-                  trim: {
-                    frames: [0, 0],
-                    // for render only; irrelevant for test but required
-                    waveformPeaks: {
-                      positive: new Float32Array(),
-                      negative: new Float32Array(),
-                    },
-                  },
-                  normalize: null,
-                  pitchAdjustment: 1,
-                })
-            );
-          },
-          samplesForKey,
-          ['compressed', 'multi_compressed'].includes(key)
-        );
-        const webSampleBufferContents = Buffer.from(
-          await page.evaluate(async (sampleContainers) => {
-            /**
-             * @type {typeof import('../src/utils/syro').getSyroSampleBuffer}
-             */
-            const getSyroSampleBuffer = window.getSyroSampleBuffer;
-            const { syroBuffer } = await getSyroSampleBuffer(
-              sampleContainers,
-              () => null
+      const slotNumbers = [3, 0, 150];
+      /**
+       * @typedef {{
+       *   syroBuffer: number[];
+       *   dataStartPoints: number[];
+       *   peakWorkerMemoryBytes: number;
+       * }} DeleteBufferResult
+       * @type {[DeleteBufferResult, boolean, DeleteBufferResult]}
+       */
+      const [encoded, composable, composed] = await page.evaluate(
+        async (slotNumbers) => {
+          /**
+           * @type {typeof import('../src/utils/syro')}
+           */
+          const { getSyroDeleteBuffer, precomputeSyroDeleteBuffers } =
+            syroUtilsModule;
+          const getDeleteBuffer = async () => {
+            let peakWorkerMemoryBytes = 0;
+            const { syroBuffer, dataStartPoints } = await getSyroDeleteBuffer(
+              slotNumbers,
+              (progress, stats) => {
+                peakWorkerMemoryBytes = stats.peakWorkerMemoryBytes;
+              }
             ).syroBufferPromise;
-            const sampleBufferContents = [...syroBuffer];
-            return sampleBufferContents;
-          }, sampleContainersHandle)
-        );
-        await fs.writeFile(
-          path.join(
-            artifactsDir,
-            `${samplesForKey
-              .map((s) => s.sourceFileId.split('/').pop().split('.wav')[0])
-              .join(' + ')} [wasm] (${key}).syrostream.wav`
-          ),
-          webSampleBufferContents
-        );
-        const webSampleBufferHeader = webSampleBufferContents.slice(0, 44);
-        const snapshotSampleBufferHeader = snapshots[key].slice(0, 44);
-        t.deepEqual(
-          webSampleBufferHeader,
-          snapshotSampleBufferHeader,
-          `WASM WAV headers should match snapshot (${key})`
-        );
-        const webSampleBufferPcmData = webSampleBufferContents.slice(44);
-        const snapshotSampleBufferPcmData = snapshots[key].slice(44);
-        t.deepEqual(
-          webSampleBufferPcmData,
-          snapshotSampleBufferPcmData,
-          `WASM PCM data should match snapshot (${key})`
-        );
-        if (!webSampleBufferPcmData.equals(snapshotSampleBufferPcmData)) {
-          printDiffForWavBuffers(t, webSampleBufferContents, snapshots[key]);
-        }
-      }
+            return {
+              syroBuffer: [...syroBuffer],
+              dataStartPoints,
+              peakWorkerMemoryBytes,
+            };
+          };
+          const encoded = await getDeleteBuffer();
+          const composable = await precomputeSyroDeleteBuffers(200);
+          const composed = await getDeleteBuffer();
+          return [encoded, composable, composed];
+        },
+        slotNumbers
+      );
+      t.ok(encoded.syroBuffer.length > 44, 'Erase stream is encoded');
+      t.ok(
+        encoded.peakWorkerMemoryBytes > 0,
+        'First erase stream is encoded on a worker'
+      );
+      t.equal(
+        composable,
+        true,
+        'Precomputed erase segments should pass their check'
+      );
+      t.equal(
+        composed.peakWorkerMemoryBytes,
+        0,
+        'Erase stream after precomputing should come from the segment cache'
+      );
+      t.equal(
+        encoded.dataStartPoints.length,
+        slotNumbers.length,
+        'Erase stream has a start point for each slot'
+      );
+      t.ok(
+        Buffer.from(composed.syroBuffer).equals(
+          Buffer.from(encoded.syroBuffer)
+        ),
+        'Erase stream from the segment cache should match the encoded one'
+      );
+      t.deepEqual(
+        composed.dataStartPoints,
+        encoded.dataStartPoints,
+        'Start points from the segment cache should match the encoded ones'
+      );
     },
     t
   );